@@ -0,0 +1,57 @@
+"""Count TCP segments received per response (Linux only).
+
+Run minefield_server.py and then:
+
+    python count_segments.py /static/count_segments.py /file /list /
+
+or, for 16 pipelined keep-alive requests:
+
+    python count_segments.py --pipeline 16 /
+
+The count comes from tcpi_segs_in of the client socket, so it includes the
+server's ACK of the request.
+"""
+import socket
+import struct
+import sys
+
+HOST = ("127.0.0.1", 8000)
+TCPI_SEGS_IN_OFFSET = 140
+
+
+def segs_in(sock):
+    info = sock.getsockopt(socket.IPPROTO_TCP, socket.TCP_INFO, 256)
+    return struct.unpack_from("I", info, TCPI_SEGS_IN_OFFSET)[0]
+
+
+def request(path, depth):
+    if depth == 1:
+        return ("GET %s HTTP/1.0\r\nHost: localhost\r\n\r\n" % path).encode()
+    req = "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n" % path
+    last = "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n" % path
+    return (req * (depth - 1) + last).encode()
+
+
+def count(path, n=100, depth=1):
+    total = 0
+    data = request(path, depth)
+    for i in range(n):
+        sock = socket.create_connection(HOST)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        before = segs_in(sock)
+        sock.sendall(data)
+        while sock.recv(65536):
+            pass
+        total += segs_in(sock) - before
+        sock.close()
+    return total / float(n)
+
+
+if __name__ == "__main__":
+    args = sys.argv[1:]
+    depth = 1
+    if args[:1] == ["--pipeline"]:
+        depth = int(args[1])
+        args = args[2:]
+    for path in args or ["/static/count_segments.py", "/file", "/list", "/"]:
+        print("%-30s %.2f segments" % (path, count(path, depth=depth)))
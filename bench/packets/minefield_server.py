@@ -0,0 +1,24 @@
+import os
+from minefield import server
+
+# serve this directory with mount_static and file_wrapper
+ROOT = os.path.dirname(os.path.abspath(__file__))
+BODY = b"x" * 1000
+
+def app(environ, start_response):
+    path = environ["PATH_INFO"]
+    if path == "/file":
+        start_response("200 OK", [("Content-type", "text/plain")])
+        f = open(os.path.join(ROOT, "count_segments.py"), "rb")
+        return environ["wsgi.file_wrapper"](f)
+    if path == "/list":
+        start_response("200 OK", [("Content-type", "text/plain"),
+                                  ("Content-Length", str(len(BODY) * 10))])
+        return [BODY] * 10
+    start_response("200 OK", [("Content-type", "text/plain")])
+    return [b"Hello world!"]
+
+server.set_keepalive(10)
+server.mount_static("/static", ROOT)
+server.listen(("0.0.0.0", 8000))
+server.run(app)
@@ -1,6 +1,6 @@
 from flask import Flask, render_template, request, session, jsonify
 import uuid
-from meinheld import server, middleware
+from minefield import server
 
 
 SECRET_KEY = 'development key'
@@ -25,18 +25,19 @@ def index():
 @app.route('/a/message/updates', methods=['POST'])
 def message_update():
     global cache, waiters
-    c = request.environ.get(middleware.CONTINUATION_KEY, None)
+    c = server.get_continuation(request.environ)
     cursor = session.get('cursor')
-    if not cache or cursor == cache[-1]['id']:
-        waiters.append(c)
-        try:
+    if not c.resumed and not c.expired:
+        if not cache or cursor == cache[-1]['id']:
+            # the view is called again on resume() or after 60 seconds
+            waiters.append(c)
             c.suspend(60)
-        except:
-            waiters.remove(c)
-            raise
+            return ''
 
+    if c.expired:
+        waiters.remove(c)
+        return jsonify({'messages': []})
     print("suspend->resume %s" % c)
-    assert cursor != cache[-1]['id'], cursor
     try:
         for index, m in enumerate(cache):
             if m['id'] == cursor:
@@ -71,4 +72,4 @@ def message_new():
 
 if __name__ == "__main__":
     server.listen(("0.0.0.0", 8000))
-    server.run(middleware.ContinuationMiddleware(app))
+    server.run(app)
@@ -0,0 +1,54 @@
+from minefield import server
+import json
+
+# EventSource chat. Messages are pushed to every subscriber with
+# server.broadcast(), which queues one bytes object on all connections.
+
+PAGE = b"""<!DOCTYPE html>
+<html><body>
+<form onsubmit="fetch('/post', {method: 'POST', body: this.body.value});
+                this.body.value = ''; return false;">
+<input name="body" autocomplete="off"><input type="submit" value="Post">
+</form>
+<ul id="messages"></ul>
+<script>
+new EventSource('/events').onmessage = function (e) {
+    var li = document.createElement('li');
+    li.textContent = JSON.parse(e.data).body;
+    document.getElementById('messages').appendChild(li);
+};
+</script>
+</body></html>
+"""
+
+subscribers = []
+
+def events(environ, start_response):
+    stream = server.stream(environ)
+    subscribers.append(stream)
+    start_response('200 OK', [('Content-type', 'text/event-stream'),
+                              ('Cache-Control', 'no-cache')])
+    return stream
+
+def post(environ, start_response):
+    global subscribers
+    length = int(environ.get('CONTENT_LENGTH') or 0)
+    body = environ['wsgi.input'].read(length).decode('utf-8', 'replace')
+    data = "data: %s\n\n" % json.dumps({'from': environ['REMOTE_ADDR'], 'body': body})
+    # forget disconnected clients
+    subscribers = [s for s in subscribers if not s.closed]
+    n = server.broadcast(subscribers, data.encode('utf-8'))
+    start_response('200 OK', [('Content-type', 'text/plain')])
+    return [("sent to %d clients" % n).encode()]
+
+def app(environ, start_response):
+    path = environ['PATH_INFO']
+    if path == '/events':
+        return events(environ, start_response)
+    if path == '/post' and environ['REQUEST_METHOD'] == 'POST':
+        return post(environ, start_response)
+    start_response('200 OK', [('Content-type', 'text/html')])
+    return [PAGE]
+
+server.listen(("0.0.0.0", 8000))
+server.run(app)
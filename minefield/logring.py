@@ -0,0 +1,182 @@
+"""reader of the binary access log ring (``server.set_log_ring()``).
+
+The worker appends one fixed-size record per request to a mmap'd file,
+this module tails it from another process::
+
+    from minefield import logring
+
+    with logring.LogRing("/dev/shm/minefield.1234.ring") as ring:
+        for record in ring.follow():
+            print(logring.format_record(record))
+
+or from the command line::
+
+    python -m minefield.logring /dev/shm/minefield.1234.ring --follow
+    python -m minefield.logring /dev/shm/minefield.1234.ring --summary
+"""
+
+import collections
+import mmap
+import socket
+import struct
+import time
+
+__all__ = ["LogRing", "Record", "path_hash", "format_record", "summarize"]
+
+MAGIC = b"MFLRING1"
+VERSION = 1
+
+_header = struct.Struct("=8sIIQQI28x")
+_record = struct.Struct("=QQQQQHBBHH16s")
+_seq = struct.Struct("=Q")
+
+# enum http_method of http_parser.h
+METHODS = ("DELETE", "GET", "HEAD", "POST", "PUT", "CONNECT", "OPTIONS",
+           "TRACE", "COPY", "LOCK", "MKCOL", "MOVE", "PROPFIND", "PROPPATCH",
+           "SEARCH", "UNLOCK", "REPORT", "MKACTIVITY", "CHECKOUT", "MERGE",
+           "M-SEARCH", "NOTIFY", "SUBSCRIBE", "UNSUBSCRIBE", "PATCH", "PURGE")
+
+Record = collections.namedtuple("Record", [
+    "start", "end", "status", "method", "path_hash", "remote_addr",
+    "remote_port", "bytes"])
+Record.duration = property(lambda self: self.end - self.start)
+
+
+def path_hash(path):
+    """hash of PATH_INFO as written in records (FNV-1a 64)."""
+    if not isinstance(path, bytes):
+        try:
+            path = path.encode("latin-1")
+        except UnicodeEncodeError:
+            path = path.encode("utf-8")
+    h = 14695981039346656037
+    for c in bytearray(path):
+        h = ((h ^ c) * 1099511628211) & 0xffffffffffffffff
+    return h
+
+
+class LogRing(object):
+    """records of a ring file, from the oldest one still in the ring."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, size, self.capacity, head, self.pid = _header.unpack_from(self._map, 0)
+        if magic != MAGIC or version != VERSION or size != _record.size:
+            self._map.close()
+            raise ValueError("%s is not a log ring" % path)
+        self.position = max(0, head - self.capacity)
+        self.lost = 0
+
+    @property
+    def head(self):
+        return _seq.unpack_from(self._map, 24)[0]
+
+    def read(self):
+        """records written since the last read."""
+        records = []
+        head = self.head
+        if head - self.position > self.capacity:
+            # overwritten before read
+            self.lost += head - self.capacity - self.position
+            self.position = head - self.capacity
+        while self.position < head:
+            offset = _header.size + (self.position % self.capacity) * _record.size
+            values = _record.unpack_from(self._map, offset)
+            if values[0] != self.position + 1 or _seq.unpack_from(self._map, offset)[0] != values[0]:
+                if values[0] > self.position + 1:
+                    # lapped while reading
+                    self.lost += 1
+                    self.position += 1
+                    continue
+                # still being written
+                break
+            records.append(_make_record(values))
+            self.position += 1
+        return records
+
+    def follow(self, interval=0.2):
+        """yield records as they are written."""
+        while True:
+            records = self.read()
+            for record in records:
+                yield record
+            if not records:
+                time.sleep(interval)
+
+    def close(self):
+        self._map.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def _make_record(values):
+    seq, start, end, nbytes, phash, status, method, family, port, _, addr = values
+    if family == socket.AF_INET:
+        remote_addr = socket.inet_ntop(socket.AF_INET, addr[:4])
+    else:
+        remote_addr = socket.inet_ntop(socket.AF_INET6, addr)
+    return Record(start / 1000.0, end / 1000.0, status,
+                  METHODS[method] if method < len(METHODS) else "-",
+                  phash, remote_addr, port, nbytes)
+
+
+def format_record(record):
+    t = time.strftime("%Y-%m-%dT%H:%M:%S", time.localtime(record.start))
+    return "%s.%03d %s:%d %s %016x %d %d %.3f" % (
+        t, int(record.start * 1000) % 1000, record.remote_addr, record.remote_port,
+        record.method, record.path_hash, record.status, record.bytes, record.duration)
+
+
+def summarize(records):
+    """count, status counts, bytes and latency percentiles (seconds)."""
+    durations = sorted(r.duration for r in records)
+    statuses = collections.Counter(r.status for r in records)
+
+    def percentile(p):
+        if not durations:
+            return 0.0
+        return durations[min(len(durations) - 1, int(len(durations) * p))]
+
+    return {
+        "count": len(durations),
+        "status": dict(statuses),
+        "bytes": sum(r.bytes for r in records),
+        "p50": percentile(0.5),
+        "p90": percentile(0.9),
+        "p99": percentile(0.99),
+        "max": durations[-1] if durations else 0.0,
+    }
+
+
+def main(argv=None):
+    import argparse
+
+    parser = argparse.ArgumentParser(description="read a minefield log ring")
+    parser.add_argument("path")
+    parser.add_argument("--follow", "-f", action="store_true", help="wait for new records")
+    parser.add_argument("--summary", "-s", action="store_true", help="print totals instead of records")
+    args = parser.parse_args(argv)
+
+    with LogRing(args.path) as ring:
+        if args.summary:
+            summary = summarize(ring.read())
+            for key in ("count", "bytes", "p50", "p90", "p99", "max"):
+                print("%s: %s" % (key, summary[key]))
+            for status, count in sorted(summary["status"].items()):
+                print("status %d: %d" % (status, count))
+            return
+        try:
+            records = ring.follow() if args.follow else ring.read()
+            for record in records:
+                print(format_record(record))
+        except KeyboardInterrupt:
+            pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,152 @@
+"""asyncio event loop running on the minefield (picoev) loop.
+
+Callbacks go through the pending calls and timers of the server loop and
+readers / writers are watched with ``server.watch()``, so HTTP serving and
+asyncio clients share one epoll instance::
+
+    import asyncio
+    from minefield import server, loop
+
+    asyncio.set_event_loop_policy(loop.EventLoopPolicy())
+    server.listen(("0.0.0.0", 8000))
+    loop.run(app)
+
+Outside ``run()`` the event loop works as usual (``run_until_complete()``
+etc.) by turning the server loop with ``server.run_once()``.
+"""
+
+import asyncio
+import selectors
+import threading
+import sys
+
+from asyncio import events
+
+from minefield import server
+
+__all__ = ["EventLoop", "EventLoopPolicy", "run"]
+
+
+def _run_handle(handle):
+    if not handle._cancelled and not handle._loop._closed:
+        handle._run()
+
+
+class _PicoevSelector(selectors._BaseSelectorImpl):
+    """keeps the selector keys, readiness is reported by the server loop."""
+
+    def __init__(self):
+        super().__init__()
+        self._loop = None
+
+    def register(self, fileobj, events, data=None):
+        key = super().register(fileobj, events, data)
+        try:
+            server.watch(key.fd, events, self._dispatch)
+        except BaseException:
+            super().unregister(fileobj)
+            raise
+        return key
+
+    def unregister(self, fileobj):
+        key = super().unregister(fileobj)
+        server.watch(key.fd, 0)
+        return key
+
+    def select(self, timeout=None):
+        # events are dispatched from the server loop
+        server.run_once(timeout if timeout is not None else -1)
+        return []
+
+    def close(self):
+        for key in list(self._fd_to_key.values()):
+            self.unregister(key.fileobj)
+        super().close()
+
+    def _dispatch(self, fd, mask):
+        key = self._fd_to_key.get(fd)
+        if key is not None and self._loop is not None:
+            self._loop._process_events([(key, mask & key.events)])
+
+
+class EventLoop(asyncio.SelectorEventLoop):
+
+    def __init__(self):
+        self._timers = {}
+        selector = _PicoevSelector()
+        super().__init__(selector)
+        selector._loop = self
+
+    def _call_soon(self, callback, args, context):
+        handle = events.Handle(callback, args, self, context)
+        if handle._source_traceback:
+            del handle._source_traceback[-1]
+        server.call_later(0, _run_handle, handle)
+        return handle
+
+    def _add_callback(self, handle):
+        if not handle._cancelled:
+            server.call_later(0, _run_handle, handle)
+
+    def call_at(self, when, callback, *args, context=None):
+        if when is None:
+            raise TypeError("when cannot be None")
+        self._check_closed()
+        if self._debug:
+            self._check_thread()
+            self._check_callback(callback, 'call_at')
+        timer = events.TimerHandle(when, callback, args, self, context)
+        if timer._source_traceback:
+            del timer._source_traceback[-1]
+        self._timers[timer] = server.call_later(when - self.time(), self._run_timer, timer)
+        timer._scheduled = True
+        return timer
+
+    def _run_timer(self, timer):
+        del self._timers[timer]
+        timer._scheduled = False
+        _run_handle(timer)
+
+    def _timer_handle_cancelled(self, handle):
+        t = self._timers.pop(handle, None)
+        if t is not None:
+            t.cancel()
+
+    def _run_once(self):
+        server.run_once()
+
+    def close(self):
+        if self.is_running():
+            raise RuntimeError("Cannot close a running event loop")
+        for t in self._timers.values():
+            t.cancel()
+        self._timers.clear()
+        super().close()
+
+    def serve(self, app, silent=0):
+        """server.run(app) with this event loop running."""
+        self._check_closed()
+        self._check_running()
+        old_agen_hooks = sys.get_asyncgen_hooks()
+        try:
+            self._thread_id = threading.get_ident()
+            sys.set_asyncgen_hooks(firstiter=self._asyncgen_firstiter_hook,
+                                   finalizer=self._asyncgen_finalizer_hook)
+            events._set_running_loop(self)
+            server.run(app, silent)
+        finally:
+            self._thread_id = None
+            events._set_running_loop(None)
+            sys.set_asyncgen_hooks(*old_agen_hooks)
+
+
+class EventLoopPolicy(asyncio.DefaultEventLoopPolicy):
+    _loop_factory = EventLoop
+
+
+def run(app, silent=0):
+    """serve app with the current event loop (an EventLoop) running."""
+    loop = asyncio.get_event_loop()
+    if not isinstance(loop, EventLoop):
+        raise TypeError("event loop is not minefield.loop.EventLoop")
+    loop.serve(app, silent)
@@ -0,0 +1,154 @@
+"""reader of the worker statistics file (``server.set_stats_file()``).
+
+Each worker keeps its counters and latency histograms in a mmap'd file,
+a parent process (a gunicorn master, a monitoring agent) sums them::
+
+    import glob
+    from minefield import metrics
+
+    total = metrics.aggregate(glob.glob("/dev/shm/minefield.*.stats"))
+    print(total["requests"], total["total_time"]["p99"])
+
+or from the command line::
+
+    python -m minefield.metrics /dev/shm/minefield.*.stats
+"""
+
+import mmap
+import struct
+
+__all__ = ["read_stats", "aggregate", "COUNTERS", "HISTOGRAMS"]
+
+MAGIC = b"MFSTATS1"
+VERSION = 1
+
+_header = struct.Struct("=8sIIIIIIQ24x")
+
+# order of stat_counter and stat_hist of stats.h
+COUNTERS = ("accepts", "accept_errors", "connections", "keepalive", "requests",
+            "status_1xx", "status_2xx", "status_3xx", "status_4xx", "status_5xx",
+            "bytes_sent", "parse_errors", "timeouts", "app_errors")
+HISTOGRAMS = ("wait_time", "read_time", "queue_time", "app_time", "send_time", "total_time")
+
+QUANTILES = (("p50", 0.5), ("p90", 0.9), ("p99", 0.99), ("p999", 0.999))
+
+
+class Histogram(object):
+    """log-linear histogram of microseconds."""
+
+    def __init__(self, sub_bits, count, total, maximum, buckets):
+        self.sub_bits = sub_bits
+        self.count = count
+        self.sum = total
+        self.max = maximum
+        self.buckets = list(buckets)
+
+    def merge(self, other):
+        if other.sub_bits != self.sub_bits or len(other.buckets) != len(self.buckets):
+            raise ValueError("histogram layouts differ")
+        self.count += other.count
+        self.sum += other.sum
+        self.max = max(self.max, other.max)
+        self.buckets = [a + b for a, b in zip(self.buckets, other.buckets)]
+
+    def bucket_range(self, i):
+        sub = 1 << self.sub_bits
+        if i < sub:
+            return i, 1
+        e = i // sub + self.sub_bits - 1
+        width = 1 << (e - self.sub_bits)
+        return (sub + i % sub) * width, width
+
+    def quantile(self, q):
+        """value at quantile q in seconds, the middle of its bucket."""
+        if self.count == 0:
+            return 0.0
+        rank = max(1, int(q * self.count + 0.5))
+        seen = 0
+        for i, n in enumerate(self.buckets):
+            seen += n
+            if seen >= rank:
+                low, width = self.bucket_range(i)
+                return min(low + width // 2, self.max) / 1000000.0
+        return self.max / 1000000.0
+
+    def as_dict(self):
+        """same keys as the histograms of server.stats()."""
+        d = {
+            "count": self.count,
+            "sum": self.sum / 1000000.0,
+            "mean": self.sum / 1000000.0 / self.count if self.count else 0.0,
+            "max": self.max / 1000000.0,
+        }
+        for name, q in QUANTILES:
+            d[name] = self.quantile(q)
+        return d
+
+
+def _read_raw(path):
+    with open(path, "rb") as f:
+        m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    try:
+        magic, version, ncounters, nhists, nbuckets, sub_bits, pid, start = _header.unpack_from(m, 0)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError("%s is not a stats file" % path)
+        counters = struct.unpack_from("=%dQ" % ncounters, m, _header.size)
+        offset = _header.size + 8 * ncounters
+        hist = struct.Struct("=%dQ" % (3 + nbuckets))
+        hists = []
+        for i in range(nhists):
+            values = hist.unpack_from(m, offset + i * hist.size)
+            hists.append(Histogram(sub_bits, values[0], values[1], values[2], values[3:]))
+    finally:
+        m.close()
+    return pid, start, counters, hists
+
+
+def read_stats(path):
+    """counters and Histogram objects of one worker."""
+    pid, start, counters, hists = _read_raw(path)
+    result = {"pid": pid, "start": start / 1000.0}
+    result.update(zip(COUNTERS, counters))
+    result.update(zip(HISTOGRAMS, hists))
+    return result
+
+
+def aggregate(paths):
+    """sum of the workers, histograms as dicts like server.stats()."""
+    total = dict.fromkeys(COUNTERS, 0)
+    hists = {}
+    workers = 0
+    for path in paths:
+        stats = read_stats(path)
+        workers += 1
+        for name in COUNTERS:
+            total[name] += stats[name]
+        for name in HISTOGRAMS:
+            if name in hists:
+                hists[name].merge(stats[name])
+            else:
+                hists[name] = stats[name]
+    for name in HISTOGRAMS:
+        total[name] = hists[name].as_dict() if name in hists else Histogram(0, 0, 0, 0, []).as_dict()
+    total["workers"] = workers
+    return total
+
+
+def main(argv=None):
+    import argparse
+
+    parser = argparse.ArgumentParser(description="sum minefield worker statistics")
+    parser.add_argument("paths", nargs="+")
+    args = parser.parse_args(argv)
+
+    total = aggregate(args.paths)
+    for name in ("workers",) + COUNTERS:
+        print("%s: %d" % (name, total[name]))
+    for name in HISTOGRAMS:
+        h = total[name]
+        print("%s: count %d mean %.6f p50 %.6f p90 %.6f p99 %.6f p999 %.6f max %.6f" % (
+            name, h["count"], h["mean"], h["p50"], h["p90"], h["p99"], h["p999"], h["max"]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,966 @@
+#include "access_log.h"
+#include "time_cache.h"
+#include "stats.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <signal.h>
+
+/*
+ * native access log of server.set_access_log().
+ * the format is compiled to a list of ops once, each request renders its
+ * line straight from client_t and the environ into the ring buffer. a
+ * writer thread flushes the ring with large writes when it is half full
+ * or every flush_interval; without the writer (outside server.run()) the
+ * ring is flushed by the loop when it fills up.
+ */
+
+int access_log_fd = -1;
+
+static log_op ops[MAX_LOG_OPS];
+static int op_cnt = 0;
+static char *format_buf = NULL;     // literals of ops point into it
+static char *log_path = NULL;       // reopened by reopen_access_log()
+static pid_t log_pid;
+
+static PyObject *remote_user_key = NULL;
+static PyObject *method_key = NULL;
+static PyObject *path_key = NULL;
+static PyObject *query_key = NULL;
+static PyObject *protocol_key = NULL;
+
+static THREAD_LOCAL char line[ACCESS_LOG_LINE];
+
+static char *ring = NULL;
+static size_t ring_size = 0;
+static uint64_t ring_head = 0;      // appended by the loops
+static uint64_t ring_tail = 0;      // written to access_log_fd
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;    // wakes the writer
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;   // ring has room
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER; // one writer of the fd
+
+static pthread_t writer;
+static int writer_running = 0;
+static int writer_stopping = 0;
+static long flush_msec = 1000;
+
+typedef struct {
+    const char *name;
+    log_op_type type;
+} log_var;
+
+// nginx variables
+static log_var log_vars[] = {
+    {"remote_addr", LOG_REMOTE_ADDR},
+    {"remote_port", LOG_REMOTE_PORT},
+    {"remote_user", LOG_REMOTE_USER},
+    {"time_local", LOG_TIME_LOCAL},
+    {"msec", LOG_MSEC},
+    {"request", LOG_REQUEST},
+    {"request_method", LOG_METHOD},
+    {"uri", LOG_PATH},
+    {"args", LOG_ARGS},
+    {"query_string", LOG_ARGS},
+    {"request_uri", LOG_REQUEST_URI},
+    {"server_protocol", LOG_PROTOCOL},
+    {"status", LOG_STATUS},
+    {"body_bytes_sent", LOG_BYTES},
+    {"request_time", LOG_REQUEST_TIME},
+    {"wait_time", LOG_WAIT_TIME},
+    {"read_time", LOG_READ_TIME},
+    {"queue_time", LOG_QUEUE_TIME},
+    {"app_time", LOG_APP_TIME},
+    {"send_time", LOG_SEND_TIME},
+    {"pid", LOG_PID},
+    {NULL, LOG_LITERAL}
+};
+
+typedef struct {
+    char *p;
+    char *end;
+} log_line;
+
+static inline void
+put_bytes(log_line *l, const char *s, size_t len)
+{
+    if (len > (size_t)(l->end - l->p)) {
+        len = l->end - l->p;
+    }
+    memcpy(l->p, s, len);
+    l->p += len;
+}
+
+static inline void
+put_char(log_line *l, char c)
+{
+    if (l->p < l->end) {
+        *l->p++ = c;
+    }
+}
+
+static void
+put_uint(log_line *l, uint64_t v)
+{
+    char buf[24], *p = buf + sizeof(buf);
+
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    put_bytes(l, p, buf + sizeof(buf) - p);
+}
+
+/* seconds.milliseconds */
+static void
+put_msec(log_line *l, uint64_t msec)
+{
+    char buf[4];
+
+    put_uint(l, msec / 1000);
+    buf[0] = '.';
+    buf[1] = '0' + msec / 100 % 10;
+    buf[2] = '0' + msec / 10 % 10;
+    buf[3] = '0' + msec % 10;
+    put_bytes(l, buf, 4);
+}
+
+/* seconds.microseconds */
+static void
+put_usec(log_line *l, uint64_t usec)
+{
+    char buf[7];
+    int i;
+
+    put_uint(l, usec / 1000000);
+    buf[0] = '.';
+    for (i = 6; i > 0; i--) {
+        buf[i] = '0' + usec % 10;
+        usec /= 10;
+    }
+    put_bytes(l, buf, 7);
+}
+
+/* quotes, backslashes and unprintable bytes are written as \xHH */
+static void
+put_escaped(log_line *l, const char *s, size_t len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    const char *end = s + len;
+    unsigned char c;
+
+    while (s < end && l->p < l->end) {
+        c = (unsigned char)*s++;
+        if (c == '"' || c == '\\' || c < 0x20 || c > 0x7e) {
+            if (l->end - l->p < 4) {
+                break;
+            }
+            *l->p++ = '\\';
+            *l->p++ = 'x';
+            *l->p++ = hex[c >> 4];
+            *l->p++ = hex[c & 0xf];
+        } else {
+            *l->p++ = c;
+        }
+    }
+}
+
+static const char *
+env_value(PyObject *environ, PyObject *key, Py_ssize_t *len)
+{
+    PyObject *o;
+    const char *s;
+
+    if (environ == NULL) {
+        return NULL;
+    }
+    o = PyDict_GetItem(environ, key);
+    if (o == NULL) {
+        return NULL;
+    }
+#ifdef PY3
+    if (PyUnicode_Check(o)) {
+        if (PyUnicode_KIND(o) == PyUnicode_1BYTE_KIND) {
+            // latin-1, the bytes of the request
+            *len = PyUnicode_GET_LENGTH(o);
+            return (const char *)PyUnicode_DATA(o);
+        }
+        s = PyUnicode_AsUTF8AndSize(o, len);
+        if (s == NULL) {
+            PyErr_Clear();
+        }
+        return s;
+    }
+#endif
+    if (PyBytes_Check(o)) {
+        *len = PyBytes_GET_SIZE(o);
+        s = PyBytes_AS_STRING(o);
+        return s;
+    }
+    return NULL;
+}
+
+static void
+put_env(log_line *l, PyObject *environ, PyObject *key)
+{
+    const char *s;
+    Py_ssize_t len = 0;
+
+    s = env_value(environ, key, &len);
+    if (s == NULL || len == 0) {
+        put_char(l, '-');
+    } else {
+        put_escaped(l, s, len);
+    }
+}
+
+static void
+put_uri(log_line *l, PyObject *environ)
+{
+    const char *s;
+    Py_ssize_t len = 0;
+
+    s = env_value(environ, path_key, &len);
+    if (s) {
+        put_escaped(l, s, len);
+    }
+    s = env_value(environ, query_key, &len);
+    if (s && len > 0) {
+        put_char(l, '?');
+        put_escaped(l, s, len);
+    }
+}
+
+/*
+ * flush the ring to access_log_fd, called without the GIL.
+ * data is dropped on write errors.
+ */
+static void
+drain_ring(void)
+{
+    uint64_t head, tail;
+    size_t off, n;
+    ssize_t w;
+
+    pthread_mutex_lock(&write_lock);
+    pthread_mutex_lock(&ring_lock);
+    head = ring_head;
+    tail = ring_tail;
+    pthread_mutex_unlock(&ring_lock);
+
+    while (tail < head) {
+        off = tail % ring_size;
+        n = head - tail;
+        if (n > ring_size - off) {
+            n = ring_size - off;
+        }
+        w = write(access_log_fd, ring + off, n);
+        if (w == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            tail = head;
+        } else {
+            tail += w;
+        }
+        pthread_mutex_lock(&ring_lock);
+        ring_tail = tail;
+        pthread_cond_broadcast(&space_cond);
+        pthread_mutex_unlock(&ring_lock);
+    }
+    pthread_mutex_unlock(&write_lock);
+}
+
+/*
+ * wait for len bytes of room in the ring, called without the GIL.
+ */
+static void
+wait_space(size_t len)
+{
+    pthread_mutex_lock(&ring_lock);
+    while (ring != NULL && ring_size - (ring_head - ring_tail) < len) {
+        if (writer_running) {
+            pthread_cond_signal(&ring_cond);
+            pthread_cond_wait(&space_cond, &ring_lock);
+        } else {
+            pthread_mutex_unlock(&ring_lock);
+            drain_ring();
+            pthread_mutex_lock(&ring_lock);
+        }
+    }
+    pthread_mutex_unlock(&ring_lock);
+}
+
+static void
+append_ring(const char *s, size_t len)
+{
+    size_t off, n;
+
+    pthread_mutex_lock(&ring_lock);
+    while (ring_size - (ring_head - ring_tail) < len) {
+        // a slow disk blocks this thread only, not the other loops
+        pthread_mutex_unlock(&ring_lock);
+        Py_BEGIN_ALLOW_THREADS
+        wait_space(len);
+        Py_END_ALLOW_THREADS
+        pthread_mutex_lock(&ring_lock);
+        if (ring == NULL) {
+            // closed meanwhile
+            pthread_mutex_unlock(&ring_lock);
+            return;
+        }
+    }
+    off = ring_head % ring_size;
+    n = ring_size - off;
+    if (n >= len) {
+        memcpy(ring + off, s, len);
+    } else {
+        memcpy(ring + off, s, n);
+        memcpy(ring, s + n, len - n);
+    }
+    ring_head += len;
+    if (writer_running && ring_head - ring_tail >= ring_size / 2) {
+        pthread_cond_signal(&ring_cond);
+    }
+    pthread_mutex_unlock(&ring_lock);
+}
+
+void
+write_access_log(client_t *client, request *req, uintptr_t delta_msec)
+{
+    PyObject *environ = req ? req->environ : NULL;
+    log_line l;
+    log_op *op;
+    const char *s;
+    Py_ssize_t len = 0;
+    int64_t usec;
+    int i;
+
+    l.p = line;
+    l.end = line + sizeof(line) - 1;    // room for the newline
+    for (i = 0; i < op_cnt; i++) {
+        op = ops + i;
+        switch (op->type) {
+            case LOG_LITERAL:
+                put_bytes(&l, op->s, op->len);
+                break;
+            case LOG_REMOTE_ADDR:
+                put_bytes(&l, client->remote_addr, strlen(client->remote_addr));
+                break;
+            case LOG_REMOTE_PORT:
+                put_uint(&l, client->remote_port);
+                break;
+            case LOG_DASH:
+                put_char(&l, '-');
+                break;
+            case LOG_REMOTE_USER:
+                put_env(&l, environ, remote_user_key);
+                break;
+            case LOG_TIME:
+                put_char(&l, '[');
+                put_bytes(&l, (char *)http_log_time, strlen((char *)http_log_time));
+                put_char(&l, ']');
+                break;
+            case LOG_TIME_LOCAL:
+                put_bytes(&l, (char *)http_log_time, strlen((char *)http_log_time));
+                break;
+            case LOG_MSEC:
+                put_msec(&l, current_msec);
+                break;
+            case LOG_REQUEST:
+                if (environ == NULL) {
+                    put_char(&l, '-');
+                    break;
+                }
+                put_env(&l, environ, method_key);
+                put_char(&l, ' ');
+                put_uri(&l, environ);
+                put_char(&l, ' ');
+                put_env(&l, environ, protocol_key);
+                break;
+            case LOG_METHOD:
+                put_env(&l, environ, method_key);
+                break;
+            case LOG_PATH:
+                put_env(&l, environ, path_key);
+                break;
+            case LOG_QUERY:
+                s = env_value(environ, query_key, &len);
+                if (s && len > 0) {
+                    put_char(&l, '?');
+                    put_escaped(&l, s, len);
+                }
+                break;
+            case LOG_ARGS:
+                put_env(&l, environ, query_key);
+                break;
+            case LOG_REQUEST_URI:
+                if (environ == NULL) {
+                    put_char(&l, '-');
+                } else {
+                    put_uri(&l, environ);
+                }
+                break;
+            case LOG_PROTOCOL:
+                put_env(&l, environ, protocol_key);
+                break;
+            case LOG_STATUS:
+                put_uint(&l, client->status_code);
+                break;
+            case LOG_BYTES_CLF:
+                if (client->write_bytes == 0) {
+                    put_char(&l, '-');
+                } else {
+                    put_uint(&l, client->write_bytes);
+                }
+                break;
+            case LOG_BYTES:
+                put_uint(&l, client->write_bytes);
+                break;
+            case LOG_SECONDS:
+                put_uint(&l, delta_msec / 1000);
+                break;
+            case LOG_MICROS:
+                usec = req ? request_span(req, HIST_TOTAL) : -1;
+                put_uint(&l, usec >= 0 ? (uint64_t)usec : (uint64_t)delta_msec * 1000);
+                break;
+            case LOG_REQUEST_TIME:
+                put_msec(&l, delta_msec);
+                break;
+            case LOG_WAIT_TIME:
+            case LOG_READ_TIME:
+            case LOG_QUEUE_TIME:
+            case LOG_APP_TIME:
+            case LOG_SEND_TIME:
+                usec = req ? request_span(req, HIST_WAIT + op->type - LOG_WAIT_TIME) : -1;
+                if (usec >= 0) {
+                    put_usec(&l, usec);
+                } else {
+                    put_char(&l, '-');
+                }
+                break;
+            case LOG_PID:
+                put_uint(&l, log_pid);
+                break;
+            case LOG_ENV:
+                put_env(&l, environ, op->key);
+                break;
+        }
+    }
+    *l.p++ = '\n';
+    append_ring(line, l.p - line);
+}
+
+static void*
+writer_main(void *arg)
+{
+    struct timespec ts;
+    sigset_t set;
+
+    // signals go to the loop thread
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock(&ring_lock);
+    while (!writer_stopping) {
+        if (ring_head - ring_tail < ring_size / 2) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += flush_msec / 1000;
+            ts.tv_nsec += (flush_msec % 1000) * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&ring_cond, &ring_lock, &ts);
+        }
+        if (ring_head != ring_tail) {
+            pthread_mutex_unlock(&ring_lock);
+            drain_ring();
+            pthread_mutex_lock(&ring_lock);
+        }
+    }
+    pthread_mutex_unlock(&ring_lock);
+    return NULL;
+}
+
+/*
+ * start the writer thread, called by server.run().
+ */
+int
+access_log_start(void)
+{
+    int ret;
+
+    if (access_log_fd == -1 || writer_running) {
+        return 0;
+    }
+    log_pid = getpid();
+    writer_stopping = 0;
+    ret = pthread_create(&writer, NULL, writer_main, NULL);
+    if (ret != 0) {
+        errno = ret;
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+    writer_running = 1;
+    return 0;
+}
+
+/*
+ * join the writer thread and flush the rest.
+ */
+void
+access_log_stop(void)
+{
+    if (writer_running) {
+        pthread_mutex_lock(&ring_lock);
+        writer_stopping = 1;
+        pthread_cond_signal(&ring_cond);
+        pthread_mutex_unlock(&ring_lock);
+        Py_BEGIN_ALLOW_THREADS
+        pthread_join(writer, NULL);
+        Py_END_ALLOW_THREADS
+        writer_running = 0;
+    }
+    if (access_log_fd != -1) {
+        Py_BEGIN_ALLOW_THREADS
+        drain_ring();
+        Py_END_ALLOW_THREADS
+    }
+}
+
+static int
+init_keys(void)
+{
+    if (remote_user_key != NULL) {
+        return 0;
+    }
+    remote_user_key = NATIVE_FROMSTRING("REMOTE_USER");
+    method_key = NATIVE_FROMSTRING("REQUEST_METHOD");
+    path_key = NATIVE_FROMSTRING("PATH_INFO");
+    query_key = NATIVE_FROMSTRING("QUERY_STRING");
+    protocol_key = NATIVE_FROMSTRING("SERVER_PROTOCOL");
+    if (!remote_user_key || !method_key || !path_key || !query_key || !protocol_key) {
+        Py_CLEAR(remote_user_key);
+        Py_CLEAR(method_key);
+        Py_CLEAR(path_key);
+        Py_CLEAR(query_key);
+        Py_CLEAR(protocol_key);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+clear_ops(log_op *o, int cnt)
+{
+    int i;
+
+    for (i = 0; i < cnt; i++) {
+        Py_CLEAR(o[i].key);
+    }
+}
+
+static int
+add_op(log_op *o, int *cnt, log_op_type type, const char *s, size_t len, PyObject *key)
+{
+    if (*cnt == MAX_LOG_OPS) {
+        Py_XDECREF(key);
+        PyErr_Format(PyExc_ValueError, "too many log format items (max %d)", MAX_LOG_OPS);
+        return -1;
+    }
+    if (type == LOG_LITERAL && len == 0) {
+        return 0;
+    }
+    o[*cnt].type = type;
+    o[*cnt].s = s;
+    o[*cnt].len = len;
+    o[*cnt].key = key;
+    (*cnt)++;
+    return 0;
+}
+
+/* Referer -> HTTP_REFERER */
+static PyObject *
+header_key(const char *name, size_t len)
+{
+    char key[256], *p;
+    size_t i;
+
+    if (len + 6 > sizeof(key)) {
+        PyErr_SetString(PyExc_ValueError, "log format header name is too long");
+        return NULL;
+    }
+    memcpy(key, "HTTP_", 5);
+    p = key + 5;
+    for (i = 0; i < len; i++) {
+        *p++ = name[i] == '-' ? '_' : toupper((unsigned char)name[i]);
+    }
+    *p = '\0';
+    return NATIVE_FROMSTRING(key);
+}
+
+/* apache %x and %{name}x tokens, p is after the % */
+static int
+compile_apache(log_op *o, int *cnt, char **pp)
+{
+    char *p = *pp, *name = NULL, *close;
+    PyObject *key = NULL;
+    log_op_type type;
+
+    if (*p == '>' || *p == '<') {
+        // final status
+        p++;
+    }
+    if (*p == '{') {
+        name = p + 1;
+        close = strchr(name, '}');
+        if (close == NULL) {
+            PyErr_SetString(PyExc_ValueError, "unterminated '{' in log format");
+            return -1;
+        }
+        *close = '\0';
+        p = close + 1;
+    }
+    switch (*p) {
+        case 'h': case 'a': type = LOG_REMOTE_ADDR; break;
+        case 'l': type = LOG_DASH; break;
+        case 'u': type = LOG_REMOTE_USER; break;
+        case 't': type = LOG_TIME; break;
+        case 'r': type = LOG_REQUEST; break;
+        case 'm': type = LOG_METHOD; break;
+        case 'U': type = LOG_PATH; break;
+        case 'q': type = LOG_QUERY; break;
+        case 'H': type = LOG_PROTOCOL; break;
+        case 's': type = LOG_STATUS; break;
+        case 'b': type = LOG_BYTES_CLF; break;
+        case 'B': type = LOG_BYTES; break;
+        case 'T': type = LOG_SECONDS; break;
+        case 'D': type = LOG_MICROS; break;
+        case 'P': type = LOG_PID; break;
+        case 'p':
+            if (name == NULL || strcmp(name, "remote")) {
+                goto unknown;
+            }
+            type = LOG_REMOTE_PORT;
+            name = NULL;
+            break;
+        case 'i':
+            if (name == NULL) {
+                goto unknown;
+            }
+            key = header_key(name, strlen(name));
+            if (key == NULL) {
+                return -1;
+            }
+            type = LOG_ENV;
+            name = NULL;
+            break;
+        case 'e':
+            if (name == NULL) {
+                goto unknown;
+            }
+            key = NATIVE_FROMSTRING(name);
+            if (key == NULL) {
+                return -1;
+            }
+            type = LOG_ENV;
+            name = NULL;
+            break;
+        default:
+            goto unknown;
+    }
+    if (name != NULL) {
+        goto unknown;
+    }
+    *pp = p + 1;
+    return add_op(o, cnt, type, NULL, 0, key);
+
+unknown:
+    PyErr_Format(PyExc_ValueError, "unknown log format item '%%%c'", *p ? *p : ' ');
+    return -1;
+}
+
+/* nginx $name and ${name} variables, p is after the $ */
+static int
+compile_nginx(log_op *o, int *cnt, char **pp)
+{
+    char *p = *pp, *name;
+    size_t len;
+    PyObject *key = NULL;
+    log_var *v;
+    int brace = 0;
+
+    if (*p == '{') {
+        brace = 1;
+        p++;
+    }
+    name = p;
+    while (isalnum((unsigned char)*p) || *p == '_') {
+        p++;
+    }
+    len = p - name;
+    if (brace) {
+        if (*p != '}') {
+            PyErr_SetString(PyExc_ValueError, "unterminated '{' in log format");
+            return -1;
+        }
+        p++;
+    }
+    if (len == 0) {
+        PyErr_SetString(PyExc_ValueError, "empty log format variable");
+        return -1;
+    }
+    *pp = p;
+    if (len > 5 && !memcmp(name, "http_", 5)) {
+        key = header_key(name + 5, len - 5);
+        if (key == NULL) {
+            return -1;
+        }
+        return add_op(o, cnt, LOG_ENV, NULL, 0, key);
+    }
+    for (v = log_vars; v->name; v++) {
+        if (strlen(v->name) == len && !memcmp(v->name, name, len)) {
+            return add_op(o, cnt, v->type, NULL, 0, NULL);
+        }
+    }
+    PyErr_Format(PyExc_ValueError, "unknown log format variable '$%.*s'", (int)len, name);
+    return -1;
+}
+
+static int
+compile_format(char *buf, log_op *o, int *cnt)
+{
+    char *p = buf, *lit = buf;
+    int ret;
+
+    *cnt = 0;
+    while (*p) {
+        if (*p != '%' && *p != '$') {
+            p++;
+            continue;
+        }
+        if (add_op(o, cnt, LOG_LITERAL, lit, p - lit, NULL) == -1) {
+            goto error;
+        }
+        if (p[0] == p[1]) {
+            // %% and $$
+            lit = ++p;
+            p++;
+            continue;
+        }
+        if (*p++ == '%') {
+            ret = compile_apache(o, cnt, &p);
+        } else {
+            ret = compile_nginx(o, cnt, &p);
+        }
+        if (ret == -1) {
+            goto error;
+        }
+        lit = p;
+    }
+    if (add_op(o, cnt, LOG_LITERAL, lit, p - lit, NULL) == -1) {
+        goto error;
+    }
+    return 0;
+
+error:
+    clear_ops(o, *cnt);
+    *cnt = 0;
+    return -1;
+}
+
+static int
+open_log(PyObject *target, char **path)
+{
+    PyObject *bytes = NULL;
+    int fd;
+
+    *path = NULL;
+#ifdef PY3
+    if (PyLong_Check(target)) {
+        fd = (int)PyLong_AsLong(target);
+#else
+    if (PyInt_Check(target)) {
+        fd = (int)PyInt_AsLong(target);
+#endif
+        if (fd < 0) {
+            if (!PyErr_Occurred()) {
+                PyErr_SetString(PyExc_ValueError, "fd value out of range ");
+            }
+            return -1;
+        }
+        fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (fd == -1) {
+            PyErr_SetFromErrno(PyExc_IOError);
+        }
+        return fd;
+    }
+#ifdef PY3
+    if (!PyUnicode_FSConverter(target, &bytes)) {
+        return -1;
+    }
+#else
+    if (!PyString_Check(target)) {
+        PyErr_SetString(PyExc_TypeError, "target must be a path or a file descriptor");
+        return -1;
+    }
+    Py_INCREF(target);
+    bytes = target;
+#endif
+    fd = open(PyBytes_AS_STRING(bytes), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_IOError, target);
+        Py_DECREF(bytes);
+        return -1;
+    }
+    *path = PyMem_Malloc(PyBytes_GET_SIZE(bytes) + 1);
+    if (*path == NULL) {
+        close(fd);
+        Py_DECREF(bytes);
+        PyErr_NoMemory();
+        return -1;
+    }
+    memcpy(*path, PyBytes_AS_STRING(bytes), PyBytes_GET_SIZE(bytes) + 1);
+    Py_DECREF(bytes);
+    return fd;
+}
+
+static void
+close_log(void)
+{
+    if (access_log_fd == -1) {
+        return;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    drain_ring();
+    Py_END_ALLOW_THREADS
+    close(access_log_fd);
+    access_log_fd = -1;
+    clear_ops(ops, op_cnt);
+    op_cnt = 0;
+    PyMem_Free(format_buf);
+    format_buf = NULL;
+    PyMem_Free(log_path);
+    log_path = NULL;
+    pthread_mutex_lock(&ring_lock);
+    PyMem_Free(ring);
+    ring = NULL;
+    ring_size = 0;
+    ring_head = ring_tail = 0;
+    pthread_mutex_unlock(&ring_lock);
+}
+
+PyObject *
+set_access_log(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *target;
+    char *format = ACCESS_LOG_COMBINED, *buf = NULL, *path = NULL, *new_ring = NULL;
+    Py_ssize_t buffer_size = ACCESS_LOG_BUFFER;
+    double flush_interval = 1.0;
+    log_op new_ops[MAX_LOG_OPS];
+    int cnt = 0, fd;
+    size_t len;
+    static char *kwlist[] = {"target", "format", "buffer_size", "flush_interval", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|znd:set_access_log", kwlist,
+                                     &target, &format, &buffer_size, &flush_interval)) {
+        return NULL;
+    }
+    if (writer_running) {
+        PyErr_SetString(PyExc_RuntimeError, "access log is used by the running server");
+        return NULL;
+    }
+    if (target == Py_None) {
+        close_log();
+        Py_RETURN_NONE;
+    }
+    if (format == NULL) {
+        format = ACCESS_LOG_COMBINED;
+    }
+    if (buffer_size < ACCESS_LOG_MIN_BUFFER) {
+        PyErr_SetString(PyExc_ValueError, "buffer_size value out of range ");
+        return NULL;
+    }
+    if (flush_interval <= 0) {
+        PyErr_SetString(PyExc_ValueError, "flush_interval value out of range ");
+        return NULL;
+    }
+    if (init_keys() == -1) {
+        return NULL;
+    }
+
+    len = strlen(format);
+    buf = PyMem_Malloc(len + 1);
+    new_ring = PyMem_Malloc(buffer_size);
+    if (buf == NULL || new_ring == NULL) {
+        PyMem_Free(buf);
+        PyMem_Free(new_ring);
+        return PyErr_NoMemory();
+    }
+    memcpy(buf, format, len + 1);
+    if (compile_format(buf, new_ops, &cnt) == -1) {
+        goto error;
+    }
+    fd = open_log(target, &path);
+    if (fd == -1) {
+        clear_ops(new_ops, cnt);
+        goto error;
+    }
+
+    close_log();
+    memcpy(ops, new_ops, sizeof(log_op) * cnt);
+    op_cnt = cnt;
+    format_buf = buf;
+    log_path = path;
+    ring = new_ring;
+    ring_size = buffer_size;
+    flush_msec = (long)(flush_interval * 1000);
+    if (flush_msec <= 0) {
+        flush_msec = 1;
+    }
+    log_pid = getpid();
+    access_log_fd = fd;
+    Py_RETURN_NONE;
+
+error:
+    PyMem_Free(buf);
+    PyMem_Free(new_ring);
+    return NULL;
+}
+
+PyObject *
+flush_access_log(PyObject *self, PyObject *args)
+{
+    if (access_log_fd != -1) {
+        Py_BEGIN_ALLOW_THREADS
+        drain_ring();
+        Py_END_ALLOW_THREADS
+    }
+    Py_RETURN_NONE;
+}
+
+/*
+ * reopen the log file after rotation, buffered lines go to the old file.
+ */
+PyObject *
+reopen_access_log(PyObject *self, PyObject *args)
+{
+    int fd;
+
+    if (access_log_fd == -1 || log_path == NULL) {
+        Py_RETURN_NONE;
+    }
+    fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, log_path);
+    }
+    Py_BEGIN_ALLOW_THREADS
+    drain_ring();
+    pthread_mutex_lock(&write_lock);
+    dup2(fd, access_log_fd);
+    fcntl(access_log_fd, F_SETFD, FD_CLOEXEC);
+    pthread_mutex_unlock(&write_lock);
+    Py_END_ALLOW_THREADS
+    close(fd);
+    Py_RETURN_NONE;
+}
@@ -0,0 +1,66 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include "minefield.h"
+#include "client.h"
+#include "request.h"
+
+#define ACCESS_LOG_COMBINED "%h %l %u %t \"%r\" %>s %b \"%{Referer}i\" \"%{User-Agent}i\""
+#define ACCESS_LOG_BUFFER 1024 * 256
+#define ACCESS_LOG_MIN_BUFFER 1024 * 16
+#define ACCESS_LOG_LINE 1024 * 8
+#define MAX_LOG_OPS 64
+
+typedef enum {
+    LOG_LITERAL,
+    LOG_REMOTE_ADDR,
+    LOG_REMOTE_PORT,
+    LOG_DASH,
+    LOG_REMOTE_USER,
+    LOG_TIME,                   // [28/Sep/1970:12:00:00 +0600]
+    LOG_TIME_LOCAL,             // without brackets
+    LOG_MSEC,                   // epoch seconds with milliseconds
+    LOG_REQUEST,
+    LOG_METHOD,
+    LOG_PATH,
+    LOG_QUERY,                  // ?query or empty
+    LOG_ARGS,                   // query without '?'
+    LOG_REQUEST_URI,
+    LOG_PROTOCOL,
+    LOG_STATUS,
+    LOG_BYTES_CLF,              // '-' for no bytes
+    LOG_BYTES,
+    LOG_SECONDS,
+    LOG_MICROS,
+    LOG_REQUEST_TIME,           // seconds with milliseconds
+    LOG_WAIT_TIME,              // phases of stats.h, seconds with microseconds
+    LOG_READ_TIME,
+    LOG_QUEUE_TIME,
+    LOG_APP_TIME,
+    LOG_SEND_TIME,
+    LOG_PID,
+    LOG_ENV,
+} log_op_type;
+
+typedef struct {
+    log_op_type type;
+    const char *s;              // literal
+    size_t len;
+    PyObject *key;              // environ key of LOG_ENV
+} log_op;
+
+extern int access_log_fd;
+
+void write_access_log(client_t *client, request *req, uintptr_t delta_msec);
+
+int access_log_start(void);
+
+void access_log_stop(void);
+
+PyObject* set_access_log(PyObject *self, PyObject *args, PyObject *kwds);
+
+PyObject* flush_access_log(PyObject *self, PyObject *args);
+
+PyObject* reopen_access_log(PyObject *self, PyObject *args);
+
+#endif
@@ -0,0 +1,43 @@
+#include "arena.h"
+#include "slab.h"
+
+void*
+arena_alloc_slow(arena_t *arena, size_t size)
+{
+    arena_block *block;
+
+    if (size > (ARENA_BLOCK_SIZE - sizeof(arena_block)) / 2) {
+        block = PyMem_Malloc(sizeof(arena_block) + size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena->large;
+        arena->large = block;
+        return block + 1;
+    }
+    block = slab_alloc(SLAB_ARENA);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->ptr = (char *)(block + 1) + size;
+    arena->end = (char *)block + ARENA_BLOCK_SIZE;
+    return block + 1;
+}
+
+void
+arena_reset(arena_t *arena)
+{
+    arena_block *block;
+
+    while ((block = arena->blocks) != NULL) {
+        arena->blocks = block->next;
+        slab_free(SLAB_ARENA, block);
+    }
+    while ((block = arena->large) != NULL) {
+        arena->large = block->next;
+        PyMem_Free(block);
+    }
+    arena->ptr = arena->end = NULL;
+}
@@ -0,0 +1,53 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "minefield.h"
+
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/*
+ * bump allocator of a request, reset when the request is freed.
+ * blocks come from the slab, allocations over half a block are linked
+ * apart.
+ */
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t pad;                 // keep the data aligned
+} arena_block;
+
+typedef struct {
+    char *ptr;
+    char *end;
+    arena_block *blocks;
+    arena_block *large;
+} arena_t;
+
+void* arena_alloc_slow(arena_t *arena, size_t size);
+
+void arena_reset(arena_t *arena);
+
+static inline void*
+arena_alloc(arena_t *arena, size_t size)
+{
+    char *p = arena->ptr;
+
+    size = ARENA_ROUND(size);
+    if (likely(p != NULL && (size_t)(arena->end - p) >= size)) {
+        arena->ptr = p + size;
+        return p;
+    }
+    return arena_alloc_slow(arena, size);
+}
+
+/* give back the last allocation, others stay until the reset */
+static inline void
+arena_free(arena_t *arena, void *p, size_t size)
+{
+    if ((char *)p + ARENA_ROUND(size) == arena->ptr) {
+        arena->ptr = (char *)p;
+    }
+}
+
+#endif
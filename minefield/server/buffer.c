@@ -1,45 +1,20 @@
 #include "buffer.h"
+#include "slab.h"
 
 #define LIMIT_MAX 1024 * 1024 * 1024
 
-#define MAXFREELIST 1024 * 16 * 2
-
-static buffer_t *buffer_free_list[MAXFREELIST];
-static int numfree = 0;
-
-void
-buffer_list_fill(void)
-{
-    buffer_t *buf;
-
-    while (numfree < MAXFREELIST) {
-        buf = (buffer_t*)PyMem_Malloc(sizeof(buffer_t));
-        buffer_free_list[numfree++] = buf;
-    }
-}
-
-void
-buffer_list_clear(void)
-{
-    buffer_t *op;
-
-    while (numfree) {
-        op = buffer_free_list[--numfree];
-        PyMem_Free(op);
-    }
-}
+uint64_t body_buffered = 0; //in-memory request bodies of all clients
 
 static buffer_t*
 alloc_buffer(void)
 {
     buffer_t *buf;
-    if (numfree) {
-        buf = buffer_free_list[--numfree];
-        //DEBUG("use pooled buf %p", buf);
-    }else{
-        buf = (buffer_t*)PyMem_Malloc(sizeof(buffer_t));
-        //DEBUG("alloc buf %p", buf);
+
+    buf = (buffer_t*)slab_alloc(SLAB_BUFFER);
+    if (buf == NULL) {
+        return NULL;
     }
+    //DEBUG("alloc buf %p", buf);
     memset(buf, 0, sizeof(buffer_t));
     return buf;
 }
@@ -47,12 +22,8 @@ alloc_buffer(void)
 static void
 dealloc_buffer(buffer_t *buf)
 {
-    if (numfree < MAXFREELIST){
-        //DEBUG("back to buffer pool %p", buf);
-        buffer_free_list[numfree++] = buf;
-    }else{
-        PyMem_Free(buf);
-    }
+    //DEBUG("back to buffer slab %p", buf);
+    slab_free(SLAB_BUFFER, buf);
 }
 
 /*
@@ -97,6 +68,9 @@ new_buffer(size_t buf_size, size_t limit)
     //buf = PyMem_Malloc(sizeof(buffer));
     //memset(buf, 0, sizeof(buffer));
     buf = alloc_buffer();
+    if (buf == NULL) {
+        return NULL;
+    }
 
     buf->buf = PyMem_Malloc(sizeof(char) * buf_size);
     buf->buf_size = buf_size;
@@ -109,6 +83,30 @@ new_buffer(size_t buf_size, size_t limit)
     return buf;
 }
 
+/*
+ * buffer of a request, the data stays in the arena until the request is
+ * freed.
+ */
+buffer_t*
+new_arena_buffer(arena_t *arena, size_t buf_size, size_t limit)
+{
+    buffer_t *buf;
+
+    buf = alloc_buffer();
+    if (buf == NULL) {
+        return NULL;
+    }
+    buf->buf = arena_alloc(arena, buf_size);
+    if (buf->buf == NULL) {
+        dealloc_buffer(buf);
+        return NULL;
+    }
+    buf->arena = arena;
+    buf->buf_size = buf_size;
+    buf->limit = limit ? limit : LIMIT_MAX;
+    return buf;
+}
+
 buffer_result
 write2buf(buffer_t *buf, const char *c, size_t  l) {
 
@@ -126,10 +124,19 @@ write2buf(buffer_t *buf, const char *c, size_t  l) {
         if(buf->buf_size > buf->limit){
             buf->buf_size = buf->limit + 1;
         }
-        newbuf = (char*)PyMem_Realloc(buf->buf, buf->buf_size);
+        if (buf->arena) {
+            newbuf = (char*)arena_alloc(buf->arena, buf->buf_size);
+            if (newbuf) {
+                memcpy(newbuf, buf->buf, buf->len);
+            }
+        } else {
+            newbuf = (char*)PyMem_Realloc(buf->buf, buf->buf_size);
+        }
         if (!newbuf) {
             PyErr_SetString(PyExc_MemoryError,"out of memory");
-            free(buf->buf);
+            if (buf->arena == NULL) {
+                PyMem_Free(buf->buf);
+            }
             buf->buf = 0;
             buf->buf_size = buf->len = 0;
             return MEMORY_ERROR;
@@ -148,7 +155,12 @@ write2buf(buffer_t *buf, const char *c, size_t  l) {
 void
 free_buffer(buffer_t *buf)
 {
-    PyMem_Free(buf->buf);
+    if (buf->arena == NULL) {
+        PyMem_Free(buf->buf);
+    }
+    if (buf->charged) {
+        COUNTER_SUB(body_buffered, buf->charged);
+    }
     //PyMem_Free(buf);
     dealloc_buffer(buf);
 }
@@ -2,6 +2,7 @@
 #define BUFFER_H
 
 #include "minefield.h"
+#include "arena.h"
 
 typedef enum{
     WRITE_OK,
@@ -14,10 +15,16 @@ typedef struct _buffer {
     size_t buf_size;
     size_t len;
     size_t limit;
+    arena_t *arena;             // buf is allocated from it
+    size_t charged;             // bytes counted in body_buffered
 } buffer_t;
 
+extern uint64_t body_buffered;
+
 buffer_t* new_buffer(size_t buf_size, size_t limit);
 
+buffer_t* new_arena_buffer(arena_t *arena, size_t buf_size, size_t limit);
+
 buffer_result write2buf(buffer_t *buf, const char *c, size_t  l);
 
 void free_buffer(buffer_t *buf);
@@ -25,8 +32,4 @@ void free_buffer(buffer_t *buf);
 PyObject* getPyString(buffer_t *buf);
 
 char* getString(buffer_t *buf);
-
-void buffer_list_fill(void);
-
-void buffer_list_clear(void);
 #endif
@@ -1,8 +1,8 @@
 #include "client.h"
 #define CLIENT_MAXFREELIST 1024
 
-static ClientObject *client_free_list[CLIENT_MAXFREELIST];
-static int client_numfree = 0;
+static THREAD_LOCAL ClientObject *client_free_list[CLIENT_MAXFREELIST];
+static THREAD_LOCAL int client_numfree = 0;
 
 void
 ClientObject_list_fill(void)
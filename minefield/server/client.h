@@ -6,7 +6,7 @@
 
 typedef struct _client {
     int fd;
-    char *remote_addr;
+    char remote_addr[INET6_ADDRSTRLEN];
     int remote_port;
 
     char keep_alive;
@@ -29,9 +29,33 @@ typedef struct _client {
     uint8_t content_length_set;     // content_length_set flag
     uint64_t content_length;         // content_length
     uint64_t write_bytes;            // send body length
-    void *bucket;               //write_data
+    void *bucket;               //write_data (output queue head)
+    void *bucket_tail;          //output queue tail
+    uint64_t buffered;          //queued but unsent bytes
     uint8_t response_closed;    //response closed flag
     uint8_t use_cork;     // use TCP_CORK
+    void *file_response;        // sendfile state (file_response_t)
+    uint8_t range_response;     // byte range response type
+    uint8_t wait_read;          // response waits for wait_fd readable
+    int wait_fd;
+    void *compress;             // response compression state (compress_t)
+    uint8_t content_encoding;   // response content coding
+    uint8_t vary_encoding;      // add Vary: Accept-Encoding
+    uint8_t seq_body;           // response is list or tuple
+    uint32_t body_items;        // unsent items of list or tuple response
+    uint8_t notsent_lowat;      // TCP_NOTSENT_LOWAT is set
+    uint8_t pipelining;         // run_pipeline is on the stack
+    uint8_t request_done;       // close_client finished current request
+    void *stream;               // stream response (StreamObject)
+    uint8_t stream_idle;        // stream waits for data, watching reads
+    void *continuation;         // continuation of the parked request
+    uint8_t parked;             // request is suspended
+    void *task;                 // coroutine of async application (task_t)
+    void *loop;                 // picoev_loop serving the client
+    uint64_t accept_usec;       // monotonic, until the first request starts
+    uint8_t read_paused;        // reads wait for the memory budget
+    void *paused_prev;          // paused list of the loop
+    void *paused_next;
 } client_t;
 
 typedef struct {
@@ -0,0 +1,310 @@
+#include "compress.h"
+
+int compress_level = 0;
+
+size_t compress_min_length = 256;
+
+static char *compress_types[MAX_COMPRESS_TYPES];
+static int compress_type_cnt = 0;
+
+static const char *default_types[] = {
+    "text/",
+    "application/json",
+    "application/javascript",
+    "application/xml",
+    "image/svg+xml",
+    NULL
+};
+
+const char *
+encoding_name(int encoding)
+{
+    switch (encoding) {
+        case ENCODING_GZIP:
+            return "gzip";
+        case ENCODING_DEFLATE:
+            return "deflate";
+        case ENCODING_BR:
+            return "br";
+        default:
+            return NULL;
+    }
+}
+
+/*
+ * select content coding from Accept-Encoding.
+ * highest q wins, br > gzip > deflate on tie.
+ */
+int
+select_encoding(const char *accept, int allow_br)
+{
+    const char *p = accept, *name, *end;
+    size_t namelen;
+    double q, best_q = 0;
+    int encoding, best = ENCODING_NONE;
+    static const int rank[] = {0, 2, 1, 3};
+    char *e;
+
+#ifndef HAVE_BROTLI
+    allow_br = 0;
+#endif
+    if (accept == NULL) {
+        return ENCODING_NONE;
+    }
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        name = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        namelen = p - name;
+        q = 1;
+        end = p;
+        while (*end && *end != ',') {
+            end++;
+        }
+        // ;q=0.5
+        while (p < end) {
+            if ((*p == 'q' || *p == 'Q') && p[1] == '=') {
+                q = strtod(p + 2, &e);
+                break;
+            }
+            p++;
+        }
+        p = end;
+
+        if (namelen == 4 && !strncasecmp(name, "gzip", 4)) {
+            encoding = ENCODING_GZIP;
+        } else if (namelen == 7 && !strncasecmp(name, "deflate", 7)) {
+            encoding = ENCODING_DEFLATE;
+        } else if (namelen == 2 && !strncasecmp(name, "br", 2) && allow_br) {
+            encoding = ENCODING_BR;
+        } else if (namelen == 1 && *name == '*') {
+            encoding = ENCODING_GZIP;
+        } else {
+            continue;
+        }
+        if (q <= 0) {
+            continue;
+        }
+        if (q > best_q || (q == best_q && rank[encoding] > rank[best])) {
+            best_q = q;
+            best = encoding;
+        }
+    }
+    return best;
+}
+
+int
+is_compressible_type(const char *ctype)
+{
+    const char **t;
+    int i;
+
+    if (ctype == NULL) {
+        return 0;
+    }
+    if (compress_type_cnt == 0) {
+        for (t = default_types; *t; t++) {
+            if (!strncasecmp(ctype, *t, strlen(*t))) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (i = 0; i < compress_type_cnt; i++) {
+        if (!strncasecmp(ctype, compress_types[i], strlen(compress_types[i]))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+compress_t *
+new_compress(int encoding)
+{
+    compress_t *c;
+    int ret;
+
+    c = PyMem_Malloc(sizeof(compress_t));
+    if (c == NULL) {
+        return NULL;
+    }
+    memset(c, 0, sizeof(compress_t));
+    c->encoding = encoding;
+
+#ifdef HAVE_BROTLI
+    if (encoding == ENCODING_BR) {
+        c->br = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+        if (c->br == NULL) {
+            PyMem_Free(c);
+            return NULL;
+        }
+        BrotliEncoderSetParameter(c->br, BROTLI_PARAM_QUALITY,
+                                  compress_level > BROTLI_MAX_QUALITY ? BROTLI_MAX_QUALITY : compress_level);
+        return c;
+    }
+#endif
+    // gzip wrapper or zlib wrapper for "deflate" (RFC 7230 4.2.2)
+    ret = deflateInit2(&c->zs, compress_level, Z_DEFLATED,
+                       encoding == ENCODING_GZIP ? MAX_WBITS + 16 : MAX_WBITS,
+                       8, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        PyMem_Free(c);
+        return NULL;
+    }
+    GDEBUG("alloc compress %p %s", c, encoding_name(encoding));
+    return c;
+}
+
+#ifdef HAVE_BROTLI
+static int
+brotli_write(compress_t *c, const char *data, size_t len, int flush, buffer_t *out)
+{
+    uint8_t tmp[COMPRESS_BUF_SIZE];
+    const uint8_t *next_in = (const uint8_t *)data;
+    size_t avail_in = len, avail_out;
+    uint8_t *next_out;
+    BrotliEncoderOperation op = BROTLI_OPERATION_PROCESS;
+
+    if (flush == COMPRESS_FLUSH) {
+        op = BROTLI_OPERATION_FLUSH;
+    } else if (flush == COMPRESS_FINISH) {
+        op = BROTLI_OPERATION_FINISH;
+    }
+    do {
+        next_out = tmp;
+        avail_out = sizeof(tmp);
+        if (!BrotliEncoderCompressStream(c->br, op, &avail_in, &next_in, &avail_out, &next_out, NULL)) {
+            return -1;
+        }
+        if (write2buf(out, (char *)tmp, sizeof(tmp) - avail_out) != WRITE_OK) {
+            return -1;
+        }
+    } while (avail_in || BrotliEncoderHasMoreOutput(c->br));
+    return 1;
+}
+#endif
+
+/*
+ * compress data and append output to out.
+ * COMPRESS_FLUSH emits everything so far (streaming responses),
+ * COMPRESS_FINISH ends the stream.
+ */
+int
+compress_write(compress_t *c, const char *data, size_t len, int flush, buffer_t *out)
+{
+    char tmp[COMPRESS_BUF_SIZE];
+    int mode = Z_NO_FLUSH, ret;
+
+#ifdef HAVE_BROTLI
+    if (c->encoding == ENCODING_BR) {
+        return brotli_write(c, data, len, flush, out);
+    }
+#endif
+    if (flush == COMPRESS_FLUSH) {
+        mode = Z_SYNC_FLUSH;
+    } else if (flush == COMPRESS_FINISH) {
+        mode = Z_FINISH;
+    }
+    c->zs.next_in = (Bytef *)data;
+    c->zs.avail_in = (uInt)len;
+    do {
+        c->zs.next_out = (Bytef *)tmp;
+        c->zs.avail_out = sizeof(tmp);
+        ret = deflate(&c->zs, mode);
+        if (ret == Z_STREAM_ERROR) {
+            return -1;
+        }
+        if (write2buf(out, tmp, sizeof(tmp) - c->zs.avail_out) != WRITE_OK) {
+            return -1;
+        }
+    } while (c->zs.avail_out == 0);
+    return 1;
+}
+
+void
+free_compress(compress_t *c)
+{
+    if (c == NULL) {
+        return;
+    }
+    GDEBUG("dealloc compress %p", c);
+#ifdef HAVE_BROTLI
+    if (c->br) {
+        BrotliEncoderDestroyInstance(c->br);
+        PyMem_Free(c);
+        return;
+    }
+#endif
+    deflateEnd(&c->zs);
+    PyMem_Free(c);
+}
+
+PyObject *
+set_compression(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    int level = 6, i;
+    Py_ssize_t min_length = 256, len;
+    PyObject *types = NULL, *fast = NULL, *bytes;
+    char *type;
+    static char *kwlist[] = {"level", "min_length", "types", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|inO:set_compression", kwlist, &level, &min_length, &types)) {
+        return NULL;
+    }
+    if (level < 0 || level > 9) {
+        PyErr_SetString(PyExc_ValueError, "level must be 0-9");
+        return NULL;
+    }
+    if (min_length < 0) {
+        PyErr_SetString(PyExc_ValueError, "min_length must be >= 0");
+        return NULL;
+    }
+    if (types != NULL && types != Py_None) {
+        fast = PySequence_Fast(types, "types must be a sequence of content types");
+        if (fast == NULL) {
+            return NULL;
+        }
+        if (PySequence_Fast_GET_SIZE(fast) > MAX_COMPRESS_TYPES) {
+            Py_DECREF(fast);
+            PyErr_Format(PyExc_ValueError, "too many types (max %d)", MAX_COMPRESS_TYPES);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < compress_type_cnt; i++) {
+        PyMem_Free(compress_types[i]);
+    }
+    compress_type_cnt = 0;
+    compress_level = level;
+    compress_min_length = min_length;
+
+    if (fast) {
+        len = PySequence_Fast_GET_SIZE(fast);
+        for (i = 0; i < len; i++) {
+#ifdef PY3
+            bytes = PyUnicode_AsLatin1String(PySequence_Fast_GET_ITEM(fast, i));
+#else
+            bytes = PyObject_Str(PySequence_Fast_GET_ITEM(fast, i));
+#endif
+            if (bytes == NULL) {
+                Py_DECREF(fast);
+                return NULL;
+            }
+            type = PyMem_Malloc(PyBytes_GET_SIZE(bytes) + 1);
+            if (type == NULL) {
+                Py_DECREF(bytes);
+                Py_DECREF(fast);
+                return PyErr_NoMemory();
+            }
+            strcpy(type, PyBytes_AS_STRING(bytes));
+            Py_DECREF(bytes);
+            compress_types[compress_type_cnt++] = type;
+        }
+        Py_DECREF(fast);
+    }
+    Py_RETURN_NONE;
+}
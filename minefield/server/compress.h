@@ -0,0 +1,51 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "minefield.h"
+#include "client.h"
+#include "buffer.h"
+
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#define ENCODING_NONE 0
+#define ENCODING_GZIP 1
+#define ENCODING_DEFLATE 2
+#define ENCODING_BR 3
+
+#define COMPRESS_NO_FLUSH 0
+#define COMPRESS_FLUSH 1
+#define COMPRESS_FINISH 2
+
+#define MAX_COMPRESS_TYPES 16
+#define COMPRESS_BUF_SIZE 16384
+
+typedef struct {
+    uint8_t encoding;
+    z_stream zs;
+#ifdef HAVE_BROTLI
+    BrotliEncoderState *br;
+#endif
+} compress_t;
+
+extern int compress_level;
+
+extern size_t compress_min_length;
+
+int select_encoding(const char *accept, int allow_br);
+
+int is_compressible_type(const char *ctype);
+
+const char* encoding_name(int encoding);
+
+compress_t* new_compress(int encoding);
+
+int compress_write(compress_t *c, const char *data, size_t len, int flush, buffer_t *out);
+
+void free_compress(compress_t *c);
+
+PyObject* set_compression(PyObject *self, PyObject *args, PyObject *kwds);
+
+#endif
@@ -0,0 +1,232 @@
+#include "continuation.h"
+#include "server.h"
+
+/*
+ * suspend/resume without greenlet.
+ * after c.suspend() the application returns and the request is parked in
+ * the loop. c.resume() or the timeout calls the application again with the
+ * same environ, c.resumed / c.expired tell which one happened.
+ */
+
+#define CONTINUATION_MAXFREELIST 1024
+
+static THREAD_LOCAL ContinuationObject *continuation_free_list[CONTINUATION_MAXFREELIST];
+static THREAD_LOCAL int continuation_numfree = 0;
+
+void
+ContinuationObject_list_fill(void)
+{
+    ContinuationObject *c;
+    while (continuation_numfree < CONTINUATION_MAXFREELIST) {
+        c = PyObject_NEW(ContinuationObject, &ContinuationObjectType);
+        continuation_free_list[continuation_numfree++] = c;
+    }
+}
+
+void
+ContinuationObject_list_clear(void)
+{
+    ContinuationObject *op;
+
+    while (continuation_numfree) {
+        op = continuation_free_list[--continuation_numfree];
+        PyObject_DEL(op);
+    }
+}
+
+static ContinuationObject*
+alloc_ContinuationObject(void)
+{
+    ContinuationObject *c;
+    if (continuation_numfree) {
+        c = continuation_free_list[--continuation_numfree];
+        _Py_NewReference((PyObject *)c);
+        GDEBUG("use pooled %p", c);
+    }else{
+        c = PyObject_NEW(ContinuationObject, &ContinuationObjectType);
+        GDEBUG("alloc %p", c);
+    }
+    return c;
+}
+
+PyObject*
+ContinuationObject_New(client_t *client)
+{
+    ContinuationObject *c = alloc_ContinuationObject();
+    if (c == NULL) {
+        return NULL;
+    }
+    c->client = client;
+    c->timeout = 0;
+    c->suspended = 0;
+    c->resumed = 0;
+    c->expired = 0;
+    return (PyObject *)c;
+}
+
+/*
+ * the continuation of the request, created when the application first
+ * asks for it and kept in the environ for the next calls.
+ */
+PyObject *
+get_continuation(PyObject *self, PyObject *args)
+{
+    PyObject *environ, *pyclient, *c;
+    client_t *client;
+
+    if (!PyArg_ParseTuple(args, "O!:get_continuation", &PyDict_Type, &environ)) {
+        return NULL;
+    }
+    pyclient = PyDict_GetItemString(environ, "minefield.client");
+    if (pyclient == NULL || !CheckClientObject(pyclient)) {
+        PyErr_SetString(PyExc_ValueError, "environ is not a minefield request");
+        return NULL;
+    }
+    client = ((ClientObject *)pyclient)->client;
+    if (client->current_req == NULL) {
+        PyErr_SetString(PyExc_IOError, "request is already finished");
+        return NULL;
+    }
+    // the server looks it up in the environ of the request, not a copy
+    environ = client->current_req->environ;
+    c = PyDict_GetItemString(environ, "minefield.continuation");
+    if (c != NULL) {
+        Py_INCREF(c);
+        return c;
+    }
+    c = ContinuationObject_New(client);
+    if (c == NULL) {
+        return NULL;
+    }
+    if (PyDict_SetItemString(environ, "minefield.continuation", c) == -1) {
+        Py_DECREF(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void
+ContinuationObject_dealloc(ContinuationObject *self)
+{
+    if (continuation_numfree < CONTINUATION_MAXFREELIST){
+        continuation_free_list[continuation_numfree++] = self;
+        GDEBUG("back to pool %p", self);
+    }else{
+        PyObject_DEL(self);
+    }
+}
+
+static PyObject *
+ContinuationObject_suspend(ContinuationObject *self, PyObject *args)
+{
+    int timeout = 0;
+
+    if (!PyArg_ParseTuple(args, "|i:suspend", &timeout)) {
+        return NULL;
+    }
+    if (self->client == NULL) {
+        PyErr_SetString(PyExc_IOError, "request is already finished");
+        return NULL;
+    }
+    if (self->suspended) {
+        PyErr_SetString(PyExc_IOError, "request is already suspended");
+        return NULL;
+    }
+    if (timeout < 0) {
+        PyErr_SetString(PyExc_ValueError, "timeout value out of range ");
+        return NULL;
+    }
+    self->timeout = timeout;
+    self->suspended = 1;
+    self->resumed = 0;
+    self->expired = 0;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+ContinuationObject_resume(ContinuationObject *self, PyObject *args)
+{
+    if (self->client == NULL || !self->suspended || self->resumed) {
+        Py_RETURN_FALSE;
+    }
+    self->resumed = 1;
+    wake_continuation(self->client);
+    Py_RETURN_TRUE;
+}
+
+static PyObject *
+ContinuationObject_get_suspended(ContinuationObject *self, void *closure)
+{
+    return PyBool_FromLong(self->suspended);
+}
+
+static PyObject *
+ContinuationObject_get_resumed(ContinuationObject *self, void *closure)
+{
+    return PyBool_FromLong(self->resumed);
+}
+
+static PyObject *
+ContinuationObject_get_expired(ContinuationObject *self, void *closure)
+{
+    return PyBool_FromLong(self->expired);
+}
+
+static PyMethodDef ContinuationObject_method[] = {
+    {"suspend", (PyCFunction)ContinuationObject_suspend, METH_VARARGS, "park the request when the application returns"},
+    {"resume", (PyCFunction)ContinuationObject_resume, METH_VARARGS, "call the application again for a suspended request"},
+    { NULL, NULL}
+};
+
+static PyGetSetDef ContinuationObject_getset[] = {
+    {"suspended", (getter)ContinuationObject_get_suspended, NULL, "request is parked", NULL},
+    {"resumed", (getter)ContinuationObject_get_resumed, NULL, "request was resumed", NULL},
+    {"expired", (getter)ContinuationObject_get_expired, NULL, "suspend timed out", NULL},
+    { NULL }
+};
+
+PyTypeObject ContinuationObjectType = {
+#ifdef PY3
+    PyVarObject_HEAD_INIT(NULL, 0)
+#else
+    PyObject_HEAD_INIT(NULL)
+    0,                    /* ob_size */
+#endif
+    "minefield.continuation",             /*tp_name*/
+    sizeof(ContinuationObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)ContinuationObject_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "continuation",            /* tp_doc */
+    0,                       /* tp_traverse */
+    0,                       /* tp_clear */
+    0,                       /* tp_richcompare */
+    0,                       /* tp_weaklistoffset */
+    0,                       /* tp_iter */
+    0,                       /* tp_iternext */
+    ContinuationObject_method,  /* tp_methods */
+    0,                         /* tp_members */
+    ContinuationObject_getset, /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                      /* tp_init */
+    0,                         /* tp_alloc */
+    0,                           /* tp_new */
+};
@@ -0,0 +1,26 @@
+#ifndef CONTINUATION_H
+#define CONTINUATION_H
+
+#include "minefield.h"
+#include "client.h"
+
+typedef struct {
+    PyObject_HEAD
+    client_t *client;           // NULL once the request is finished
+    int timeout;                // suspend timeout sec, 0 is no timeout
+    uint8_t suspended;
+    uint8_t resumed;
+    uint8_t expired;
+} ContinuationObject;
+
+extern PyTypeObject ContinuationObjectType;
+
+PyObject* ContinuationObject_New(client_t *client);
+
+PyObject* get_continuation(PyObject *self, PyObject *args);
+
+void ContinuationObject_list_fill(void);
+
+void ContinuationObject_list_clear(void);
+
+#endif
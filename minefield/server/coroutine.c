@@ -0,0 +1,197 @@
+#include "coroutine.h"
+#include "server.h"
+
+#ifdef PY3
+
+/*
+ * futures awaited by async applications.
+ * a future yields itself to the driver in server.c, which registers a
+ * timer or the fd on the loop and resumes the coroutine when it fires.
+ * futures are one-shot, awaiting after completion returns immediately.
+ * asyncio futures (of minefield.loop) are waited through a FUTURE_ASYNCIO
+ * future set as their done callback.
+ */
+
+PyObject*
+FutureObject_New(uint8_t kind, int fd, long msec, int timeout)
+{
+    FutureObject *f = PyObject_NEW(FutureObject, &FutureObjectType);
+    if (f == NULL) {
+        return NULL;
+    }
+    f->kind = kind;
+    f->fd = fd;
+    f->msec = msec;
+    f->timeout = timeout;
+    f->armed = 0;
+    f->done = 0;
+    f->timedout = 0;
+    f->client = NULL;
+    f->timer = NULL;
+    f->waited = NULL;
+    GDEBUG("alloc FutureObject %p", f);
+    return (PyObject *)f;
+}
+
+PyObject*
+get_await_iter(PyObject *awaitable)
+{
+    PyObject *iter;
+
+    iter = Py_TYPE(awaitable)->tp_as_async->am_await(awaitable);
+    if (iter == NULL) {
+        return NULL;
+    }
+    if (!PyIter_Check(iter)) {
+        PyErr_Format(PyExc_TypeError, "__await__() returned non-iterator of type '%.100s'",
+                     Py_TYPE(iter)->tp_name);
+        Py_DECREF(iter);
+        return NULL;
+    }
+    return iter;
+}
+
+PyObject *
+future_sleep(PyObject *self, PyObject *args)
+{
+    double seconds;
+
+    if (!PyArg_ParseTuple(args, "d:sleep", &seconds)) {
+        return NULL;
+    }
+    if (seconds < 0) {
+        PyErr_SetString(PyExc_ValueError, "seconds value out of range ");
+        return NULL;
+    }
+    return FutureObject_New(FUTURE_SLEEP, -1, (long)(seconds * 1000 + 0.5), 0);
+}
+
+static PyObject *
+new_fd_future(PyObject *args, uint8_t kind, const char *format)
+{
+    PyObject *fileobj;
+    int fd, timeout = 0;
+
+    if (!PyArg_ParseTuple(args, format, &fileobj, &timeout)) {
+        return NULL;
+    }
+    fd = PyObject_AsFileDescriptor(fileobj);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (timeout < 0) {
+        PyErr_SetString(PyExc_ValueError, "timeout value out of range ");
+        return NULL;
+    }
+    return FutureObject_New(kind, fd, 0, timeout);
+}
+
+PyObject *
+future_wait_readable(PyObject *self, PyObject *args)
+{
+    return new_fd_future(args, FUTURE_READ, "O|i:wait_readable");
+}
+
+PyObject *
+future_wait_writable(PyObject *self, PyObject *args)
+{
+    return new_fd_future(args, FUTURE_WRITE, "O|i:wait_writable");
+}
+
+static void
+FutureObject_dealloc(FutureObject *self)
+{
+    GDEBUG("dealloc FutureObject %p", self);
+    Py_XDECREF(self->timer);
+    Py_XDECREF(self->waited);
+    PyObject_DEL(self);
+}
+
+static PyObject *
+FutureObject_await(FutureObject *self)
+{
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *
+FutureObject_iternext(FutureObject *self)
+{
+    if (!self->done) {
+        // hand over to the driver
+        Py_INCREF(self);
+        return (PyObject *)self;
+    }
+    if (self->timedout) {
+        PyErr_SetString(timeout_error, "wait timed out");
+    }
+    return NULL;
+}
+
+/* called by the sleep timer or as done callback of the asyncio future */
+static PyObject *
+FutureObject_call(FutureObject *self, PyObject *args, PyObject *kwargs)
+{
+    fire_future(self, 0);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+FutureObject_get_done(FutureObject *self, void *closure)
+{
+    return PyBool_FromLong(self->done);
+}
+
+static PyGetSetDef FutureObject_getset[] = {
+    {"done", (getter)FutureObject_get_done, NULL, "future is completed", NULL},
+    { NULL }
+};
+
+static PyAsyncMethods FutureObject_as_async = {
+    (unaryfunc)FutureObject_await,  /* am_await */
+    0,                              /* am_aiter */
+    0,                              /* am_anext */
+};
+
+PyTypeObject FutureObjectType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "minefield.future",             /*tp_name*/
+    sizeof(FutureObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)FutureObject_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    &FutureObject_as_async,    /*tp_as_async*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    (ternaryfunc)FutureObject_call, /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "future",                  /* tp_doc */
+    0,                       /* tp_traverse */
+    0,                       /* tp_clear */
+    0,                       /* tp_richcompare */
+    0,                       /* tp_weaklistoffset */
+    PyObject_SelfIter,       /* tp_iter */
+    (iternextfunc)FutureObject_iternext, /* tp_iternext */
+    0,                         /* tp_methods */
+    0,                         /* tp_members */
+    FutureObject_getset,       /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                      /* tp_init */
+    0,                         /* tp_alloc */
+    0,                           /* tp_new */
+};
+
+#endif
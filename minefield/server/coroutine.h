@@ -0,0 +1,53 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include "minefield.h"
+#include "client.h"
+
+#ifdef PY3
+
+#define FUTURE_SLEEP 0
+#define FUTURE_READ 1
+#define FUTURE_WRITE 2
+#define FUTURE_ASYNCIO 3
+
+typedef struct {
+    PyObject_HEAD
+    uint8_t kind;
+    int fd;                     // waited fd of FUTURE_READ / FUTURE_WRITE
+    long msec;                  // sleep time
+    int timeout;                // fd wait timeout sec, 0 is no timeout
+    uint8_t armed;              // timer or fd is registered
+    uint8_t done;
+    uint8_t timedout;
+    client_t *client;           // waiting request, NULL when not awaited
+    PyObject *timer;            // sleep timer
+    PyObject *waited;           // asyncio future of FUTURE_ASYNCIO
+} FutureObject;
+
+typedef struct {
+    PyObject *coro;             // awaitable being driven (its __await__ iterator)
+    PyObject *aiter;            // async iterator of the response body
+    FutureObject *future;       // future the coroutine waits for
+    uint8_t paused;             // body waits for the output queue to drain
+} task_t;
+
+extern PyTypeObject FutureObjectType;
+
+#define is_awaitable(o) (Py_TYPE(o)->tp_as_async != NULL && Py_TYPE(o)->tp_as_async->am_await != NULL)
+
+#define is_async_iterator(o) (Py_TYPE(o)->tp_as_async != NULL && Py_TYPE(o)->tp_as_async->am_anext != NULL)
+
+PyObject* FutureObject_New(uint8_t kind, int fd, long msec, int timeout);
+
+PyObject* get_await_iter(PyObject *awaitable);
+
+PyObject* future_sleep(PyObject *self, PyObject *args);
+
+PyObject* future_wait_readable(PyObject *self, PyObject *args);
+
+PyObject* future_wait_writable(PyObject *self, PyObject *args);
+
+#endif
+
+#endif
@@ -45,7 +45,7 @@ _siftdown(heapq_t *q, uint32_t startpos, uint32_t pos)
     while(likely(pos > startpos)){
         parentpos = (pos - 1) >> 1;
         parent = p[parentpos];
-        if(newitem->seconds < parent->seconds){
+        if(newitem->msec < parent->msec){
             p[pos] = parent;
             pos = parentpos;
         }else{
@@ -70,7 +70,7 @@ _siftup(heapq_t *q, uint32_t pos)
     while(likely(childpos < size)){
         rightpos = childpos + 1;
         childpositem = p[childpos];
-        if(rightpos < size && childpositem->seconds > p[rightpos]->seconds){
+        if(rightpos < size && childpositem->msec > p[rightpos]->msec){
             childpos = rightpos;
             childpositem = p[childpos];
         }
@@ -3,8 +3,10 @@
 #include "response.h"
 #include "input.h"
 #include "util.h"
-
-#define MAXFREELIST 1024
+#include "probes.h"
+#include "trace.h"
+#include "slab.h"
+#include "memory.h"
 
 /**
  * environ spec.
@@ -114,42 +116,16 @@ static PyObject *http_method_mkactivity;
 static PyObject *http_method_checkout;
 static PyObject *http_method_merge;
 
-static http_parser *http_parser_free_list[MAXFREELIST];
-static int numfree = 0;
-
-void
-parser_list_fill(void)
-{
-    http_parser *p;
-
-    while (numfree < MAXFREELIST) {
-        p = (http_parser*)PyMem_Malloc(sizeof(http_parser));
-        http_parser_free_list[numfree++] = p;
-    }
-}
-
-void
-parser_list_clear(void)
-{
-    http_parser *p;
-
-    while (numfree) {
-        p = http_parser_free_list[--numfree];
-        PyMem_Free(p);
-    }
-}
-
 static http_parser*
 alloc_parser(void)
 {
     http_parser *p;
-    if (numfree) {
-        p = http_parser_free_list[--numfree];
-        GDEBUG("use pooled %p", p);
-    }else{
-        p = (http_parser*)PyMem_Malloc(sizeof(http_parser));
-        GDEBUG("alloc %p", p);
+
+    p = (http_parser*)slab_alloc(SLAB_PARSER);
+    if (p == NULL) {
+        return NULL;
     }
+    GDEBUG("alloc %p", p);
     memset(p, 0, sizeof(http_parser));
     return p;
 }
@@ -157,12 +133,8 @@ alloc_parser(void)
 void
 dealloc_parser(http_parser *p)
 {
-    if (numfree < MAXFREELIST){
-        http_parser_free_list[numfree++] = p;
-        GDEBUG("back to pool %p", p);
-    }else{
-        PyMem_Free(p);
-    }
+    GDEBUG("back to slab %p", p);
+    slab_free(SLAB_PARSER, p);
 }
 
 PyObject*
@@ -435,6 +407,9 @@ write_body2mem(request *req, const char *buf, size_t buf_len)
 {
     buffer_t *body = (buffer_t*)req->body;
     write2buf(body, buf, buf_len);
+    // memory budget, counted as it arrives
+    body->charged += buf_len;
+    COUNTER_ADD(body_buffered, buf_len);
 
     req->body_readed += buf_len;
     DEBUG("write_body2mem %d bytes", (int)buf_len);
@@ -479,6 +454,9 @@ message_begin_cb(http_parser *p)
         return -1;
     }
     req->start_msec = current_msec;
+    req->timing[TIMING_FIRST_BYTE] = monotonic_usec();
+    req->timing[TIMING_ACCEPT] = client->accept_usec;
+    client->accept_usec = 0;
     client->current_req = req;
     environ = new_environ(client);
     client->complete = 0;
@@ -488,6 +466,8 @@ message_begin_cb(http_parser *p)
     /* client->body_length = 0; */
     req->environ = environ;
     push_request(client->request_queue, client->current_req);
+    TRACE_REQUEST_BEGIN(req);
+    PROBE2(request_begin, client->fd, req);
     return 0;
 }
 
@@ -586,8 +566,10 @@ url_cb(http_parser *p, const char *buf, size_t len)
     if(unlikely(req->path)){
         ret = write2buf(req->path, buf, len);
     }else{
-        req->path = new_buffer(1024, LIMIT_PATH);
-        ret = write2buf(req->path, buf, len);
+        req->path = new_arena_buffer(&req->arena, 1024, LIMIT_PATH);
+        if(likely(req->path)){
+            ret = write2buf(req->path, buf, len);
+        }
     }
     switch(ret){
         case MEMORY_ERROR:
@@ -609,6 +591,7 @@ static int
 body_cb(http_parser *p, const char *buf, size_t len)
 {
     request *req = get_current_request(p);
+    buffer_t *body;
     DEBUG("body_cb");
 
     if(max_content_length < req->body_readed + len){
@@ -623,10 +606,10 @@ body_cb(http_parser *p, const char *buf, size_t len)
             req->bad_request_code = 411;
             return -1;
         }
-        if(req->body_length > client_body_buffer_size){
-            //large size request
+        if(req->body_length > client_body_buffer_size || memory_spill_body(req->body_length)){
+            //large size request or over the memory budget
             FILE *tmp = tmpfile();
-            if(tmp < 0){
+            if(tmp == NULL){
                 req->bad_request_code = 500;
                 return -1;
             }
@@ -637,7 +620,12 @@ body_cb(http_parser *p, const char *buf, size_t len)
         }else{
             //default memory stream
             DEBUG("client->body_length %d", req->body_length);
-            req->body = new_buffer(req->body_length, 0);
+            body = new_buffer(req->body_length, 0);
+            if(body == NULL){
+                req->bad_request_code = 500;
+                return -1;
+            }
+            req->body = body;
             req->body_type = BODY_TYPE_BUFFER;
             DEBUG("BODY_TYPE_BUFFER");
         }
@@ -681,9 +669,12 @@ headers_complete_cb(http_parser *p)
         return -1;
     }
 
+    PROBE4(headers_complete, client->fd, http_method_str(p->method),
+            req->path ? req->path->buf : "", req->path ? req->path->len : 0);
     if(likely(req->path)){
         ret = set_path(env, req->path->buf, req->path->len);
         free_buffer(req->path);
+        req->path = NULL;
         if(unlikely(ret == -1)){
            //TODO Error 
            return -1;
@@ -728,6 +719,8 @@ headers_complete_cb(http_parser *p)
         return -1;
     }
 
+    req->method = p->method;
+    req->timing[TIMING_HEADERS] = monotonic_usec();
     switch(p->method){
         case HTTP_DELETE:
             obj = http_method_delete;
@@ -801,6 +794,17 @@ headers_complete_cb(http_parser *p)
     req->body_length = content_length;
     /* client->current_req = NULL; */
 
+    if(p->http_major == 1 && p->http_minor == 1){
+        char *expect = get_environ_value(env, "HTTP_EXPECT", NULL);
+        if(expect){
+            if(strcasecmp(expect, "100-continue")){
+                req->bad_request_code = 417;
+                return -1;
+            }
+            req->expect_continue = content_length > 0 || (p->flags & F_CHUNKED);
+        }
+    }
+
     //keep client data
     obj = ClientObject_New(client);
     if(unlikely(obj == NULL)){
@@ -822,6 +826,9 @@ message_complete_cb(http_parser *p)
     client_t *client = get_client(p);
     DEBUG("message_complete_cb");
     client->complete = 1;
+    if (client->current_req) {
+        client->current_req->timing[TIMING_BODY] = monotonic_usec();
+    }
     client->upgrade = p->upgrade;
 
     /* request *req = client->request_queue->tail; */
@@ -842,7 +849,7 @@ static http_parser_settings settings =
   };
 
 
-static PyMethodDef method = {"file_wrapper", (PyCFunction)file_wrapper, METH_VARARGS, 0};
+static PyMethodDef method = {"file_wrapper", (PyCFunction)file_wrapper, METH_VARARGS|METH_KEYWORDS, 0};
 
 int
 init_parser(client_t *cli, const char *name, const short port)
@@ -2,8 +2,8 @@
 
 #define IO_MAXFREELIST 1024
 
-static InputObject *io_free_list[IO_MAXFREELIST];
-static int io_numfree = 0;
+static THREAD_LOCAL InputObject *io_free_list[IO_MAXFREELIST];
+static THREAD_LOCAL int io_numfree = 0;
 
 void
 InputObject_list_fill(void)
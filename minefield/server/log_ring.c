@@ -0,0 +1,187 @@
+#include "log_ring.h"
+#include "time_cache.h"
+#include "util.h"
+#include <arpa/inet.h>
+#include <sys/mman.h>
+
+/*
+ * binary access log of server.set_log_ring().
+ * a completed request is one fixed-size record in a mmap'd file ring
+ * (/dev/shm for shared memory), external readers tail it without
+ * touching the worker. writers reserve a position with an atomic add,
+ * a record is valid when its seq is the position + 1.
+ */
+
+log_ring_header *log_ring = NULL;
+
+static log_record *records;
+static size_t map_size = 0;
+static int ring_used = 0;       // by server.run(), loop threads write to it
+
+static uint64_t
+hash_path(const char *s, Py_ssize_t len)
+{
+    // FNV-1a 64
+    uint64_t h = 14695981039346656037ULL;
+
+    while (len--) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t
+environ_path_hash(PyObject *environ)
+{
+    PyObject *o;
+    const char *s = NULL;
+    Py_ssize_t len = 0;
+
+    if (environ == NULL || (o = PyDict_GetItemString(environ, "PATH_INFO")) == NULL) {
+        return 0;
+    }
+#ifdef PY3
+    if (PyUnicode_Check(o)) {
+        if (PyUnicode_KIND(o) == PyUnicode_1BYTE_KIND) {
+            s = (const char *)PyUnicode_DATA(o);
+            len = PyUnicode_GET_LENGTH(o);
+        } else if ((s = PyUnicode_AsUTF8AndSize(o, &len)) == NULL) {
+            PyErr_Clear();
+            return 0;
+        }
+    }
+#endif
+    if (PyBytes_Check(o)) {
+        s = PyBytes_AS_STRING(o);
+        len = PyBytes_GET_SIZE(o);
+    }
+    return s ? hash_path(s, len) : 0;
+}
+
+void
+write_log_record(client_t *client, request *req)
+{
+    log_record *rec;
+    uint64_t pos;
+
+    pos = __atomic_fetch_add(&log_ring->head, 1, __ATOMIC_RELAXED);
+    rec = records + pos % log_ring->capacity;
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    rec->end_msec = current_msec;
+    rec->bytes = client->write_bytes;
+    rec->status = client->status_code;
+    if (req) {
+        rec->start_msec = req->start_msec ? req->start_msec : current_msec;
+        rec->method = req->method;
+        rec->path_hash = environ_path_hash(req->environ);
+    } else {
+        rec->start_msec = current_msec;
+        rec->method = LOG_METHOD_NONE;
+        rec->path_hash = 0;
+    }
+    rec->family = AF_INET;
+    rec->port = client->remote_port;
+    rec->reserved = 0;
+    memset(rec->addr, 0, sizeof(rec->addr));
+    inet_pton(AF_INET, client->remote_addr, rec->addr);
+
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * the loops of server.run() write records, the ring stays mapped until
+ * log_ring_stop().
+ */
+void
+log_ring_start(void)
+{
+    ring_used = 1;
+}
+
+void
+log_ring_stop(void)
+{
+    ring_used = 0;
+}
+
+static void
+unmap_ring(void)
+{
+    if (log_ring != NULL) {
+        munmap(log_ring, map_size);
+        log_ring = NULL;
+        records = NULL;
+        map_size = 0;
+    }
+}
+
+PyObject *
+set_log_ring(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *path, *bytes;
+    Py_ssize_t capacity = LOG_RING_RECORDS;
+    log_ring_header *header;
+    size_t size;
+    void *map;
+    int fd;
+    static char *kwlist[] = {"path", "records", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|n:set_log_ring", kwlist, &path, &capacity)) {
+        return NULL;
+    }
+    if (ring_used) {
+        PyErr_SetString(PyExc_RuntimeError, "log ring is used by the running server");
+        return NULL;
+    }
+    if (path == Py_None) {
+        unmap_ring();
+        Py_RETURN_NONE;
+    }
+    if (capacity < 1 || capacity > LOG_RING_MAX_RECORDS) {
+        PyErr_SetString(PyExc_ValueError, "records value out of range ");
+        return NULL;
+    }
+    bytes = pid_path(path);
+    if (bytes == NULL) {
+        return NULL;
+    }
+
+    size = sizeof(log_ring_header) + sizeof(log_record) * capacity;
+    fd = open(PyBytes_AS_STRING(bytes), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, PyBytes_AS_STRING(bytes));
+        Py_DECREF(bytes);
+        return NULL;
+    }
+    if (ftruncate(fd, size) == -1) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, PyBytes_AS_STRING(bytes));
+        close(fd);
+        Py_DECREF(bytes);
+        return NULL;
+    }
+    Py_DECREF(bytes);
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return PyErr_SetFromErrno(PyExc_IOError);
+    }
+
+    header = (log_ring_header *)map;
+    header->version = LOG_RING_VERSION;
+    header->record_size = sizeof(log_record);
+    header->capacity = capacity;
+    header->head = 0;
+    header->pid = getpid();
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    // readers wait for the magic
+    memcpy(header->magic, LOG_RING_MAGIC, sizeof(header->magic));
+
+    unmap_ring();
+    records = (log_record *)(header + 1);
+    map_size = size;
+    log_ring = header;
+    Py_RETURN_NONE;
+}
@@ -0,0 +1,51 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include "minefield.h"
+#include "client.h"
+
+#define LOG_RING_MAGIC "MFLRING1"
+#define LOG_RING_VERSION 1
+#define LOG_RING_RECORDS 65536
+#define LOG_RING_MAX_RECORDS 1024 * 1024 * 64
+#define LOG_METHOD_NONE 255
+
+/*
+ * shared memory layout, read by minefield/logring.py.
+ * integers are native endian, the file is the header and capacity records.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity;          // records
+    uint64_t head;              // records reserved by the writers
+    uint32_t pid;
+    uint8_t reserved[28];
+} log_ring_header;              // 64 bytes
+
+typedef struct {
+    uint64_t seq;               // position + 1 when complete, 0 while written
+    uint64_t start_msec;        // unix time of the request start
+    uint64_t end_msec;
+    uint64_t bytes;             // body bytes sent
+    uint64_t path_hash;         // FNV-1a 64 of PATH_INFO
+    uint16_t status;
+    uint8_t method;             // enum http_method, LOG_METHOD_NONE without request
+    uint8_t family;             // AF_INET
+    uint16_t port;
+    uint16_t reserved;
+    uint8_t addr[16];           // network order
+} log_record;                   // 64 bytes
+
+extern log_ring_header *log_ring;
+
+void write_log_record(client_t *client, request *req);
+
+void log_ring_start(void);
+
+void log_ring_stop(void);
+
+PyObject* set_log_ring(PyObject *self, PyObject *args, PyObject *kwds);
+
+#endif
@@ -0,0 +1,208 @@
+#include "memory.h"
+
+/*
+ * worker memory budget of server.set_memory_budget().
+ * it covers the in-memory request bodies, counted as the bytes arrive,
+ * and the queued output. a new body goes to a tmpfile when it would not
+ * fit whole. over the budget streaming responses stop pulling data and
+ * the uploads into memory stop being read, except the one of the loop
+ * closest to its end, so that one finishes and frees its body. once it
+ * is done the paused upload with the fewest bytes left takes over, all
+ * of them are resumed when the usage drops. paused connections keep
+ * their read timeout.
+ */
+
+uint64_t memory_budget = 0;
+
+static uint64_t spilled_bodies = 0;
+static uint64_t paused_reads = 0;
+static uint64_t paused_now = 0;
+
+static THREAD_LOCAL client_t *paused_head = NULL;
+static THREAD_LOCAL client_t *runner = NULL;   // upload still read over the budget
+
+// resume below 7/8 of the budget, not to pause again at once
+#define RESUME_LEVEL(b) ((b) - (b) / 8)
+// recheck of the paused reads in msec, other loops free the memory too
+#define RESUME_WAIT 100
+
+static int
+uploading(client_t *client)
+{
+    request *req = client->current_req;
+
+    return req != NULL && req->body_type == BODY_TYPE_BUFFER && req->body_readed < req->body_length;
+}
+
+static uint64_t
+remaining(client_t *client)
+{
+    request *req = client->current_req;
+
+    return req->body_length - req->body_readed;
+}
+
+/*
+ * the body of length does not fit in the budget, count it as spilled.
+ */
+int
+memory_spill_body(uint64_t length)
+{
+    if (!memory_over_budget(length)) {
+        return 0;
+    }
+    COUNTER_ADD(spilled_bodies, 1);
+    return 1;
+}
+
+static void
+pause_read(picoev_loop *loop, client_t *client)
+{
+    DEBUG("pause reads fd:%d", client->fd);
+    picoev_set_events(loop, client->fd, 0);
+    client->read_paused = 1;
+    client->paused_prev = NULL;
+    client->paused_next = paused_head;
+    if (paused_head) {
+        paused_head->paused_prev = client;
+    }
+    paused_head = client;
+    COUNTER_ADD(paused_reads, 1);
+    COUNTER_ADD(paused_now, 1);
+}
+
+static void
+resume_read(picoev_loop *loop, client_t *client)
+{
+    DEBUG("resume reads fd:%d", client->fd);
+    memory_unpause(client);
+    picoev_set_events(loop, client->fd, PICOEV_READ);
+}
+
+/*
+ * pause the reads of the client over the budget, return 1 when paused.
+ */
+int
+memory_pause_read(picoev_loop *loop, client_t *client)
+{
+    if (!memory_over_budget(0) || !uploading(client) || remaining(client) < MEMORY_PAUSE_MIN) {
+        return 0;
+    }
+    if (runner != NULL && !uploading(runner)) {
+        runner = NULL;
+    }
+    if (runner == NULL || runner == client) {
+        runner = client;
+        return 0;
+    }
+    if (remaining(client) < remaining(runner)) {
+        pause_read(loop, runner);
+        runner = client;
+        return 0;
+    }
+    pause_read(loop, client);
+    return 1;
+}
+
+void
+memory_unpause(client_t *client)
+{
+    client_t *prev = client->paused_prev, *next = client->paused_next;
+
+    if (prev) {
+        prev->paused_next = next;
+    } else {
+        paused_head = next;
+    }
+    if (next) {
+        next->paused_prev = prev;
+    }
+    client->paused_prev = client->paused_next = NULL;
+    client->read_paused = 0;
+    COUNTER_SUB(paused_now, 1);
+}
+
+/* the client is freed */
+void
+memory_release_client(client_t *client)
+{
+    if (client->read_paused) {
+        memory_unpause(client);
+    }
+    if (runner == client) {
+        runner = NULL;
+    }
+}
+
+/* called by the loops each turn */
+void
+memory_resume_reads(picoev_loop *loop)
+{
+    client_t *client, *next = NULL;
+
+    if (likely(paused_head == NULL)) {
+        return;
+    }
+    if (memory_budget == 0 || body_buffered + total_buffered <= RESUME_LEVEL(memory_budget)) {
+        while (paused_head != NULL) {
+            resume_read(loop, paused_head);
+        }
+        runner = NULL;
+        return;
+    }
+    if (runner != NULL && uploading(runner)) {
+        return;
+    }
+    // hand over to the upload closest to its end
+    for (client = paused_head; client; client = client->paused_next) {
+        if (next == NULL || remaining(client) < remaining(next)) {
+            next = client;
+        }
+    }
+    resume_read(loop, next);
+    runner = next;
+}
+
+/* msec until the paused reads are checked, -1 without them */
+int
+memory_resume_wait(void)
+{
+    return paused_head ? RESUME_WAIT : -1;
+}
+
+PyObject *
+set_memory_budget(PyObject *self, PyObject *args)
+{
+    long long temp;
+
+    if (!PyArg_ParseTuple(args, "L", &temp)) {
+        return NULL;
+    }
+    if (temp < 0) {
+        PyErr_SetString(PyExc_ValueError, "memory budget value out of range ");
+        return NULL;
+    }
+    memory_budget = (uint64_t)temp;
+    Py_RETURN_NONE;
+}
+
+PyObject *
+get_memory_budget(PyObject *self, PyObject *args)
+{
+    return Py_BuildValue("K", (unsigned PY_LONG_LONG)memory_budget);
+}
+
+PyObject *
+memory_usage(PyObject *self, PyObject *args)
+{
+    uint64_t bodies = body_buffered, output = total_buffered;
+
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+            "bodies", (unsigned PY_LONG_LONG)bodies,
+            "output", (unsigned PY_LONG_LONG)output,
+            "total", (unsigned PY_LONG_LONG)(bodies + output),
+            "budget", (unsigned PY_LONG_LONG)memory_budget,
+            "spilled", (unsigned PY_LONG_LONG)spilled_bodies,
+            "paused", (unsigned PY_LONG_LONG)paused_now,
+            "pauses", (unsigned PY_LONG_LONG)paused_reads);
+}
@@ -0,0 +1,38 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "minefield.h"
+#include "picoev.h"
+#include "client.h"
+#include "response.h"
+
+// uploads with less left are not paused
+#define MEMORY_PAUSE_MIN (64 * 1024)
+
+extern uint64_t memory_budget;
+
+static inline int
+memory_over_budget(uint64_t extra)
+{
+    return memory_budget != 0 && body_buffered + total_buffered + extra > memory_budget;
+}
+
+int memory_spill_body(uint64_t length);
+
+int memory_pause_read(picoev_loop *loop, client_t *client);
+
+void memory_unpause(client_t *client);
+
+void memory_release_client(client_t *client);
+
+void memory_resume_reads(picoev_loop *loop);
+
+int memory_resume_wait(void);
+
+PyObject* set_memory_budget(PyObject *self, PyObject *args);
+
+PyObject* get_memory_budget(PyObject *self, PyObject *args);
+
+PyObject* memory_usage(PyObject *self, PyObject *args);
+
+#endif
@@ -16,9 +16,8 @@
 
 #ifdef linux
 #include <sys/sendfile.h>
-#elif defined(__APPLE__) || defined(__FreeBSD__)
-#include <sys/uio.h>
 #endif
+#include <sys/uio.h>
 
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -78,6 +77,30 @@
 #define YDEBUG(...) do{}while(0)
 #endif
 
+/* state of the loop thread, each server loop runs in its own thread */
+#define THREAD_LOCAL __thread
+
+/* shared caches, the GIL guards them on default builds */
+#ifdef Py_GIL_DISABLED
+#include <pthread.h>
+# define DECLARE_CACHE_LOCK static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER
+# define CACHE_LOCK() pthread_mutex_lock(&cache_lock)
+# define CACHE_UNLOCK() pthread_mutex_unlock(&cache_lock)
+#else
+# define DECLARE_CACHE_LOCK
+# define CACHE_LOCK() do{}while(0)
+# define CACHE_UNLOCK() do{}while(0)
+#endif
+
+/* process-wide counters updated by every loop */
+#ifdef Py_GIL_DISABLED
+# define COUNTER_ADD(v, n) __atomic_fetch_add(&(v), (n), __ATOMIC_RELAXED)
+# define COUNTER_SUB(v, n) __atomic_fetch_sub(&(v), (n), __ATOMIC_RELAXED)
+#else
+# define COUNTER_ADD(v, n) ((v) += (n))
+# define COUNTER_SUB(v, n) ((v) -= (n))
+#endif
+
 #if __GNUC__ >= 3
 # define likely(x)    __builtin_expect(!!(x), 1)
 # define unlikely(x)    __builtin_expect(!!(x), 0)
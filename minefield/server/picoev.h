@@ -43,6 +43,7 @@ extern "C" {
 #include <stdlib.h>
 #include <string.h>
 #include "time_cache.h"
+#include "stall.h"
 
 #define PICOEV_IS_INITED (picoev.max_fd != 0)  
 #define PICOEV_IS_INITED_AND_FD_IN_RANGE(fd) \
@@ -126,7 +127,7 @@ extern "C" {
   int picoev_update_events_internal(picoev_loop* loop, int fd, int events);
   
   /* internal: poll once and call the handlers (defined by each backend) */
-  int picoev_poll_once_internal(picoev_loop* loop, int max_wait);
+  int picoev_poll_once_internal(picoev_loop* loop, int max_wait_msec);
   
   /* internal, aligned allocator with address scrambling to avoid cache
      line contention */
@@ -368,8 +369,10 @@ extern "C" {
 		if (v < 0) {
 		  picoev_fd* fd = picoev.fds + k;
 		  assert(fd->loop_id == loop->loop_id);
+		  uint64_t stall = stall_begin();
 		  fd->timeout_idx = PICOEV_TIMEOUT_IDX_UNUSED;
 		  (*fd->callback)(loop, k, PICOEV_TIMEOUT, fd->cb_arg);
+		  STALL_END(stall, STALL_TIMEOUT, NULL);
 		}
 	      }
 	      vec[j] = 0;
@@ -381,13 +384,13 @@ extern "C" {
     }
   }
   
-  /* loop once */
+  /* loop once, max_wait is in milliseconds */
   PICOEV_INLINE
-  int picoev_loop_once(picoev_loop* loop, int max_wait) {
-    if (max_wait > loop->timeout.resolution) {
-      max_wait = loop->timeout.resolution;
+  int picoev_loop_once(picoev_loop* loop, int max_wait_msec) {
+    if (max_wait_msec > loop->timeout.resolution * 1000) {
+      max_wait_msec = loop->timeout.resolution * 1000;
     }
-    if ( unlikely(picoev_poll_once_internal(loop, max_wait) != 0) ) {
+    if ( unlikely(picoev_poll_once_internal(loop, max_wait_msec) != 0) ) {
       return -1;
     }
     loop->now = current_msec / 1000;
@@ -136,7 +136,7 @@ int picoev_update_events_internal(picoev_loop* _loop, int fd, int events)
   return 0;
 }
 
-int picoev_poll_once_internal(picoev_loop* _loop, int max_wait)
+int picoev_poll_once_internal(picoev_loop* _loop, int max_wait_msec)
 {
   picoev_loop_epoll* loop = (picoev_loop_epoll*)_loop;
   int i, nevents;
@@ -144,7 +144,7 @@ int picoev_poll_once_internal(picoev_loop* _loop, int max_wait)
   Py_BEGIN_ALLOW_THREADS
   nevents = epoll_wait(loop->epfd, loop->events,
 		       sizeof(loop->events) / sizeof(loop->events[0]),
-		       max_wait * 1000);
+		       max_wait_msec);
   Py_END_ALLOW_THREADS
   cache_time_update();
 
@@ -156,8 +156,14 @@ int picoev_poll_once_internal(picoev_loop* _loop, int max_wait)
     picoev_fd* target = picoev.fds + event->data.fd;
     if (loop->loop.loop_id == target->loop_id && likely((target->events & PICOEV_READWRITE) != 0)) {
       int revents = ((event->events & EPOLLIN) != 0 ? PICOEV_READ : 0) | ((event->events & EPOLLOUT) != 0 ? PICOEV_WRITE : 0);
+      if (unlikely((event->events & (EPOLLHUP | EPOLLERR)) != 0)) {
+        /* closed pipe reports only HUP, let the callback see EOF */
+        revents |= target->events & PICOEV_READWRITE;
+      }
       if (likely(revents != 0)) {
+        uint64_t stall = stall_begin();
         (*target->callback)(&loop->loop, event->data.fd, revents, target->cb_arg);
+        STALL_END(stall, STALL_IO, NULL);
       }
     } else {
 #if PICOEV_EPOLL_DEFER_DELETES
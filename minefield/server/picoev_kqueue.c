@@ -166,7 +166,7 @@ int picoev_update_events_internal(picoev_loop* _loop, int fd, int events)
   return 0;
 }
 
-int picoev_poll_once_internal(picoev_loop* _loop, int max_wait)
+int picoev_poll_once_internal(picoev_loop* _loop, int max_wait_msec)
 {
   picoev_loop_kqueue* loop = (picoev_loop_kqueue*)_loop;
   struct timespec ts;
@@ -175,8 +175,8 @@ int picoev_poll_once_internal(picoev_loop* _loop, int max_wait)
   /* apply pending changes, with last changes stored to loop->changelist */
   cl_off = apply_pending_changes(loop, 0);
   
-  ts.tv_sec = max_wait;
-  ts.tv_nsec = 0;
+  ts.tv_sec = max_wait_msec / 1000;
+  ts.tv_nsec = (max_wait_msec % 1000) * 1000000;
 
   Py_BEGIN_ALLOW_THREADS
   nevents = kevent(loop->kq, loop->changelist, cl_off, loop->events,
@@ -196,6 +196,7 @@ int picoev_poll_once_internal(picoev_loop* _loop, int max_wait)
     if (loop->loop.loop_id == target->loop_id
 	&& (event->filter & (EVFILT_READ | EVFILT_WRITE)) != 0) {
       int revents;
+      uint64_t stall;
       switch (event->filter) {
       case EVFILT_READ:
 	revents = PICOEV_READ;
@@ -208,7 +209,9 @@ int picoev_poll_once_internal(picoev_loop* _loop, int max_wait)
 	revents = 0; // suppress compiler warning
 	break;
       }
+      stall = stall_begin();
       (*target->callback)(&loop->loop, event->ident, revents, target->cb_arg);
+      STALL_END(stall, STALL_IO, NULL);
     }
   }
   
@@ -119,7 +119,7 @@ int picoev_update_events_internal(picoev_loop* loop, int fd, int events)
   return 0;
 }
 
-int picoev_poll_once_internal(picoev_loop* loop, int max_wait)
+int picoev_poll_once_internal(picoev_loop* loop, int max_wait_msec)
 {
   fd_set readfds, writefds, errorfds;
   struct timeval tv;
@@ -148,8 +148,8 @@ int picoev_poll_once_internal(picoev_loop* loop, int max_wait)
   }
   
   /* select and handle if any */
-  tv.tv_sec = max_wait;
-  tv.tv_usec = 0;
+  tv.tv_sec = max_wait_msec / 1000;
+  tv.tv_usec = (max_wait_msec % 1000) * 1000;
 
   Py_BEGIN_ALLOW_THREADS
   r = select(maxfd + 1, &readfds, &writefds, &errorfds, &tv);
@@ -165,7 +165,9 @@ int picoev_poll_once_internal(picoev_loop* loop, int max_wait)
 	int revents = (PICOEV_FD_ISSET(i, &readfds) ? PICOEV_READ : 0)
 	  | (PICOEV_FD_ISSET(i, &writefds) ? PICOEV_WRITE : 0);
 	if (revents != 0) {
+	  uint64_t stall = stall_begin();
 	  (*target->callback)(loop, i, revents, target->cb_arg);
+	  STALL_END(stall, STALL_IO, NULL);
 	}
       }
     }
@@ -0,0 +1,256 @@
+#include "pool.h"
+#include "util.h"
+#include <pthread.h>
+#include <signal.h>
+
+/*
+ * worker threads of server.set_threads().
+ * the loop thread submits application calls, a worker runs the call with
+ * the GIL and queues the job as done, the loop is woken by the notify fd
+ * (eventfd, a pipe elsewhere) and finishes the response itself.
+ * workers keep their thread state and only hold the GIL while calling.
+ */
+
+int pool_running = 0;
+
+static THREAD_LOCAL pool_job_t *current_job = NULL; // called by the worker
+
+static pthread_t *threads = NULL;
+static int thread_cnt = 0;
+static int stopping = 0;
+
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static pool_job_t *jobs_head = NULL;
+static pool_job_t *jobs_tail = NULL;
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pool_job_t *done_head = NULL;
+static pool_job_t *done_tail = NULL;
+
+static int notify_fd = -1;
+static int notify_wfd = -1;
+
+static void
+push_job(pool_job_t **head, pool_job_t **tail, pool_job_t *job)
+{
+    job->next = NULL;
+    if (*tail) {
+        (*tail)->next = job;
+    } else {
+        *head = job;
+    }
+    *tail = job;
+}
+
+static pool_job_t*
+pop_job(pool_job_t **head, pool_job_t **tail)
+{
+    pool_job_t *job = *head;
+
+    if (job) {
+        *head = job->next;
+        if (*head == NULL) {
+            *tail = NULL;
+        }
+        job->next = NULL;
+    }
+    return job;
+}
+
+static void*
+worker_main(void *arg)
+{
+    PyGILState_STATE gstate;
+    PyThreadState *save;
+    pool_job_t *job;
+    sigset_t set;
+
+    // signals go to the loop thread
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    gstate = PyGILState_Ensure();
+    save = PyEval_SaveThread();
+    while (1) {
+        pthread_mutex_lock(&job_lock);
+        while (jobs_head == NULL && !stopping) {
+            pthread_cond_wait(&job_cond, &job_lock);
+        }
+        job = pop_job(&jobs_head, &jobs_tail);
+        pthread_mutex_unlock(&job_lock);
+        if (job == NULL) {
+            break;
+        }
+
+        PyEval_RestoreThread(save);
+        job->start_usec = monotonic_usec();
+        current_job = job;
+        job->result = PyObject_CallObject(job->callable, job->args);
+        current_job = NULL;
+        job->end_usec = monotonic_usec();
+        if (job->result == NULL) {
+            PyErr_Fetch(&job->exc_type, &job->exc_value, &job->exc_tb);
+        }
+        save = PyEval_SaveThread();
+
+        pthread_mutex_lock(&done_lock);
+        push_job(&done_head, &done_tail, job);
+        pthread_mutex_unlock(&done_lock);
+        pool_wake();
+    }
+    PyEval_RestoreThread(save);
+    PyGILState_Release(gstate);
+    return NULL;
+}
+
+/*
+ * start the worker threads, called with the GIL on the loop thread.
+ */
+int
+start_pool(int cnt)
+{
+    int i, ret;
+
+    if (pool_running || cnt <= 0) {
+        return 0;
+    }
+#if PY_VERSION_HEX < 0x03070000
+    PyEval_InitThreads();
+#endif
+    if (open_notify_fd(&notify_fd, &notify_wfd) == -1) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+    threads = PyMem_Malloc(sizeof(pthread_t) * cnt);
+    if (threads == NULL) {
+        close_notify_fd(notify_fd, notify_wfd);
+        notify_fd = notify_wfd = -1;
+        PyErr_NoMemory();
+        return -1;
+    }
+    stopping = 0;
+    pool_running = 1;
+    for (i = 0; i < cnt; i++) {
+        ret = pthread_create(&threads[i], NULL, worker_main, NULL);
+        if (ret != 0) {
+            stop_pool();
+            errno = ret;
+            PyErr_SetFromErrno(PyExc_IOError);
+            return -1;
+        }
+        thread_cnt++;
+    }
+    DEBUG("start %d worker threads", thread_cnt);
+    return 0;
+}
+
+/*
+ * join the worker threads, queued jobs are run first.
+ */
+void
+stop_pool(void)
+{
+    int i;
+
+    if (!pool_running) {
+        return;
+    }
+    pthread_mutex_lock(&job_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&job_cond);
+    pthread_mutex_unlock(&job_lock);
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < thread_cnt; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    Py_END_ALLOW_THREADS
+
+    PyMem_Free(threads);
+    threads = NULL;
+    thread_cnt = 0;
+    pool_running = 0;
+    close_notify_fd(notify_fd, notify_wfd);
+    notify_fd = notify_wfd = -1;
+}
+
+/*
+ * queue callable(*args) to the workers, the references are stolen.
+ */
+int
+pool_submit(void *arg, PyObject *callable, PyObject *args)
+{
+    pool_job_t *job;
+
+    job = PyMem_Malloc(sizeof(pool_job_t));
+    if (job == NULL) {
+        Py_DECREF(callable);
+        Py_DECREF(args);
+        PyErr_NoMemory();
+        return -1;
+    }
+    memset(job, 0, sizeof(pool_job_t));
+    job->arg = arg;
+    job->callable = callable;
+    job->args = args;
+
+    pthread_mutex_lock(&job_lock);
+    push_job(&jobs_head, &jobs_tail, job);
+    pthread_cond_signal(&job_cond);
+    pthread_mutex_unlock(&job_lock);
+    return 0;
+}
+
+/*
+ * when the worker thread started the call of arg, 0 on other threads.
+ */
+uint64_t
+pool_call_start(void *arg)
+{
+    if (current_job == NULL || current_job->arg != arg) {
+        return 0;
+    }
+    return current_job->start_usec;
+}
+
+pool_job_t*
+pool_next_done(void)
+{
+    pool_job_t *job;
+
+    pthread_mutex_lock(&done_lock);
+    job = pop_job(&done_head, &done_tail);
+    pthread_mutex_unlock(&done_lock);
+    return job;
+}
+
+void
+free_pool_job(pool_job_t *job)
+{
+    Py_XDECREF(job->callable);
+    Py_XDECREF(job->args);
+    Py_XDECREF(job->result);
+    Py_XDECREF(job->exc_type);
+    Py_XDECREF(job->exc_value);
+    Py_XDECREF(job->exc_tb);
+    PyMem_Free(job);
+}
+
+int
+pool_notify_fd(void)
+{
+    return notify_fd;
+}
+
+void
+pool_drain_notify(void)
+{
+    drain_notify_fd(notify_fd);
+}
+
+void
+pool_wake(void)
+{
+    write_notify_fd(notify_wfd);
+}
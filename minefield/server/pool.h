@@ -0,0 +1,41 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "minefield.h"
+
+#define MAX_POOL_THREADS 1024
+
+typedef struct pool_job {
+    void *arg;                  // owner data, a ClientObject
+    PyObject *callable;
+    PyObject *args;
+    PyObject *result;           // NULL when the call raised
+    PyObject *exc_type;
+    PyObject *exc_value;
+    PyObject *exc_tb;
+    uint64_t start_usec;        // the call on the worker, monotonic
+    uint64_t end_usec;
+    struct pool_job *next;
+} pool_job_t;
+
+extern int pool_running;
+
+int start_pool(int threads);
+
+void stop_pool(void);
+
+int pool_submit(void *arg, PyObject *callable, PyObject *args);
+
+pool_job_t* pool_next_done(void);
+
+void free_pool_job(pool_job_t *job);
+
+uint64_t pool_call_start(void *arg);
+
+int pool_notify_fd(void);
+
+void pool_drain_notify(void);
+
+void pool_wake(void);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * USDT probes of the "minefield" provider for bpftrace, perf and SystemTap.
+ * with <sys/sdt.h> (systemtap-sdt-dev) each probe is a nop and an ELF note,
+ * without it they are not compiled. arguments:
+ *
+ *   accept(fd, remote_addr, remote_port)
+ *   request_begin(fd, request)
+ *   headers_complete(fd, method, url, url_len)   url is not terminated
+ *   app_call(fd, request)
+ *   app_return(fd, request, error)
+ *   write(fd, bytes)                             -1 on error
+ *   sendfile(fd, bytes)                          -1 on error
+ *   timeout(fd, kind)                            0 read, 1 write
+ *   request_end(fd, request, status, body_bytes)
+ *   close(fd)
+ */
+
+#ifdef HAVE_SYS_SDT
+#include <sys/sdt.h>
+
+#define PROBE1(name, a) DTRACE_PROBE1(minefield, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(minefield, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(minefield, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(minefield, name, a, b, c, d)
+#else
+#define PROBE1(name, a) do{}while(0)
+#define PROBE2(name, a, b) do{}while(0)
+#define PROBE3(name, a, b, c) do{}while(0)
+#define PROBE4(name, a, b, c, d) do{}while(0)
+#endif
+
+#endif
@@ -1,58 +1,38 @@
 #include "request.h"
 #include "client.h"
-
-/* use free_list */
-#define REQUEST_MAXFREELIST 1024
-#define HEADER_MAXFREELIST 1024 * 16
-
-static request *request_free_list[REQUEST_MAXFREELIST];
-static int request_numfree = 0;
-
-void
-request_list_fill(void)
-{
-    request *req;
-    while (request_numfree < REQUEST_MAXFREELIST) {
-        req = (request *)PyMem_Malloc(sizeof(request));
-        request_free_list[request_numfree++] = req;
-    }
-}
-
-void
-request_list_clear(void)
-{
-    request *op;
-
-    while (request_numfree) {
-        op = request_free_list[--request_numfree];
-        PyMem_Free(op);
-    }
-}
+#include "slab.h"
+#include "pool.h"
 
 static request*
 alloc_request(void)
 {
     request *req;
-    if (request_numfree) {
-        req = request_free_list[--request_numfree];
-        GDEBUG("use pooled req %p", req);
-    }else{
-        req = (request *)PyMem_Malloc(sizeof(request));
-        GDEBUG("alloc req %p", req);
+
+    req = (request *)slab_alloc(SLAB_REQUEST);
+    if (req == NULL) {
+        return NULL;
     }
+    GDEBUG("alloc req %p", req);
     memset(req, 0, sizeof(request));
     return req;
 }
 
+static const char *timing_names[TIMING_COUNT] = {
+    "accept",
+    "first_byte",
+    "headers",
+    "body",
+    "app_start",
+    "app_end",
+    "first_write",
+    "last_write",
+};
+
 void
 dealloc_request(request *req)
 {
-    if (request_numfree < REQUEST_MAXFREELIST){
-        GDEBUG("back to request pool %p", req);
-        request_free_list[request_numfree++] = req;
-    }else{
-        PyMem_Free(req);
-    }
+    GDEBUG("back to request slab %p", req);
+    slab_free(SLAB_REQUEST, req);
 }
 
 
@@ -119,7 +99,6 @@ new_request(void)
 {
     request *req = alloc_request();
     //request *req = (request *)PyMem_Malloc(sizeof(request));
-    memset(req, 0, sizeof(request));
     return req;
 }
 
@@ -127,10 +106,282 @@ new_request(void)
 void
 free_request(request *req)
 {
-    Py_XDECREF(req->path);
+    if (req->path) {
+        free_buffer(req->path);
+    }
     Py_XDECREF(req->field);
     Py_XDECREF(req->value);
+    arena_reset(&req->arena);
+    if (req->timing_obj) {
+        // keep the timestamps for the environ
+        TimingObject *timing = (TimingObject *)req->timing_obj;
+        memcpy(timing->timing, req->timing, sizeof(req->timing));
+        timing->req = NULL;
+    }
     dealloc_request(req);
     //PyMem_Free(req);
 }
 
+/*
+ * environ["minefield.timing"], a read-only mapping of the timestamps of the
+ * request in seconds of time.monotonic(), None when the request did not get
+ * there. values are read from the request when asked, floats are only made
+ * for the keys that are read.
+ */
+
+PyObject *
+new_timing(request *req, void *owner)
+{
+    TimingObject *timing;
+
+    timing = PyObject_NEW(TimingObject, &TimingObjectType);
+    if (timing == NULL) {
+        return NULL;
+    }
+    timing->req = req;
+    timing->owner = owner;
+    req->timing_obj = (PyObject *)timing;
+    GDEBUG("alloc TimingObject %p", timing);
+    return (PyObject *)timing;
+}
+
+static int
+timing_index(PyObject *key)
+{
+    const char *name;
+    int i;
+
+    if (!PyUnicode_Check(key)) {
+        return -1;
+    }
+    name = PyUnicode_AsUTF8(key);
+    if (name == NULL) {
+        PyErr_Clear();
+        return -1;
+    }
+    for (i = 0; i < TIMING_COUNT; i++) {
+        if (strcmp(name, timing_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static PyObject *
+timing_value(TimingObject *self, int i)
+{
+    uint64_t usec = 0;
+
+    if (i == TIMING_APP_START) {
+        // the call of a worker thread, recorded when it returns
+        usec = pool_call_start(self->owner);
+    }
+    if (usec == 0) {
+        usec = self->req ? self->req->timing[i] : self->timing[i];
+    }
+    if (usec == 0) {
+        Py_RETURN_NONE;
+    }
+    return PyFloat_FromDouble(usec / 1000000.0);
+}
+
+static PyObject *
+timing_items(TimingObject *self, int what)
+{
+    PyObject *list, *item;
+    int i;
+
+    list = PyList_New(TIMING_COUNT);
+    if (list == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < TIMING_COUNT; i++) {
+        if (what == 0) {
+            item = NATIVE_FROMSTRING(timing_names[i]);
+        } else if (what == 1) {
+            item = timing_value(self, i);
+        } else {
+            item = Py_BuildValue("(sN)", timing_names[i], timing_value(self, i));
+        }
+        if (item == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+static Py_ssize_t
+TimingObject_length(TimingObject *self)
+{
+    return TIMING_COUNT;
+}
+
+static PyObject *
+TimingObject_subscript(TimingObject *self, PyObject *key)
+{
+    int i = timing_index(key);
+
+    if (i < 0) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    return timing_value(self, i);
+}
+
+static int
+TimingObject_contains(TimingObject *self, PyObject *key)
+{
+    return timing_index(key) >= 0;
+}
+
+static PyObject *
+TimingObject_iter(TimingObject *self)
+{
+    PyObject *keys, *iter;
+
+    keys = timing_items(self, 0);
+    if (keys == NULL) {
+        return NULL;
+    }
+    iter = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iter;
+}
+
+static PyObject *
+TimingObject_keys(TimingObject *self, PyObject *args)
+{
+    return timing_items(self, 0);
+}
+
+static PyObject *
+TimingObject_values(TimingObject *self, PyObject *args)
+{
+    return timing_items(self, 1);
+}
+
+static PyObject *
+TimingObject_items(TimingObject *self, PyObject *args)
+{
+    return timing_items(self, 2);
+}
+
+static PyObject *
+TimingObject_get(TimingObject *self, PyObject *args)
+{
+    PyObject *key, *def = Py_None;
+    int i;
+
+    if (!PyArg_ParseTuple(args, "O|O:get", &key, &def)) {
+        return NULL;
+    }
+    i = timing_index(key);
+    if (i < 0) {
+        Py_INCREF(def);
+        return def;
+    }
+    return timing_value(self, i);
+}
+
+static PyObject *
+TimingObject_copy(TimingObject *self, PyObject *args)
+{
+    PyObject *dict, *items;
+
+    dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
+    items = timing_items(self, 2);
+    if (items == NULL || PyDict_MergeFromSeq2(dict, items, 1) == -1) {
+        Py_XDECREF(items);
+        Py_DECREF(dict);
+        return NULL;
+    }
+    Py_DECREF(items);
+    return dict;
+}
+
+static void
+TimingObject_dealloc(TimingObject *self)
+{
+    GDEBUG("dealloc TimingObject %p", self);
+    if (self->req) {
+        self->req->timing_obj = NULL;
+    }
+    PyObject_DEL(self);
+}
+
+static PyMappingMethods TimingObject_as_mapping = {
+    (lenfunc)TimingObject_length,           /* mp_length */
+    (binaryfunc)TimingObject_subscript,     /* mp_subscript */
+    0,                                      /* mp_ass_subscript */
+};
+
+static PySequenceMethods TimingObject_as_sequence = {
+    0,                                      /* sq_length */
+    0,                                      /* sq_concat */
+    0,                                      /* sq_repeat */
+    0,                                      /* sq_item */
+    0,                                      /* sq_slice */
+    0,                                      /* sq_ass_item */
+    0,                                      /* sq_ass_slice */
+    (objobjproc)TimingObject_contains,      /* sq_contains */
+};
+
+static PyMethodDef TimingObject_method[] = {
+    {"keys", (PyCFunction)TimingObject_keys, METH_NOARGS, "names of the timestamps"},
+    {"values", (PyCFunction)TimingObject_values, METH_NOARGS, "timestamps"},
+    {"items", (PyCFunction)TimingObject_items, METH_NOARGS, "(name, timestamp) pairs"},
+    {"get", (PyCFunction)TimingObject_get, METH_VARARGS, "timestamp of the name or default"},
+    {"copy", (PyCFunction)TimingObject_copy, METH_NOARGS, "timestamps as a dict"},
+    { NULL, NULL}
+};
+
+PyTypeObject TimingObjectType = {
+#ifdef PY3
+    PyVarObject_HEAD_INIT(NULL, 0)
+#else
+    PyObject_HEAD_INIT(NULL)
+    0,                    /* ob_size */
+#endif
+    "minefield.timing",             /*tp_name*/
+    sizeof(TimingObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)TimingObject_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &TimingObject_as_sequence, /*tp_as_sequence*/
+    &TimingObject_as_mapping,  /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "request timestamps",      /* tp_doc */
+    0,                       /* tp_traverse */
+    0,                       /* tp_clear */
+    0,                       /* tp_richcompare */
+    0,                       /* tp_weaklistoffset */
+    (getiterfunc)TimingObject_iter, /* tp_iter */
+    0,                       /* tp_iternext */
+    TimingObject_method,       /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                      /* tp_init */
+    0,                         /* tp_alloc */
+    0,                           /* tp_new */
+};
@@ -3,6 +3,7 @@
 
 #include "minefield.h"
 #include "buffer.h"
+#include "arena.h"
 
 #define LIMIT_PATH 1024 * 8
 #define LIMIT_FRAGMENT 1024
@@ -24,6 +25,19 @@ typedef enum {
     VALUE,
 } field_type;
 
+/* monotonic microseconds of a request, 0 when it did not happen */
+typedef enum {
+    TIMING_ACCEPT,              // connection accepted, first request only
+    TIMING_FIRST_BYTE,
+    TIMING_HEADERS,
+    TIMING_BODY,
+    TIMING_APP_START,
+    TIMING_APP_END,
+    TIMING_FIRST_WRITE,
+    TIMING_LAST_WRITE,
+    TIMING_COUNT
+} request_timing;
+
 typedef struct {
     buffer_t *path;
     uint32_t num_headers;
@@ -34,12 +48,18 @@ typedef struct {
     int body_length;
     int body_readed;
     int bad_request_code;
+    uint8_t expect_continue;    // send 100 Continue before reading the body
     void *body;
     request_body_type body_type;
     
     PyObject *field;
     PyObject *value;
     uintptr_t start_msec;
+    uint64_t timing[TIMING_COUNT];
+    uint8_t method;             // enum http_method
+    uint64_t trace_id;          // sampled by server.set_trace(), 0 otherwise
+    arena_t arena;              // path and response buckets, freed with the request
+    PyObject *timing_obj;       // environ["minefield.timing"], not owned
 
 } request;
 
@@ -64,8 +84,15 @@ void free_request(request *req);
 
 void dealloc_request(request *req);
 
-void request_list_fill(void);
+typedef struct {
+    PyObject_HEAD
+    request *req;               // NULL once the request is freed
+    void *owner;                // ClientObject of the call, see pool_call_start()
+    uint64_t timing[TIMING_COUNT]; // copy of the freed request
+} TimingObject;
+
+extern PyTypeObject TimingObjectType;
 
-void request_list_clear(void);
+PyObject* new_timing(request *req, void *owner);
 
 #endif
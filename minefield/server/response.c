@@ -2,16 +2,35 @@
 #include "log.h"
 #include "util.h"
 #include "minefield.h"
+#include "server.h"
+#include "static_file.h"
+#include "response_cache.h"
+#include "compress.h"
+#include "stream.h"
+#include "probes.h"
+#include "trace.h"
+#include "memory.h"
+#include <ctype.h>
+#include <limits.h>
+#include <poll.h>
 
 #define CRLF "\r\n"
 #define DELIM ": "
 
+#define DEFAULT_BLKSIZE 8192
+
 #define H_MSG_500 "HTTP/1.0 500 Internal Server Error\r\nContent-Type: text/html\r\nServer:  " SERVER "\r\n\r\n"
 
 #define H_MSG_503 "HTTP/1.0 503 Service Unavailable\r\nContent-Type: text/html\r\nServer: " SERVER "\r\n\r\n"
 
 #define H_MSG_400 "HTTP/1.0 400 Bad Request\r\nContent-Type: text/html\r\nServer: " SERVER "\r\n\r\n"
 
+#define H_MSG_403 "HTTP/1.0 403 Forbidden\r\nContent-Type: text/html\r\nServer: " SERVER "\r\n\r\n"
+
+#define H_MSG_404 "HTTP/1.0 404 Not Found\r\nContent-Type: text/html\r\nServer: " SERVER "\r\n\r\n"
+
+#define H_MSG_405 "HTTP/1.0 405 Method Not Allowed\r\nContent-Type: text/html\r\nAllow: GET, HEAD\r\nServer: " SERVER "\r\n\r\n"
+
 #define H_MSG_408 "HTTP/1.0 408 Request Timeout\r\nContent-Type: text/html\r\nServer: " SERVER "\r\n\r\n"
 
 #define H_MSG_411 "HTTP/1.0 411 Length Required\r\nContent-Type: text/html\r\nServer: " SERVER "\r\n\r\n"
@@ -27,6 +46,12 @@
 
 #define MSG_400 H_MSG_400 "<html><head><title>Bad Request</title></head><body><p>Bad Request.</p></body></html>"
 
+#define MSG_403 H_MSG_403 "<html><head><title>Forbidden</title></head><body><p>Forbidden.</p></body></html>"
+
+#define MSG_404 H_MSG_404 "<html><head><title>Not Found</title></head><body><p>Not Found.</p></body></html>"
+
+#define MSG_405 H_MSG_405 "<html><head><title>Method Not Allowed</title></head><body><p>Method Not Allowed.</p></body></html>"
+
 #define MSG_408 H_MSG_408 "<html><head><title>Request Timeout</title></head><body><p>Request Timeout.</p></body></html>"
 
 #define MSG_411 H_MSG_411 "<html><head><title>Length Required</title></head><body><p>Length Required.</p></body></html>"
@@ -35,7 +60,15 @@
 
 #define MSG_417 H_MSG_417 "<html><head><title>Expectation Failed</title></head><body><p>Expectation Failed.</p></body></html>"
 
-ResponseObject *start_response = NULL;
+THREAD_LOCAL ResponseObject *start_response = NULL;
+
+static HeaderBlockObject *default_headers = NULL;
+
+static THREAD_LOCAL uint32_t boundary_seq = 0;
+
+uint64_t total_buffered = 0; //queued output of all clients
+
+static PyObject* create_status(PyObject *bytes, int bytelen, int http_minor);
 
 static PyObject*
 wsgi_to_bytes(PyObject *value)
@@ -70,126 +103,32 @@ wsgi_to_bytes(PyObject *value)
     return result;
 }
 
-static int
-blocking_write(client_t *client, char *data, size_t len)
-{
-    size_t r = 0, send_len = len;
-    while ( (int)len > 0 ){
-        if (len < send_len){
-             send_len = len;
-        }
-        Py_BEGIN_ALLOW_THREADS
-        r = write(client->fd, data, send_len);
-        Py_END_ALLOW_THREADS
-        switch(r){
-            case 0:
-                return 1;
-                break;
-            case -1:
-                if (errno == EAGAIN || errno == EWOULDBLOCK) { /* try again later */
-                    usleep(200);
-                    break;
-                }else{
-                    // fatal error
-                    //close
-                    if(errno == EPIPE){
-                        // Connection reset by peer 
-                        client->keep_alive = 0;
-                        client->status_code = 500;
-                        client->header_done = 1;
-                        client->response_closed = 1;
-                    }else{
-                        PyErr_SetFromErrno(PyExc_IOError);
-                        /* write_error_log(__FILE__, __LINE__); */
-                        call_error_logger();
-                        client->keep_alive = 0;
-                    }
-                    return -1;
-                }
-            default:
-                data += (int)r;
-                len -= r;
-                client->write_bytes += r;
-        }
-    }
-    return 1;
-}
-
-void
-send_error_page(client_t *client)
-{
-    shutdown(client->fd, SHUT_RD);
-    if(client->header_done || client->response_closed){
-        // already sended response data
-        // close connection
-        return;
-    }
-
-    /* int status = client->bad_request_code; */
-    /* int r = status < 0 ? status * -1:status; */
-    /* client->status_code = client->bad_request_code; */
-
-    DEBUG("send_error_page status_code %d client %p", client->status_code, client);
-
-    switch(client->status_code){
-        case 400:
-            blocking_write(client, MSG_400, sizeof(MSG_400) -1);
-            client->write_bytes -= sizeof(H_MSG_400) -1;
-            break;
-        case 408:
-            blocking_write(client, MSG_408, sizeof(MSG_408) -1);
-            client->write_bytes -= sizeof(H_MSG_408) -1;
-            break;
-        case 411:
-            blocking_write(client, MSG_411, sizeof(MSG_411) -1);
-            client->write_bytes -= sizeof(H_MSG_411) -1;
-            break;
-        case 413:
-            blocking_write(client, MSG_413, sizeof(MSG_413) -1);
-            client->write_bytes -= sizeof(H_MSG_413) -1;
-            break;
-        case 417:
-            blocking_write(client, MSG_417, sizeof(MSG_417) -1);
-            client->write_bytes -= sizeof(H_MSG_417) -1;
-            break;
-        case 503:
-            blocking_write(client, MSG_503, sizeof(MSG_503) -1);
-            client->write_bytes -= sizeof(H_MSG_503) -1;
-            break;
-        default:
-            //Internal Server Error
-            blocking_write(client, MSG_500, sizeof(MSG_500) -1);
-            client->write_bytes -= sizeof(H_MSG_500) -1;
-            break;
-    }
-    client->keep_alive = 0;
-    client->header_done = 1;
-    client->response_closed = 1;
-}
-
-
-
+/*
+ * bucket and iov in one block, from the arena of the current request.
+ * buckets are sent or dropped by free_pending() before the request is
+ * freed, most right away so the arena takes the space back.
+ */
 static write_bucket *
-new_write_bucket(int fd, int cnt)
+new_write_bucket(client_t *client, int cnt)
 {
 
     write_bucket *bucket;
-    iovec_t *iov;
+    request *req = client->current_req;
+    size_t size = sizeof(write_bucket) + sizeof(iovec_t) * cnt;
 
-    bucket = PyMem_Malloc(sizeof(write_bucket));
+    if (req) {
+        bucket = arena_alloc(&req->arena, size);
+    } else {
+        bucket = PyMem_Malloc(size);
+    }
     if(bucket == NULL){
         return NULL;
     }
     memset(bucket, 0, sizeof(write_bucket));
 
-    bucket->fd = fd;
-    iov = (iovec_t *)PyMem_Malloc(sizeof(iovec_t) * cnt);
-    if(iov == NULL){
-        PyMem_Free(bucket);
-        return NULL;
-    }
-    memset(iov, 0, sizeof(iovec_t));
-    bucket->iov = iov;
+    bucket->fd = client->fd;
+    bucket->arena = req ? &req->arena : NULL;
+    bucket->iov = (iovec_t *)(bucket + 1);
     bucket->iov_size = cnt;
     GDEBUG("allocate %p", bucket);
     return bucket;
@@ -201,8 +140,11 @@ free_write_bucket(write_bucket *bucket)
     GDEBUG("free %p", bucket);
     Py_CLEAR(bucket->temp1);
     Py_CLEAR(bucket->chunk_data);
-    PyMem_Free(bucket->iov);
-    PyMem_Free(bucket);
+    if (bucket->arena) {
+        arena_free(bucket->arena, bucket, sizeof(write_bucket) + sizeof(iovec_t) * bucket->iov_size);
+    } else {
+        PyMem_Free(bucket);
+    }
 }
 
 
@@ -225,6 +167,15 @@ set_chunked_data(write_bucket *bucket, char *lendata, size_t lenlen, char *data,
     set2bucket(bucket, CRLF, 2);
 }
 
+static void
+set_chunk(write_bucket *bucket, char *data, size_t datalen)
+{
+    int len;
+
+    len = snprintf(bucket->chunk_size, sizeof(bucket->chunk_size), "%zx", datalen);
+    set_chunked_data(bucket, bucket->chunk_size, len, data, datalen);
+}
+
 static void
 set_last_chunked_data(write_bucket *bucket)
 {
@@ -270,9 +221,27 @@ writev_bucket(write_bucket *data)
     writev_log(data);
     printf("\x1B[0m\n");
 #endif
+#ifdef MSG_MORE
+    if (data->more) {
+        // coalesce with the following write
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = data->iov;
+        msg.msg_iovlen = data->iov_cnt;
+        w = sendmsg(data->fd, &msg, MSG_MORE);
+        if (w == -1 && errno == ENOTSOCK) {
+            data->more = 0;
+            w = writev(data->fd, data->iov, data->iov_cnt);
+        }
+    } else {
+        w = writev(data->fd, data->iov, data->iov_cnt);
+    }
+#else
     w = writev(data->fd, data->iov, data->iov_cnt);
+#endif
     BDEBUG("writev fd:%d ret:%d total_size:%d", data->fd, (int)w, data->total);
     Py_END_ALLOW_THREADS
+    PROBE2(write, data->fd, (long)w);
     if(w == -1){
         //error
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -313,50 +282,250 @@ writev_bucket(write_bucket *data)
     return STATUS_OK;
 }
 
-static int
-set_file_content_length(client_t *client, write_bucket *bucket)
+/*
+ * queued buckets leave the arena in any order, move them to the heap so
+ * a slow client does not grow it.
+ */
+static write_bucket *
+heap_bucket(write_bucket *bucket)
 {
-    struct stat info;
-    int in_fd, ret = 0;
-    size_t size = 0;
-    Py_ssize_t valuelen = 0;
-    FileWrapperObject *filewrap = NULL;
-    PyObject *filelike = NULL, *length = NULL;
-    char *value = NULL; 
+    write_bucket *copy;
+    size_t size = sizeof(write_bucket) + sizeof(iovec_t) * bucket->iov_size;
+    char *start = (char *)bucket, *base;
+    uint32_t i;
+
+    copy = PyMem_Malloc(size);
+    if (copy == NULL) {
+        // stays in the arena
+        return bucket;
+    }
+    memcpy(copy, bucket, size);
+    copy->iov = (iovec_t *)(copy + 1);
+    for (i = 0; i < copy->iov_cnt; i++) {
+        // the chunk size lives in the bucket
+        base = copy->iov[i].iov_base;
+        if (base >= start && base < start + size) {
+            copy->iov[i].iov_base = (char *)copy + (base - start);
+        }
+    }
+    copy->arena = NULL;
+    arena_free(bucket->arena, bucket, size);
+    return copy;
+}
 
-    filewrap = (FileWrapperObject *)client->response;
-    filelike = filewrap->filelike;
+static void
+queue_bucket(client_t *client, write_bucket *bucket)
+{
+    if (bucket->arena) {
+        bucket = heap_bucket(bucket);
+    }
+    bucket->next = NULL;
+    if (client->bucket == NULL) {
+        client->bucket = bucket;
+    } else {
+        ((write_bucket *)client->bucket_tail)->next = bucket;
+    }
+    client->bucket_tail = bucket;
+    client->buffered += bucket->total;
+    COUNTER_ADD(total_buffered, bucket->total);
+}
 
-    in_fd = PyObject_AsFileDescriptor(filelike);
-    if (in_fd == -1) {
-        call_error_logger();
+/* bytes of bucket a writev_bucket() call sent, -1 on error */
+static inline int64_t
+bucket_written(write_bucket *bucket, uint32_t remain, response_status ret)
+{
+    if (ret == STATUS_ERROR) {
         return -1;
     }
-    if (fstat(in_fd, &info) == -1){
-        PyErr_SetFromErrno(PyExc_IOError);
-        return -1;
+    return ret == STATUS_OK ? remain : remain - bucket->total;
+}
+
+/*
+ * write bucket, or queue it behind pending output.
+ * body bytes are counted in write_bytes once the bucket is accepted.
+ */
+static response_status
+send_bucket(client_t *client, write_bucket *bucket)
+{
+    request *req = client->current_req;
+    response_status ret;
+    uint64_t start;
+    uint32_t remain;
+
+    if (req && req->timing[TIMING_FIRST_WRITE] == 0) {
+        req->timing[TIMING_FIRST_WRITE] = monotonic_usec();
     }
+    if (client->bucket == NULL) {
+        start = trace_begin(req);
+        remain = bucket->total;
+        ret = writev_bucket(bucket);
+        TRACE_END(req, TRACE_WRITE, start, bucket_written(bucket, remain, ret));
+        if (ret != STATUS_SUSPEND) {
+            if (ret == STATUS_OK) {
+                client->write_bytes += bucket->body_len;
+            }
+            free_write_bucket(bucket);
+            return ret;
+        }
+    }
+    client->write_bytes += bucket->body_len;
+    queue_bucket(client, bucket);
+    return STATUS_SUSPEND;
+}
 
-    size = info.st_size;
-    client->content_length_set = 1;
-    client->content_length = size;
-    DEBUG("set content length:%" PRIu64 , size);
-    length = PyBytes_FromFormat("%zu", size);
-    if (length == NULL) {
-        return -1;
+/*
+ * send queued buckets in order.
+ */
+static response_status
+flush_buckets(client_t *client)
+{
+    write_bucket *bucket;
+    uint32_t remain;
+    uint64_t start;
+    response_status ret;
+
+    while ((bucket = client->bucket) != NULL) {
+        remain = bucket->total;
+        if (bucket->next) {
+            bucket->more = 1;
+        }
+        start = trace_begin(client->current_req);
+        ret = writev_bucket(bucket);
+        TRACE_END(client->current_req, TRACE_WRITE, start, bucket_written(bucket, remain, ret));
+        if (ret == STATUS_ERROR) {
+            return ret;
+        }
+        if (ret == STATUS_SUSPEND) {
+            client->buffered -= remain - bucket->total;
+            COUNTER_SUB(total_buffered, remain - bucket->total);
+            return ret;
+        }
+        client->buffered -= remain;
+        COUNTER_SUB(total_buffered, remain);
+        client->bucket = bucket->next;
+        free_write_bucket(bucket);
+    }
+    client->bucket_tail = NULL;
+    return STATUS_OK;
+}
+
+typedef struct {
+    uint16_t code;
+    const char *msg;
+    size_t len;
+    size_t header_len;
+} error_page_t;
+
+#define ERROR_PAGE(code) {code, MSG_##code, sizeof(MSG_##code) - 1, sizeof(H_MSG_##code) - 1}
+
+static error_page_t error_pages[] = {
+    ERROR_PAGE(400),
+    ERROR_PAGE(403),
+    ERROR_PAGE(404),
+    ERROR_PAGE(405),
+    ERROR_PAGE(408),
+    ERROR_PAGE(411),
+    ERROR_PAGE(413),
+    ERROR_PAGE(417),
+    ERROR_PAGE(503),
+    //Internal Server Error (default)
+    ERROR_PAGE(500),
+};
+
+/*
+ * write static message, queue the rest if the socket is full.
+ */
+static response_status
+write_message(client_t *client, const char *msg, size_t len)
+{
+    write_bucket *bucket;
+
+    bucket = new_write_bucket(client, 1);
+    if (bucket == NULL) {
+        return STATUS_ERROR;
     }
+    set2bucket(bucket, (char *)msg, len);
+    return send_bucket(client, bucket);
+}
 
-    PyBytes_AsStringAndSize(length, &value, &valuelen);
-    
-    add_header(bucket, "Content-Length", 14, value, valuelen);
-    ret = PyList_Append(bucket->temp1, length);
-    if (ret == -1) {
-        return -1;
+/*
+ * send error page without blocking.
+ * return STATUS_SUSPEND if the page is pending in the output queue.
+ */
+response_status
+send_error_page(client_t *client)
+{
+    error_page_t *page = error_pages;
+    response_status ret;
+
+    shutdown(client->fd, SHUT_RD);
+    if(client->header_done || client->response_closed || client->bucket){
+        // already sended response data
+        // close connection
+        return STATUS_OK;
     }
-    Py_DECREF(length);
-    return 1;
+
+    DEBUG("send_error_page status_code %d client %p", client->status_code, client);
+
+    while (page->code != 500 && page->code != client->status_code) {
+        page++;
+    }
+    client->keep_alive = 0;
+    client->header_done = 1;
+    client->response_closed = 1;
+    ret = write_message(client, page->msg, page->len);
+    // body length for access log
+    client->write_bytes = page->len - page->header_len;
+    return ret;
+}
+
+response_status
+send_continue(client_t *client)
+{
+    request *req = client->current_req;
+    response_status ret;
+    uint64_t first_write = req ? req->timing[TIMING_FIRST_WRITE] : 0;
+
+    ret = write_message(client, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+    // not the response
+    if (req) {
+        req->timing[TIMING_FIRST_WRITE] = first_write;
+    }
+    return ret;
+}
+
+/*
+ * flush the output queue only, drop it on error.
+ */
+response_status
+write_pending(client_t *client)
+{
+    response_status ret;
+
+    ret = flush_buckets(client);
+    if (ret == STATUS_ERROR) {
+        free_pending(client);
+    }
+    return ret;
+}
+
+void
+free_pending(client_t *client)
+{
+    write_bucket *bucket;
+
+    while ((bucket = client->bucket) != NULL) {
+        client->bucket = bucket->next;
+        // unsent body is not logged
+        client->write_bytes -= bucket->body_len < bucket->total ? bucket->body_len : bucket->total;
+        COUNTER_SUB(total_buffered, bucket->total);
+        free_write_bucket(bucket);
+    }
+    client->bucket_tail = NULL;
+    client->buffered = 0;
 }
 
+
 /*
 static int
 get_len(PyObject *v)
@@ -396,7 +565,123 @@ set_content_length(client_t *client, write_bucket *bucket, char *data, size_t da
 */
 
 static int
-add_all_headers(write_bucket *bucket, PyObject *fast_headers, int hlen, client_t *client)
+check_header(char *name, char *value)
+{
+    if (unlikely(strchr(name, ':') != 0)) {
+        PyErr_Format(PyExc_ValueError, "header name may not contains ':'"
+                     "response header with name '%s' and value '%s'",
+                     name, value);
+        return -1;
+    }
+
+    if (unlikely(strchr(name, '\n') != 0 || strchr(value, '\n') != 0)) {
+        PyErr_Format(PyExc_ValueError, "embedded newline in "
+                     "response header with name '%s' and value '%s'",
+                     name, value);
+        return -1;
+    }
+    return 1;
+}
+
+int
+CheckHeaderBlock(PyObject *obj)
+{
+    if (obj->ob_type != &HeaderBlockType){
+        return 0;
+    }
+    return 1;
+}
+
+static void
+mark_default_override(const char *name, size_t namelen, uint64_t *overrides)
+{
+    uint32_t i;
+    header_entry *entry;
+    char *data;
+
+    if (likely(default_headers == NULL)) {
+        return;
+    }
+    data = PyBytes_AS_STRING(default_headers->data);
+    for (i = 0; i < default_headers->count; i++) {
+        entry = default_headers->entries + i;
+        if (entry->namelen == namelen && !strncasecmp(data + entry->name_off, name, namelen)) {
+            *overrides |= ((uint64_t)1 << i);
+        }
+    }
+}
+
+static int
+skip_entity_header(client_t *client, const char *name, size_t namelen)
+{
+    if (likely(client->range_response == RANGE_NONE &&
+               client->content_encoding == ENCODING_NONE)) {
+        return 0;
+    }
+    // entity headers are replaced by range or encoded response
+    if (namelen == 14 && !strncasecmp(name, "Content-Length", 14)) {
+        return 1;
+    }
+    if (client->range_response == RANGE_MULTI &&
+        namelen == 12 && !strncasecmp(name, "Content-Type", 12)) {
+        return 1;
+    }
+    return 0;
+}
+
+static int
+add_header_block(write_bucket *bucket, HeaderBlockObject *block, uint64_t *overrides, client_t *client)
+{
+    uint32_t i;
+    header_entry *entry;
+    char *data = PyBytes_AS_STRING(block->data);
+
+    for (i = 0; i < block->count; i++) {
+        entry = block->entries + i;
+        mark_default_override(data + entry->name_off, entry->namelen, overrides);
+    }
+    if (unlikely(client->range_response == RANGE_MULTI)) {
+        for (i = 0; i < block->count; i++) {
+            entry = block->entries + i;
+            if (!skip_entity_header(client, data + entry->name_off, entry->namelen)) {
+                set2bucket(bucket, data + entry->line_off, entry->linelen);
+            }
+        }
+    } else {
+        //serialized once, sent as single iovec
+        set2bucket(bucket, data, PyBytes_GET_SIZE(block->data));
+    }
+    return PyList_Append(bucket->temp1, (PyObject *)block);
+}
+
+static int
+add_default_headers(write_bucket *bucket, uint64_t overrides)
+{
+    uint32_t i;
+    header_entry *entry;
+    HeaderBlockObject *block = default_headers;
+    char *data;
+
+    if (block == NULL) {
+        return 1;
+    }
+    data = PyBytes_AS_STRING(block->data);
+    if (likely(overrides == 0)) {
+        set2bucket(bucket, data, PyBytes_GET_SIZE(block->data));
+    } else {
+        for (i = 0; i < block->count; i++) {
+            entry = block->entries + i;
+            if (!(overrides & ((uint64_t)1 << i))) {
+                set2bucket(bucket, data + entry->line_off, entry->linelen);
+            }
+        }
+    }
+    //keep block alive while bucket is pending
+    return PyList_Append(bucket->temp1, (PyObject *)block);
+}
+
+static int
+add_all_headers(write_bucket *bucket, PyObject *fast_headers, int hlen, client_t *client, uint64_t *overrides)
 {
     int i;
     PyObject *tuple = NULL;
@@ -413,6 +698,13 @@ add_all_headers(write_bucket *bucket, PyObject *fast_headers, int hlen, client_t
 
             tuple = PySequence_Fast_GET_ITEM(fast_headers, i);
 
+            if (CheckHeaderBlock(tuple)) {
+                if (add_header_block(bucket, (HeaderBlockObject *)tuple, overrides, client) == -1) {
+                    goto error;
+                }
+                continue;
+            }
+
             if (unlikely( !PyTuple_Check(tuple))) {
                 PyErr_Format(PyExc_TypeError, "list of tuple values "
                              "expected, value of type %.200s found",
@@ -447,21 +739,20 @@ add_all_headers(write_bucket *bucket, PyObject *fast_headers, int hlen, client_t
                 goto error;
             }
 
-            if (unlikely(strchr(name, ':') != 0)) {
-                PyErr_Format(PyExc_ValueError, "header name may not contains ':'"
-                             "response header with name '%s' and value '%s'",
-                             name, value);
+            if (unlikely(check_header(name, value) == -1)) {
                 goto error;
             }
 
-            if (unlikely(strchr(name, '\n') != 0 || strchr(value, '\n') != 0)) {
-                PyErr_Format(PyExc_ValueError, "embedded newline in "
-                             "response header with name '%s' and value '%s'",
-                             name, value);
-                goto error;
+            if (!strcasecmp(name, "Server") || !strcasecmp(name, "Date") ||
+                (response_cache_max_bytes && !strcasecmp(name, CACHE_HEADER))) {
+                Py_CLEAR(bytes1);
+                Py_CLEAR(bytes2);
+                continue;
             }
-
-            if (!strcasecmp(name, "Server") || !strcasecmp(name, "Date")) {
+            mark_default_override(name, namelen, overrides);
+            if (unlikely(skip_entity_header(client, name, namelen))) {
+                Py_CLEAR(bytes1);
+                Py_CLEAR(bytes2);
                 continue;
             }
 
@@ -538,7 +829,7 @@ add_status_line(write_bucket *bucket, client_t *client)
     return 1;
 }
 
-static PyObject*
+PyObject*
 get_chunk_data(size_t datalen)
 {
     char lendata[32];
@@ -550,34 +841,484 @@ get_chunk_data(size_t datalen)
 
 
 static void
-set_first_body_data(client_t *client, char *data, size_t datalen)
+set_first_body_data(client_t *client, write_bucket *bucket, char *data, size_t datalen)
 {
-    write_bucket *bucket = client->bucket;
     if(data){
+        bucket->body_len = datalen;
         if(client->chunked_response){
-            char *lendata  = NULL;
-            Py_ssize_t len = 0;
-
-            PyObject *chunk_data = get_chunk_data(datalen);
-            //TODO CHECK ERROR
-            PyBytes_AsStringAndSize(chunk_data, &lendata, &len);
-            set_chunked_data(bucket, lendata, len, data, datalen);
-            bucket->chunk_data = chunk_data;
+            set_chunk(bucket, data, datalen);
         }else{
             set2bucket(bucket, data, datalen);
         }
     }
 }
 
-static response_status
-write_headers(client_t *client, char *data, size_t datalen, char is_file)
+static int
+add_header_value(write_bucket *bucket, char *key, size_t keylen, const char *val, size_t vallen)
 {
-    write_bucket *bucket = 0; 
-    uint32_t hlen = 0;
-    PyObject *headers = NULL, *templist = NULL;
-    response_status ret;
-    
-    DEBUG("header write? %d", client->header_done);
+    PyObject *value;
+    int ret;
+
+    value = PyBytes_FromStringAndSize(val, vallen);
+    if (value == NULL) {
+        return -1;
+    }
+    add_header(bucket, key, keylen, PyBytes_AS_STRING(value), vallen);
+    //keep value while bucket is pending
+    ret = PyList_Append(bucket->temp1, value);
+    Py_DECREF(value);
+    return ret;
+}
+
+/*
+ * parse "bytes=" range set.
+ * return satisfiable range count, 0 if no range is satisfiable and
+ * -1 if the header is invalid or unsupported (ignore it and send all)
+ */
+static int
+parse_range(const char *p, uint64_t size, byte_range *ranges)
+{
+    int cnt = 0;
+    uint64_t start, end, last;
+    char *e;
+
+    while (*p == ' ') {
+        p++;
+    }
+    if (strncasecmp(p, "bytes=", 6)) {
+        return -1;
+    }
+    p += 6;
+    for (;;) {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        errno = 0;
+        if (*p == '-') {
+            //suffix-byte-range-spec
+            p++;
+            if (!isdigit((unsigned char)*p)) {
+                return -1;
+            }
+            last = strtoull(p, &e, 10);
+            if (errno == ERANGE) {
+                return -1;
+            }
+            p = e;
+            start = last >= size ? 0 : size - last;
+            end = size;
+        } else if (isdigit((unsigned char)*p)) {
+            start = strtoull(p, &e, 10);
+            if (errno == ERANGE || *e != '-') {
+                return -1;
+            }
+            p = e + 1;
+            end = size;
+            if (isdigit((unsigned char)*p)) {
+                last = strtoull(p, &e, 10);
+                if (errno == ERANGE || last < start) {
+                    return -1;
+                }
+                p = e;
+                if (last < size) {
+                    end = last + 1;
+                }
+            }
+        } else {
+            return -1;
+        }
+        if (start < end) {
+            if (cnt == MAX_RANGES) {
+                return -1;
+            }
+            ranges[cnt].start = start;
+            ranges[cnt].end = end;
+            cnt++;
+        }
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        return -1;
+    }
+    return cnt;
+}
+
+static int
+set_status_line(client_t *client, uint16_t code, const char *status)
+{
+    PyObject *bytes, *line;
+
+    bytes = PyBytes_FromString(status);
+    if (bytes == NULL) {
+        return -1;
+    }
+    line = create_status(bytes, PyBytes_GET_SIZE(bytes), client->http_parser->http_minor);
+    Py_DECREF(bytes);
+    if (line == NULL) {
+        return -1;
+    }
+    Py_XDECREF(client->http_status);
+    client->http_status = line;
+    client->status_code = code;
+    return 1;
+}
+
+static PyObject*
+header_block_value(HeaderBlockObject *block, const char *name, size_t namelen)
+{
+    uint32_t i;
+    header_entry *entry;
+    char *data = PyBytes_AS_STRING(block->data);
+
+    for (i = 0; i < block->count; i++) {
+        entry = block->entries + i;
+        if (entry->namelen == namelen && !strncasecmp(data + entry->name_off, name, namelen)) {
+            // name ": " value CRLF
+            return PyBytes_FromStringAndSize(data + entry->name_off + namelen + 2,
+                                             entry->linelen - namelen - 4);
+        }
+    }
+    return NULL;
+}
+
+static PyObject*
+find_response_header(client_t *client, const char *key, size_t keylen)
+{
+    PyObject *fast, *item, *name, *value = NULL;
+    Py_ssize_t i, len;
+
+    fast = PySequence_Fast(client->headers, "header must be list");
+    if (fast == NULL) {
+        PyErr_Clear();
+        return NULL;
+    }
+    len = PySequence_Fast_GET_SIZE(fast);
+    for (i = 0; i < len && value == NULL; i++) {
+        item = PySequence_Fast_GET_ITEM(fast, i);
+        if (CheckHeaderBlock(item)) {
+            value = header_block_value((HeaderBlockObject *)item, key, keylen);
+        } else if (PyTuple_Check(item) && PyTuple_GET_SIZE(item) == 2) {
+            name = wsgi_to_bytes(PyTuple_GET_ITEM(item, 0));
+            if (name == NULL) {
+                break;
+            }
+            if (!strcasecmp(PyBytes_AS_STRING(name), key)) {
+                value = wsgi_to_bytes(PyTuple_GET_ITEM(item, 1));
+            }
+            Py_DECREF(name);
+        }
+    }
+    Py_DECREF(fast);
+    if (value == NULL && default_headers != NULL) {
+        value = header_block_value(default_headers, key, keylen);
+    }
+    PyErr_Clear();
+    return value;
+}
+
+static PyObject*
+find_content_type(client_t *client)
+{
+    return find_response_header(client, "Content-Type", 12);
+}
+
+static int
+setup_multipart(client_t *client, file_response_t *f)
+{
+    PyObject *parts, *part, *ctype;
+    byte_range *r;
+    uint32_t i;
+    uint64_t total = 0;
+    char range[64];
+
+    snprintf(f->boundary, sizeof(f->boundary), "%08x%08x",
+             (unsigned int)current_msec, (unsigned int)++boundary_seq);
+    parts = PyList_New(0);
+    if (parts == NULL) {
+        return -1;
+    }
+    ctype = find_content_type(client);
+    for (i = 0; i < f->range_cnt; i++) {
+        r = f->ranges + i;
+        snprintf(range, sizeof(range), "%" PRIu64 "-%" PRIu64 "/%" PRIu64,
+                 r->start - f->base, r->end - 1 - f->base, f->size);
+        part = PyBytes_FromFormat("%s--%s\r\n%s%s%sContent-Range: bytes %s\r\n\r\n",
+                                  i ? "\r\n" : "", f->boundary,
+                                  ctype ? "Content-Type: " : "",
+                                  ctype ? PyBytes_AS_STRING(ctype) : "",
+                                  ctype ? "\r\n" : "", range);
+        if (part == NULL || PyList_Append(parts, part) == -1) {
+            Py_XDECREF(part);
+            goto error;
+        }
+        total += PyBytes_GET_SIZE(part) + (r->end - r->start);
+        Py_DECREF(part);
+    }
+    part = PyBytes_FromFormat("\r\n--%s--\r\n", f->boundary);
+    if (part == NULL || PyList_Append(parts, part) == -1) {
+        Py_XDECREF(part);
+        goto error;
+    }
+    total += PyBytes_GET_SIZE(part);
+    Py_DECREF(part);
+    Py_XDECREF(ctype);
+
+    f->parts = parts;
+    client->content_length = total;
+    return 1;
+error:
+    Py_XDECREF(ctype);
+    Py_DECREF(parts);
+    return -1;
+}
+
+static int
+setup_range(client_t *client, file_response_t *f)
+{
+    PyObject *environ = client->current_req->environ;
+    char *range;
+    int cnt, i;
+
+    if (get_environ_value(environ, "HTTP_IF_RANGE", NULL)) {
+        // validator is not known here, always send the entire file
+        return 1;
+    }
+    range = get_environ_value(environ, "HTTP_RANGE", NULL);
+    if (range == NULL) {
+        return 1;
+    }
+    cnt = parse_range(range, f->size, f->ranges);
+    DEBUG("range '%s' count %d", range, cnt);
+    if (cnt == -1) {
+        //ignore
+        f->ranges[0].start = f->base;
+        f->ranges[0].end = f->base + f->size;
+        return 1;
+    } else if (cnt == 0) {
+        client->range_response = RANGE_UNSATISFIABLE;
+        client->content_length = 0;
+        f->range_cnt = 0;
+        return set_status_line(client, 416, "416 Requested Range Not Satisfiable");
+    }
+    for (i = 0; i < cnt; i++) {
+        f->ranges[i].start += f->base;
+        f->ranges[i].end += f->base;
+    }
+    f->range_cnt = cnt;
+    if (set_status_line(client, 206, "206 Partial Content") == -1) {
+        return -1;
+    }
+    if (cnt == 1) {
+        client->range_response = RANGE_SINGLE;
+        client->content_length = f->ranges[0].end - f->ranges[0].start;
+        return 1;
+    }
+    client->range_response = RANGE_MULTI;
+    return setup_multipart(client, f);
+}
+
+static int
+add_file_headers(client_t *client, write_bucket *bucket)
+{
+    file_response_t *f = (file_response_t *)client->file_response;
+    char value[96];
+    int len = 0;
+
+    if (f->is_pipe) {
+        if (!client->content_length_set) {
+            // body is delimited by connection close
+            client->keep_alive = 0;
+        }
+        return 1;
+    }
+    if (client->status_code == 200 || client->range_response) {
+        add_header(bucket, "Accept-Ranges", 13, "bytes", 5);
+    }
+    switch (client->range_response) {
+        case RANGE_SINGLE:
+            len = snprintf(value, sizeof(value), "bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64,
+                           f->ranges[0].start - f->base, f->ranges[0].end - 1 - f->base, f->size);
+            if (add_header_value(bucket, "Content-Range", 13, value, len) == -1) {
+                return -1;
+            }
+            break;
+        case RANGE_MULTI:
+            len = snprintf(value, sizeof(value), "multipart/byteranges; boundary=%s", f->boundary);
+            if (add_header_value(bucket, "Content-Type", 12, value, len) == -1) {
+                return -1;
+            }
+            break;
+        case RANGE_UNSATISFIABLE:
+            len = snprintf(value, sizeof(value), "bytes */%" PRIu64, f->size);
+            if (add_header_value(bucket, "Content-Range", 13, value, len) == -1) {
+                return -1;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (client->range_response || !client->content_length_set) {
+        len = snprintf(value, sizeof(value), "%" PRIu64, client->content_length);
+        if (add_header_value(bucket, "Content-Length", 14, value, len) == -1) {
+            return -1;
+        }
+        client->content_length_set = 1;
+    } else if (client->content_length < f->size) {
+        // application limits the body
+        f->ranges[0].end = f->ranges[0].start + client->content_length;
+    } else if (client->content_length > f->size) {
+        // can't send promised length
+        client->keep_alive = 0;
+    }
+    DEBUG("set content length:%" PRIu64, client->content_length);
+    return 1;
+}
+
+/*
+ * decide content coding of iterator response.
+ * return 1 if body is compressed, 0 if not, -1 on error.
+ */
+static int
+setup_compress(client_t *client)
+{
+    PyObject *value, *item;
+    uint64_t length = 0;
+    Py_ssize_t i;
+    int encoding, ok, is_seq;
+
+    if (client->status_code < 200 || client->status_code == 204 ||
+        client->status_code == 206 || client->status_code == 304) {
+        return 0;
+    }
+    value = find_response_header(client, "Content-Encoding", 16);
+    if (value != NULL) {
+        Py_DECREF(value);
+        return 0;
+    }
+    value = find_content_type(client);
+    if (value == NULL) {
+        return 0;
+    }
+    ok = is_compressible_type(PyBytes_AS_STRING(value));
+    Py_DECREF(value);
+    if (!ok) {
+        return 0;
+    }
+    // representation depends on Accept-Encoding
+    client->vary_encoding = 1;
+
+    is_seq = PyList_Check(client->response) || PyTuple_Check(client->response);
+    if (is_seq) {
+        for (i = 0; i < PySequence_Fast_GET_SIZE(client->response); i++) {
+            item = PySequence_Fast_GET_ITEM(client->response, i);
+            if (PyBytes_Check(item)) {
+                length += PyBytes_GET_SIZE(item);
+            }
+        }
+        if (length < compress_min_length) {
+            return 0;
+        }
+    } else {
+        value = find_response_header(client, "Content-Length", 14);
+        if (value != NULL) {
+            length = strtoull(PyBytes_AS_STRING(value), NULL, 10);
+            Py_DECREF(value);
+            if (length < compress_min_length) {
+                return 0;
+            }
+        }
+    }
+    if (client->http_parser->method == HTTP_HEAD) {
+        return 0;
+    }
+    encoding = select_encoding(get_environ_value(client->current_req->environ, "HTTP_ACCEPT_ENCODING", NULL), 1);
+    if (encoding == ENCODING_NONE) {
+        return 0;
+    }
+    client->compress = new_compress(encoding);
+    if (client->compress == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    client->content_encoding = encoding;
+    if (!is_seq && client->http_parser->http_minor == 0) {
+        // body is delimited by connection close
+        client->keep_alive = 0;
+    }
+    return 1;
+}
+
+static int
+add_encoding_headers(client_t *client, write_bucket *bucket, char is_file)
+{
+    const char *name;
+    char value[32];
+    int len;
+
+    add_header(bucket, "Vary", 4, "Accept-Encoding", 15);
+    if (client->content_encoding == ENCODING_NONE) {
+        return 1;
+    }
+    name = encoding_name(client->content_encoding);
+    add_header(bucket, "Content-Encoding", 16, (char *)name, strlen(name));
+    if (!is_file && client->content_length_set) {
+        // length of the encoded body
+        len = snprintf(value, sizeof(value), "%" PRIu64, client->content_length);
+        if (add_header_value(bucket, "Content-Length", 14, value, len) == -1) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+static int
+file_body_follows(client_t *client)
+{
+    file_response_t *f = (file_response_t *)client->file_response;
+
+    if (f == NULL || f->is_pipe || f->range_idx >= f->range_cnt) {
+        return 0;
+    }
+    return f->parts != NULL || f->ranges[0].end > f->ranges[0].start;
+}
+
+/*
+ * let long-running streams wake up only when the unsent data is small,
+ * instead of queueing the whole socket buffer.
+ */
+static void
+set_stream_lowat(client_t *client)
+{
+#ifdef TCP_NOTSENT_LOWAT
+    int lowat = notsent_lowat;
+
+    if (client->notsent_lowat || lowat <= 0) {
+        return;
+    }
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+    client->notsent_lowat = 1;
+#endif
+}
+
+response_status
+write_headers(client_t *client, char *data, size_t datalen, char is_file)
+{
+    write_bucket *bucket = 0; 
+    uint32_t hlen = 0, dlen = 0;
+    uint64_t overrides = 0;
+    uint32_t i;
+    PyObject *headers = NULL, *templist = NULL, *item;
+    response_status ret;
+    
+    DEBUG("header write? %d", client->header_done);
     if(client->header_done){
         return STATUS_OK;
     }
@@ -591,8 +1332,20 @@ write_headers(client_t *client, char *data, size_t datalen, char is_file)
         goto error;
     }
     hlen = PySequence_Fast_GET_SIZE(headers);
+    if (default_headers) {
+        dlen = default_headers->count;
+    }
+    for (i = 0; i < hlen; i++) {
+        item = PySequence_Fast_GET_ITEM(headers, i);
+        if (CheckHeaderBlock(item)) {
+            dlen += ((HeaderBlockObject *)item)->count;
+        }
+    }
+    if (client->range_response == RANGE_MULTI) {
+        mark_default_override("Content-Type", 12, &overrides);
+    }
 
-    bucket = new_write_bucket(client->fd, (hlen * 4) + 42 );
+    bucket = new_write_bucket(client, (hlen * 4) + dlen + 54 );
 
     if(bucket == NULL){
         goto error;
@@ -604,20 +1357,30 @@ write_headers(client_t *client, char *data, size_t datalen, char is_file)
         goto error;
     }
     //write header
-    if(add_all_headers(bucket, headers, hlen, client) == -1){
+    if(add_all_headers(bucket, headers, hlen, client, &overrides) == -1){
         //Error
         goto error;
     }
+    if(add_default_headers(bucket, overrides) == -1){
+        goto error;
+    }
     
+    if (unlikely(client->vary_encoding)) {
+        if (add_encoding_headers(client, bucket, is_file) == -1) {
+            goto error;
+        }
+    }
+
     // check content_length_set
-    if(data && !client->content_length_set && client->http_parser->http_minor == 1){
+    if((data || client->compress || is_stream_response(client)) &&
+       !client->content_length_set && client->http_parser->http_minor == 1){
         //Transfer-Encoding chunked
         add_header(bucket, "Transfer-Encoding", 17, "chunked", 7);
         client->chunked_response = 1;
     }
 
-    if (is_file && !client->content_length_set){
-        if (set_file_content_length(client, bucket) == -1) {
+    if (is_file && client->file_response){
+        if (add_file_headers(client, bucket) == -1) {
             goto error;
         }
     }
@@ -632,20 +1395,21 @@ write_headers(client_t *client, char *data, size_t datalen, char is_file)
     set2bucket(bucket, CRLF, 2);
 
     //write body
-    client->bucket = bucket;
-    set_first_body_data(client, data, datalen);
+    set_first_body_data(client, bucket, data, datalen);
 
-    ret = writev_bucket(bucket);
-    if(ret != STATUS_SUSPEND){
-        client->header_done = 1;
-        if(ret == STATUS_OK && data){
-            client->write_bytes += datalen;
+    if (is_file) {
+        if (client->range_response == RANGE_MULTI) {
+            // part headers and ranges are sent by separate calls
+            enable_cork(client);
         }
-        // clear
-        free_write_bucket(bucket);
-        client->bucket = NULL;
+        bucket->more = file_body_follows(client);
+    } else {
+        bucket->more = client->seq_body && (client->body_items > 1 || client->chunked_response);
     }
 
+    client->header_done = 1;
+    ret = send_bucket(client, bucket);
+
     Py_DECREF(headers);
     return ret;
 error:
@@ -656,62 +1420,80 @@ error:
     Py_XDECREF(headers);
     if(bucket){
         free_write_bucket(bucket);
-        client->bucket = NULL;
     }
     return STATUS_ERROR;
 }
 
-static int
-write_sendfile(int out_fd, int in_fd, int offset, size_t count)
+static ssize_t
+write_sendfile(int out_fd, int in_fd, uint64_t offset, uint64_t count)
 {
-    int size = (int)count;
-    int res;
+    ssize_t res;
 #ifdef linux
-    /*
-    if (size == 0) {
-        struct stat info;
-        DEBUG("call fstat");
-        if (fstat(in_fd, &info) == -1){
-            PyErr_SetFromErrno(PyExc_IOError);
-            write_error_log(__FILE__, __LINE__);
-            return -1;
-        }
-
-        size = info.st_size - lseek(in_fd, 0, SEEK_CUR);
-    }*/
+    off_t off = (off_t)offset;
+    if (count > 0x7ffff000) {
+        count = 0x7ffff000;
+    }
     Py_BEGIN_ALLOW_THREADS
-    res = sendfile(out_fd, in_fd, NULL, size);
+    res = sendfile(out_fd, in_fd, &off, (size_t)count);
     Py_END_ALLOW_THREADS
     return res;
 #elif defined(__FreeBSD__)
-    off_t len;
+    off_t len = 0;
     Py_BEGIN_ALLOW_THREADS
-    res = sendfile(in_fd, out_fd, offset, 0, NULL, &len, 0);
+    res = sendfile(in_fd, out_fd, offset, count, NULL, &len, 0);
     Py_END_ALLOW_THREADS
     if (res == 0) {
         return len;
     } else {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) { 
-            return len; 
+        if ((errno == EAGAIN || errno == EWOULDBLOCK) && len > 0) {
+            return len;
         }
         return -1;
     }
-#elif defined(__APPLE__) 
-    off_t len;
+#elif defined(__APPLE__)
+    off_t len = count;
     Py_BEGIN_ALLOW_THREADS
     res = sendfile(in_fd, out_fd, offset, &len, NULL, 0);
     Py_END_ALLOW_THREADS
     if (res == 0) {
         return len;
     } else {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) { 
-            return len; 
+        if ((errno == EAGAIN || errno == EWOULDBLOCK) && len > 0) {
+            return len;
         }
         return -1;
     }
+#else
+    errno = ENOSYS;
+    return -1;
 #endif
 }
 
+static ssize_t
+write_pread(client_t *client, file_response_t *f, uint64_t offset, uint64_t count)
+{
+    ssize_t r;
+
+    if (f->buf == NULL) {
+        f->buf = PyMem_Malloc(f->blksize);
+        if (f->buf == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    if (count > f->blksize) {
+        count = f->blksize;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    r = pread(f->fd, f->buf, count, (off_t)offset);
+    if (r > 0) {
+        // short write is fine, next pread starts from sent offset
+        r = write(client->fd, f->buf, r);
+    }
+    Py_END_ALLOW_THREADS
+    return r;
+}
+
 response_status
 close_response(client_t *client)
 {
@@ -744,85 +1526,359 @@ close_response(client_t *client)
 
 
 static response_status
-process_sendfile(client_t *client)
+write_part(client_t *client, file_response_t *f, PyObject *part)
 {
-    PyObject *filelike = NULL;
-    FileWrapperObject *filewrap = NULL;
-    int in_fd, ret;
+    char *data = PyBytes_AS_STRING(part);
+    uint64_t len = PyBytes_GET_SIZE(part);
+    ssize_t r;
 
-    filewrap = (FileWrapperObject *)client->response;
-    filelike = filewrap->filelike;
+    while (f->part_pos < len) {
+        Py_BEGIN_ALLOW_THREADS
+        r = write(client->fd, data + f->part_pos, len - f->part_pos);
+        Py_END_ALLOW_THREADS
+        if (r == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return STATUS_SUSPEND;
+            }
+            client->keep_alive = 0;
+            client->status_code = 500;
+            return STATUS_ERROR;
+        }
+        f->part_pos += r;
+        client->write_bytes += r;
+    }
+    f->part_pos = 0;
+    return STATUS_OK;
+}
 
-    in_fd = PyObject_AsFileDescriptor(filelike);
-    if (in_fd == -1) {
-        PyErr_Clear();
-        return STATUS_OK;
+static response_status
+send_range(client_t *client, file_response_t *f, byte_range *range)
+{
+    ssize_t ret;
+    uint64_t remain, start;
+
+    while ((remain = range->end - range->start - f->pos) > 0) {
+        start = trace_begin(client->current_req);
+        if (f->use_pread) {
+            ret = write_pread(client, f, range->start + f->pos, remain);
+        } else {
+            ret = write_sendfile(client->fd, f->fd, range->start + f->pos, remain);
+            PROBE2(sendfile, client->fd, (long)ret);
+        }
+        TRACE_END(client->current_req, TRACE_SENDFILE, start, (int64_t)ret);
+        DEBUG("process_sendfile send %d", (int)ret);
+        if (ret == 0) {
+            // file truncated, promised length can't be sent
+            client->keep_alive = 0;
+            return STATUS_ERROR;
+        }
+        if (ret == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { /* try again later */
+                DEBUG("process_sendfile EAGAIN");
+                return STATUS_SUSPEND;
+            }
+            if (!f->use_pread && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                // sendfile not supported by this fd
+                f->use_pread = 1;
+                enable_cork(client);
+                continue;
+            }
+            /* fatal error */
+            client->keep_alive = 0;
+            client->status_code = 500;
+            return STATUS_ERROR;
+        }
+        f->pos += ret;
+        client->write_bytes += ret;
     }
+    return STATUS_OK;
+}
 
-    while(client->content_length > client->write_bytes){
-        ret = write_sendfile(client->fd, in_fd, client->write_bytes, client->content_length);
-        DEBUG("process_sendfile send %d", ret);
-        switch (ret) {
-            case 0:
-                break;
-            case -1: /* error */
-                if (errno == EAGAIN || errno == EWOULDBLOCK) { /* try again later */
-                    //next
-                    DEBUG("process_sendfile EAGAIN %d", ret);
-                    return STATUS_SUSPEND;
-                } else { /* fatal error */
-                    client->keep_alive = 0;
-                    /* client->bad_request_code = 500; */
-                    client->status_code = 500;
-                    //close
-                    return STATUS_ERROR;
+static response_status
+process_splice(client_t *client, file_response_t *f)
+{
+#ifdef linux
+    ssize_t r;
+    size_t count;
+    struct pollfd pfd;
+
+    for (;;) {
+        count = f->blksize;
+        if (client->content_length_set) {
+            if (client->content_length <= client->write_bytes) {
+                return STATUS_OK;
+            }
+            if (client->content_length - client->write_bytes < count) {
+                count = client->content_length - client->write_bytes;
+            }
+        }
+        Py_BEGIN_ALLOW_THREADS
+        r = splice(f->fd, NULL, client->fd, NULL, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        Py_END_ALLOW_THREADS
+        DEBUG("process_splice send %d", (int)r);
+        if (r == 0) {
+            //EOF
+            if (client->content_length_set && client->content_length > client->write_bytes) {
+                client->keep_alive = 0;
+            }
+            return STATUS_OK;
+        }
+        if (r == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pfd.fd = f->fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                if (poll(&pfd, 1, 0) == 0) {
+                    // pipe is empty, wait for the writer
+                    client->wait_read = 1;
+                    client->wait_fd = f->fd;
                 }
-            default:
-                client->write_bytes += ret;
+                return STATUS_SUSPEND;
+            }
+            client->keep_alive = 0;
+            client->status_code = 500;
+            return STATUS_ERROR;
+        }
+        client->write_bytes += r;
+    }
+#else
+    return STATUS_ERROR;
+#endif
+}
 
+static response_status
+process_sendfile(client_t *client)
+{
+    file_response_t *f = (file_response_t *)client->file_response;
+    response_status ret;
+
+    if (f->is_pipe) {
+        ret = process_splice(client, f);
+        if (ret != STATUS_OK) {
+            return ret;
         }
+        return close_response(client);
+    }
+
+    while (f->range_idx < f->range_cnt) {
+        if (f->parts && !f->part_done) {
+            ret = write_part(client, f, PyList_GET_ITEM(f->parts, f->range_idx));
+            if (ret != STATUS_OK) {
+                return ret;
+            }
+            f->part_done = 1;
+        }
+        ret = send_range(client, f, f->ranges + f->range_idx);
+        if (ret != STATUS_OK) {
+            return ret;
+        }
+        f->range_idx++;
+        f->part_done = 0;
+        f->pos = 0;
+    }
+    if (f->parts && !f->part_done) {
+        //closing boundary
+        ret = write_part(client, f, PyList_GET_ITEM(f->parts, f->range_cnt));
+        if (ret != STATUS_OK) {
+            return ret;
+        }
+        f->part_done = 1;
+    }
+    if (client->use_cork) {
+        // flush
+        disable_cork(client);
     }
     //all send
-    //disable_cork(client);
     return close_response(client);
 }
 
+static PyObject *
+compress_item(client_t *client, const char *data, size_t len, int flush)
+{
+    buffer_t *out;
+
+    out = new_buffer(len / 2 + 64, 0);
+    if (out == NULL) {
+        return PyErr_NoMemory();
+    }
+    if (compress_write(client->compress, data, len, flush, out) == -1) {
+        free_buffer(out);
+        if (!PyErr_Occurred()) {
+            PyErr_SetString(PyExc_IOError, "failed to compress response");
+        }
+        return NULL;
+    }
+    return getPyString(out);
+}
+
+/*
+ * compress list or tuple body at once and send it with Content-Length.
+ */
+static response_status
+write_compressed_body(client_t *client)
+{
+    PyObject *item, *body;
+    buffer_t *out;
+    Py_ssize_t i;
+    response_status ret;
+
+    out = new_buffer(8192, 0);
+    if (out == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    for (i = 0; i < PySequence_Fast_GET_SIZE(client->response); i++) {
+        item = PySequence_Fast_GET_ITEM(client->response, i);
+        if (!PyBytes_Check(item)) {
+            PyErr_SetString(PyExc_TypeError, "response item must be a byte string");
+            goto error;
+        }
+        if (compress_write(client->compress, PyBytes_AS_STRING(item), PyBytes_GET_SIZE(item),
+                           COMPRESS_NO_FLUSH, out) == -1) {
+            goto error;
+        }
+    }
+    if (compress_write(client->compress, NULL, 0, COMPRESS_FINISH, out) == -1) {
+        goto error;
+    }
+    free_compress(client->compress);
+    client->compress = NULL;
+
+    body = getPyString(out);
+    if (body == NULL) {
+        call_error_logger();
+        return STATUS_ERROR;
+    }
+    client->content_length_set = 1;
+    client->content_length = PyBytes_GET_SIZE(body);
+    client->body_items = 0;
+    ret = write_headers(client, PyBytes_AS_STRING(body), PyBytes_GET_SIZE(body), 0);
+    if (ret == STATUS_SUSPEND && client->bucket) {
+        // keep body while bucket is pending
+        PyList_Append(((write_bucket *)client->bucket_tail)->temp1, body);
+    }
+    Py_DECREF(body);
+    return ret;
+error:
+    if (out) {
+        free_buffer(out);
+    }
+    if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_IOError, "failed to compress response");
+    }
+    call_error_logger();
+    return STATUS_ERROR;
+}
+
+/*
+ * write the end of compressed stream.
+ */
+static response_status
+finish_compress(client_t *client)
+{
+    PyObject *item;
+    write_bucket *bucket;
+    Py_ssize_t buflen;
+    response_status ret;
+
+    item = compress_item(client, NULL, 0, COMPRESS_FINISH);
+    free_compress(client->compress);
+    client->compress = NULL;
+    if (item == NULL) {
+        call_error_logger();
+        return STATUS_ERROR;
+    }
+    buflen = PyBytes_GET_SIZE(item);
+    if (buflen == 0) {
+        Py_DECREF(item);
+        return STATUS_OK;
+    }
+    bucket = new_write_bucket(client, client->chunked_response ? 4 : 1);
+    if (bucket == NULL) {
+        call_error_logger();
+        Py_DECREF(item);
+        return STATUS_ERROR;
+    }
+    if (client->chunked_response) {
+        set_chunk(bucket, PyBytes_AS_STRING(item), buflen);
+    } else {
+        set2bucket(bucket, PyBytes_AS_STRING(item), buflen);
+    }
+    bucket->temp1 = item;
+    bucket->body_len = buflen;
+    ret = send_bucket(client, bucket);
+    if (ret == STATUS_SUSPEND) {
+        // the rest is flushed with the output queue
+        return STATUS_OK;
+    }
+    return ret;
+}
+
+/*
+ * output of streaming responses is paused above output_high_watermark,
+ * output_buffer_limit or the memory budget and resumed below
+ * output_low_watermark.
+ */
+int
+output_full(client_t *client)
+{
+    if (client->bucket == NULL) {
+        // always make progress
+        return 0;
+    }
+    return client->buffered >= output_high_watermark || total_buffered >= output_buffer_limit ||
+        memory_over_budget(0);
+}
+
 static response_status
 process_write(client_t *client)
 {
     PyObject *iterator = NULL;
-    PyObject *item, *chunk_data = NULL;
-    char *buf = NULL, *lendata = NULL;
-    Py_ssize_t buflen, len;
+    PyObject *item;
+    char *buf = NULL;
+    Py_ssize_t buflen;
     write_bucket *bucket = NULL;
     response_status ret;
     
     DEBUG("process_write start");
     iterator = client->response_iter;
     if(iterator != NULL){
-        while((item =  PyIter_Next(iterator))){
+        while(1){
+            if (output_full(client)) {
+                DEBUG("pause iterator buffered:%llu", (unsigned long long)client->buffered);
+                return STATUS_SUSPEND;
+            }
+            item = PyIter_Next(iterator);
+            if (item == NULL) {
+                break;
+            }
             if(PyBytes_Check(item)){
+                if (client->compress) {
+                    Py_SETREF(item, compress_item(client, PyBytes_AS_STRING(item), PyBytes_GET_SIZE(item), COMPRESS_FLUSH));
+                    if (item == NULL) {
+                        call_error_logger();
+                        return STATUS_ERROR;
+                    }
+                }
                 //TODO CHECK
                 PyBytes_AsStringAndSize(item, &buf, &buflen);
+                if (buflen == 0 && client->chunked_response) {
+                    // empty chunk terminates the body
+                    Py_DECREF(item);
+                    continue;
+                }
                 //write
                 if(client->chunked_response){
-                    bucket = new_write_bucket(client->fd, 4);
+                    bucket = new_write_bucket(client, 4);
                     if(bucket == NULL){
                         /* write_error_log(__FILE__, __LINE__); */
                         call_error_logger();
                         Py_DECREF(item);
                         return STATUS_ERROR;
                     }
-                    lendata  = NULL;
-                    len = 0;
-
-                    chunk_data = get_chunk_data(buflen);
-                    //TODO CHECK ERROR
-                    PyBytes_AsStringAndSize(chunk_data, &lendata, &len);
-                    set_chunked_data(bucket, lendata, len, buf, buflen);
-                    bucket->chunk_data = chunk_data;
+                    set_chunk(bucket, buf, buflen);
                 }else{
-                    bucket = new_write_bucket(client->fd, 1);
+                    bucket = new_write_bucket(client, 1);
                     if(bucket == NULL){
                         /* write_error_log(__FILE__, __LINE__); */
                         call_error_logger();
@@ -832,25 +1888,25 @@ process_write(client_t *client)
                     set2bucket(bucket, buf, buflen);
                 }
                 bucket->temp1 = item;
-                ret = writev_bucket(bucket);
-                if(ret != STATUS_OK){
-                    client->bucket = bucket;
-                    /* Py_DECREF(item); */
+                bucket->body_len = buflen;
+                if (client->body_items) {
+                    client->body_items--;
+                }
+                if (client->seq_body &&
+                    !(client->content_length_set && client->content_length <= client->write_bytes + buflen)) {
+                    bucket->more = client->body_items > 0 || client->chunked_response;
+                }
+                ret = send_bucket(client, bucket);
+                if(ret == STATUS_ERROR){
                     return ret;
                 }
-
-                free_write_bucket(bucket);
-                //mark
-                client->write_bytes += buflen;
                 //check write_bytes/content_length
                 if(client->content_length_set){
                     if(client->content_length <= client->write_bytes){
                         // all done
-                        /* Py_DECREF(item); */
                         break;
                     }
                 }
-                /* Py_DECREF(item); */
             }else{
                 PyErr_SetString(PyExc_TypeError, "response item must be a byte string");
                 Py_DECREF(item);
@@ -866,18 +1922,30 @@ process_write(client_t *client)
         if(PyErr_Occurred()){
             return STATUS_ERROR;
         }
+        if (client->compress) {
+            ret = finish_compress(client);
+            if (ret != STATUS_OK) {
+                return ret;
+            }
+        }
         if(client->chunked_response){
             DEBUG("write last chunk");
             //last packet
-            bucket = new_write_bucket(client->fd, 3);
+            bucket = new_write_bucket(client, 3);
             if(bucket == NULL){
                 /* write_error_log(__FILE__, __LINE__); */
                 call_error_logger();
                 return STATUS_ERROR;
             }
             set_last_chunked_data(bucket);
-            writev_bucket(bucket);
-            free_write_bucket(bucket);
+            if (send_bucket(client, bucket) == STATUS_ERROR) {
+                return STATUS_ERROR;
+            }
+        }
+        // the body is complete, wait for the output queue
+        Py_CLEAR(client->response_iter);
+        if (client->bucket) {
+            return STATUS_SUSPEND;
         }
         return close_response(client);
     }
@@ -886,70 +1954,358 @@ process_write(client_t *client)
 
 
 response_status
-process_body(client_t *client)
+process_body(client_t *client)
+{
+    response_status ret;
+
+    if(client->bucket){
+        //retry send
+        ret = flush_buckets(client);
+        if (ret == STATUS_ERROR) {
+            free_pending(client);
+            return ret;
+        }
+        if (ret == STATUS_SUSPEND &&
+            (client->file_response || client->buffered > output_low_watermark)) {
+            return ret;
+        }
+    }
+
+    if (client->file_response) {
+        ret = process_sendfile(client);
+    }else if (is_stream_response(client)) {
+        ret = process_stream(client);
+    }else{
+        ret = process_write(client);
+        if (ret == STATUS_OK && client->bucket) {
+            // output of a finished body is pending
+            ret = STATUS_SUSPEND;
+        }
+    }
+
+    return ret;
+}
+
+static file_response_t *
+new_file_response(client_t *client, int fd, size_t blksize)
+{
+    file_response_t *f;
+
+    f = PyMem_Malloc(sizeof(file_response_t));
+    if (f == NULL) {
+        return NULL;
+    }
+    memset(f, 0, sizeof(file_response_t));
+    f->fd = fd;
+    f->blksize = blksize;
+    client->file_response = f;
+    return f;
+}
+
+static void
+set_file_window(client_t *client, file_response_t *f, uint64_t base, uint64_t size)
+{
+    f->base = base;
+    f->size = size;
+    f->range_cnt = 1;
+    f->ranges[0].start = base;
+    f->ranges[0].end = base + size;
+    client->content_length = size;
+}
+
+/*
+ * open precompressed "<name>.gz" next to the file if the client accepts gzip.
+ * return fd or -1.
+ */
+static int
+open_gzip_sidecar(client_t *client, FileWrapperObject *filewrap, struct stat *info)
+{
+    PyObject *name, *path = NULL, *value;
+    char gzpath[PATH_MAX];
+    struct stat st;
+    int fd, len;
+
+    if (client->status_code != 200) {
+        return -1;
+    }
+    value = find_response_header(client, "Content-Encoding", 16);
+    if (value != NULL) {
+        Py_DECREF(value);
+        return -1;
+    }
+    name = PyObject_GetAttrString(filewrap->filelike, "name");
+    if (name == NULL) {
+        PyErr_Clear();
+        return -1;
+    }
+#ifdef PY3
+    if (!PyUnicode_Check(name) || !PyUnicode_FSConverter(name, &path)) {
+        path = NULL;
+    }
+#else
+    if (PyBytes_Check(name)) {
+        Py_INCREF(name);
+        path = name;
+    }
+#endif
+    Py_DECREF(name);
+    if (path == NULL) {
+        PyErr_Clear();
+        return -1;
+    }
+    len = snprintf(gzpath, sizeof(gzpath), "%s.gz", PyBytes_AS_STRING(path));
+    Py_DECREF(path);
+    if (len >= (int)sizeof(gzpath)) {
+        return -1;
+    }
+    if (stat(gzpath, &st) == -1 || !S_ISREG(st.st_mode) || st.st_mtime < info->st_mtime) {
+        return -1;
+    }
+    // representation depends on Accept-Encoding
+    client->vary_encoding = 1;
+    if (select_encoding(get_environ_value(client->current_req->environ, "HTTP_ACCEPT_ENCODING", NULL), 0) != ENCODING_GZIP) {
+        return -1;
+    }
+    fd = open(gzpath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    *info = st;
+    client->content_encoding = ENCODING_GZIP;
+    DEBUG("use gzip sidecar %s", gzpath);
+    return fd;
+}
+
+static response_status
+start_response_file(client_t *client)
+{
+    FileWrapperObject *filewrap;
+    file_response_t *f;
+    struct stat info;
+    off_t base;
+    uint64_t avail;
+    int in_fd, gz_fd = -1;
+
+    filewrap = (FileWrapperObject *)client->response;
+
+    in_fd = PyObject_AsFileDescriptor(filewrap->filelike);
+    if (in_fd == -1) {
+        PyErr_Clear();
+        DEBUG("can't get fd");
+        return STATUS_ERROR;
+    }
+    if (fstat(in_fd, &info) == -1){
+        PyErr_SetFromErrno(PyExc_IOError);
+        /* write_error_log(__FILE__, __LINE__);  */
+        call_error_logger();
+        return STATUS_ERROR;
+    }
+
+    if (unlikely(compress_level) && S_ISREG(info.st_mode) &&
+        filewrap->offset < 0 && filewrap->length < 0 && lseek(in_fd, 0, SEEK_CUR) == 0) {
+        gz_fd = open_gzip_sidecar(client, filewrap, &info);
+    }
+    if (gz_fd != -1) {
+        in_fd = gz_fd;
+    }
+
+    f = new_file_response(client, in_fd, filewrap->blksize);
+    if (f == NULL) {
+        if (gz_fd != -1) {
+            close(gz_fd);
+        }
+        return STATUS_ERROR;
+    }
+    f->close_fd = gz_fd != -1;
+
+    if (S_ISREG(info.st_mode)) {
+        if (filewrap->offset < 0) {
+            // start from current file position like the iterator does
+            base = lseek(in_fd, 0, SEEK_CUR);
+            if (base < 0) {
+                base = 0;
+            }
+        } else {
+            base = filewrap->offset;
+        }
+        avail = base < info.st_size ? info.st_size - base : 0;
+        if (filewrap->length >= 0 && (uint64_t)filewrap->length < avail) {
+            avail = filewrap->length;
+        }
+        set_file_window(client, f, base, avail);
+
+        if (client->status_code == 200 && client->http_parser->method == HTTP_GET) {
+            if (setup_range(client, f) == -1) {
+                call_error_logger();
+                return STATUS_ERROR;
+            }
+        } else if (client->http_parser->method == HTTP_HEAD) {
+            f->range_cnt = 0;
+        }
+    } else {
+        f->is_pipe = 1;
+    }
+    return write_headers(client, NULL, 0, 1);
+}
+
+response_status
+start_static_response(client_t *client, uint16_t code, const char *status, int fd, uint64_t size, void *entry)
+{
+    file_response_t *f;
+    response_status ret;
+
+    f = new_file_response(client, fd, DEFAULT_BLKSIZE);
+    if (f == NULL) {
+        static_file_release(entry);
+        return STATUS_ERROR;
+    }
+    f->static_entry = entry;
+    if (set_status_line(client, code, status) == -1) {
+        return STATUS_ERROR;
+    }
+    if (code == 304) {
+        return write_headers(client, NULL, 0, 0);
+    }
+
+    set_file_window(client, f, 0, size);
+    if (client->http_parser->method == HTTP_GET) {
+        if (setup_range(client, f) == -1) {
+            return STATUS_ERROR;
+        }
+    } else {
+        // HEAD
+        f->range_cnt = 0;
+    }
+    ret = write_headers(client, NULL, 0, 1);
+    if (ret == STATUS_OK) {
+        ret = process_sendfile(client);
+    }
+    return ret;
+}
+
+/*
+ * queue a piece of stream body. data and chunk may be shared with other
+ * connections, the bucket keeps references and the send progress.
+ */
+response_status
+write_stream_data(client_t *client, PyObject *data, PyObject *chunk)
+{
+    write_bucket *bucket;
+
+    bucket = new_write_bucket(client, client->chunked_response ? 4 : 1);
+    if (bucket == NULL) {
+        PyErr_NoMemory();
+        return STATUS_ERROR;
+    }
+    if (client->chunked_response) {
+        set_chunked_data(bucket, PyBytes_AS_STRING(chunk), PyBytes_GET_SIZE(chunk),
+                         PyBytes_AS_STRING(data), PyBytes_GET_SIZE(data));
+        Py_INCREF(chunk);
+        bucket->chunk_data = chunk;
+    } else {
+        set2bucket(bucket, PyBytes_AS_STRING(data), PyBytes_GET_SIZE(data));
+    }
+    Py_INCREF(data);
+    bucket->temp1 = data;
+    bucket->body_len = PyBytes_GET_SIZE(data);
+    return send_bucket(client, bucket);
+}
+
+response_status
+finish_stream_body(client_t *client)
 {
-    response_status ret;
     write_bucket *bucket;
-    if(client->bucket){
-        bucket = (write_bucket *)client->bucket;
-        //retry send
-        ret = writev_bucket(bucket);
+    response_status ret;
 
-        if(ret == STATUS_OK){
-            client->write_bytes += bucket->total_size;
-            free_write_bucket(bucket);
-            client->bucket = NULL;
-        }else if(ret == STATUS_ERROR){
-            free_write_bucket(bucket);
-            client->bucket = NULL;
-            return ret;
-        }else{
-            //
-            return ret;
-        }
+    if (!client->chunked_response) {
+        return STATUS_OK;
     }
-
-    if (CheckFileWrapper(client->response)) {
-        ret = process_sendfile(client);
-    }else{
-        ret = process_write(client);
+    bucket = new_write_bucket(client, 3);
+    if (bucket == NULL) {
+        PyErr_NoMemory();
+        return STATUS_ERROR;
+    }
+    set_last_chunked_data(bucket);
+    ret = send_bucket(client, bucket);
+    if (ret == STATUS_SUSPEND && client->bucket == NULL) {
+        ret = STATUS_OK;
     }
-
     return ret;
 }
 
-static response_status
-start_response_file(client_t *client)
+/*
+ * write response from cache entry data (status, headers, body).
+ * Server, Date and Connection are added per request.
+ */
+response_status
+write_cached_response(client_t *client, uint16_t status_code, PyObject *data)
 {
-    PyObject *filelike;
-    FileWrapperObject *filewrap;
-    int ret,in_fd, size;
-    struct stat info;
+    write_bucket *bucket;
+    PyObject *status, *headers, *body;
 
-    filewrap = (FileWrapperObject *)client->response;
-    filelike = filewrap->filelike;
+    status = PyTuple_GET_ITEM(data, 0);
+    headers = PyTuple_GET_ITEM(data, 1);
+    body = PyTuple_GET_ITEM(data, 2);
 
-    in_fd = PyObject_AsFileDescriptor(filelike);
-    if (in_fd == -1) {
-        PyErr_Clear();
-        DEBUG("can't get fd");
+    bucket = new_write_bucket(client, 20);
+    if (bucket == NULL) {
         return STATUS_ERROR;
     }
-    ret = write_headers(client, NULL, 0, 1);
-    if(!client->content_length_set){
-        if (fstat(in_fd, &info) == -1){
-            PyErr_SetFromErrno(PyExc_IOError);
-            /* write_error_log(__FILE__, __LINE__);  */
-            call_error_logger();
-            return STATUS_ERROR;
-        }
+    Py_INCREF(data);
+    bucket->temp1 = data;
 
-        size = info.st_size;
-        client->content_length_set = 1;
-        client->content_length = size;
+    if (client->http_parser->http_minor == 1) {
+        set2bucket(bucket, "HTTP/1.1 ", 9);
+    } else {
+        set2bucket(bucket, "HTTP/1.0 ", 9);
+    }
+    set2bucket(bucket, PyBytes_AS_STRING(status), PyBytes_GET_SIZE(status));
+    add_header(bucket, "Server", 6,  SERVER, sizeof(SERVER) -1);
+    add_header(bucket, "Date", 4, (char *)http_time, 29);
+    set2bucket(bucket, PyBytes_AS_STRING(headers), PyBytes_GET_SIZE(headers));
+    if (client->keep_alive == 1) {
+        add_header(bucket, "Connection", 10, "Keep-Alive", 10);
+    } else {
+        add_header(bucket, "Connection", 10, "close", 5);
+    }
+    set2bucket(bucket, CRLF, 2);
+    if (client->http_parser->method != HTTP_HEAD) {
+        set2bucket(bucket, PyBytes_AS_STRING(body), PyBytes_GET_SIZE(body));
     }
-    return ret;
 
+    client->status_code = status_code;
+    client->header_done = 1;
+    bucket->body_len = PyBytes_GET_SIZE(body);
+    return send_bucket(client, bucket);
+}
+
+void
+free_file_response(client_t *client)
+{
+    file_response_t *f = (file_response_t *)client->file_response;
+
+    if (f == NULL) {
+        return;
+    }
+    Py_XDECREF(f->parts);
+    if (f->buf) {
+        PyMem_Free(f->buf);
+    }
+    if (f->close_fd) {
+        close(f->fd);
+    }
+    disable_cork(client);
+    if (f->static_entry) {
+        static_file_release(f->static_entry);
+    }
+    PyMem_Free(f);
+    client->file_response = NULL;
+    client->range_response = RANGE_NONE;
+    client->wait_read = 0;
 }
 
 static response_status
@@ -961,6 +2317,24 @@ start_response_write(client_t *client)
     Py_ssize_t buflen;
     response_status ret;
 
+    if (PyList_Check(client->response) || PyTuple_Check(client->response)) {
+        client->seq_body = 1;
+        client->body_items = PySequence_Fast_GET_SIZE(client->response);
+    } else {
+        set_stream_lowat(client);
+    }
+
+    if (unlikely(compress_level)) {
+        if (setup_compress(client) == -1) {
+            call_error_logger();
+            return STATUS_ERROR;
+        }
+        if (client->compress &&
+            (PyList_Check(client->response) || PyTuple_Check(client->response))) {
+            return write_compressed_body(client);
+        }
+    }
+
     iterator = PyObject_GetIter(client->response);
     if (PyErr_Occurred()){
         /* write_error_log(__FILE__, __LINE__); */
@@ -973,13 +2347,26 @@ start_response_write(client_t *client)
     DEBUG("client %p", client);
     if(item != NULL && PyBytes_Check(item)){
 
+        if (client->compress) {
+            Py_SETREF(item, compress_item(client, PyBytes_AS_STRING(item), PyBytes_GET_SIZE(item), COMPRESS_FLUSH));
+            if (item == NULL) {
+                call_error_logger();
+                return STATUS_ERROR;
+            }
+        }
         //write string only
         buf = PyBytes_AS_STRING(item);
         buflen = PyBytes_GET_SIZE(item);
 
         /* DEBUG("status_code %d body:%.*s", client->status_code, (int)buflen, buf); */
-        ret = write_headers(client, buf, buflen, 0);
-        //TODO when ret == STATUS_SUSPEND keep item
+        ret = write_headers(client, buflen ? buf : NULL, buflen, 0);
+        if (client->body_items) {
+            client->body_items--;
+        }
+        if (ret == STATUS_SUSPEND && client->bucket) {
+            // keep item while bucket is pending
+            PyList_Append(((write_bucket *)client->bucket_tail)->temp1, item);
+        }
         Py_DECREF(item);
         return ret;
     }else{
@@ -1008,10 +2395,14 @@ response_start(client_t *client)
     if(client->status_code == 304){
         return write_headers(client, NULL, 0, 0);
     }
+    if (unlikely(response_cache_max_bytes)) {
+        response_cache_store(client);
+    }
 
-    if (CheckFileWrapper(client->response)) {
+    if (is_stream_response(client)) {
+        ret = start_stream(client);
+    }else if (CheckFileWrapper(client->response)) {
         DEBUG("use sendfile");
-        //enable_cork(client);
         ret = start_response_file(client);
         if(ret == STATUS_OK){
             // sended header
@@ -1020,9 +2411,12 @@ response_start(client_t *client)
     }else{
         ret = start_response_write(client);
         DEBUG("start_response_write status_code %d ret = %d", client->status_code, ret);
-        if(ret == STATUS_OK){
-            // sended header
+        if(ret != STATUS_ERROR){
+            // pull ahead while the headers are queued
             ret = process_write(client);
+            if (ret == STATUS_OK && client->bucket) {
+                ret = STATUS_SUSPEND;
+            }
         }
     }
     return ret;
@@ -1048,6 +2442,18 @@ create_start_response(client_t *cli)
     return (PyObject *)start_response;
 }
 
+/* start_response of its own, for calls on worker threads */
+PyObject*
+new_start_response(client_t *cli)
+{
+    ResponseObject *res = PyObject_NEW(ResponseObject, &ResponseObjectType);
+
+    if (res != NULL) {
+        res->cli = cli;
+    }
+    return (PyObject *)res;
+}
+
 static void
 ResponseObject_dealloc(ResponseObject* self)
 {
@@ -1207,7 +2613,7 @@ ResponseObject_call(PyObject *obj, PyObject *args, PyObject *kw)
 }
 
 static PyObject *
-FileWrapperObject_new(PyObject *self, PyObject *filelike, size_t blksize)
+FileWrapperObject_new(PyObject *self, PyObject *filelike, size_t blksize, long long offset, long long length)
 {
     FileWrapperObject *f;
     f = PyObject_NEW(FileWrapperObject, &FileWrapperType);
@@ -1215,6 +2621,9 @@ FileWrapperObject_new(PyObject *self, PyObject *filelike, size_t blksize)
         return NULL;
     }
 
+    f->blksize = blksize;
+    f->offset = offset;
+    f->length = length;
     f->filelike = filelike;
     Py_INCREF(f->filelike);
     GDEBUG("alloc FileWrapperObject %p", f);
@@ -1262,16 +2671,21 @@ FileWrapperObject_close(FileWrapperObject *self, PyObject *args)
 }
 
 PyObject *
-file_wrapper(PyObject *self, PyObject *args)
+file_wrapper(PyObject *self, PyObject *args, PyObject *kwds)
 {
     PyObject *filelike = NULL;
-    size_t blksize = 0;
-    //PyObject *result = NULL;
+    Py_ssize_t blksize = 0;
+    long long offset = -1, length = -1;
+    static char *kwlist[] = {"filelike", "blksize", "offset", "length", NULL};
 
-    if (!PyArg_ParseTuple(args, "O|l:file_wrapper", &filelike, &blksize))
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nLL:file_wrapper", kwlist,
+                                     &filelike, &blksize, &offset, &length))
         return NULL;
 
-    return FileWrapperObject_new(self, filelike, blksize);
+    if (blksize <= 0) {
+        blksize = DEFAULT_BLKSIZE;
+    }
+    return FileWrapperObject_new(self, filelike, blksize, offset, length);
 }
 
 int 
@@ -1279,6 +2693,7 @@ CheckFileWrapper(PyObject *obj)
 {
     FileWrapperObject *f;
     PyObject *filelike;
+    struct stat info;
     int in_fd;
     if (obj->ob_type != &FileWrapperType){
         return 0;
@@ -1292,8 +2707,292 @@ CheckFileWrapper(PyObject *obj)
         PyErr_Clear();
         return 0;
     }
+    if (fstat(in_fd, &info) == -1) {
+        return 0;
+    }
+    if (S_ISREG(info.st_mode)) {
+        return 1;
+    }
+#ifdef linux
+    if (S_ISFIFO(info.st_mode)) {
+        return 1;
+    }
+#endif
+    // socket, tty etc. use iterator
+    return 0;
+}
 
-    return 1;
+static int
+is_reserved_header(const char *name)
+{
+    return !strcasecmp(name, "Server") || !strcasecmp(name, "Date") ||
+           !strcasecmp(name, "Connection") || !strcasecmp(name, "Content-Length") ||
+           !strcasecmp(name, "Transfer-Encoding");
+}
+
+/*
+ * serialize response headers for the response cache.
+ * reserved headers are dropped and Content-Length is set to body length.
+ * ttl is taken from the cache header.
+ * return NULL without exception if the response must not be cached.
+ */
+PyObject *
+serialize_cache_headers(PyObject *headers, size_t body_len, long *ttl)
+{
+    PyObject *fast = NULL, *tuple, *bytes1 = NULL, *bytes2 = NULL;
+    HeaderBlockObject *block;
+    buffer_t *buf = NULL;
+    char *name = NULL, *value = NULL, *end;
+    Py_ssize_t namelen, valuelen, i, hlen;
+    uint64_t overrides = 0;
+    uint32_t j;
+    header_entry *entry;
+    char lendata[48];
+    int len;
+
+    fast = PySequence_Fast(headers, "headers must be a list of tuple");
+    if (fast == NULL) {
+        return NULL;
+    }
+    buf = new_buffer(256, 0);
+    if (buf == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    hlen = PySequence_Fast_GET_SIZE(fast);
+    for (i = 0; i < hlen; i++) {
+        tuple = PySequence_Fast_GET_ITEM(fast, i);
+        if (CheckHeaderBlock(tuple)) {
+            block = (HeaderBlockObject *)tuple;
+            for (j = 0; j < block->count; j++) {
+                entry = block->entries + j;
+                mark_default_override(PyBytes_AS_STRING(block->data) + entry->name_off, entry->namelen, &overrides);
+            }
+            if (write2buf(buf, PyBytes_AS_STRING(block->data), PyBytes_GET_SIZE(block->data)) != WRITE_OK) {
+                goto error;
+            }
+            continue;
+        }
+        if (!PyTuple_Check(tuple) || PyTuple_GET_SIZE(tuple) != 2) {
+            PyErr_SetString(PyExc_TypeError, "list of tuple(name, value) expected");
+            goto error;
+        }
+        bytes1 = wsgi_to_bytes(PyTuple_GET_ITEM(tuple, 0));
+        if (bytes1 == NULL || PyBytes_AsStringAndSize(bytes1, &name, &namelen) == -1) {
+            goto error;
+        }
+        bytes2 = wsgi_to_bytes(PyTuple_GET_ITEM(tuple, 1));
+        if (bytes2 == NULL || PyBytes_AsStringAndSize(bytes2, &value, &valuelen) == -1) {
+            goto error;
+        }
+        if (check_header(name, value) == -1) {
+            goto error;
+        }
+        if (!strcasecmp(name, CACHE_HEADER)) {
+            *ttl = strtol(value, &end, 10);
+            if (*end) {
+                *ttl = 0;
+            }
+        } else if (!strcasecmp(name, "Set-Cookie")) {
+            // per client response
+            goto error;
+        } else if (!is_reserved_header(name)) {
+            mark_default_override(name, namelen, &overrides);
+            if (write2buf(buf, name, namelen) != WRITE_OK ||
+                write2buf(buf, DELIM, 2) != WRITE_OK ||
+                write2buf(buf, value, valuelen) != WRITE_OK ||
+                write2buf(buf, CRLF, 2) != WRITE_OK) {
+                goto error;
+            }
+        }
+        Py_CLEAR(bytes1);
+        Py_CLEAR(bytes2);
+    }
+
+    if (default_headers) {
+        for (j = 0; j < default_headers->count; j++) {
+            entry = default_headers->entries + j;
+            if (!(overrides & ((uint64_t)1 << j)) &&
+                write2buf(buf, PyBytes_AS_STRING(default_headers->data) + entry->line_off, entry->linelen) != WRITE_OK) {
+                goto error;
+            }
+        }
+    }
+    len = snprintf(lendata, sizeof(lendata), "Content-Length: %zu\r\n", body_len);
+    if (write2buf(buf, lendata, len) != WRITE_OK) {
+        goto error;
+    }
+    Py_DECREF(fast);
+    return getPyString(buf);
+
+error:
+    Py_XDECREF(bytes1);
+    Py_XDECREF(bytes2);
+    Py_XDECREF(fast);
+    if (buf) {
+        free_buffer(buf);
+    }
+    return NULL;
+}
+
+static PyObject *
+HeaderBlockObject_new(PyObject *headers)
+{
+    HeaderBlockObject *block = NULL;
+    PyObject *fast = NULL, *tuple = NULL, *bytes1 = NULL, *bytes2 = NULL;
+    header_entry *entries = NULL, *entry;
+    buffer_t *buf = NULL;
+    char *name = NULL, *value = NULL;
+    Py_ssize_t namelen, valuelen, i, hlen;
+
+    if (CheckHeaderBlock(headers)) {
+        Py_INCREF(headers);
+        return headers;
+    }
+
+    fast = PySequence_Fast(headers, "headers must be a list of tuple");
+    if (fast == NULL) {
+        return NULL;
+    }
+    hlen = PySequence_Fast_GET_SIZE(fast);
+
+    entries = PyMem_Malloc(sizeof(header_entry) * (hlen ? hlen : 1));
+    if (entries == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    buf = new_buffer(256, 0);
+    if (buf == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+
+    for (i = 0; i < hlen; i++) {
+        tuple = PySequence_Fast_GET_ITEM(fast, i);
+        if (!PyTuple_Check(tuple) || PyTuple_GET_SIZE(tuple) != 2) {
+            PyErr_SetString(PyExc_TypeError, "list of tuple(name, value) expected");
+            goto error;
+        }
+        bytes1 = wsgi_to_bytes(PyTuple_GET_ITEM(tuple, 0));
+        if (bytes1 == NULL || PyBytes_AsStringAndSize(bytes1, &name, &namelen) == -1) {
+            goto error;
+        }
+        bytes2 = wsgi_to_bytes(PyTuple_GET_ITEM(tuple, 1));
+        if (bytes2 == NULL || PyBytes_AsStringAndSize(bytes2, &value, &valuelen) == -1) {
+            goto error;
+        }
+        if (check_header(name, value) == -1) {
+            goto error;
+        }
+        if (is_reserved_header(name)) {
+            PyErr_Format(PyExc_ValueError, "header '%s' can not be compiled", name);
+            goto error;
+        }
+
+        entry = entries + i;
+        entry->line_off = buf->len;
+        entry->name_off = buf->len;
+        entry->namelen = namelen;
+        if (write2buf(buf, name, namelen) != WRITE_OK ||
+            write2buf(buf, DELIM, 2) != WRITE_OK ||
+            write2buf(buf, value, valuelen) != WRITE_OK ||
+            write2buf(buf, CRLF, 2) != WRITE_OK) {
+            goto error;
+        }
+        entry->linelen = buf->len - entry->line_off;
+        Py_CLEAR(bytes1);
+        Py_CLEAR(bytes2);
+    }
+
+    block = PyObject_NEW(HeaderBlockObject, &HeaderBlockType);
+    if (block == NULL) {
+        goto error;
+    }
+    block->data = getPyString(buf);
+    buf = NULL;
+    block->entries = entries;
+    block->count = (uint32_t)hlen;
+    if (block->data == NULL) {
+        Py_DECREF(block);
+        Py_DECREF(fast);
+        return NULL;
+    }
+    Py_DECREF(fast);
+    GDEBUG("alloc HeaderBlockObject %p", block);
+    return (PyObject *)block;
+
+error:
+    Py_XDECREF(bytes1);
+    Py_XDECREF(bytes2);
+    Py_XDECREF(fast);
+    if (buf) {
+        free_buffer(buf);
+    }
+    if (entries) {
+        PyMem_Free(entries);
+    }
+    return NULL;
+}
+
+static void
+HeaderBlockObject_dealloc(HeaderBlockObject *self)
+{
+    GDEBUG("dealloc HeaderBlockObject %p", self);
+    Py_XDECREF(self->data);
+    if (self->entries) {
+        PyMem_Free(self->entries);
+    }
+    PyObject_DEL(self);
+}
+
+static Py_ssize_t
+HeaderBlockObject_length(HeaderBlockObject *self)
+{
+    return self->count;
+}
+
+PyObject *
+new_header_block(PyObject *headers)
+{
+    return HeaderBlockObject_new(headers);
+}
+
+PyObject *
+compile_headers(PyObject *self, PyObject *args)
+{
+    PyObject *headers = NULL;
+
+    if (!PyArg_ParseTuple(args, "O:compile_headers", &headers)) {
+        return NULL;
+    }
+    return HeaderBlockObject_new(headers);
+}
+
+PyObject *
+set_default_headers(PyObject *self, PyObject *args)
+{
+    PyObject *headers = NULL, *block = NULL;
+
+    if (!PyArg_ParseTuple(args, "O:set_default_headers", &headers)) {
+        return NULL;
+    }
+    if (headers != Py_None) {
+        block = HeaderBlockObject_new(headers);
+        if (block == NULL) {
+            return NULL;
+        }
+        if (((HeaderBlockObject *)block)->count > MAX_DEFAULT_HEADERS) {
+            Py_DECREF(block);
+            PyErr_Format(PyExc_ValueError, "too many default headers (max %d)", MAX_DEFAULT_HEADERS);
+            return NULL;
+        }
+        if (((HeaderBlockObject *)block)->count == 0) {
+            Py_CLEAR(block);
+        }
+    }
+    Py_XDECREF(default_headers);
+    default_headers = (HeaderBlockObject *)block;
+    Py_RETURN_NONE;
 }
 
 static PyMethodDef FileWrapperObject_method[] = {
@@ -1393,3 +3092,53 @@ PyTypeObject FileWrapperType = {
     0,                           /* tp_new */
 };
 
+static PySequenceMethods HeaderBlockObject_as_sequence = {
+    (lenfunc)HeaderBlockObject_length, /* sq_length */
+};
+
+PyTypeObject HeaderBlockType = {
+#ifdef PY3
+    PyVarObject_HEAD_INIT(NULL, 0)
+#else
+    PyObject_HEAD_INIT(NULL)
+    0,                    /* ob_size */
+#endif
+    MODULE_NAME ".HeaderBlock",             /*tp_name*/
+    sizeof(HeaderBlockObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)HeaderBlockObject_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &HeaderBlockObject_as_sequence, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "pre-serialized response headers",           /* tp_doc */
+    0,                       /* tp_traverse */
+    0,                       /* tp_clear */
+    0,                       /* tp_richcompare */
+    0,                       /* tp_weaklistoffset */
+    0,                       /* tp_iter */
+    0,                       /* tp_iternext */
+    0,             /* tp_methods */
+    0,             /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                      /* tp_init */
+    0,                         /* tp_alloc */
+    0,                           /* tp_new */
+};
+
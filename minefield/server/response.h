@@ -16,8 +16,13 @@ typedef struct {
     uint32_t total;
     uint32_t total_size;
     uint8_t sended;
+    uint8_t more; //more data follows, send with MSG_MORE
+    uint32_t body_len; //body bytes in this bucket
     PyObject *temp1; //keep origin pointer
     PyObject *chunk_data; //keep chunk_data origin pointer
+    void *next; //next bucket of client output queue
+    arena_t *arena; //request arena of the bucket and iov, NULL on the heap
+    char chunk_size[18]; //hex size of the chunk
 } write_bucket;
 
 
@@ -29,9 +34,59 @@ typedef struct {
 typedef struct {
     PyObject_HEAD
     PyObject *filelike;
-
+    size_t blksize;
+    long long offset;           // start offset, -1 is current file position
+    long long length;           // max bytes, -1 is until EOF
 } FileWrapperObject;
 
+#define RANGE_NONE 0
+#define RANGE_SINGLE 1
+#define RANGE_MULTI 2
+#define RANGE_UNSATISFIABLE 3
+
+#define MAX_RANGES 16
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;               // exclusive
+} byte_range;
+
+typedef struct {
+    int fd;
+    uint8_t is_pipe;
+    uint8_t use_pread;
+    uint8_t part_done;
+    uint8_t close_fd;           // fd is owned (precompressed sidecar)
+    size_t blksize;
+    uint64_t base;              // file offset of the first byte
+    uint64_t size;              // representation length
+    uint32_t range_cnt;
+    uint32_t range_idx;
+    uint64_t pos;               // sent bytes of current range
+    uint64_t part_pos;          // sent bytes of current part header
+    PyObject *parts;            // multipart part headers and closing boundary
+    void *static_entry;         // static file cache entry
+    char *buf;                  // pread buffer
+    char boundary[24];
+    byte_range ranges[MAX_RANGES];
+} file_response_t;
+
+typedef struct {
+    size_t name_off;
+    size_t namelen;
+    size_t line_off;
+    size_t linelen;
+} header_entry;
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *data;           // serialized "name: value\r\n" lines (PyBytes)
+    header_entry *entries;
+    uint32_t count;
+} HeaderBlockObject;
+
+#define MAX_DEFAULT_HEADERS 64
+
 typedef enum {
     STATUS_OK = 0,
     STATUS_SUSPEND,
@@ -40,16 +95,33 @@ typedef enum {
 
 extern PyTypeObject ResponseObjectType;
 extern PyTypeObject FileWrapperType;
-extern ResponseObject *start_response;
+extern PyTypeObject HeaderBlockType;
+extern THREAD_LOCAL ResponseObject *start_response;
 
 PyObject* create_start_response(client_t *cli);
 
-PyObject* file_wrapper(PyObject *self, PyObject *args);
+PyObject* new_start_response(client_t *cli);
+
+PyObject* file_wrapper(PyObject *self, PyObject *args, PyObject *kwds);
 
 int CheckFileWrapper(PyObject *obj);
 
+int CheckHeaderBlock(PyObject *obj);
+
+PyObject* compile_headers(PyObject *self, PyObject *args);
+
+PyObject* set_default_headers(PyObject *self, PyObject *args);
+
 response_status response_start(client_t *client);
 
+response_status write_headers(client_t *client, char *data, size_t datalen, char is_file);
+
+PyObject* get_chunk_data(size_t datalen);
+
+response_status write_stream_data(client_t *client, PyObject *data, PyObject *chunk);
+
+response_status finish_stream_body(client_t *client);
+
 response_status process_body(client_t *client);
 
 response_status close_response(client_t *client);
@@ -58,7 +130,27 @@ void setup_start_response(void);
 
 void clear_start_response(void);
 
-void send_error_page(client_t *client);
+response_status send_error_page(client_t *client);
+
+response_status send_continue(client_t *client);
+
+response_status write_pending(client_t *client);
+
+void free_pending(client_t *client);
+
+int output_full(client_t *client);
+
+extern uint64_t total_buffered;
+
+void free_file_response(client_t *client);
+
+response_status start_static_response(client_t *client, uint16_t code, const char *status, int fd, uint64_t size, void *entry);
+
+PyObject* new_header_block(PyObject *headers);
+
+PyObject* serialize_cache_headers(PyObject *headers, size_t body_len, long *ttl);
+
+response_status write_cached_response(client_t *client, uint16_t status_code, PyObject *data);
 
 
 #endif
@@ -0,0 +1,505 @@
+#include "response_cache.h"
+#include "util.h"
+#include "time_cache.h"
+#include "server.h"
+#include <ctype.h>
+
+size_t response_cache_max_bytes = 0;
+
+static size_t cache_bytes = 0;
+static cache_entry *buckets[CACHE_HASH_SIZE];
+static cache_entry *lru_head = NULL;
+static cache_entry *lru_tail = NULL;
+
+static char *vary_keys[MAX_CACHE_VARY];
+static int vary_cnt = 0;
+
+// entries are shared by the loops of set_loops()
+DECLARE_CACHE_LOCK;
+
+static const char *key_names[] = {"HTTP_HOST", "PATH_INFO", "QUERY_STRING"};
+
+static uint32_t
+hash_key(const char *key, size_t len)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while (len--) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * key is host, path, query and vary header values separated by NUL,
+ * each one after '+', or '-' alone when it is missing.
+ * only GET responses are cached so method is implied.
+ */
+static int
+build_key(PyObject *environ, char *key, size_t *keylen)
+{
+    size_t len = 0;
+    Py_ssize_t vlen;
+    char *value;
+    int i;
+
+    for (i = 0; i < 3 + vary_cnt; i++) {
+        value = get_environ_value(environ, i < 3 ? key_names[i] : vary_keys[i - 3], &vlen);
+        if (value == NULL) {
+            vlen = 0;
+        }
+        if (len + vlen + 2 > MAX_CACHE_KEY) {
+            return -1;
+        }
+        if (value == NULL) {
+            key[len++] = '-';
+        } else {
+            key[len++] = '+';
+            memcpy(key + len, value, vlen);
+            len += vlen;
+        }
+        key[len++] = '\0';
+    }
+    *keylen = len;
+    return 1;
+}
+
+static void
+lru_unlink(cache_entry *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        lru_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        lru_tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void
+lru_push(cache_entry *e)
+{
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) {
+        lru_head->prev = e;
+    }
+    lru_head = e;
+    if (lru_tail == NULL) {
+        lru_tail = e;
+    }
+}
+
+static void
+remove_entry(cache_entry *e)
+{
+    cache_entry **pp;
+
+    pp = &buckets[e->hash % CACHE_HASH_SIZE];
+    while (*pp && *pp != e) {
+        pp = &(*pp)->hnext;
+    }
+    if (*pp) {
+        *pp = e->hnext;
+    }
+    lru_unlink(e);
+    cache_bytes -= e->size;
+    // pending writes keep their own reference to data
+    Py_DECREF(e->data);
+    PyMem_Free(e->key);
+    PyMem_Free(e);
+}
+
+static void
+clear_entries(void)
+{
+    while (lru_head) {
+        remove_entry(lru_head);
+    }
+}
+
+static cache_entry *
+find_entry(const char *key, size_t keylen, uint32_t hash)
+{
+    cache_entry *e;
+
+    for (e = buckets[hash % CACHE_HASH_SIZE]; e; e = e->hnext) {
+        if (e->hash == hash && e->keylen == keylen && !memcmp(e->key, key, keylen)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static int
+insert_entry(PyObject *environ, uint16_t status_code, PyObject *data, long ttl)
+{
+    char key[MAX_CACHE_KEY];
+    size_t keylen, size;
+    uint32_t hash;
+    cache_entry *e;
+    Py_ssize_t i;
+
+    if (build_key(environ, key, &keylen) == -1) {
+        return 0;
+    }
+    size = sizeof(cache_entry) + keylen;
+    for (i = 0; i < PyTuple_GET_SIZE(data); i++) {
+        size += PyBytes_GET_SIZE(PyTuple_GET_ITEM(data, i));
+    }
+    if (size > response_cache_max_bytes) {
+        return 0;
+    }
+
+    hash = hash_key(key, keylen);
+    e = find_entry(key, keylen, hash);
+    if (e) {
+        remove_entry(e);
+    }
+    while (lru_tail && cache_bytes + size > response_cache_max_bytes) {
+        remove_entry(lru_tail);
+    }
+
+    e = PyMem_Malloc(sizeof(cache_entry));
+    if (e == NULL) {
+        return -1;
+    }
+    memset(e, 0, sizeof(cache_entry));
+    e->key = PyMem_Malloc(keylen);
+    if (e->key == NULL) {
+        PyMem_Free(e);
+        return -1;
+    }
+    memcpy(e->key, key, keylen);
+    e->keylen = keylen;
+    e->hash = hash;
+    e->status_code = status_code;
+    e->size = size;
+    e->expire_msec = current_msec + ttl * 1000;
+    Py_INCREF(data);
+    e->data = data;
+
+    e->hnext = buckets[hash % CACHE_HASH_SIZE];
+    buckets[hash % CACHE_HASH_SIZE] = e;
+    lru_push(e);
+    cache_bytes += size;
+    DEBUG("cache response size:%d ttl:%ld", (int)size, ttl);
+    return 1;
+}
+
+/*
+ * write cached response.
+ * return 0 if not found (call application)
+ */
+int
+response_cache_start(client_t *client, response_status *status)
+{
+    char key[MAX_CACHE_KEY];
+    size_t keylen;
+    uint32_t hash;
+    cache_entry *e;
+    PyObject *data;
+    uint16_t code;
+
+    if (likely(lru_head == NULL)) {
+        return 0;
+    }
+    if (client->http_parser->method != HTTP_GET &&
+        client->http_parser->method != HTTP_HEAD) {
+        return 0;
+    }
+    if (build_key(client->current_req->environ, key, &keylen) == -1) {
+        return 0;
+    }
+    hash = hash_key(key, keylen);
+    CACHE_LOCK();
+    e = find_entry(key, keylen, hash);
+    if (e == NULL) {
+        CACHE_UNLOCK();
+        return 0;
+    }
+    if (e->expire_msec <= current_msec) {
+        remove_entry(e);
+        CACHE_UNLOCK();
+        return 0;
+    }
+    lru_unlink(e);
+    lru_push(e);
+    data = e->data;
+    Py_INCREF(data);
+    code = e->status_code;
+    CACHE_UNLOCK();
+    DEBUG("response cache hit %p", e);
+    *status = write_cached_response(client, code, data);
+    Py_DECREF(data);
+    return 1;
+}
+
+static int
+has_cache_header(PyObject *headers)
+{
+    PyObject *item, *name;
+    Py_ssize_t i;
+
+    if (!PyList_Check(headers)) {
+        return 0;
+    }
+    for (i = 0; i < PyList_GET_SIZE(headers); i++) {
+        item = PyList_GET_ITEM(headers, i);
+        if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 2) {
+            continue;
+        }
+        name = PyTuple_GET_ITEM(item, 0);
+#ifdef PY3
+        if (PyUnicode_Check(name) && PyUnicode_GET_LENGTH(name) == sizeof(CACHE_HEADER) - 1) {
+            const char *s = PyUnicode_AsUTF8(name);
+            if (s && !strcasecmp(s, CACHE_HEADER)) {
+                return 1;
+            }
+        }
+#else
+        if (PyBytes_Check(name) && !strcasecmp(PyBytes_AS_STRING(name), CACHE_HEADER)) {
+            return 1;
+        }
+#endif
+    }
+    return 0;
+}
+
+static PyObject *
+join_body(PyObject *response)
+{
+    PyObject *fast, *item, *body;
+    Py_ssize_t i, len, total = 0;
+    char *p;
+
+    fast = PySequence_Fast(response, "response must be a sequence");
+    if (fast == NULL) {
+        return NULL;
+    }
+    len = PySequence_Fast_GET_SIZE(fast);
+    for (i = 0; i < len; i++) {
+        item = PySequence_Fast_GET_ITEM(fast, i);
+        if (!PyBytes_Check(item)) {
+            Py_DECREF(fast);
+            return NULL;
+        }
+        total += PyBytes_GET_SIZE(item);
+    }
+    body = PyBytes_FromStringAndSize(NULL, total);
+    if (body == NULL) {
+        Py_DECREF(fast);
+        return NULL;
+    }
+    p = PyBytes_AS_STRING(body);
+    for (i = 0; i < len; i++) {
+        item = PySequence_Fast_GET_ITEM(fast, i);
+        memcpy(p, PyBytes_AS_STRING(item), PyBytes_GET_SIZE(item));
+        p += PyBytes_GET_SIZE(item);
+    }
+    Py_DECREF(fast);
+    return body;
+}
+
+/*
+ * store response of the application when it has the cache header.
+ * only list or tuple bodies are stored, the iterator is not consumed.
+ */
+void
+response_cache_store(client_t *client)
+{
+    PyObject *body = NULL, *headers = NULL, *status = NULL, *data = NULL;
+    long ttl = 0;
+
+    if (client->http_parser->method != HTTP_GET || client->headers == NULL ||
+        client->http_status == NULL) {
+        return;
+    }
+    if (!has_cache_header(client->headers)) {
+        return;
+    }
+    if (!PyList_Check(client->response) && !PyTuple_Check(client->response)) {
+        return;
+    }
+    body = join_body(client->response);
+    if (body == NULL) {
+        goto error;
+    }
+    headers = serialize_cache_headers(client->headers, PyBytes_GET_SIZE(body), &ttl);
+    if (headers == NULL || ttl <= 0) {
+        goto error;
+    }
+    // strip "HTTP/1.x "
+    status = PyBytes_FromStringAndSize(PyBytes_AS_STRING(client->http_status) + 9,
+                                       PyBytes_GET_SIZE(client->http_status) - 9);
+    if (status == NULL) {
+        goto error;
+    }
+    data = PyTuple_Pack(3, status, headers, body);
+    if (data == NULL) {
+        goto error;
+    }
+    CACHE_LOCK();
+    insert_entry(client->current_req->environ, client->status_code, data, ttl);
+    CACHE_UNLOCK();
+error:
+    PyErr_Clear();
+    Py_XDECREF(body);
+    Py_XDECREF(headers);
+    Py_XDECREF(status);
+    Py_XDECREF(data);
+}
+
+PyObject *
+set_response_cache(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    Py_ssize_t max_bytes = 0, i, len;
+    PyObject *vary = NULL, *fast = NULL, *item, *bytes;
+    char *name, *p;
+    static char *kwlist[] = {"max_bytes", "vary", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "n|O:set_response_cache", kwlist, &max_bytes, &vary)) {
+        return NULL;
+    }
+    if (max_bytes < 0) {
+        PyErr_SetString(PyExc_ValueError, "max_bytes must be >= 0");
+        return NULL;
+    }
+    if (vary != NULL && vary != Py_None) {
+        fast = PySequence_Fast(vary, "vary must be a sequence of header names");
+        if (fast == NULL) {
+            return NULL;
+        }
+        if (PySequence_Fast_GET_SIZE(fast) > MAX_CACHE_VARY) {
+            Py_DECREF(fast);
+            PyErr_Format(PyExc_ValueError, "too many vary headers (max %d)", MAX_CACHE_VARY);
+            return NULL;
+        }
+    }
+
+    CACHE_LOCK();
+    clear_entries();
+    for (i = 0; i < vary_cnt; i++) {
+        PyMem_Free(vary_keys[i]);
+    }
+    vary_cnt = 0;
+    response_cache_max_bytes = max_bytes;
+    CACHE_UNLOCK();
+
+    if (fast) {
+        len = PySequence_Fast_GET_SIZE(fast);
+        for (i = 0; i < len; i++) {
+            item = PySequence_Fast_GET_ITEM(fast, i);
+#ifdef PY3
+            bytes = PyUnicode_AsLatin1String(item);
+#else
+            bytes = PyObject_Str(item);
+#endif
+            if (bytes == NULL) {
+                Py_DECREF(fast);
+                return NULL;
+            }
+            // Accept-Encoding -> HTTP_ACCEPT_ENCODING
+            name = PyMem_Malloc(PyBytes_GET_SIZE(bytes) + 6);
+            if (name == NULL) {
+                Py_DECREF(bytes);
+                Py_DECREF(fast);
+                return PyErr_NoMemory();
+            }
+            strcpy(name, "HTTP_");
+            strcpy(name + 5, PyBytes_AS_STRING(bytes));
+            for (p = name + 5; *p; p++) {
+                *p = *p == '-' ? '_' : toupper((unsigned char)*p);
+            }
+            Py_DECREF(bytes);
+            vary_keys[vary_cnt++] = name;
+        }
+        Py_DECREF(fast);
+    }
+    Py_RETURN_NONE;
+}
+
+PyObject *
+cache_response(PyObject *self, PyObject *args)
+{
+    PyObject *environ, *status, *headers, *body;
+    PyObject *bytes = NULL, *serialized = NULL, *data = NULL;
+    long ttl, header_ttl = 0;
+    char *end;
+    long code;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "O!OOSl:cache_response", &PyDict_Type, &environ,
+                          &status, &headers, &body, &ttl)) {
+        return NULL;
+    }
+    if (response_cache_max_bytes == 0) {
+        PyErr_SetString(PyExc_RuntimeError, "response cache is disabled");
+        return NULL;
+    }
+#ifdef PY3
+    bytes = PyUnicode_AsLatin1String(status);
+#else
+    bytes = PyObject_Str(status);
+#endif
+    if (bytes == NULL) {
+        return NULL;
+    }
+    code = strtol(PyBytes_AS_STRING(bytes), &end, 10);
+    if (code < 100 || code > 999 || *end != ' ') {
+        PyErr_SetString(PyExc_ValueError, "status code is invalid");
+        goto error;
+    }
+    serialized = serialize_cache_headers(headers, PyBytes_GET_SIZE(body), &header_ttl);
+    if (serialized == NULL) {
+        if (!PyErr_Occurred()) {
+            PyErr_SetString(PyExc_ValueError, "response is not cacheable");
+        }
+        goto error;
+    }
+    Py_SETREF(bytes, PyBytes_FromFormat("%s\r\n", PyBytes_AS_STRING(bytes)));
+    if (bytes == NULL) {
+        goto error;
+    }
+    data = PyTuple_Pack(3, bytes, serialized, body);
+    if (data == NULL) {
+        goto error;
+    }
+    ret = 0;
+    if (ttl > 0) {
+        if (!loop_thread()) {
+            // a worker thread of set_threads(), its time cache is not updated
+            cache_time_update();
+        }
+        CACHE_LOCK();
+        ret = insert_entry(environ, (uint16_t)code, data, ttl);
+        CACHE_UNLOCK();
+    }
+    if (ret == -1) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    Py_DECREF(bytes);
+    Py_DECREF(serialized);
+    Py_DECREF(data);
+    return PyBool_FromLong(ret);
+error:
+    Py_XDECREF(bytes);
+    Py_XDECREF(serialized);
+    Py_XDECREF(data);
+    return NULL;
+}
+
+PyObject *
+clear_response_cache(PyObject *self, PyObject *args)
+{
+    CACHE_LOCK();
+    clear_entries();
+    CACHE_UNLOCK();
+    Py_RETURN_NONE;
+}
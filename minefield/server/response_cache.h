@@ -0,0 +1,38 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include "minefield.h"
+#include "client.h"
+#include "response.h"
+
+#define CACHE_HEADER "X-Minefield-Cache"
+#define CACHE_HASH_SIZE 1024
+#define MAX_CACHE_VARY 8
+#define MAX_CACHE_KEY 4096
+
+typedef struct _cache_entry {
+    char *key;
+    size_t keylen;
+    uint32_t hash;
+    uint16_t status_code;
+    PyObject *data;             // (status, headers, body) bytes tuple
+    size_t size;
+    uintptr_t expire_msec;
+    struct _cache_entry *hnext;
+    struct _cache_entry *prev;
+    struct _cache_entry *next;
+} cache_entry;
+
+extern size_t response_cache_max_bytes;
+
+int response_cache_start(client_t *client, response_status *status);
+
+void response_cache_store(client_t *client);
+
+PyObject* set_response_cache(PyObject *self, PyObject *args, PyObject *kwds);
+
+PyObject* cache_response(PyObject *self, PyObject *args);
+
+PyObject* clear_response_cache(PyObject *self, PyObject *args);
+
+#endif
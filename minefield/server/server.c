@@ -2,6 +2,7 @@
 
 #include <arpa/inet.h>
 #include <signal.h>
+#include <pthread.h>
 
 #ifdef linux
 #include <sys/prctl.h>
@@ -10,6 +11,7 @@
 
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <math.h>
 
 #include "http_request_parser.h"
 #include "response.h"
@@ -19,6 +21,20 @@
 #include "input.h"
 #include "timer.h"
 #include "heapq.h"
+#include "static_file.h"
+#include "response_cache.h"
+#include "compress.h"
+#include "stream.h"
+#include "continuation.h"
+#include "pool.h"
+#include "access_log.h"
+#include "log_ring.h"
+#include "stats.h"
+#include "stall.h"
+#include "probes.h"
+#include "trace.h"
+#include "slab.h"
+#include "memory.h"
 
 #define ACCEPT_TIMEOUT_SECS 1
 #define READ_TIMEOUT_SECS 30
@@ -35,17 +51,43 @@ static char *server_name = "127.0.0.1";
 static uint16_t server_port = 8000;
 /* static int listen_sock;  // listen socket */
 static PyObject *listen_socks = NULL;  // listen socket
+static THREAD_LOCAL PyObject *loop_socks = NULL;  // listen sockets of the loop
 
-static volatile sig_atomic_t loop_done;
+static THREAD_LOCAL volatile sig_atomic_t loop_done;
 static volatile sig_atomic_t call_shutdown = 0;
 static volatile sig_atomic_t catch_signal = 0;
 
-static picoev_loop* main_loop = NULL; //main loop
-static heapq_t *g_timers;
-static pending_queue_t *g_pendings = NULL;
+static THREAD_LOCAL picoev_loop* main_loop = NULL; //loop of the thread
+static THREAD_LOCAL heapq_t *g_timers = NULL;
+static THREAD_LOCAL pending_queue_t *g_pendings = NULL;
 
 // active event cnt
-static int activecnt = 0;
+static THREAD_LOCAL int activecnt = 0;
+
+/*
+ * server.run() loops, one per thread.
+ * other threads reach a loop through its wakeup fd: scheduled calls and
+ * shutdown requests are posted under the lock.
+ */
+typedef struct {
+    pthread_t thread;
+    int wake_fd;
+    int wake_wfd;
+    pthread_mutex_t lock;
+    PyObject *calls;            // posted TimerObjects
+    int stop_timeout;           // posted shutdown, -1 is none
+    PyObject *socks;            // listen sockets of the loop
+} loop_thread_t;
+
+#define MAX_LOOPS 256
+
+static int server_loops = 1; // set_loops
+static loop_thread_t loops[MAX_LOOPS]; // [0] is the first loop, the thread of server.run()
+static int loop_cnt = 0; // opened loops
+static THREAD_LOCAL loop_thread_t *current_loop = NULL;
+
+static pthread_mutex_t picoev_lock = PTHREAD_MUTEX_INITIALIZER;
+static int picoev_users = 0;
 
 static PyObject *wsgi_app = NULL; //wsgi app
 
@@ -55,25 +97,42 @@ static char is_write_access_log = 0;
 
 static int is_keep_alive = 0; //keep alive support
 static int keep_alive_timeout = 5;
+static int worker_threads = 0; // application calls on the loop thread
+static int pipeline_batch = 16; // pipelined requests per loop turn
 
 uint64_t max_content_length = 1024 * 1024 * 16; //max_content_length
 int client_body_buffer_size = 1024 * 500;  //client_body_buffer_size
+int notsent_lowat = 1024 * 128;  //TCP_NOTSENT_LOWAT of streaming responses
+int write_timeout = 300; //write timeout sec
+uint64_t output_high_watermark = 1024 * 64; //stop pulling response iterator
+uint64_t output_low_watermark = 1024 * 16; //resume pulling response iterator
+uint64_t output_buffer_limit = 1024 * 1024 * 64; //max queued output of the worker
 
 static char *unix_sock_name = NULL;
 
 static int backlog = 1024 * 4; // backlog size
 static int max_fd = 1024 * 4;  // picoev max_fd
 
-PyObject* current_client;
+typedef struct {
+    PyObject *callback;
+    int events;
+} fd_watch_t;
+
+static fd_watch_t *fd_watches = NULL; // server.watch() callbacks, not counted in activecnt
+static int fd_watches_size = 0;
+
+THREAD_LOCAL PyObject* current_client;
 PyObject* timeout_error;
 
 /* reuse object */
 static PyObject *client_key = NULL; //minefield.client
+static PyObject *continuation_key = NULL; //minefield.continuation
 static PyObject *wsgi_input_key = NULL; //wsgi.input key
 static PyObject *status_code_key = NULL; //STATUS_CODE
 static PyObject *bytes_sent_key = NULL; // SEND_BYTES
 static PyObject *request_time_key = NULL; // REQUEST_TIME
 static PyObject *local_time_key = NULL; // LOCAL_TIME
+static PyObject *timing_key = NULL; // minefield.timing
 static PyObject *empty_string = NULL; //""
 
 /* gunicorn */
@@ -82,11 +141,6 @@ static int tempfile_fd = 0;
 static int gtimeout = 0;
 static int ppid = 0;
 
-#define CLIENT_MAXFREELIST 1024
-
-static client_t *client_free_list[CLIENT_MAXFREELIST];
-static int client_numfree = 0;
-
 static void
 read_callback(picoev_loop* loop, int fd, int events, void* cb_arg);
 
@@ -96,8 +150,55 @@ write_callback(picoev_loop* loop, int fd, int events, void* cb_arg);
 static void
 kill_callback(picoev_loop* loop, int fd, int events, void* cb_arg);
 
+static void
+accept_callback(picoev_loop* loop, int fd, int events, void* cb_arg);
+
+static void
+loop_wake_callback(picoev_loop* loop, int fd, int events, void* cb_arg);
+
+static int
+open_loop(loop_thread_t *t);
+
+static void
+close_loop(loop_thread_t *t);
+
+static void
+stop_loops(int timeout);
+
+static void
+close_socks(PyObject *socks);
+
+static int
+queue_timer(TimerObject *timer);
+
+static void
+wait_read_callback(picoev_loop* loop, int fd, int events, void* cb_arg);
+
+static int
+peer_closed(picoev_loop* loop, int fd);
+
+static void
+park_request(ClientObject *pyclient, ContinuationObject *continuation);
+
+static void
+suspend_response(ClientObject *pyclient);
+
+#ifdef PY3
+static void
+start_task(ClientObject *pyclient, PyObject *res);
+
+static void
+free_task(client_t *client);
+#endif
+
+static void
+send_error_response(client_t *client);
+
+static void
+suspend_error_page(client_t *client);
+
 static PyObject*
-internal_schedule_call(int seconds, PyObject *cb, PyObject *args, PyObject *kwargs);
+internal_schedule_call(long msec, PyObject *cb, PyObject *args, PyObject *kwargs);
 
 static int
 prepare_call_wsgi(client_t *client);
@@ -108,6 +209,9 @@ call_wsgi_handler(client_t *client);
 static int
 check_status_code(client_t *client);
 
+static void
+run_pipeline(client_t *client);
+
 static pending_queue_t*
 init_pendings(void)
 {
@@ -149,38 +253,16 @@ realloc_pendings(void)
     return 1;
 }
 
-static void
-client_t_list_fill(void)
-{
-    client_t *client;
-    while (client_numfree < CLIENT_MAXFREELIST) {
-        client = (client_t *)PyMem_Malloc(sizeof(client_t));
-        client_free_list[client_numfree++] = client;
-    }
-}
-
-static void
-client_t_list_clear(void)
-{
-    client_t *op;
-
-    while (client_numfree) {
-        op = client_free_list[--client_numfree];
-        PyMem_Free(op);
-    }
-}
-
 static client_t*
 alloc_client_t(void)
 {
     client_t *client;
-    if (client_numfree) {
-        client = client_free_list[--client_numfree];
-        GDEBUG("use pooled %p", client);
-    } else {
-        client = (client_t *)PyMem_Malloc(sizeof(client_t));
-        GDEBUG("alloc %p", client);
+
+    client = (client_t *)slab_alloc(SLAB_CLIENT);
+    if (client == NULL) {
+        return NULL;
     }
+    GDEBUG("alloc %p", client);
     memset(client, 0, sizeof(client_t));
     return client;
 }
@@ -188,17 +270,14 @@ alloc_client_t(void)
 static void
 dealloc_client(client_t *client)
 {
-    if (client_numfree < CLIENT_MAXFREELIST) {
-        client_free_list[client_numfree++] = client;
-        GDEBUG("back to pool %p", client);
-    } else {
-        PyMem_Free(client);
-    }
+    GDEBUG("back to slab %p", client);
+    memory_release_client(client);
+    slab_free(SLAB_CLIENT, client);
 }
 
 
 static client_t *
-new_client_t(int client_fd, char *remote_addr, uint32_t remote_port)
+new_client_t(int client_fd, const char *remote_addr, uint32_t remote_port)
 {
     client_t *client;
 
@@ -209,13 +288,33 @@ new_client_t(int client_fd, char *remote_addr, uint32_t remote_port)
     client->fd = client_fd;
     client->complete = 1;
     client->request_queue = new_request_queue();
-    client->remote_addr = remote_addr;
+    snprintf(client->remote_addr, sizeof(client->remote_addr), "%s", remote_addr);
     client->remote_port = remote_port;
+    client->loop = main_loop;
     /* client->body_type = BODY_TYPE_NONE; */
     GDEBUG("client alloc %p", client);
     return client;
 }
 
+/*
+ * environ["minefield.timing"], it reads the timestamps from the request
+ * when they are asked for.
+ */
+static void
+set_timing(PyObject *environ, request *req, PyObject *pyclient)
+{
+    PyObject *timing;
+
+    if (req->timing_obj != NULL) {
+        return;
+    }
+    timing = new_timing(req, pyclient);
+    if (timing == NULL || PyDict_SetItem(environ, timing_key, timing) == -1) {
+        PyErr_Clear();
+    }
+    Py_XDECREF(timing);
+}
+
 static void
 set_log_value(client_t *client, PyObject *environ, uintptr_t delta_msec)
 {
@@ -252,10 +351,34 @@ static void
 clean_client(client_t *client)
 {
     PyObject *environ = NULL;
+    ContinuationObject *continuation;
     uintptr_t end, delta_msec = 0;
 
     request *req = client->current_req;
    
+    if (req || client->status_code != 408) {
+        stat_response(client->status_code, client->write_bytes);
+        if (req) {
+            req->timing[TIMING_LAST_WRITE] = monotonic_usec();
+            stat_request(req);
+            if (unlikely(req->trace_id != 0)) {
+                trace_request(req, client->status_code, client->write_bytes);
+            }
+            PROBE4(request_end, client->fd, req, client->status_code, client->write_bytes);
+        }
+    }
+    if ((access_log_fd != -1 || log_ring != NULL) && (req || client->status_code != 408)) {
+        cache_time_update();
+        if (log_ring != NULL) {
+            write_log_record(client, req);
+        }
+        if (access_log_fd != -1) {
+            if (req && req->start_msec > 0) {
+                delta_msec = current_msec - req->start_msec;
+            }
+            write_access_log(client, req, delta_msec);
+        }
+    }
     if (is_write_access_log) {
         DEBUG("write access log");
         cache_time_update();
@@ -266,6 +389,7 @@ clean_client(client_t *client)
                 delta_msec = end - req->start_msec;
             }
             set_log_value(client, environ, delta_msec);
+            set_timing(environ, req, NULL);
             call_access_logger(environ);
         } else {
             if (client->status_code != 408) {
@@ -276,6 +400,16 @@ clean_client(client_t *client)
         }
     }
 
+    free_pending(client);
+#ifdef PY3
+    free_task(client);
+#endif
+    detach_stream(client);
+    free_file_response(client);
+    free_compress(client->compress);
+    client->compress = NULL;
+    client->content_encoding = ENCODING_NONE;
+    client->vary_encoding = 0;
     Py_CLEAR(client->http_status);
     Py_CLEAR(client->headers);
     Py_CLEAR(client->response_iter);
@@ -287,6 +421,10 @@ clean_client(client_t *client)
 
     DEBUG("status_code:%d env:%p", client->status_code, req->environ);
     if (req->environ) { 
+        continuation = (ContinuationObject *)PyDict_GetItem(req->environ, continuation_key);
+        if (continuation) {
+            continuation->client = NULL;
+        }
         /* PyDict_Clear(client->environ); */
         /* DEBUG("CLEAR environ"); */
         Py_CLEAR(req->environ);
@@ -303,6 +441,8 @@ clean_client(client_t *client)
 
 init:
     client->current_req = NULL;
+    client->continuation = NULL;
+    client->parked = 0;
     client->header_done = 0;
     client->response_closed = 0;
     client->chunked_response = 0;
@@ -311,12 +451,12 @@ init:
     client->write_bytes = 0;
 }
 
+static void
+release_client(client_t *client);
+
 static void
 close_client(client_t *client)
 {
-    client_t *new_client = NULL;
-    int ret;
-
     if (!client->response_closed) {
         close_response(client);
     }
@@ -332,16 +472,25 @@ close_client(client_t *client)
 
     clean_client(client);
 
+    if (client->pipelining) {
+        // run_pipeline continues with the next request
+        client->request_done = 1;
+        return;
+    }
     DEBUG("remain http pipeline size :%d", client->request_queue->size);
     if (client->request_queue->size > 0) {
-        if (check_status_code(client) > 0) {
-            //process pipeline
-            if (prepare_call_wsgi(client) > 0) {
-                call_wsgi_handler(client);
-            }
-        }
+        //process pipeline
+        run_pipeline(client);
         return ;
     }
+    release_client(client);
+}
+
+static void
+release_client(client_t *client)
+{
+    client_t *new_client = NULL;
+    int ret;
 
     if (client->http_parser != NULL) {
         /* PyMem_Free(client->http_parser); */
@@ -351,9 +500,12 @@ close_client(client_t *client)
     free_request_queue(client->request_queue);
     if (!client->keep_alive) {
         close(client->fd);
+        PROBE1(close, client->fd);
+        STAT_DEC(STAT_CONNECTIONS);
         BDEBUG("close client:%p fd:%d", client, client->fd);
     } else {
         BDEBUG("keep alive client:%p fd:%d", client, client->fd);
+        STAT_INC(STAT_KEEPALIVE);
         new_client = new_client_t(client->fd, client->remote_addr, client->remote_port);
         new_client->keep_alive = 1;
         init_parser(new_client, server_name, server_port);
@@ -366,14 +518,132 @@ close_client(client_t *client)
     dealloc_client(client);
 }
 
-static void init_main_loop(void)
+static void
+watch_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+{
+    PyObject *callback = fd_watches[fd].callback, *res;
+
+    Py_INCREF(callback);
+    res = PyObject_CallFunction(callback, "ii", fd, events & PICOEV_READWRITE);
+    Py_DECREF(callback);
+    if (res == NULL) {
+        call_error_logger();
+        return;
+    }
+    Py_DECREF(res);
+}
+
+/* timers and pending calls of the thread */
+static int
+init_loop_queues(void)
+{
+    if (g_timers == NULL) {
+        g_timers = init_queue();
+        if (g_timers == NULL) {
+            return -1;
+        }
+    }
+    if (g_pendings == NULL) {
+        g_pendings = init_pendings();
+        if (g_pendings == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* the loop thread exits, drop what it did not fire */
+static void
+clear_loop_queues(void)
+{
+    TimerObject *timer;
+    uint32_t i;
+
+    for (i = 0; i < g_pendings->size; i++) {
+        g_pendings->q[i]->active = NULL;
+        Py_DECREF(g_pendings->q[i]);
+    }
+    free(g_pendings->q);
+    PyMem_Free(g_pendings);
+    g_pendings = NULL;
+    while (g_timers->size > 0) {
+        timer = heappop(g_timers);
+        timer->active = NULL;
+        Py_DECREF(timer);
+    }
+    destroy_queue(g_timers);
+    g_timers = NULL;
+}
+
+static int init_main_loop(void)
 {
+    int fd;
+
     if (main_loop == NULL) {
+        cache_time_update();
+        if (init_loop_queues() == -1) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        pthread_mutex_lock(&picoev_lock);
         /* init picoev */
-        picoev_init(max_fd);
+        if (picoev_users++ == 0) {
+            picoev_init(max_fd);
+        }
         /* create loop */
         main_loop = picoev_create_loop(60);
+        if (main_loop == NULL && --picoev_users == 0) {
+            picoev_deinit();
+        }
+        pthread_mutex_unlock(&picoev_lock);
+        if (main_loop == NULL) {
+            PyErr_SetFromErrno(PyExc_IOError);
+            return -1;
+        }
+        if (current_loop == NULL && loop_cnt == 0 && open_loop(loops) == 0) {
+            // the first loop, threads without a loop post calls to it
+            current_loop = loops;
+            loop_cnt = 1;
+        }
+        if (current_loop != NULL) {
+            // not counted in activecnt
+            (void)picoev_add(main_loop, current_loop->wake_fd, PICOEV_READ, 0, loop_wake_callback, NULL);
+        }
+        if (current_loop != loops) {
+            return 0;
+        }
+        static_file_watch();
+        // fd watches outlive the loop of server.run()
+        for (fd = 0; fd < fd_watches_size && fd < max_fd; fd++) {
+            if (fd_watches[fd].callback) {
+                (void)picoev_add(main_loop, fd, fd_watches[fd].events, 0, watch_callback, NULL);
+            }
+        }
+    }
+    return 0;
+}
+
+static void
+destroy_main_loop(void)
+{
+    if (current_loop != NULL) {
+        picoev_del(main_loop, current_loop->wake_fd);
+        if (current_loop == loops) {
+            static_file_unwatch();
+            // calls posted meanwhile run with the next loop
+            loop_wake_callback(main_loop, current_loop->wake_fd, PICOEV_READ, NULL);
+            close_loop(current_loop);
+            current_loop = NULL;
+            loop_cnt = 0;
+        }
+    }
+    pthread_mutex_lock(&picoev_lock);
+    picoev_destroy_loop(main_loop);
+    if (--picoev_users == 0) {
+        picoev_deinit();
     }
+    pthread_mutex_unlock(&picoev_lock);
+    main_loop = NULL;
 }
 
 static void
@@ -395,11 +665,11 @@ kill_server(int timeout)
     PyObject *iter = NULL, *item;
     int set_callback = 0;
 
-    if (main_loop == NULL) {
+    if (main_loop == NULL || loop_socks == NULL) {
         return;
     }
 
-    iter = PyObject_GetIter(listen_socks);
+    iter = PyObject_GetIter(loop_socks);
     if (PyErr_Occurred()){
         call_error_logger();
         return;
@@ -414,8 +684,9 @@ kill_server(int timeout)
             listen_sock = (int)PyInt_AsLong(item);
 #endif
 
-            //stop accepting
-            if (!picoev_del(main_loop, listen_sock)) {
+            //stop accepting, once
+            if (picoev_get_callback(main_loop, listen_sock, NULL) == accept_callback
+                    && !picoev_del(main_loop, listen_sock)) {
                 activecnt--;
                 DEBUG("activecnt:%d", activecnt);
             }
@@ -468,42 +739,33 @@ check_status_code(client_t *client)
         DEBUG("bad status code %d", req->bad_request_code);
         set_current_request(client);
         client->status_code = req->bad_request_code;
-        send_error_page(client);
-        close_client(client);
+        send_error_response(client);
         return -1;
     }
     return 1;
 }
 
-static void
-app_handler(PyObject *env)
+/*
+ * start sending the response of the application, res is stolen.
+ * return 1 while the response is suspended in the loop, the client
+ * must not be touched otherwise.
+ */
+static int
+start_app_response(ClientObject *pyclient, PyObject *res)
 {
-    int ret, active;
-    PyObject *wsgi_args = NULL, *start = NULL, *res = NULL;
-    ClientObject *pyclient;
-    client_t *client;
-    request *req;
+    client_t *client = pyclient->client;
+    request *req = client->current_req;
     response_status status;
 
-    pyclient = (ClientObject*)PyDict_GetItem(env, client_key);
-    client = pyclient->client;
-
-    req = client->current_req;
-    start = create_start_response(client);
-
-    DEBUG("call wsgi app");
-    wsgi_args = PyTuple_Pack(2, env, start);
-    res = PyObject_CallObject(wsgi_app, wsgi_args);
-    Py_DECREF(wsgi_args);
-    DEBUG("called wsgi app");
-
     //check response & PyErr_Occurred
     if (res && res == Py_None) {
         PyErr_SetString(PyExc_Exception, "response must be a iter or sequence object");
+        Py_DECREF(res);
         goto error;
     }
     //Check wsgi_app error
     if (PyErr_Occurred()) {
+        Py_XDECREF(res);
         goto error;
     }
 
@@ -512,7 +774,7 @@ app_handler(PyObject *env)
     if (client->response_closed) {
         //closed
         close_client(client);
-        return;
+        return 0;
     }
     status = response_start(client);
 
@@ -524,18 +786,16 @@ app_handler(PyObject *env)
         case STATUS_SUSPEND:
             // continue
             // set callback
-            active = picoev_is_active(main_loop, client->fd);
-            ret = picoev_add(main_loop, client->fd, PICOEV_WRITE, 300, write_callback, (void *)pyclient);
-            if ((ret == 0 && !active)) {
-                activecnt++;
-            }
+            suspend_response(pyclient);
+            return 1;
         default:
             // send OK
             close_client(client);
     }
-    return;
+    return 0;
 
 error:
+    STAT_INC(STAT_APP_ERRORS);
     client->status_code = 500;
     status = close_response(client);
     if (status == STATUS_ERROR) {
@@ -543,87 +803,974 @@ error:
     }
     /* write_error_log(__FILE__, __LINE__); */
     call_error_logger();
-    send_error_page(client);
-    close_client(client);
+    send_error_response(client);
+    return 0;
 }
 
+/*
+ * the application returned res (NULL on error), start its response.
+ */
 static void
-call_wsgi_handler(client_t *client)
+finish_app_call(ClientObject *pyclient, PyObject *env, PyObject *res)
 {
-    request *req = NULL;
+    ContinuationObject *continuation;
 
-    req = client->current_req;
-    current_client = PyDict_GetItem(req->environ, client_key);
+    PROBE3(app_return, pyclient->client->fd, pyclient->client->current_req, res == NULL);
+    continuation = (ContinuationObject *)PyDict_GetItem(env, continuation_key);
+    if (continuation && continuation->suspended && !PyErr_Occurred()) {
+        // response comes from the resumed call
+        Py_XDECREF(res);
+        park_request(pyclient, continuation);
+        return;
+    }
+#ifdef PY3
+    if (res && !PyErr_Occurred() && (is_awaitable(res) || is_async_iterator(res))) {
+        // async application, driven by the loop
+        start_task(pyclient, res);
+        return;
+    }
+#endif
+    start_app_response(pyclient, res);
+}
 
-    app_handler(req->environ);
+/*
+ * run the application on a worker thread, pool_callback finishes it.
+ * the client is not watched meanwhile, like an inline call.
+ */
+static void
+submit_app_call(ClientObject *pyclient, PyObject *env)
+{
+    PyObject *start, *args;
+
+    start = new_start_response(pyclient->client);
+    if (start == NULL) {
+        start_app_response(pyclient, NULL);
+        return;
+    }
+    args = PyTuple_Pack(2, env, start);
+    Py_DECREF(start);
+    if (args == NULL) {
+        start_app_response(pyclient, NULL);
+        return;
+    }
+    Py_INCREF(wsgi_app);
+    if (pool_submit(pyclient, wsgi_app, args) == -1) {
+        start_app_response(pyclient, NULL);
+        return;
+    }
+    Py_INCREF(pyclient);
+    activecnt++;
 }
 
 static void
-write_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+app_handler(PyObject *env)
 {
-    ClientObject *pyclient = (ClientObject*)cb_arg;
-    client_t *client = pyclient->client;
-    int ret;
-    DEBUG("call write_callback");
-    current_client = (PyObject*)pyclient;
-    if ((events & PICOEV_TIMEOUT) != 0) {
+    PyObject *wsgi_args = NULL, *start = NULL, *res = NULL;
+    ClientObject *pyclient;
+    client_t *client;
 
-        DEBUG("** write_callback timeout **");
+    pyclient = (ClientObject*)PyDict_GetItem(env, client_key);
+    client = pyclient->client;
 
-        //timeout
-        client->keep_alive = 0;
-        close_client(client);
+    STALL_REQUEST(client->current_req);
+    if (client->current_req) {
+        // pool_callback() replaces it with the call time of the worker
+        client->current_req->timing[TIMING_APP_START] = monotonic_usec();
+        set_timing(env, client->current_req, (PyObject *)pyclient);
+    }
+    PROBE2(app_call, client->fd, client->current_req);
+    if (pool_running) {
+        submit_app_call(pyclient, env);
+        return;
+    }
 
-    } else if ((events & PICOEV_WRITE) != 0) {
-        ret = process_body(client);
-        DEBUG("process_body ret %d", ret);
-        if (ret != 0) {
-            //ok or die
-            close_client(client);
-        }
+    start = create_start_response(client);
+
+    DEBUG("call wsgi app");
+    wsgi_args = PyTuple_Pack(2, env, start);
+    res = PyObject_CallObject(wsgi_app, wsgi_args);
+    if (client->current_req) {
+        client->current_req->timing[TIMING_APP_END] = monotonic_usec();
     }
+    Py_DECREF(wsgi_args);
+    DEBUG("called wsgi app");
+
+    finish_app_call(pyclient, env, res);
 }
 
-static int
-check_http_expect(client_t *client)
+/*
+ * the loop stopped, join the workers and drop calls it can not finish.
+ */
+static void
+stop_pool_jobs(void)
 {
-    PyObject *c = NULL;
-    char *val = NULL;
-    int ret;
-    request *req = client->current_req;
+    pool_job_t *job;
 
-    if (client->http_parser->http_minor == 1) {
-        ///TODO CHECK
-        c = PyDict_GetItemString(req->environ, "HTTP_EXPECT");
-        if (c) {
-            val = PyBytes_AS_STRING(c);
-            if (!strncasecmp(val, "100-continue", 12)) {
-                ret = write(client->fd, "HTTP/1.1 100 Continue\r\n\r\n", 25);
-                if (ret < 0) {
-                    //fail
-                    PyErr_SetFromErrno(PyExc_IOError);
-                    /* write_error_log(__FILE__, __LINE__);  */
-                    call_error_logger();
-                    client->keep_alive = 0;
-                    client->status_code = 500;
-                    send_error_page(client);
-                    close_client(client);
-                    return -1;
-                }
+    picoev_del(main_loop, pool_notify_fd());
+    stop_pool();
+    while ((job = pool_next_done()) != NULL) {
+        Py_DECREF((PyObject *)job->arg);
+        free_pool_job(job);
+    }
+}
+
+/*
+ * application calls done by the workers.
+ */
+static void
+pool_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+{
+    pool_job_t *job;
+    ClientObject *pyclient;
+    PyObject *res;
+
+    pool_drain_notify();
+    while ((job = pool_next_done()) != NULL) {
+        activecnt--;
+        pyclient = (ClientObject *)job->arg;
+        res = job->result;
+        job->result = NULL;
+        if (res == NULL) {
+            PyErr_Restore(job->exc_type, job->exc_value, job->exc_tb);
+            job->exc_type = job->exc_value = job->exc_tb = NULL;
+        }
+        STALL_REQUEST(pyclient->client->current_req);
+        if (pyclient->client->current_req) {
+            pyclient->client->current_req->timing[TIMING_APP_START] = job->start_usec;
+            pyclient->client->current_req->timing[TIMING_APP_END] = job->end_usec;
+        }
+        current_client = (PyObject *)pyclient;
+        finish_app_call(pyclient, PyTuple_GET_ITEM(job->args, 0), res);
+        Py_DECREF(pyclient);
+        free_pool_job(job);
+    }
+}
+
+static void
+continuation_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+{
+    ClientObject *pyclient = (ClientObject *)cb_arg;
+    client_t *client = pyclient->client;
+    ContinuationObject *continuation = client->continuation;
+
+    if ((events & PICOEV_TIMEOUT) != 0) {
+        continuation->expired = 1;
+    } else if ((events & PICOEV_WRITE) == 0) {
+        if (peer_closed(loop, fd)) {
+            client->keep_alive = 0;
+            close_client(client);
+        }
+        return;
+    }
+    if (!picoev_del(loop, fd)) {
+        activecnt--;
+    }
+    client->parked = 0;
+    client->continuation = NULL;
+    continuation->suspended = 0;
+    current_client = (PyObject *)pyclient;
+    // call the application again
+    Py_CLEAR(client->http_status);
+    Py_CLEAR(client->headers);
+    app_handler(client->current_req->environ);
+}
+
+/*
+ * keep the suspended request until resume() or timeout,
+ * the socket is watched for disconnect meanwhile.
+ */
+static void
+park_request(ClientObject *pyclient, ContinuationObject *continuation)
+{
+    client_t *client = pyclient->client;
+    int ret;
+
+    if (picoev_is_active(main_loop, client->fd)) {
+        if (!picoev_del(main_loop, client->fd)) {
+            activecnt--;
+        }
+    }
+    client->continuation = continuation;
+    client->parked = 1;
+    ret = picoev_add(main_loop, client->fd, continuation->resumed ? PICOEV_WRITE : PICOEV_READ,
+                     continuation->timeout, continuation_callback, (void *)pyclient);
+    if (ret == 0) {
+        activecnt++;
+    } else {
+        client->keep_alive = 0;
+        close_client(client);
+    }
+}
+
+void
+wake_continuation(client_t *client)
+{
+    if (client->parked) {
+        // run from the loop, not from the caller of resume()
+        picoev_set_events((picoev_loop *)client->loop, client->fd, PICOEV_WRITE);
+    }
+}
+
+/* cancelled timers no longer keep their loop alive */
+void
+timer_cancelled(TimerObject *timer)
+{
+    if (timer->active != NULL) {
+        (*timer->active)--;
+        timer->active = NULL;
+    }
+}
+
+#ifdef PY3
+/*
+ * async applications.
+ * a coroutine returned by the application runs on the loop until it
+ * returns the WSGI response, an async iterator response is pulled item by
+ * item into a stream. both wait for minefield futures (sleep,
+ * wait_readable, wait_writable) or asyncio futures of minefield.loop,
+ * a bare yield resumes on the next turn.
+ */
+
+static void
+step_task(client_t *client);
+
+static void
+unwatch_client(client_t *client)
+{
+    if (picoev_is_active(main_loop, client->fd)) {
+        if (!picoev_del(main_loop, client->fd)) {
+            activecnt--;
+        }
+    }
+}
+
+static void
+future_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+{
+    FutureObject *future = (FutureObject *)cb_arg;
+
+    if (!picoev_del(loop, fd)) {
+        activecnt--;
+    }
+    future->armed = 0;
+    fire_future(future, (events & PICOEV_TIMEOUT) != 0);
+    Py_DECREF(future);
+}
+
+static int
+arm_future(client_t *client, FutureObject *future)
+{
+    PyObject *res;
+    int ret;
+
+    if (future->client || future->done) {
+        PyErr_SetString(PyExc_RuntimeError, "future is already awaited");
+        return -1;
+    }
+    if (future->kind == FUTURE_SLEEP) {
+        future->timer = internal_schedule_call(future->msec, (PyObject *)future, NULL, NULL);
+        if (future->timer == NULL) {
+            return -1;
+        }
+    } else if (future->kind == FUTURE_ASYNCIO) {
+        res = PyObject_CallMethod(future->waited, "add_done_callback", "O", (PyObject *)future);
+        if (res == NULL) {
+            return -1;
+        }
+        Py_DECREF(res);
+    } else {
+        if (future->fd < 0 || future->fd >= max_fd || picoev_is_active(main_loop, future->fd)) {
+            PyErr_Format(PyExc_IOError, "can not watch fd %d", future->fd);
+            return -1;
+        }
+        ret = picoev_add(main_loop, future->fd, future->kind == FUTURE_READ ? PICOEV_READ : PICOEV_WRITE,
+                         future->timeout, future_callback, (void *)future);
+        if (ret != 0) {
+            PyErr_SetFromErrno(PyExc_IOError);
+            return -1;
+        }
+        activecnt++;
+        Py_INCREF(future);
+    }
+    future->armed = 1;
+    future->client = client;
+    return 0;
+}
+
+static void
+disarm_future(FutureObject *future)
+{
+    PyObject *res;
+
+    if (future->armed) {
+        future->armed = 0;
+        if (future->kind == FUTURE_SLEEP) {
+            cancel_timer((TimerObject *)future->timer);
+        } else if (future->kind == FUTURE_ASYNCIO) {
+            // nobody waits for it any more
+            res = PyObject_CallMethod(future->waited, "cancel", NULL);
+            Py_XDECREF(res);
+            PyErr_Clear();
+        } else {
+            if (!picoev_del(main_loop, future->fd)) {
+                activecnt--;
+            }
+            Py_DECREF(future);
+        }
+    }
+    Py_CLEAR(future->timer);
+    Py_CLEAR(future->waited);
+    future->client = NULL;
+}
+
+void
+fire_future(FutureObject *future, int timedout)
+{
+    client_t *client = future->client;
+
+    future->armed = 0;
+    future->done = 1;
+    future->timedout = timedout;
+    future->client = NULL;
+    Py_CLEAR(future->timer);
+    Py_CLEAR(future->waited);
+    if (client == NULL) {
+        return;
+    }
+    ((task_t *)client->task)->future = NULL;
+    step_task(client);
+    Py_DECREF(future);
+}
+
+/* res is stolen, return 1 if the task waits for it */
+static int
+wait_future(client_t *client, PyObject *res)
+{
+    PyObject *blocking, *future;
+
+    if (res == Py_None) {
+        // bare yield, resume on the next loop turn
+        Py_DECREF(res);
+        res = FutureObject_New(FUTURE_SLEEP, -1, 0, 0);
+        if (res == NULL) {
+            return 0;
+        }
+    } else if (Py_TYPE(res) != &FutureObjectType) {
+        blocking = PyObject_GetAttrString(res, "_asyncio_future_blocking");
+        if (blocking == NULL || !PyObject_IsTrue(blocking)) {
+            Py_XDECREF(blocking);
+            PyErr_Clear();
+            PyErr_Format(PyExc_TypeError, "minefield can not wait for '%.100s' object",
+                         Py_TYPE(res)->tp_name);
+            Py_DECREF(res);
+            return 0;
+        }
+        Py_DECREF(blocking);
+        // asyncio future of minefield.loop
+        if (PyObject_SetAttrString(res, "_asyncio_future_blocking", Py_False) == -1) {
+            Py_DECREF(res);
+            return 0;
+        }
+        future = FutureObject_New(FUTURE_ASYNCIO, -1, 0, 0);
+        if (future == NULL) {
+            Py_DECREF(res);
+            return 0;
+        }
+        ((FutureObject *)future)->waited = res;
+        res = future;
+    }
+    if (arm_future(client, (FutureObject *)res) == -1) {
+        Py_DECREF(res);
+        return 0;
+    }
+    ((task_t *)client->task)->future = (FutureObject *)res;
+    return 1;
+}
+
+static PyObject *
+fetch_exception(void)
+{
+    PyObject *type, *value, *tb;
+
+    PyErr_Fetch(&type, &value, &tb);
+    PyErr_NormalizeException(&type, &value, &tb);
+    if (tb) {
+        PyException_SetTraceback(value, tb);
+    }
+    Py_XDECREF(type);
+    Py_XDECREF(tb);
+    return value;
+}
+
+static PyObject *
+stop_iteration_value(void)
+{
+    PyObject *exc, *value;
+
+    exc = fetch_exception();
+    value = PyObject_GetAttrString(exc, "value");
+    Py_DECREF(exc);
+    return value;
+}
+
+static void
+free_task(client_t *client)
+{
+    task_t *task = client->task;
+    PyObject *type, *value, *tb, *res;
+
+    if (task == NULL) {
+        return;
+    }
+    client->task = NULL;
+    if (task->future) {
+        disarm_future(task->future);
+        Py_DECREF(task->future);
+    }
+    if (task->coro) {
+        PyErr_Fetch(&type, &value, &tb);
+        // unfinished coroutine, run its finally blocks
+        res = PyObject_CallMethod(task->coro, "close", NULL);
+        Py_XDECREF(res);
+        PyErr_Clear();
+        PyErr_Restore(type, value, tb);
+        Py_DECREF(task->coro);
+    }
+    Py_XDECREF(task->aiter);
+    PyMem_Free(task);
+}
+
+static void
+task_watch_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+{
+    ClientObject *pyclient = (ClientObject *)cb_arg;
+    client_t *client = pyclient->client;
+
+    if ((events & PICOEV_READ) != 0 && peer_closed(loop, fd)) {
+        client->keep_alive = 0;
+        close_client(client);
+    }
+}
+
+static task_t *
+new_task(void)
+{
+    task_t *task;
+
+    task = PyMem_Malloc(sizeof(task_t));
+    if (task == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    memset(task, 0, sizeof(task_t));
+    return task;
+}
+
+static void
+start_async_body(ClientObject *pyclient, PyObject *aiter)
+{
+    client_t *client = pyclient->client;
+    PyObject *stream;
+    task_t *task;
+
+    task = new_task();
+    if (task == NULL) {
+        Py_DECREF(aiter);
+        start_app_response(pyclient, NULL);
+        return;
+    }
+    stream = new_stream(client);
+    if (stream == NULL) {
+        PyMem_Free(task);
+        Py_DECREF(aiter);
+        start_app_response(pyclient, NULL);
+        return;
+    }
+    task->aiter = aiter;
+    client->task = task;
+    if (start_app_response(pyclient, stream)) {
+        step_task(client);
+    }
+}
+
+static void
+start_task(ClientObject *pyclient, PyObject *res)
+{
+    client_t *client = pyclient->client;
+    task_t *task;
+
+    if (!is_awaitable(res)) {
+        start_async_body(pyclient, res);
+        return;
+    }
+    task = new_task();
+    if (task == NULL) {
+        Py_DECREF(res);
+        start_app_response(pyclient, NULL);
+        return;
+    }
+    task->coro = get_await_iter(res);
+    Py_DECREF(res);
+    if (task->coro == NULL) {
+        PyMem_Free(task);
+        start_app_response(pyclient, NULL);
+        return;
+    }
+    client->task = task;
+    // watch for disconnect while the application runs
+    unwatch_client(client);
+    if (picoev_add(main_loop, client->fd, PICOEV_READ, 0, task_watch_callback, (void *)pyclient) == 0) {
+        activecnt++;
+    }
+    step_task(client);
+}
+
+static void
+finish_app_task(ClientObject *pyclient, PyObject *res)
+{
+    client_t *client = pyclient->client;
+
+    unwatch_client(client);
+    free_task(client);
+    if (res && is_async_iterator(res)) {
+        start_async_body(pyclient, res);
+        return;
+    }
+    start_app_response(pyclient, res);
+}
+
+/*
+ * run the coroutine until it waits for a future or ends.
+ * the client may be released when this returns.
+ */
+static void
+step_task(client_t *client)
+{
+    task_t *task = client->task;
+    ClientObject *pyclient;
+    PyObject *res, *exc = NULL;
+    int ret;
+
+    pyclient = (ClientObject *)PyDict_GetItem(client->current_req->environ, client_key);
+    current_client = (PyObject *)pyclient;
+    // start_response is shared, bind it to this request again
+    (void)create_start_response(client);
+    while (1) {
+        if (task->coro == NULL) {
+            // next item of the async body
+            if (task->paused || output_full(client)) {
+                task->paused = 1;
+                return;
+            }
+            res = Py_TYPE(task->aiter)->tp_as_async->am_anext(task->aiter);
+            if (res == NULL) {
+                goto error;
+            }
+            task->coro = is_awaitable(res) ? get_await_iter(res) : NULL;
+            if (task->coro == NULL && !PyErr_Occurred()) {
+                PyErr_SetString(PyExc_TypeError, "__anext__ returned non-awaitable");
+            }
+            Py_DECREF(res);
+            if (task->coro == NULL) {
+                goto error;
+            }
+        }
+        if (exc) {
+            res = PyObject_CallMethod(task->coro, "throw", "O", exc);
+            Py_CLEAR(exc);
+        } else {
+            res = Py_TYPE(task->coro)->tp_iternext(task->coro);
+        }
+        if (res != NULL) {
+            if (wait_future(client, res)) {
+                return;
+            }
+            // let the coroutine handle it
+            exc = fetch_exception();
+            continue;
+        }
+
+        if (!PyErr_Occurred()) {
+            res = Py_None;
+            Py_INCREF(res);
+        } else if (PyErr_ExceptionMatches(PyExc_StopIteration)) {
+            res = stop_iteration_value();
+            if (res == NULL) {
+                goto error;
+            }
+        } else if (task->aiter && PyErr_ExceptionMatches(PyExc_StopAsyncIteration)) {
+            // end of the async body
+            PyErr_Clear();
+            end_stream(client, 0);
+            free_task(client);
+            return;
+        } else {
+            goto error;
+        }
+        Py_CLEAR(task->coro);
+
+        if (task->aiter == NULL) {
+            finish_app_task(pyclient, res);
+            return;
+        }
+        if (!PyBytes_Check(res)) {
+            PyErr_SetString(PyExc_TypeError, "response item must be a byte string");
+            Py_DECREF(res);
+            goto error;
+        }
+        ret = write_stream(client, res);
+        Py_DECREF(res);
+        if (ret == -1) {
+            goto error;
+        }
+        if (ret == 0 && (client->stream == NULL || ((StreamObject *)client->stream)->closed)) {
+            // connection is gone, closed from the loop
+            free_task(client);
+            return;
+        }
+    }
+
+error:
+    if (task->aiter) {
+        // headers are sent, cut the body
+        call_error_logger();
+        end_stream(client, 1);
+        free_task(client);
+        return;
+    }
+    unwatch_client(client);
+    free_task(client);
+    start_app_response(pyclient, NULL);
+}
+
+void
+resume_task(client_t *client)
+{
+    task_t *task = client->task;
+
+    if (task->paused && client->buffered <= output_low_watermark) {
+        task->paused = 0;
+        step_task(client);
+    }
+}
+#endif
+
+static void
+error_page_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+{
+    client_t *client = (client_t *)cb_arg;
+
+    if ((events & PICOEV_TIMEOUT) == 0 && (events & PICOEV_WRITE) != 0) {
+        if (write_pending(client) == STATUS_SUSPEND) {
+            return;
+        }
+    }
+    close_client(client);
+}
+
+static void
+suspend_error_page(client_t *client)
+{
+    int ret;
+
+    if (picoev_is_active(main_loop, client->fd)) {
+        if (!picoev_del(main_loop, client->fd)) {
+            activecnt--;
+        }
+    }
+    ret = picoev_add(main_loop, client->fd, PICOEV_WRITE, write_timeout, error_page_callback, (void *)client);
+    if (ret == 0) {
+        activecnt++;
+    } else {
+        close_client(client);
+    }
+}
+
+/*
+ * send error page and close the client, waiting for the socket if it is full.
+ */
+static void
+send_error_response(client_t *client)
+{
+    if (send_error_page(client) == STATUS_SUSPEND) {
+        suspend_error_page(client);
+        return;
+    }
+    close_client(client);
+}
+
+static void
+suspend_response(ClientObject *pyclient)
+{
+    client_t *client = pyclient->client;
+    int ret, active;
+
+    if (client->wait_read) {
+        // response source is not readable, wait for it instead of the socket
+        if (picoev_is_active(main_loop, client->fd)) {
+            if (!picoev_del(main_loop, client->fd)) {
+                activecnt--;
+            }
+        }
+        ret = picoev_add(main_loop, client->wait_fd, PICOEV_READ, write_timeout, wait_read_callback, (void *)pyclient);
+        if (ret == 0) {
+            activecnt++;
+            return;
+        }
+        client->wait_read = 0;
+    }
+    active = picoev_is_active(main_loop, client->fd);
+    ret = picoev_add(main_loop, client->fd, PICOEV_WRITE, write_timeout, write_callback, (void *)pyclient);
+    if ((ret == 0 && !active)) {
+        activecnt++;
+    }
+}
+
+static void
+finish_native_response(client_t *client, response_status status)
+{
+    switch (status) {
+        case STATUS_SUSPEND:
+            if (client->response_closed) {
+                // error page is pending
+                suspend_error_page(client);
+            } else {
+                suspend_response((ClientObject *)current_client);
+            }
+            break;
+        case STATUS_ERROR:
+            client->status_code = 500;
+            client->keep_alive = 0;
+            send_error_response(client);
+            break;
+        default:
+            close_client(client);
+    }
+}
+
+static void
+pipeline_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+{
+    client_t *client = (client_t *)cb_arg;
+
+    if (!picoev_del(loop, fd)) {
+        activecnt--;
+    }
+    if ((events & PICOEV_TIMEOUT) != 0) {
+        client->keep_alive = 0;
+        release_client(client);
+        return;
+    }
+    run_pipeline(client);
+}
+
+/*
+ * run queued requests of the connection one after another.
+ * close_client only marks the request done while this runs, so pipelined
+ * requests don't recurse. responses are corked while more requests are
+ * queued and go out together. after pipeline_batch requests the rest waits
+ * for the next loop turn.
+ */
+static void
+run_pipeline(client_t *client)
+{
+    int cnt = 0, ret;
+
+    client->pipelining = 1;
+    while (1) {
+        client->request_done = 0;
+        if (client->request_queue->size > 1 && !client->use_cork) {
+            enable_cork(client);
+        }
+        if (check_status_code(client) > 0) {
+            //current request ok
+            if (prepare_call_wsgi(client) > 0) {
+                call_wsgi_handler(client);
+            }
+        }
+        if (!client->request_done) {
+            // suspended, close_client resumes the pipeline
+            client->pipelining = 0;
+            if (client->file_response == NULL) {
+                disable_cork(client);
+            }
+            return;
+        }
+        if (client->request_queue->size == 0) {
+            break;
+        }
+        if (++cnt >= pipeline_batch) {
+            // yield to other connections
+            client->pipelining = 0;
+            disable_cork(client);
+            ret = picoev_add(main_loop, client->fd, PICOEV_WRITE, write_timeout, pipeline_callback, (void *)client);
+            if (ret == 0) {
+                activecnt++;
             } else {
-                //417
                 client->keep_alive = 0;
-                client->status_code = 417;
-                send_error_page(client);
-                close_client(client);
-                return -1;
+                release_client(client);
+            }
+            return;
+        }
+    }
+    client->pipelining = 0;
+    disable_cork(client);
+    release_client(client);
+}
+
+static void
+call_wsgi_handler(client_t *client)
+{
+    request *req = NULL;
+    response_status status;
+
+    req = client->current_req;
+    current_client = PyDict_GetItem(req->environ, client_key);
+
+    if (response_cache_start(client, &status) || static_file_start(client, &status)) {
+        // served without calling the application
+        finish_native_response(client, status);
+        return;
+    }
+    app_handler(req->environ);
+}
+
+static void
+static_notify_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+{
+    if ((events & PICOEV_READ) != 0) {
+        static_file_process_events();
+    }
+}
+
+/*
+ * read the static file notify fd on the loop of server.run() or
+ * run_once(), return 0 when the thread runs no such loop.
+ */
+int
+watch_static_notify(int fd)
+{
+    if (main_loop == NULL || current_loop != loops) {
+        return 0;
+    }
+    // not counted in activecnt
+    return picoev_add(main_loop, fd, PICOEV_READ, 0, static_notify_callback, NULL) == 0;
+}
+
+/* return 0 when another thread runs the loop */
+int
+unwatch_static_notify(int fd)
+{
+    if (main_loop == NULL || current_loop != loops) {
+        return 0;
+    }
+    if (picoev_is_active(main_loop, fd)) {
+        picoev_del(main_loop, fd);
+    }
+    return 1;
+}
+
+static void
+write_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+{
+    ClientObject *pyclient = (ClientObject*)cb_arg;
+    client_t *client = pyclient->client;
+    int ret;
+    DEBUG("call write_callback");
+    current_client = (PyObject*)pyclient;
+    STALL_REQUEST(client->current_req);
+    if ((events & PICOEV_TIMEOUT) != 0) {
+
+        DEBUG("** write_callback timeout **");
+
+        //timeout
+        STAT_INC(STAT_TIMEOUTS);
+        PROBE2(timeout, client->fd, 1);
+        client->keep_alive = 0;
+        close_client(client);
+
+    } else if ((events & PICOEV_WRITE) != 0) {
+        ret = process_body(client);
+        DEBUG("process_body ret %d", ret);
+        if (ret == STATUS_SUSPEND) {
+            if (client->wait_read) {
+                suspend_response(pyclient);
+            } else if (is_stream_response(client) && client->bucket == NULL) {
+                // nothing to send, watch for disconnect until wake_stream
+                client->stream_idle = 1;
+                picoev_set_events(loop, fd, PICOEV_READ);
+                picoev_set_timeout(loop, fd, 0);
             }
+        } else {
+            //ok or die
+            close_client(client);
+        }
+    } else if ((events & PICOEV_READ) != 0 && client->stream_idle) {
+        if (peer_closed(loop, fd)) {
+            client->keep_alive = 0;
+            close_client(client);
         }
+    }
+}
+
+/*
+ * waiting connection became readable, check for EOF.
+ * pipelined input is left to the parser and no longer watched.
+ */
+static int
+peer_closed(picoev_loop* loop, int fd)
+{
+    char c;
+    ssize_t r;
+
+    r = recv(fd, &c, 1, MSG_PEEK);
+    if (r == 0) {
         return 1;
     }
+    if (r == -1) {
+        return errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+    }
+    picoev_set_events(loop, fd, 0);
     return 0;
 }
 
+void
+wake_stream(client_t *client)
+{
+    if (client->stream_idle) {
+        client->stream_idle = 0;
+        picoev_set_events((picoev_loop *)client->loop, client->fd, PICOEV_WRITE);
+        picoev_set_timeout((picoev_loop *)client->loop, client->fd, write_timeout);
+    }
+}
+
+static void
+wait_read_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+{
+    ClientObject *pyclient = (ClientObject*)cb_arg;
+    client_t *client = pyclient->client;
+    int ret;
+
+    DEBUG("call wait_read_callback fd:%d", fd);
+    if (!picoev_del(loop, fd)) {
+        activecnt--;
+    }
+    client->wait_read = 0;
+    current_client = (PyObject*)pyclient;
+    if ((events & PICOEV_TIMEOUT) != 0) {
+        DEBUG("** wait_read_callback timeout **");
+        client->keep_alive = 0;
+        close_client(client);
+        return;
+    }
+    ret = process_body(client);
+    if (ret == STATUS_SUSPEND) {
+        suspend_response(pyclient);
+    } else {
+        close_client(client);
+    }
+}
+
 #ifdef PY3
 static int
 set_input_file(client_t *client)
@@ -746,11 +1893,6 @@ prepare_call_wsgi(client_t *client)
     
     req = client->current_req;
 
-    //check Expect
-    if (check_http_expect(client) < 0) {
-        return -1;
-    }
-
     if (req->body_type == BODY_TYPE_TMPFILE) {
         if (set_input_file(client) == -1) {
             return -1;
@@ -785,9 +1927,11 @@ set_read_error(client_t *client, int status_code)
         if (!client->complete) {
             // read error while reading request.
             client->status_code = status_code;
-            send_error_page(client);
-        } // else keepalive timeout. should not send any data.
-        close_client(client);
+            send_error_response(client);
+        } else {
+            // keepalive timeout. should not send any data.
+            close_client(client);
+        }
         return -1;
     }
 }
@@ -797,6 +1941,10 @@ read_timeout(int fd, client_t *client)
 {
     RDEBUG("** read timeout fd:%d", fd);
     //timeout
+    if (!client->complete) {
+        STAT_INC(STAT_TIMEOUTS);
+    }
+    PROBE2(timeout, fd, 0);
     return set_read_error(client, 408);
 }
 
@@ -817,6 +1965,7 @@ parse_http_request(int fd, client_t *client, char *buf, ssize_t r)
         return -1;
     } else {
         if (nread != r || req->bad_request_code > 0) {
+            STAT_INC(STAT_PARSE_ERRORS);
             if (req == NULL) {
                 DEBUG("fd %d bad_request code 400", fd);
                 return set_read_error(client, 400);
@@ -843,7 +1992,9 @@ read_request(picoev_loop *loop, int fd, client_t *client, char call_time_update)
         picoev_set_timeout(loop, fd, READ_TIMEOUT_SECS);
     }
 
+    Py_BEGIN_ALLOW_THREADS
     r = read(client->fd, buf, sizeof(buf));
+    Py_END_ALLOW_THREADS
     switch (r) {
         case 0: 
             return set_read_error(client, 503);
@@ -874,29 +2025,81 @@ read_request(picoev_loop *loop, int fd, client_t *client, char call_time_update)
     }
 }
 
+/*
+ * send interim "100 Continue" when the request body is awaited.
+ * the rest is flushed from read_callback if the socket is full.
+ */
+static void
+reply_continue(picoev_loop *loop, client_t *client)
+{
+    request *req = client->current_req;
+
+    if (req == NULL || !req->expect_continue || client->request_queue->head != req) {
+        return;
+    }
+    req->expect_continue = 0;
+    if (send_continue(client) == STATUS_SUSPEND) {
+        picoev_set_events(loop, client->fd, PICOEV_READ | PICOEV_WRITE);
+    }
+}
+
 static void
 read_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
 {
     client_t *client = ( client_t *)(cb_arg);
+    write_bucket *bucket;
     int finish = 0;
 
     if ((events & PICOEV_TIMEOUT) != 0) {
+        if (client->read_paused) {
+            memory_unpause(client);
+        }
         finish = read_timeout(fd, client);
 
-    } else if ((events & PICOEV_READ) != 0) {
-        finish = read_request(loop, fd, client, 0);
+    } else {
+        if ((events & PICOEV_WRITE) != 0) {
+            // pending interim response
+            switch (write_pending(client)) {
+                case STATUS_SUSPEND:
+                    break;
+                case STATUS_ERROR:
+                    client->keep_alive = 0;
+                    close_client(client);
+                    return;
+                default:
+                    picoev_set_events(loop, fd, PICOEV_READ);
+            }
+        }
+        if ((events & PICOEV_READ) != 0) {
+            if (unlikely(memory_budget != 0) && memory_pause_read(loop, client)) {
+                // resumed by memory_resume_reads()
+                return;
+            }
+            finish = read_request(loop, fd, client, 0);
+            if (finish == 0) {
+                reply_continue(loop, client);
+            }
+        }
     }
     if (finish == 1) {
         if (!picoev_del(main_loop, client->fd)) {
             activecnt--;
             DEBUG("activecnt:%d", activecnt);
         }
-        if (check_status_code(client) > 0) {
-            //current request ok
-            if (prepare_call_wsgi(client) > 0) {
-                call_wsgi_handler(client);
+        bucket = (write_bucket *)client->bucket;
+        if (bucket) {
+            if (bucket->total < bucket->total_size) {
+                // partially sent interim response can't be followed by a response
+                client->keep_alive = 0;
+                client->header_done = 1;
+                client->response_closed = 1;
+                close_client(client);
+                return;
             }
+            // the body has arrived without it
+            free_pending(client);
         }
+        run_pipeline(client);
         return;
     }
 }
@@ -907,7 +2110,7 @@ accept_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
     int client_fd, ret;
     client_t *client;
     struct sockaddr_in client_addr;
-    char *remote_addr;
+    char remote_addr[INET_ADDRSTRLEN];
     uint32_t remote_port;
     int finish = 0;
     if ((events & PICOEV_TIMEOUT) != 0) {
@@ -935,27 +2138,28 @@ accept_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
                     loop_done = 0;
                     return;
                 }
-                remote_addr = inet_ntoa (client_addr.sin_addr);
+                inet_ntop(AF_INET, &client_addr.sin_addr, remote_addr, sizeof(remote_addr));
                 remote_port = ntohs(client_addr.sin_port);
                 client = new_client_t(client_fd, remote_addr, remote_port);
                 init_parser(client, server_name, server_port);
+                client->accept_usec = monotonic_usec();
+                PROBE3(accept, client_fd, remote_addr, remote_port);
+                STAT_INC(STAT_ACCEPTS);
+                STAT_INC(STAT_CONNECTIONS);
 
                 finish = read_request(loop, fd, client, 1);
                 if (finish == 1) {
-                    if (check_status_code(client) > 0) {
-                        //current request ok
-                        if (prepare_call_wsgi(client) > 0) {
-                            call_wsgi_handler(client);
-                        }
-                    }
+                    run_pipeline(client);
                 } else if (finish == 0) {
                     ret = picoev_add(loop, client_fd, PICOEV_READ, keep_alive_timeout, read_callback, (void *)client);
                     if (ret == 0) {
                         activecnt++;
+                        reply_continue(loop, client);
                     }
                 }
             } else {
                 if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    STAT_INC(STAT_ACCEPT_ERRORS);
                     PyErr_SetFromErrno(PyExc_IOError);
                     /* write_error_log(__FILE__, __LINE__); */
                     call_error_logger();
@@ -968,27 +2172,47 @@ accept_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
     }
 }
 
+/* state of each loop thread */
 static void
-setup_server_env(void)
+setup_loop_env(void)
 {
-    /* setup_listen_sock(listen_sock); */
     cache_time_init();
-    setup_static_env(server_name, server_port);
+    stall_register_loop();
     setup_start_response();
-    
+
     ClientObject_list_fill();
-    client_t_list_fill();
-    parser_list_fill();
-    request_list_fill();
-    buffer_list_fill();
+    ContinuationObject_list_fill();
     InputObject_list_fill();
+    slab_prewarm();
+}
+
+static void
+clear_loop_env(void)
+{
+    clear_start_response();
+    stall_unregister_loop();
+
+    ClientObject_list_clear();
+    ContinuationObject_list_clear();
+    InputObject_list_clear();
+    slab_trim();
+}
+
+static void
+setup_server_env(void)
+{
+    /* setup_listen_sock(listen_sock); */
+    setup_static_env(server_name, server_port);
+    setup_loop_env();
     
     client_key = NATIVE_FROMSTRING("minefield.client");
+    continuation_key = NATIVE_FROMSTRING("minefield.continuation");
     wsgi_input_key = NATIVE_FROMSTRING("wsgi.input");
     status_code_key = NATIVE_FROMSTRING("STATUS_CODE");
     bytes_sent_key = NATIVE_FROMSTRING("SEND_BYTES");
     request_time_key = NATIVE_FROMSTRING("REQUEST_TIME");
     local_time_key = NATIVE_FROMSTRING("LOCAL_TIME");
+    timing_key = NATIVE_FROMSTRING("minefield.timing");
     empty_string = NATIVE_FROMSTRING("");
 }
 
@@ -996,22 +2220,17 @@ static void
 clear_server_env(void)
 {
     //clean
-    clear_start_response();
+    clear_loop_env();
     clear_static_env();
-    client_t_list_clear();
-    parser_list_clear();
-    
-    ClientObject_list_clear();
-    request_list_clear();
-    buffer_list_clear();
-    InputObject_list_clear();
 
     Py_DECREF(client_key);
+    Py_DECREF(continuation_key);
     Py_DECREF(wsgi_input_key);
     Py_DECREF(status_code_key);
     Py_DECREF(bytes_sent_key);
     Py_DECREF(request_time_key);
     Py_DECREF(local_time_key);
+    Py_DECREF(timing_key);
     Py_DECREF(empty_string);
 }
 
@@ -1052,6 +2271,15 @@ inet_listen(void)
             PyErr_SetFromErrno(PyExc_IOError);
             return -1;
         }
+#ifdef SO_REUSEPORT
+        // a socket for each loop
+        if (server_loops > 1 && setsockopt(listen_sock, SOL_SOCKET, SO_REUSEPORT, &flag,
+                sizeof(int)) == -1) {
+            close(listen_sock);
+            PyErr_SetFromErrno(PyExc_IOError);
+            return -1;
+        }
+#endif
 
         Py_BEGIN_ALLOW_THREADS
         res = bind(listen_sock, p->ai_addr, p->ai_addrlen);
@@ -1187,7 +2415,7 @@ fast_notify(void)
     spinner = (spinner + 1) % 2;
     fchmod(tempfile_fd, spinner);
     if (ppid != getppid()) {
-        kill_server(gtimeout);
+        stop_loops(gtimeout);
         tempfile_fd = 0;
     }
 }
@@ -1349,7 +2577,7 @@ minefield_stop(PyObject *self, PyObject *args, PyObject *kwds)
                                      kwlist, &timeout)) {
         return NULL;
     }
-    kill_server(timeout);
+    stop_loops(timeout);
     Py_RETURN_NONE;
 }
 
@@ -1358,15 +2586,24 @@ static inline int
 fire_pendings(void)
 {
     int ret = 1;
+    uint32_t i = 0, n;
     TimerObject *timer = NULL;
     pending_queue_t *pendings = g_pendings;
+    uint64_t stall;
 
-    while(pendings->size && loop_done && activecnt > 0) {
-        timer =  *(pendings->q + --pendings->size);
+    // in order, calls scheduled meanwhile run on the next turn
+    n = pendings->size;
+    while(i < n && loop_done) {
+        timer = pendings->q[i++];
         DEBUG("start timer:%p activecnt:%d", timer, activecnt);
-        fire_timer(timer);
+        if (!timer->cancelled) {
+            timer->active = NULL;
+            stall = stall_begin();
+            fire_timer(timer);
+            STALL_END(stall, STALL_PENDING, timer->callback);
+            activecnt--;
+        }
         Py_DECREF(timer);
-        activecnt--;
 
         DEBUG("fin timer:%p activecnt:%d", timer, activecnt);
         if (PyErr_Occurred()) {
@@ -1376,6 +2613,10 @@ fire_pendings(void)
             break;
         }
     }
+    if (i > 0) {
+        pendings->size -= i;
+        memmove(pendings->q, pendings->q + i, sizeof(TimerObject*) * pendings->size);
+    }
     return ret;
 }
 
@@ -1385,20 +2626,25 @@ fire_timers(void)
     TimerObject *timer;
     int ret = 1;
     heapq_t *q = g_timers;
-    time_t now = current_msec / 1000;
+    uintptr_t now = current_msec;
+    uint64_t stall;
 
-    while(q->size > 0 && loop_done && activecnt > 0) {
+    while(q->size > 0 && loop_done) {
 
         timer = q->heap[0];
-        DEBUG("seconds:%d", timer->seconds);
-        DEBUG("now:%d", now);
-        if (timer->seconds <= now) {
+        DEBUG("msec:%lu", (unsigned long)timer->msec);
+        DEBUG("now:%lu", (unsigned long)now);
+        if (timer->msec <= now) {
             //call
             timer = heappop(q);
-            fire_timer(timer);
-
+            if (!timer->cancelled) {
+                timer->active = NULL;
+                stall = stall_begin();
+                fire_timer(timer);
+                STALL_END(stall, STALL_TIMER, timer->callback);
+                activecnt--;
+            }
             Py_DECREF(timer);
-            activecnt--;
             DEBUG("fin timer:%p activecnt:%d", timer, activecnt);
 
             if (PyErr_Occurred()) {
@@ -1416,6 +2662,38 @@ fire_timers(void)
 
 }
 
+/*
+ * how long the loop may block in msec, pending calls and timers cut it short.
+ */
+static inline int
+loop_wait(void)
+{
+    uintptr_t at;
+    int wait = 10 * 1000, trim, resume;
+
+    if (g_pendings->size > 0) {
+        return 0;
+    }
+    if (g_timers->size > 0) {
+        at = g_timers->heap[0]->msec;
+        if (at <= current_msec) {
+            return 0;
+        }
+        if (at - current_msec < (uintptr_t)wait) {
+            wait = (int)(at - current_msec);
+        }
+    }
+    trim = slab_trim_wait();
+    if (trim >= 0 && trim < wait) {
+        wait = trim;
+    }
+    resume = memory_resume_wait();
+    if (resume >= 0 && resume < wait) {
+        wait = resume;
+    }
+    return wait;
+}
+
 static int
 listen_all_sockets(void)
 {
@@ -1423,7 +2701,7 @@ listen_all_sockets(void)
     int listen_sock = 0;
     int ret = 0;
 
-    iter = PyObject_GetIter(listen_socks);
+    iter = PyObject_GetIter(loop_socks);
     
     if (PyErr_Occurred()){
         call_error_logger();
@@ -1431,7 +2709,7 @@ listen_all_sockets(void)
     }
     
     DEBUG("socks iter %p", iter);
-    DEBUG("socks size %d", PyList_Size(listen_socks));
+    DEBUG("socks size %d", PyList_Size(loop_socks));
 
     while((item =  PyIter_Next(iter))){
 #ifdef PY3
@@ -1486,6 +2764,280 @@ close_all_sockets(void)
     return 1;
 }
 
+/*
+ * loops of set_loops(n), one thread each. the loops share the listen
+ * address (SO_REUSEPORT sockets, a dup of the socket when not possible)
+ * but nothing else: timers, free lists and the time cache are thread-local.
+ */
+
+static int
+open_loop(loop_thread_t *t)
+{
+    if (open_notify_fd(&t->wake_fd, &t->wake_wfd) == -1) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    t->calls = NULL;
+    t->stop_timeout = -1;
+    t->socks = NULL;
+    return 0;
+}
+
+static void
+close_loop(loop_thread_t *t)
+{
+    close_notify_fd(t->wake_fd, t->wake_wfd);
+    t->wake_fd = t->wake_wfd = -1;
+    pthread_mutex_destroy(&t->lock);
+    Py_CLEAR(t->calls);
+}
+
+static void
+loop_wake_callback(picoev_loop* loop, int fd, int events, void* cb_arg)
+{
+    loop_thread_t *t = current_loop;
+    PyObject *calls;
+    TimerObject *timer;
+    Py_ssize_t i;
+    int timeout;
+
+    drain_notify_fd(t->wake_fd);
+    pthread_mutex_lock(&t->lock);
+    calls = t->calls;
+    t->calls = NULL;
+    timeout = t->stop_timeout;
+    t->stop_timeout = -1;
+    pthread_mutex_unlock(&t->lock);
+
+    if (calls != NULL) {
+        for (i = 0; i < PyList_GET_SIZE(calls); i++) {
+            timer = (TimerObject *)PyList_GET_ITEM(calls, i);
+            if (!timer->cancelled && queue_timer(timer) == -1) {
+                call_error_logger();
+            }
+        }
+        Py_DECREF(calls);
+    }
+    if (timeout >= 0) {
+        kill_server(timeout);
+    }
+}
+
+/*
+ * shutdown the loop of this thread and post it to the others.
+ */
+static void
+stop_loops(int timeout)
+{
+    loop_thread_t *t;
+    int i;
+
+    kill_server(timeout);
+    for (i = 0; i < loop_cnt; i++) {
+        t = loops + i;
+        if (t == current_loop) {
+            continue;
+        }
+        pthread_mutex_lock(&t->lock);
+        t->stop_timeout = timeout;
+        pthread_mutex_unlock(&t->lock);
+        write_notify_fd(t->wake_wfd);
+    }
+}
+
+/* listen socket bound to the address of fd, -1 if SO_REUSEPORT is not set */
+static int
+reuseport_socket(int fd)
+{
+#ifdef SO_REUSEPORT
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr), optlen = sizeof(int);
+    int flag = 0, sock;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, &optlen) == -1 || !flag) {
+        return -1;
+    }
+    if (getsockname(fd, (struct sockaddr *)&addr, &len) == -1) {
+        return -1;
+    }
+    if (addr.ss_family != AF_INET && addr.ss_family != AF_INET6) {
+        return -1;
+    }
+    sock = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (sock == -1) {
+        return -1;
+    }
+    if (addr.ss_family == AF_INET6) {
+        optlen = sizeof(int);
+        if (getsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &flag, &optlen) == 0) {
+            setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &flag, sizeof(int));
+        }
+    }
+    flag = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(int)) == -1 ||
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(int)) == -1 ||
+        bind(sock, (struct sockaddr *)&addr, len) == -1 ||
+        listen(sock, backlog) == -1) {
+        close(sock);
+        return -1;
+    }
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    return sock;
+#else
+    return -1;
+#endif
+}
+
+static PyObject*
+clone_listen_socks(void)
+{
+    PyObject *socks, *item;
+    Py_ssize_t i;
+    int fd, sock;
+
+    socks = PyList_New(0);
+    if (socks == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < PyList_GET_SIZE(listen_socks); i++) {
+#ifdef PY3
+        fd = (int)PyLong_AsLong(PyList_GET_ITEM(listen_socks, i));
+#else
+        fd = (int)PyInt_AsLong(PyList_GET_ITEM(listen_socks, i));
+#endif
+        sock = reuseport_socket(fd);
+        if (sock == -1) {
+            // the loops take turns on one socket
+            sock = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        }
+        if (sock == -1) {
+            PyErr_SetFromErrno(PyExc_IOError);
+            goto error;
+        }
+#ifdef PY3
+        item = PyLong_FromLong((long)sock);
+#else
+        item = PyInt_FromLong((long)sock);
+#endif
+        if (item == NULL || PyList_Append(socks, item) == -1) {
+            Py_XDECREF(item);
+            close(sock);
+            goto error;
+        }
+        Py_DECREF(item);
+    }
+    return socks;
+
+error:
+    close_socks(socks);
+    return NULL;
+}
+
+static void
+close_socks(PyObject *socks)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < PyList_GET_SIZE(socks); i++) {
+#ifdef PY3
+        close((int)PyLong_AsLong(PyList_GET_ITEM(socks, i)));
+#else
+        close((int)PyInt_AsLong(PyList_GET_ITEM(socks, i)));
+#endif
+    }
+    Py_DECREF(socks);
+}
+
+static void*
+loop_thread_main(void *arg)
+{
+    loop_thread_t *t = (loop_thread_t *)arg;
+    PyGILState_STATE gstate;
+    sigset_t set;
+
+    // signals go to the thread of server.run()
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    gstate = PyGILState_Ensure();
+    current_loop = t;
+    loop_socks = t->socks;
+    t->socks = NULL;
+    setup_loop_env();
+
+    if (init_main_loop() == -1) {
+        call_error_logger();
+    } else {
+        loop_done = 1;
+        listen_all_sockets();
+        while (likely(loop_done == 1 && activecnt > 0)) {
+            fire_pendings();
+            fire_timers();
+            picoev_loop_once(main_loop, loop_wait());
+            memory_resume_reads(main_loop);
+        }
+        current_client = NULL;
+        loop_done = 0;
+        destroy_main_loop();
+    }
+    if (g_timers != NULL) {
+        clear_loop_queues();
+    }
+    clear_loop_env();
+    close_socks(loop_socks);
+    loop_socks = NULL;
+    current_loop = NULL;
+    PyGILState_Release(gstate);
+    return NULL;
+}
+
+static int
+start_loops(void)
+{
+    loop_thread_t *t;
+    int ret;
+
+    while (loop_cnt < server_loops) {
+        t = loops + loop_cnt;
+        if (open_loop(t) == -1) {
+            return -1;
+        }
+        t->socks = clone_listen_socks();
+        if (t->socks == NULL) {
+            close_loop(t);
+            return -1;
+        }
+        ret = pthread_create(&t->thread, NULL, loop_thread_main, t);
+        if (ret != 0) {
+            close_socks(t->socks);
+            t->socks = NULL;
+            close_loop(t);
+            errno = ret;
+            PyErr_SetFromErrno(PyExc_IOError);
+            return -1;
+        }
+        loop_cnt++;
+    }
+    return 0;
+}
+
+static void
+join_loops(void)
+{
+    int i;
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 1; i < loop_cnt; i++) {
+        pthread_join(loops[i].thread, NULL);
+    }
+    Py_END_ALLOW_THREADS
+    for (i = 1; i < loop_cnt; i++) {
+        close_loop(loops + i);
+    }
+    loop_cnt = 1;
+}
+
 static PyObject *
 minefield_run_loop(PyObject *self, PyObject *args, PyObject *kwds)
 {
@@ -1499,21 +3051,52 @@ minefield_run_loop(PyObject *self, PyObject *args, PyObject *kwds)
         return NULL;
     }
 
+    if (server_loops > 1 && worker_threads > 0) {
+        PyErr_SetString(PyExc_ValueError, "set_threads() can not be used with set_loops()");
+        return NULL;
+    }
     if (listen_socks == NULL) {
         PyErr_Format(PyExc_TypeError, "not found listen socket");
         return NULL;
 
     }
+    if (loop_cnt > 0 && current_loop != loops) {
+        PyErr_SetString(PyExc_RuntimeError, "server loop is running in another thread");
+        return NULL;
+    }
+
+    if (start_pool(worker_threads) < 0) {
+        return NULL;
+    }
+    if (access_log_start() < 0) {
+        stop_pool();
+        return NULL;
+    }
+    if (stall_watchdog_start() < 0) {
+        stop_pool();
+        access_log_stop();
+        return NULL;
+    }
 
     Py_INCREF(wsgi_app);
     setup_server_env();
 
-    init_main_loop();
+    if (init_main_loop() == -1) {
+        Py_DECREF(wsgi_app);
+        clear_server_env();
+        stop_pool();
+        access_log_stop();
+        stall_watchdog_stop();
+        return NULL;
+    }
+    log_ring_start();
     loop_done = 1;
+    loop_socks = listen_socks;
 
     PyOS_setsig(SIGPIPE, sigpipe_cb);
     PyOS_setsig(SIGINT, sigint_cb);
     PyOS_setsig(SIGTERM, sigint_cb);
+    trace_install_signal();
 
 
     if (listen_all_sockets() < 0) {
@@ -1521,19 +3104,33 @@ minefield_run_loop(PyObject *self, PyObject *args, PyObject *kwds)
         return NULL;
     }
 
+    if (pool_running) {
+        // not counted in activecnt
+        (void)picoev_add(main_loop, pool_notify_fd(), PICOEV_READ, 0, pool_callback, NULL);
+    }
+    if (start_loops() < 0) {
+        // serve with the loops started
+        call_error_logger();
+    }
+
     /* loop */
     while (likely(loop_done == 1 && activecnt > 0)) {
         /* DEBUG("before activecnt:%d", activecnt); */
         fire_pendings();
         fire_timers();
-        picoev_loop_once(main_loop, 10);
+        picoev_loop_once(main_loop, loop_wait());
         if (unlikely(catch_signal != 0)) {
             if (catch_signal == SIGINT) {
                 interrupted = 1;
             }
             catch_signal = 0;
-            kill_server(0);
+            stop_loops(0);
         }
+        if (unlikely(trace_signaled)) {
+            trace_dump_signaled();
+        }
+        slab_idle_check();
+        memory_resume_reads(main_loop);
         if (watch_loop) {
             if (tempfile_fd) {
                 fast_notify();
@@ -1551,13 +3148,25 @@ minefield_run_loop(PyObject *self, PyObject *args, PyObject *kwds)
         /* DEBUG("pendings->size:%d", g_pendings->size); */
     }
 
+    if (loop_done == 0) {
+        // forced shutdown
+        stop_loops(0);
+    }
+    join_loops();
+
     Py_DECREF(wsgi_app);
     Py_CLEAR(watchdog);
     
     current_client = NULL;
-    picoev_destroy_loop(main_loop);
-    picoev_deinit();
-    main_loop = NULL;
+    if (pool_running) {
+        stop_pool_jobs();
+    }
+    loop_done = 0;
+    loop_socks = NULL;
+    destroy_main_loop();
+    access_log_stop();
+    log_ring_stop();
+    stall_watchdog_stop();
 
     clear_server_env();
 
@@ -1603,6 +3212,46 @@ minefield_get_keepalive(PyObject *self, PyObject *args)
     return Py_BuildValue("i", is_keep_alive);
 }
 
+PyObject *
+minefield_set_threads(PyObject *self, PyObject *args)
+{
+    int temp;
+    if (!PyArg_ParseTuple(args, "i", &temp))
+        return NULL;
+    if (temp < 0 || temp > MAX_POOL_THREADS) {
+        PyErr_SetString(PyExc_ValueError, "threads value out of range ");
+        return NULL;
+    }
+    worker_threads = temp;
+    Py_RETURN_NONE;
+}
+
+PyObject *
+minefield_get_threads(PyObject *self, PyObject *args)
+{
+    return Py_BuildValue("i", worker_threads);
+}
+
+PyObject *
+minefield_set_loops(PyObject *self, PyObject *args)
+{
+    int temp;
+    if (!PyArg_ParseTuple(args, "i", &temp))
+        return NULL;
+    if (temp < 1 || temp > MAX_LOOPS) {
+        PyErr_SetString(PyExc_ValueError, "loops value out of range ");
+        return NULL;
+    }
+    server_loops = temp;
+    Py_RETURN_NONE;
+}
+
+PyObject *
+minefield_get_loops(PyObject *self, PyObject *args)
+{
+    return Py_BuildValue("i", server_loops);
+}
+
 PyObject *
 minefield_set_backlog(PyObject *self, PyObject *args)
 {
@@ -1683,6 +3332,110 @@ minefield_get_client_body_buffer_size(PyObject *self, PyObject *args)
     return Py_BuildValue("i", client_body_buffer_size);
 }
 
+PyObject *
+minefield_set_notsent_lowat(PyObject *self, PyObject *args)
+{
+    int temp;
+    if (!PyArg_ParseTuple(args, "i", &temp))
+        return NULL;
+    if (temp < 0) {
+        PyErr_SetString(PyExc_ValueError, "notsent_lowat value out of range ");
+        return NULL;
+    }
+    notsent_lowat = temp;
+    Py_RETURN_NONE;
+}
+
+PyObject *
+minefield_get_notsent_lowat(PyObject *self, PyObject *args)
+{
+    return Py_BuildValue("i", notsent_lowat);
+}
+
+PyObject *
+minefield_set_write_timeout(PyObject *self, PyObject *args)
+{
+    int temp;
+    if (!PyArg_ParseTuple(args, "i", &temp))
+        return NULL;
+    if (temp <= 0) {
+        PyErr_SetString(PyExc_ValueError, "write_timeout value out of range ");
+        return NULL;
+    }
+    write_timeout = temp;
+    Py_RETURN_NONE;
+}
+
+PyObject *
+minefield_get_write_timeout(PyObject *self, PyObject *args)
+{
+    return Py_BuildValue("i", write_timeout);
+}
+
+PyObject *
+minefield_set_output_watermarks(PyObject *self, PyObject *args)
+{
+    unsigned long long high, low;
+    if (!PyArg_ParseTuple(args, "KK", &high, &low))
+        return NULL;
+    if (low > high) {
+        PyErr_SetString(PyExc_ValueError, "low watermark must not exceed high watermark");
+        return NULL;
+    }
+    output_high_watermark = high;
+    output_low_watermark = low;
+    Py_RETURN_NONE;
+}
+
+PyObject *
+minefield_get_output_watermarks(PyObject *self, PyObject *args)
+{
+    return Py_BuildValue("(KK)", (unsigned long long)output_high_watermark,
+                         (unsigned long long)output_low_watermark);
+}
+
+PyObject *
+minefield_set_output_buffer_limit(PyObject *self, PyObject *args)
+{
+    unsigned long long temp;
+    if (!PyArg_ParseTuple(args, "K", &temp))
+        return NULL;
+    output_buffer_limit = temp;
+    Py_RETURN_NONE;
+}
+
+PyObject *
+minefield_get_output_buffer_limit(PyObject *self, PyObject *args)
+{
+    return Py_BuildValue("K", (unsigned long long)output_buffer_limit);
+}
+
+PyObject *
+minefield_get_buffered_output(PyObject *self, PyObject *args)
+{
+    return Py_BuildValue("K", (unsigned long long)total_buffered);
+}
+
+PyObject *
+minefield_set_pipeline_batch(PyObject *self, PyObject *args)
+{
+    int temp;
+    if (!PyArg_ParseTuple(args, "i", &temp))
+        return NULL;
+    if (temp <= 0) {
+        PyErr_SetString(PyExc_ValueError, "pipeline_batch value out of range ");
+        return NULL;
+    }
+    pipeline_batch = temp;
+    Py_RETURN_NONE;
+}
+
+PyObject *
+minefield_get_pipeline_batch(PyObject *self, PyObject *args)
+{
+    return Py_BuildValue("i", pipeline_batch);
+}
+
 PyObject *
 minefield_set_listen_socket(PyObject *self, PyObject *args)
 {
@@ -1755,22 +3508,18 @@ minefield_set_process_name(PyObject *self, PyObject *args)
 }*/
 
 
-static PyObject*
-internal_schedule_call(int seconds, PyObject *cb, PyObject *args, PyObject *kwargs)
+/*
+ * add the timer to the queues of this thread, the queues own a reference.
+ */
+static int
+queue_timer(TimerObject *timer)
 {
-    TimerObject* timer;
     heapq_t *timers = g_timers;
     pending_queue_t *pendings = g_pendings;
 
-    timer = TimerObject_new(seconds, cb, args, kwargs);
-    if (timer == NULL) {
-        return NULL;
-    }
-    DEBUG("seconds:%d", seconds);
-    if (!seconds) {
+    if (!timer->msec) {
         if (realloc_pendings() == -1) {
-            Py_DECREF(timer);
-            return NULL;
+            return -1;
         }
         Py_INCREF(timer);
 
@@ -1780,11 +3529,73 @@ internal_schedule_call(int seconds, PyObject *cb, PyObject *args, PyObject *kwar
         DEBUG("add timer:%p pendings->size:%d", timer, pendings->size);
     } else {
         if (heappush(timers, timer) == -1) {
-            Py_DECREF(timer);
-            return NULL;
+            return -1;
         }
     }
     activecnt++;
+    timer->active = &activecnt;
+    return 0;
+}
+
+/*
+ * hand the timer to the first loop from a thread without a loop
+ * (worker threads of set_threads(), application threads).
+ */
+static int
+post_timer(TimerObject *timer)
+{
+    loop_thread_t *t = loops;
+    int ret = 0;
+
+    pthread_mutex_lock(&t->lock);
+    if (t->calls == NULL) {
+        t->calls = PyList_New(0);
+    }
+    if (t->calls == NULL || PyList_Append(t->calls, (PyObject *)timer) == -1) {
+        ret = -1;
+    }
+    pthread_mutex_unlock(&t->lock);
+    if (ret == 0) {
+        write_notify_fd(t->wake_wfd);
+    }
+    return ret;
+}
+
+/* the thread runs a loop, which keeps its time cache updated */
+int
+loop_thread(void)
+{
+    return main_loop != NULL;
+}
+
+static PyObject*
+internal_schedule_call(long msec, PyObject *cb, PyObject *args, PyObject *kwargs)
+{
+    TimerObject* timer;
+    int ret;
+
+    if (g_timers == NULL) {
+        if (loop_cnt > 0) {
+            // the thread-local time cache is not updated by a loop
+            cache_time_update();
+        } else if (init_loop_queues() == -1) {
+            return PyErr_NoMemory();
+        }
+    }
+    timer = TimerObject_new(msec, cb, args, kwargs);
+    if (timer == NULL) {
+        return NULL;
+    }
+    DEBUG("msec:%ld", msec);
+    if (g_timers == NULL) {
+        ret = post_timer(timer);
+    } else {
+        ret = queue_timer(timer);
+    }
+    if (ret == -1) {
+        Py_DECREF(timer);
+        return NULL;
+    }
     return (PyObject*)timer;
 }
 
@@ -1832,14 +3643,165 @@ minefield_schedule_call(PyObject *self, PyObject *args, PyObject *kwargs)
         cbargs = PyTuple_GetSlice(args, 2, size);
     }
 
-    timer = internal_schedule_call(seconds, cb, cbargs, kwargs);
+    timer = internal_schedule_call(seconds * 1000, cb, cbargs, kwargs);
+    Py_XDECREF(cbargs);
+    return timer;
+}
+
+static PyObject*
+minefield_call_later(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t size;
+    PyObject *delay, *cb, *cbargs = NULL, *timer;
+    double seconds;
+
+    size = PyTuple_GET_SIZE(args);
+    if (size < 2) {
+        PyErr_SetString(PyExc_TypeError, "call_later takes at least 2 arguments");
+        return NULL;
+    }
+    delay = PyTuple_GET_ITEM(args, 0);
+    cb = PyTuple_GET_ITEM(args, 1);
+
+    seconds = PyFloat_AsDouble(delay);
+    if (seconds == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (!PyCallable_Check(cb)) {
+        PyErr_SetString(PyExc_TypeError, "must be callable");
+        return NULL;
+    }
+    if (seconds < 0) {
+        seconds = 0;
+    }
+    if (size > 2) {
+        cbargs = PyTuple_GetSlice(args, 2, size);
+    }
+    if (!loop_done) {
+        // cached time is stale outside the loop
+        cache_time_update();
+    }
+    // never early
+    timer = internal_schedule_call((long)ceil(seconds * 1000), cb, cbargs, kwargs);
     Py_XDECREF(cbargs);
     return timer;
 }
 
+/*
+ * watch an fd for minefield.loop, callback(fd, events) is called when it
+ * is ready. events 0 removes the watch.
+ */
+static PyObject *
+minefield_watch(PyObject *self, PyObject *args)
+{
+    int fd, events, size;
+    PyObject *callback = Py_None;
+    fd_watch_t *w;
+
+    if (!PyArg_ParseTuple(args, "ii|O:watch", &fd, &events, &callback)) {
+        return NULL;
+    }
+    if (fd < 0 || fd >= max_fd) {
+        PyErr_SetString(PyExc_ValueError, "fd value out of range ");
+        return NULL;
+    }
+    events &= PICOEV_READWRITE;
+    if (events && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "must be callable");
+        return NULL;
+    }
+    if (fd >= fd_watches_size) {
+        size = max_fd;
+        w = PyMem_Realloc(fd_watches, sizeof(fd_watch_t) * size);
+        if (w == NULL) {
+            return PyErr_NoMemory();
+        }
+        memset(w + fd_watches_size, 0, sizeof(fd_watch_t) * (size - fd_watches_size));
+        fd_watches = w;
+        fd_watches_size = size;
+    }
+    if (init_main_loop() == -1) {
+        return NULL;
+    }
+    w = fd_watches + fd;
+
+    if (events == 0) {
+        if (w->callback) {
+            if (picoev_is_active(main_loop, fd)) {
+                picoev_del(main_loop, fd);
+            }
+            Py_CLEAR(w->callback);
+            w->events = 0;
+        }
+        Py_RETURN_NONE;
+    }
+    if (w->callback == NULL && picoev_is_active(main_loop, fd)) {
+        PyErr_Format(PyExc_IOError, "fd %d is used by the server", fd);
+        return NULL;
+    }
+    if (w->callback == NULL) {
+        if (picoev_add(main_loop, fd, events, 0, watch_callback, NULL) != 0) {
+            PyErr_SetFromErrno(PyExc_IOError);
+            return NULL;
+        }
+    } else {
+        picoev_set_events(main_loop, fd, events);
+    }
+    Py_INCREF(callback);
+    Py_XSETREF(w->callback, callback);
+    w->events = events;
+    Py_RETURN_NONE;
+}
+
+/*
+ * one turn of the loop outside server.run(), for minefield.loop.
+ * waits at most timeout seconds, or until the next timer.
+ */
+static PyObject *
+minefield_run_once(PyObject *self, PyObject *args)
+{
+    double timeout = -1;
+    int wait;
+
+    if (!PyArg_ParseTuple(args, "|d:run_once", &timeout)) {
+        return NULL;
+    }
+    if (loop_done) {
+        PyErr_SetString(PyExc_RuntimeError, "server loop is running");
+        return NULL;
+    }
+    if (init_main_loop() == -1) {
+        return NULL;
+    }
+    loop_done = 1;
+    wait = loop_wait();
+    if (timeout >= 0 && timeout * 1000 < wait) {
+        wait = (int)(timeout * 1000);
+    }
+    picoev_loop_once(main_loop, wait);
+    // callbacks last, the caller checks its state right after
+    fire_pendings();
+    fire_timers();
+    loop_done = 0;
+    Py_RETURN_NONE;
+}
+
 static PyMethodDef ServerMethods[] = {
     {"listen", (PyCFunction)minefield_listen, METH_VARARGS|METH_KEYWORDS, "set host and port num"},
     {"set_access_logger", minefield_access_log, METH_VARARGS, "set access logger function."},
+    {"set_access_log", (PyCFunction)set_access_log, METH_VARARGS|METH_KEYWORDS, "write access log to path or fd in native format"},
+    {"flush_access_log", flush_access_log, METH_VARARGS, "write buffered access log lines"},
+    {"reopen_access_log", reopen_access_log, METH_VARARGS, "reopen access log file after rotation"},
+    {"set_log_ring", (PyCFunction)set_log_ring, METH_VARARGS|METH_KEYWORDS, "append binary access records to a mmap'd ring file"},
+    {"stats", get_stats, METH_VARARGS, "return counters and latency histograms of the worker"},
+    {"reset_stats", reset_stats, METH_VARARGS, "clear counters and latency histograms"},
+    {"set_stats_file", set_stats_file, METH_VARARGS, "keep counters and latency histograms in a mmap'd file"},
+    {"set_stall_detector", (PyCFunction)set_stall_detector, METH_VARARGS|METH_KEYWORDS, "report callbacks blocking the loop longer than threshold sec"},
+    {"get_stall_threshold", get_stall_threshold, METH_VARARGS, "return the stall detector threshold"},
+    {"set_trace", (PyCFunction)set_trace, METH_VARARGS|METH_KEYWORDS, "record the spans of 1 in sample requests"},
+    {"dump_trace", dump_trace, METH_VARARGS, "write the recorded spans as Chrome trace JSON"},
+    {"set_slab", (PyCFunction)set_slab, METH_VARARGS|METH_KEYWORDS, "set the prewarmed and kept connections of the slab allocator"},
+    {"slab_stats", slab_stats, METH_VARARGS, "return the slab allocator counters"},
     {"set_error_logger", minefield_error_log, METH_VARARGS, "set error logger function."},
 
     {"set_keepalive", minefield_set_keepalive, METH_VARARGS, "set keep-alive support. value set timeout sec. default 0. (disable keep-alive)"},
@@ -1851,6 +3813,39 @@ static PyMethodDef ServerMethods[] = {
     {"set_client_body_buffer_size", minefield_set_client_body_buffer_size, METH_VARARGS, "set client_body_buffer_size"},
     {"get_client_body_buffer_size", minefield_get_client_body_buffer_size, METH_VARARGS, "return client_body_buffer_size"},
 
+    {"set_notsent_lowat", minefield_set_notsent_lowat, METH_VARARGS, "set TCP_NOTSENT_LOWAT of streaming responses (0 disables)"},
+    {"get_notsent_lowat", minefield_get_notsent_lowat, METH_VARARGS, "return TCP_NOTSENT_LOWAT of streaming responses"},
+
+    {"stream", open_stream, METH_VARARGS, "create stream response of the request"},
+    {"get_continuation", get_continuation, METH_VARARGS, "return continuation of the request"},
+    {"broadcast", broadcast, METH_VARARGS, "queue data on stream responses"},
+#ifdef PY3
+    {"sleep", future_sleep, METH_VARARGS, "future of async applications, done after the seconds"},
+    {"wait_readable", future_wait_readable, METH_VARARGS, "future of async applications, done when the fd is readable"},
+    {"wait_writable", future_wait_writable, METH_VARARGS, "future of async applications, done when the fd is writable"},
+#endif
+
+    {"set_write_timeout", minefield_set_write_timeout, METH_VARARGS, "set write timeout sec. default 300"},
+    {"get_write_timeout", minefield_get_write_timeout, METH_VARARGS, "return write timeout sec"},
+
+    {"set_output_watermarks", minefield_set_output_watermarks, METH_VARARGS, "set high and low watermarks of per-connection output buffer"},
+    {"get_output_watermarks", minefield_get_output_watermarks, METH_VARARGS, "return (high, low) watermarks of per-connection output buffer"},
+    {"set_memory_budget", set_memory_budget, METH_VARARGS, "set max in-memory request bodies and output of the worker"},
+    {"get_memory_budget", get_memory_budget, METH_VARARGS, "return the memory budget of the worker"},
+    {"memory_usage", memory_usage, METH_VARARGS, "return the memory budget usage"},
+    {"set_output_buffer_limit", minefield_set_output_buffer_limit, METH_VARARGS, "set max buffered output of the worker"},
+    {"get_output_buffer_limit", minefield_get_output_buffer_limit, METH_VARARGS, "return max buffered output of the worker"},
+    {"get_buffered_output", minefield_get_buffered_output, METH_VARARGS, "return buffered but unsent output bytes of the worker"},
+
+    {"set_pipeline_batch", minefield_set_pipeline_batch, METH_VARARGS, "set max pipelined requests processed per loop turn"},
+    {"get_pipeline_batch", minefield_get_pipeline_batch, METH_VARARGS, "return max pipelined requests processed per loop turn"},
+
+    {"set_threads", minefield_set_threads, METH_VARARGS, "set worker threads of application calls. default 0. (call on the loop thread)"},
+    {"get_threads", minefield_get_threads, METH_VARARGS, "return worker threads of application calls"},
+
+    {"set_loops", minefield_set_loops, METH_VARARGS, "set server loops, one thread each. default 1"},
+    {"get_loops", minefield_get_loops, METH_VARARGS, "return server loops"},
+
     {"set_backlog", minefield_set_backlog, METH_VARARGS, "set backlog size"},
     {"get_backlog", minefield_get_backlog, METH_VARARGS, "return backlog size"},
 
@@ -1862,6 +3857,17 @@ static PyMethodDef ServerMethods[] = {
     {"shutdown", (PyCFunction)minefield_stop, METH_VARARGS|METH_KEYWORDS, "stop main loop "},
 
     {"schedule_call", (PyCFunction)minefield_schedule_call, METH_VARARGS|METH_KEYWORDS, ""},
+    {"call_later", (PyCFunction)minefield_call_later, METH_VARARGS|METH_KEYWORDS, "call after the seconds (float), 0 is the next loop turn"},
+    {"watch", minefield_watch, METH_VARARGS, "call callback(fd, events) when the fd is ready, events 0 removes it"},
+    {"run_once", minefield_run_once, METH_VARARGS, "run one turn of the loop outside server.run()"},
+
+    {"mount_static", mount_static, METH_VARARGS, "serve files under prefix from directory without calling the application"},
+    {"compile_headers", compile_headers, METH_VARARGS, "serialize response headers once, return HeaderBlock"},
+    {"set_default_headers", set_default_headers, METH_VARARGS, "set headers added to every response"},
+    {"set_response_cache", (PyCFunction)set_response_cache, METH_VARARGS|METH_KEYWORDS, "enable in-process response cache of max_bytes"},
+    {"cache_response", cache_response, METH_VARARGS, "store response for requests like environ"},
+    {"clear_response_cache", clear_response_cache, METH_VARARGS, "remove all cached responses"},
+    {"set_compression", (PyCFunction)set_compression, METH_VARARGS|METH_KEYWORDS, "compress responses with gzip, deflate or br"},
 
     // support gunicorn
     {"set_listen_socket", minefield_set_listen_socket, METH_VARARGS, "set listen_sock"},
@@ -1910,6 +3916,10 @@ initserver(void)
         INITERROR;
     }
 
+    if (PyType_Ready(&HeaderBlockType) < 0) {
+        INITERROR;
+    }
+
     if (PyType_Ready(&ClientObjectType) < 0) {
         INITERROR;
     }
@@ -1922,6 +3932,24 @@ initserver(void)
         INITERROR;
     }
 
+    if (PyType_Ready(&TimingObjectType) < 0) {
+        INITERROR;
+    }
+
+    if (PyType_Ready(&StreamObjectType) < 0) {
+        INITERROR;
+    }
+
+    if (PyType_Ready(&ContinuationObjectType) < 0) {
+        INITERROR;
+    }
+
+#ifdef PY3
+    if (PyType_Ready(&FutureObjectType) < 0) {
+        INITERROR;
+    }
+#endif
+
     timeout_error = PyErr_NewException("minefield.server.timeout",
                       PyExc_IOError, NULL);
     if (timeout_error == NULL) {
@@ -1933,14 +3961,8 @@ initserver(void)
     //DEBUG("client size %u", sizeof(client_t));
     //DEBUG("request size %u", sizeof(request));
     //DEBUG("header bucket %u", sizeof(write_bucket));
-    g_timers = init_queue();
-    if (g_timers == NULL) {
-        INITERROR;
-    }
-    g_pendings = init_pendings();
-    if (g_pendings == NULL) {
-        INITERROR;
-    }
+    cache_time_init();
+    stats_init();
 
 #ifdef PY3
     return m;
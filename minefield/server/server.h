@@ -4,12 +4,39 @@
 #include "minefield.h"
 #include "picoev.h"
 #include "request.h"
+#include "client.h"
 #include "time_cache.h"
+#include "timer.h"
 
 
 extern uint64_t max_content_length;      //max_content_length
 extern int client_body_buffer_size; //client_body_buffer_size
-extern PyObject* current_client;
+extern int notsent_lowat; //TCP_NOTSENT_LOWAT of streaming responses
+extern int write_timeout; //write timeout sec
+extern uint64_t output_high_watermark; //stop pulling response iterator
+extern uint64_t output_low_watermark; //resume pulling response iterator
+extern uint64_t output_buffer_limit; //max queued output of the worker
+extern THREAD_LOCAL PyObject* current_client;
+
+void wake_stream(client_t *client);
+
+void wake_continuation(client_t *client);
+
+void timer_cancelled(TimerObject *timer);
+
+int loop_thread(void);
+
+int watch_static_notify(int fd);
+
+int unwatch_static_notify(int fd);
+
+#ifdef PY3
+#include "coroutine.h"
+
+void fire_future(FutureObject *future, int timedout);
+
+void resume_task(client_t *client);
+#endif
 extern PyObject* timeout_error;
 
 #endif
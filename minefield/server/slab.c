@@ -0,0 +1,325 @@
+#include "slab.h"
+#include "client.h"
+#include "request.h"
+#include "buffer.h"
+#include "time_cache.h"
+#include "arena.h"
+
+/*
+ * slab allocator of the connection state.
+ * each type has its own chunks, chunks with free objects are on the
+ * partial list, all free ones on the empty list up to max_free
+ * connections worth of objects, the others go back to the system.
+ * server.set_slab() prewarms them for the expected connections and
+ * releases the empty chunks above that after idle_trim sec without
+ * allocations. the GIL guards them, like the shared caches.
+ */
+
+#define SLAB_ALIGN 16
+#define OBJECT_SIZE(s) (((s)->size + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+#define PER_CHUNK(s) ((SLAB_CHUNK_SIZE - SLAB_HEADER_SIZE) / OBJECT_SIZE(s))
+#define CHUNK_OF(p) ((slab_chunk *)((uintptr_t)(p) & ~(uintptr_t)(SLAB_CHUNK_SIZE - 1)))
+
+typedef struct {
+    const char *name;
+    size_t size;
+    uint32_t per_conn;          // objects of a connection
+    slab_chunk *partial;
+    slab_chunk *empty;
+    uint64_t chunks;
+    uint64_t empty_chunks;
+    uint64_t in_use;
+    uint64_t peak;
+    uint64_t allocs;
+} slab_cache;
+
+static slab_cache slabs[SLAB_TYPES] = {
+    [SLAB_CLIENT] = {"client", sizeof(client_t), 1},
+    [SLAB_REQUEST] = {"request", sizeof(request), 1},
+    [SLAB_PARSER] = {"parser", sizeof(http_parser), 1},
+    // path and body
+    [SLAB_BUFFER] = {"buffer", sizeof(buffer_t), 2},
+    [SLAB_ARENA] = {"arena", ARENA_BLOCK_SIZE, 1},
+};
+
+DECLARE_CACHE_LOCK;
+
+static uint64_t prewarm_conns = 0;
+static uint64_t max_free_conns = SLAB_MAX_FREE;
+static uintptr_t idle_trim_msec = 0;
+
+// allocations since the last idle check
+static int slab_active = 0;
+static int slab_trimmed = 1;
+static uintptr_t idle_since = 0;
+
+static void
+push_chunk(slab_chunk **list, slab_chunk *ch)
+{
+    ch->prev = NULL;
+    ch->next = *list;
+    if (*list) {
+        (*list)->prev = ch;
+    }
+    *list = ch;
+}
+
+static void
+unlink_chunk(slab_chunk **list, slab_chunk *ch)
+{
+    if (ch->prev) {
+        ch->prev->next = ch->next;
+    } else {
+        *list = ch->next;
+    }
+    if (ch->next) {
+        ch->next->prev = ch->prev;
+    }
+    ch->prev = ch->next = NULL;
+}
+
+static slab_chunk *
+new_chunk(slab_type type)
+{
+    slab_cache *s = slabs + type;
+    slab_chunk *ch;
+    char *p;
+    size_t size = OBJECT_SIZE(s);
+    uint32_t i, n = PER_CHUNK(s);
+
+    if (posix_memalign((void **)&ch, SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE) != 0) {
+        return NULL;
+    }
+    ch->prev = ch->next = NULL;
+    ch->type = type;
+    ch->nfree = n;
+    p = (char *)ch + SLAB_HEADER_SIZE;
+    ch->free = p;
+    for (i = 0; i < n - 1; i++, p += size) {
+        *(void **)p = p + size;
+    }
+    *(void **)p = NULL;
+    s->chunks++;
+    GDEBUG("new %s chunk %p", s->name, ch);
+    return ch;
+}
+
+static void
+release_chunk(slab_cache *s, slab_chunk *ch)
+{
+    GDEBUG("release %s chunk %p", s->name, ch);
+    s->chunks--;
+    free(ch);
+}
+
+static uint64_t
+free_objects(slab_cache *s)
+{
+    return s->chunks * PER_CHUNK(s) - s->in_use;
+}
+
+void*
+slab_alloc(slab_type type)
+{
+    slab_cache *s = slabs + type;
+    slab_chunk *ch;
+    void *p;
+
+    CACHE_LOCK();
+    ch = s->partial;
+    if (ch == NULL) {
+        if ((ch = s->empty) != NULL) {
+            unlink_chunk(&s->empty, ch);
+            s->empty_chunks--;
+        } else if ((ch = new_chunk(type)) == NULL) {
+            CACHE_UNLOCK();
+            return NULL;
+        }
+        push_chunk(&s->partial, ch);
+    }
+    p = ch->free;
+    ch->free = *(void **)p;
+    if (--ch->nfree == 0) {
+        // full chunks are on no list
+        unlink_chunk(&s->partial, ch);
+    }
+    s->allocs++;
+    if (++s->in_use > s->peak) {
+        s->peak = s->in_use;
+    }
+    slab_active = 1;
+    CACHE_UNLOCK();
+    return p;
+}
+
+void
+slab_free(slab_type type, void *p)
+{
+    slab_cache *s = slabs + type;
+    slab_chunk *ch = CHUNK_OF(p);
+    uint64_t keep;
+
+    CACHE_LOCK();
+    *(void **)p = ch->free;
+    ch->free = p;
+    s->in_use--;
+    if (++ch->nfree == 1) {
+        push_chunk(&s->partial, ch);
+    }
+    if (ch->nfree == PER_CHUNK(s)) {
+        unlink_chunk(&s->partial, ch);
+        keep = (max_free_conns > prewarm_conns ? max_free_conns : prewarm_conns) * s->per_conn;
+        if ((s->empty_chunks + 1) * PER_CHUNK(s) <= keep) {
+            push_chunk(&s->empty, ch);
+            s->empty_chunks++;
+        } else {
+            release_chunk(s, ch);
+        }
+    }
+    CACHE_UNLOCK();
+}
+
+/*
+ * allocate the chunks of the prewarmed connections, called by the loops.
+ */
+void
+slab_prewarm(void)
+{
+    slab_cache *s;
+    slab_chunk *ch;
+    int i;
+
+    CACHE_LOCK();
+    for (i = 0; i < SLAB_TYPES; i++) {
+        s = slabs + i;
+        while (free_objects(s) < prewarm_conns * s->per_conn) {
+            if ((ch = new_chunk(i)) == NULL) {
+                break;
+            }
+            push_chunk(&s->empty, ch);
+            s->empty_chunks++;
+        }
+    }
+    CACHE_UNLOCK();
+}
+
+/*
+ * release the empty chunks above the prewarmed connections.
+ */
+void
+slab_trim(void)
+{
+    slab_cache *s;
+    slab_chunk *ch;
+    int i;
+
+    CACHE_LOCK();
+    for (i = 0; i < SLAB_TYPES; i++) {
+        s = slabs + i;
+        while ((ch = s->empty) != NULL &&
+                free_objects(s) - PER_CHUNK(s) >= prewarm_conns * s->per_conn) {
+            unlink_chunk(&s->empty, ch);
+            s->empty_chunks--;
+            release_chunk(s, ch);
+        }
+    }
+    CACHE_UNLOCK();
+}
+
+/* called by the main loop each turn */
+void
+slab_idle_check(void)
+{
+    if (idle_trim_msec == 0) {
+        return;
+    }
+    if (slab_active) {
+        slab_active = 0;
+        slab_trimmed = 0;
+        idle_since = current_msec;
+    } else if (!slab_trimmed && current_msec - idle_since >= idle_trim_msec) {
+        slab_trim();
+        slab_trimmed = 1;
+    }
+}
+
+/* msec until the idle trim, -1 without one */
+int
+slab_trim_wait(void)
+{
+    uintptr_t idle;
+
+    if (idle_trim_msec == 0) {
+        return -1;
+    }
+    if (slab_active) {
+        return (int)idle_trim_msec;
+    }
+    if (slab_trimmed) {
+        return -1;
+    }
+    idle = current_msec - idle_since;
+    return idle >= idle_trim_msec ? 0 : (int)(idle_trim_msec - idle);
+}
+
+PyObject *
+set_slab(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    Py_ssize_t prewarm = 0, max_free = SLAB_MAX_FREE;
+    double idle_trim = 0;
+    static char *kwlist[] = {"prewarm", "max_free", "idle_trim", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nnd:set_slab", kwlist, &prewarm, &max_free, &idle_trim)) {
+        return NULL;
+    }
+    if (prewarm < 0 || prewarm > 1024 * 1024) {
+        PyErr_SetString(PyExc_ValueError, "prewarm value out of range ");
+        return NULL;
+    }
+    if (max_free < 0 || max_free > 1024 * 1024) {
+        PyErr_SetString(PyExc_ValueError, "max_free value out of range ");
+        return NULL;
+    }
+    if (idle_trim < 0 || idle_trim > 86400) {
+        PyErr_SetString(PyExc_ValueError, "idle_trim value out of range ");
+        return NULL;
+    }
+    prewarm_conns = prewarm;
+    max_free_conns = max_free;
+    idle_trim_msec = (uintptr_t)(idle_trim * 1000);
+    slab_trim();
+    slab_prewarm();
+    Py_RETURN_NONE;
+}
+
+PyObject *
+slab_stats(PyObject *self, PyObject *args)
+{
+    PyObject *dict, *item;
+    slab_cache *s;
+    int i;
+
+    dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < SLAB_TYPES; i++) {
+        s = slabs + i;
+        CACHE_LOCK();
+        item = Py_BuildValue("{s:n,s:K,s:K,s:K,s:K,s:K}",
+                "size", (Py_ssize_t)OBJECT_SIZE(s),
+                "chunks", (unsigned PY_LONG_LONG)s->chunks,
+                "in_use", (unsigned PY_LONG_LONG)s->in_use,
+                "free", (unsigned PY_LONG_LONG)free_objects(s),
+                "peak", (unsigned PY_LONG_LONG)s->peak,
+                "allocs", (unsigned PY_LONG_LONG)s->allocs);
+        CACHE_UNLOCK();
+        if (item == NULL || PyDict_SetItemString(dict, s->name, item) == -1) {
+            Py_XDECREF(item);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(item);
+    }
+    return dict;
+}
@@ -0,0 +1,47 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "minefield.h"
+
+#define SLAB_CHUNK_SIZE (64 * 1024)
+#define SLAB_HEADER_SIZE 64
+#define SLAB_MAX_FREE 1024
+
+typedef enum {
+    SLAB_CLIENT,                // client_t
+    SLAB_REQUEST,
+    SLAB_PARSER,                // http_parser
+    SLAB_BUFFER,                // buffer_t, the data is allocated apart
+    SLAB_ARENA,                 // blocks of the request arenas
+    SLAB_TYPES
+} slab_type;
+
+/*
+ * objects come from SLAB_CHUNK_SIZE aligned chunks of one type, the
+ * chunk of an object is its address masked.
+ */
+typedef struct slab_chunk {
+    struct slab_chunk *prev;
+    struct slab_chunk *next;
+    void *free;                 // free objects, linked through their first word
+    uint32_t nfree;
+    uint8_t type;
+} slab_chunk;
+
+void* slab_alloc(slab_type type);
+
+void slab_free(slab_type type, void *p);
+
+void slab_prewarm(void);
+
+void slab_trim(void);
+
+void slab_idle_check(void);
+
+int slab_trim_wait(void);
+
+PyObject* set_slab(PyObject *self, PyObject *args, PyObject *kwds);
+
+PyObject* slab_stats(PyObject *self, PyObject *args);
+
+#endif
@@ -0,0 +1,392 @@
+#include "stall.h"
+#include "util.h"
+#include "log.h"
+#include <pthread.h>
+#include <signal.h>
+#include <pythread.h>
+
+/*
+ * stall detector of server.set_stall_detector().
+ * the loops take the time around each callback they dispatch and report
+ * the ones over the threshold with the request they handled. with
+ * stack=True a watchdog thread takes the Python stack of a loop that is
+ * still in a callback after the threshold, it goes with the report when
+ * the callback returns.
+ */
+
+uint64_t stall_threshold = 0;          // usec
+
+// environ of the request handled by the running callback
+static THREAD_LOCAL PyObject *stall_environ = NULL;
+
+typedef struct {
+    int used;
+    unsigned long thread_id;
+    uint64_t start;             // running callback, 0 between callbacks
+    uint64_t stack_start;       // callback the stack was taken in
+    PyObject *stack;            // str
+} stall_slot;
+
+static stall_slot slots[STALL_MAX_LOOPS];
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static THREAD_LOCAL stall_slot *slot = NULL;
+
+static PyObject *stall_logger = NULL;
+static int capture_stack = 0;
+
+static pthread_t watchdog;
+static int watchdog_running = 0;
+static int watchdog_stopping = 0;
+static pthread_mutex_t watchdog_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watchdog_cond = PTHREAD_COND_INITIALIZER;
+
+static const char *kind_names[] = {"io", "timeout", "timer", "pending"};
+
+uint64_t
+stall_enter(void)
+{
+    uint64_t now = monotonic_usec();
+
+    Py_CLEAR(stall_environ);
+    if (slot) {
+        __atomic_store_n(&slot->start, now, __ATOMIC_RELAXED);
+    }
+    return now;
+}
+
+/* the request may be done before the callback returns, keep its environ */
+void
+stall_set_request(request *req)
+{
+    PyObject *old = stall_environ;
+
+    if (req && req->environ) {
+        Py_INCREF(req->environ);
+        stall_environ = req->environ;
+        Py_XDECREF(old);
+    }
+}
+
+static void
+write_stall(uint64_t usec, stall_kind kind, PyObject *method, PyObject *path, PyObject *stack)
+{
+    PyObject *msg;
+
+#ifdef PY3
+    msg = PyUnicode_FromFormat("minefield: %s callback blocked the loop for %lu ms (%S %S)\n",
+            kind_names[kind], (unsigned long)(usec / 1000),
+            method ? method : Py_None, path ? path : Py_None);
+    if (msg != NULL) {
+        PySys_FormatStderr("%U", msg);
+        if (stack) {
+            PySys_FormatStderr("%U", stack);
+        }
+    }
+#else
+    msg = PyString_FromFormat("minefield: %s callback blocked the loop for %lu ms\n",
+            kind_names[kind], (unsigned long)(usec / 1000));
+    if (msg != NULL) {
+        PySys_WriteStderr("%s%s", PyString_AS_STRING(msg), stack ? PyString_AS_STRING(stack) : "");
+    }
+#endif
+    Py_XDECREF(msg);
+    PyErr_Clear();
+}
+
+static void
+report_stall(uint64_t usec, stall_kind kind, PyObject *callback, PyObject *stack)
+{
+    PyObject *exc, *val, *tb, *info, *res;
+    PyObject *method = NULL, *path = NULL;
+
+    // the callback may have left an error for the loop
+    PyErr_Fetch(&exc, &val, &tb);
+    if (stall_environ) {
+        method = PyDict_GetItemString(stall_environ, "REQUEST_METHOD");
+        path = PyDict_GetItemString(stall_environ, "PATH_INFO");
+    }
+    if (stall_logger == NULL) {
+        write_stall(usec, kind, method, path, stack);
+    } else {
+        info = Py_BuildValue("{s:d,s:s,s:O,s:O,s:O,s:O}",
+                "duration", usec / 1000000.0,
+                "kind", kind_names[kind],
+                "method", method ? method : Py_None,
+                "path", path ? path : Py_None,
+                "callback", callback ? callback : Py_None,
+                "stack", stack ? stack : Py_None);
+        if (info != NULL) {
+            res = PyObject_CallFunctionObjArgs(stall_logger, info, NULL);
+            Py_DECREF(info);
+            Py_XDECREF(res);
+        }
+        if (PyErr_Occurred()) {
+            call_error_logger();
+        }
+    }
+    PyErr_Restore(exc, val, tb);
+}
+
+/*
+ * the callback started at start returned, report it over the threshold.
+ */
+void
+stall_check(uint64_t start, stall_kind kind, PyObject *callback)
+{
+    uint64_t usec = monotonic_usec() - start;
+    PyObject *stack = NULL;
+
+    if (slot) {
+        __atomic_store_n(&slot->start, 0, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&slot_lock);
+        if (slot->stack) {
+            if (slot->stack_start == start) {
+                stack = slot->stack;
+            } else {
+                Py_DECREF(slot->stack);
+            }
+            slot->stack = NULL;
+        }
+        pthread_mutex_unlock(&slot_lock);
+    }
+    if (stall_threshold && usec >= stall_threshold) {
+        report_stall(usec, kind, callback, stack);
+    }
+    Py_XDECREF(stack);
+    Py_CLEAR(stall_environ);
+}
+
+int
+stall_register_loop(void)
+{
+    int i;
+
+    pthread_mutex_lock(&slot_lock);
+    for (i = 0; i < STALL_MAX_LOOPS; i++) {
+        if (!slots[i].used) {
+            slot = slots + i;
+            slot->used = 1;
+            slot->thread_id = PyThread_get_thread_ident();
+            slot->start = 0;
+            slot->stack_start = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&slot_lock);
+    return slot ? 0 : -1;
+}
+
+void
+stall_unregister_loop(void)
+{
+    PyObject *stack;
+
+    if (slot == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&slot_lock);
+    stack = slot->stack;
+    slot->stack = NULL;
+    slot->used = 0;
+    pthread_mutex_unlock(&slot_lock);
+    Py_XDECREF(stack);
+    slot = NULL;
+    Py_CLEAR(stall_environ);
+}
+
+/* formatted Python stack of a thread, called with the GIL */
+static PyObject *
+thread_stack(unsigned long thread_id)
+{
+    PyObject *sys = NULL, *traceback = NULL, *frames = NULL, *key = NULL;
+    PyObject *frame, *lines = NULL, *sep = NULL, *stack = NULL;
+
+    sys = PyImport_ImportModule("sys");
+    traceback = PyImport_ImportModule("traceback");
+    if (sys == NULL || traceback == NULL) {
+        goto done;
+    }
+    frames = PyObject_CallMethod(sys, "_current_frames", NULL);
+    key = PyLong_FromUnsignedLong(thread_id);
+    if (frames == NULL || key == NULL) {
+        goto done;
+    }
+    frame = PyDict_GetItem(frames, key);
+    if (frame == NULL) {
+        goto done;
+    }
+    lines = PyObject_CallMethod(traceback, "format_stack", "O", frame);
+    sep = NATIVE_FROMSTRING("");
+    if (lines == NULL || sep == NULL) {
+        goto done;
+    }
+    stack = PyObject_CallMethod(sep, "join", "O", lines);
+done:
+    Py_XDECREF(sys);
+    Py_XDECREF(traceback);
+    Py_XDECREF(frames);
+    Py_XDECREF(key);
+    Py_XDECREF(lines);
+    Py_XDECREF(sep);
+    PyErr_Clear();
+    return stack;
+}
+
+static void
+take_stack(stall_slot *s, uint64_t start)
+{
+    PyGILState_STATE gstate;
+    PyObject *stack, *old = NULL;
+
+    gstate = PyGILState_Ensure();
+    // the loop drops the GIL in Python code, or once the callback returned
+    if (__atomic_load_n(&s->start, __ATOMIC_RELAXED) == start) {
+        stack = thread_stack(s->thread_id);
+        pthread_mutex_lock(&slot_lock);
+        if (s->used && __atomic_load_n(&s->start, __ATOMIC_RELAXED) == start) {
+            old = s->stack;
+            s->stack = stack;
+            s->stack_start = start;
+        } else {
+            old = stack;
+        }
+        pthread_mutex_unlock(&slot_lock);
+        Py_XDECREF(old);
+    }
+    PyGILState_Release(gstate);
+}
+
+static void
+scan_slots(void)
+{
+    uint64_t now = monotonic_usec(), start, threshold = stall_threshold;
+    int i, taken;
+
+    if (threshold == 0) {
+        return;
+    }
+    for (i = 0; i < STALL_MAX_LOOPS; i++) {
+        start = __atomic_load_n(&slots[i].start, __ATOMIC_RELAXED);
+        if (start == 0 || now - start < threshold) {
+            continue;
+        }
+        pthread_mutex_lock(&slot_lock);
+        taken = !slots[i].used || slots[i].stack_start == start;
+        pthread_mutex_unlock(&slot_lock);
+        if (!taken) {
+            take_stack(slots + i, start);
+        }
+    }
+}
+
+static void*
+watchdog_main(void *arg)
+{
+    struct timespec ts;
+    uint64_t interval;
+    sigset_t set;
+
+    // signals go to the loop thread
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock(&watchdog_lock);
+    while (!watchdog_stopping) {
+        // twice per threshold
+        interval = stall_threshold / 2;
+        if (interval < 1000) {
+            interval = 1000;
+        } else if (interval > 1000000) {
+            interval = 1000000;
+        }
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (interval % 1000000) * 1000;
+        ts.tv_sec += interval / 1000000 + ts.tv_nsec / 1000000000;
+        ts.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&watchdog_cond, &watchdog_lock, &ts);
+        if (watchdog_stopping) {
+            break;
+        }
+        pthread_mutex_unlock(&watchdog_lock);
+        scan_slots();
+        pthread_mutex_lock(&watchdog_lock);
+    }
+    pthread_mutex_unlock(&watchdog_lock);
+    return NULL;
+}
+
+/*
+ * start the watchdog thread when stacks are taken, called by server.run().
+ */
+int
+stall_watchdog_start(void)
+{
+    int ret;
+
+    if (!capture_stack || stall_threshold == 0 || watchdog_running) {
+        return 0;
+    }
+    watchdog_stopping = 0;
+    ret = pthread_create(&watchdog, NULL, watchdog_main, NULL);
+    if (ret != 0) {
+        errno = ret;
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+    watchdog_running = 1;
+    return 0;
+}
+
+void
+stall_watchdog_stop(void)
+{
+    if (!watchdog_running) {
+        return;
+    }
+    pthread_mutex_lock(&watchdog_lock);
+    watchdog_stopping = 1;
+    pthread_cond_signal(&watchdog_cond);
+    pthread_mutex_unlock(&watchdog_lock);
+    // it may wait for the GIL
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(watchdog, NULL);
+    Py_END_ALLOW_THREADS
+    watchdog_running = 0;
+}
+
+PyObject *
+set_stall_detector(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    double threshold;
+    int stack = 0;
+    PyObject *logger = Py_None;
+    static char *kwlist[] = {"threshold", "stack", "logger", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "d|iO:set_stall_detector", kwlist, &threshold, &stack, &logger)) {
+        return NULL;
+    }
+    if (threshold < 0 || threshold > 3600) {
+        PyErr_SetString(PyExc_ValueError, "threshold value out of range ");
+        return NULL;
+    }
+    if (logger != Py_None && !PyCallable_Check(logger)) {
+        PyErr_SetString(PyExc_TypeError, "logger must be callable");
+        return NULL;
+    }
+    Py_XDECREF(stall_logger);
+    if (logger == Py_None) {
+        stall_logger = NULL;
+    } else {
+        Py_INCREF(logger);
+        stall_logger = logger;
+    }
+    capture_stack = stack;
+    stall_threshold = (uint64_t)(threshold * 1000000);
+    Py_RETURN_NONE;
+}
+
+PyObject *
+get_stall_threshold(PyObject *self, PyObject *args)
+{
+    return PyFloat_FromDouble(stall_threshold / 1000000.0);
+}
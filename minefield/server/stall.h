@@ -0,0 +1,61 @@
+#ifndef STALL_H
+#define STALL_H
+
+#include "minefield.h"
+#include "request.h"
+
+#define STALL_MAX_LOOPS 256
+
+typedef enum {
+    STALL_IO,                   // picoev read/write callback
+    STALL_TIMEOUT,              // picoev timeout callback
+    STALL_TIMER,                // server.call_later() and timers
+    STALL_PENDING,              // calls of the next loop turn
+} stall_kind;
+
+extern uint64_t stall_threshold;
+
+uint64_t stall_enter(void);
+
+void stall_check(uint64_t start, stall_kind kind, PyObject *callback);
+
+/* start time of a callback, 0 when the detector is off */
+static inline uint64_t
+stall_begin(void)
+{
+    if (likely(stall_threshold == 0)) {
+        return 0;
+    }
+    return stall_enter();
+}
+
+#define STALL_END(start, kind, callback) \
+    do { \
+        if (unlikely(start != 0)) { \
+            stall_check((start), (kind), (callback)); \
+        } \
+    } while (0)
+
+void stall_set_request(request *req);
+
+/* request of the running callback, reported with a stall */
+#define STALL_REQUEST(req) \
+    do { \
+        if (unlikely(stall_threshold != 0)) { \
+            stall_set_request(req); \
+        } \
+    } while (0)
+
+int stall_register_loop(void);
+
+void stall_unregister_loop(void);
+
+int stall_watchdog_start(void);
+
+void stall_watchdog_stop(void);
+
+PyObject* set_stall_detector(PyObject *self, PyObject *args, PyObject *kwds);
+
+PyObject* get_stall_threshold(PyObject *self, PyObject *args);
+
+#endif
@@ -0,0 +1,653 @@
+#include "static_file.h"
+#include "util.h"
+#include "time_cache.h"
+#include "server.h"
+#include <limits.h>
+
+#ifdef linux
+#include <sys/inotify.h>
+#endif
+
+typedef struct {
+    char *prefix;               // without trailing slash
+    size_t prefixlen;
+    char *root;
+    size_t rootlen;
+} static_mount;
+
+typedef struct {
+    const char *ext;
+    const char *type;
+} mime_type;
+
+static mime_type mime_types[] = {
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"css", "text/css"},
+    {"js", "application/javascript"},
+    {"json", "application/json"},
+    {"map", "application/json"},
+    {"txt", "text/plain"},
+    {"xml", "text/xml"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"ico", "image/x-icon"},
+    {"webp", "image/webp"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"otf", "font/otf"},
+    {"pdf", "application/pdf"},
+    {"wasm", "application/wasm"},
+    {"mp3", "audio/mpeg"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+    {NULL, NULL}
+};
+
+static static_mount mounts[MAX_STATIC_MOUNTS];
+static int mount_cnt = 0;
+
+static static_entry *buckets[STATIC_HASH_SIZE];
+static static_entry *lru_head = NULL;
+static static_entry *lru_tail = NULL;
+static uint32_t entry_cnt = 0;
+
+static int notify_fd = -1;
+static int notify_watched = 0;  // notify_fd is read by the loop of server.run()
+
+// entries are shared by the loops of set_loops()
+DECLARE_CACHE_LOCK;
+
+static uint32_t
+hash_path(const char *path, size_t len)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while (len--) {
+        h ^= (unsigned char)*path++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static const char *
+get_mime_type(const char *path, size_t len)
+{
+    const char *ext = NULL;
+    mime_type *m;
+    size_t i = len;
+
+    while (i > 0) {
+        i--;
+        if (path[i] == '.') {
+            ext = path + i + 1;
+            break;
+        }
+        if (path[i] == '/') {
+            break;
+        }
+    }
+    if (ext) {
+        for (m = mime_types; m->ext; m++) {
+            if (!strcasecmp(ext, m->ext)) {
+                return m->type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+static void
+lru_unlink(static_entry *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        lru_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        lru_tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void
+lru_push(static_entry *e)
+{
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) {
+        lru_head->prev = e;
+    }
+    lru_head = e;
+    if (lru_tail == NULL) {
+        lru_tail = e;
+    }
+}
+
+static void
+free_entry(static_entry *e)
+{
+    GDEBUG("free static entry %p %s", e, e->path);
+    close(e->fd);
+    Py_XDECREF(e->headers);
+    PyMem_Free(e->path);
+    PyMem_Free(e);
+}
+
+static void
+remove_entry(static_entry *e)
+{
+    static_entry **pp, *o;
+
+    pp = &buckets[e->hash % STATIC_HASH_SIZE];
+    while (*pp && *pp != e) {
+        pp = &(*pp)->hnext;
+    }
+    if (*pp) {
+        *pp = e->hnext;
+    }
+    lru_unlink(e);
+    entry_cnt--;
+    e->cached = 0;
+#ifdef linux
+    if (e->wd >= 0) {
+        // hard links share one watch
+        for (o = lru_head; o; o = o->next) {
+            if (o->wd == e->wd) {
+                break;
+            }
+        }
+        if (o == NULL) {
+            inotify_rm_watch(notify_fd, e->wd);
+        }
+    }
+#else
+    (void)o;
+#endif
+    if (e->refcnt == 0) {
+        free_entry(e);
+    }
+}
+
+void
+static_file_release(void *entry)
+{
+    static_entry *e = (static_entry *)entry;
+
+    CACHE_LOCK();
+    e->refcnt--;
+    if (e->refcnt == 0 && !e->cached) {
+        free_entry(e);
+    }
+    CACHE_UNLOCK();
+}
+
+static void
+clear_entries(void)
+{
+    while (lru_head) {
+        remove_entry(lru_head);
+    }
+}
+
+void
+static_file_clear(void)
+{
+    CACHE_LOCK();
+    clear_entries();
+    CACHE_UNLOCK();
+}
+
+static void
+invalidate_wd(int wd)
+{
+    static_entry *e, *next;
+
+    for (e = lru_head; e; e = next) {
+        next = e->next;
+        if (e->wd == wd) {
+            DEBUG("invalidate static entry %s", e->path);
+            remove_entry(e);
+        }
+    }
+}
+
+/*
+ * read the inotify events on the loop of server.run() or run_once(),
+ * entries are revalidated with stat until then.
+ */
+void
+static_file_watch(void)
+{
+    if (notify_fd >= 0 && !notify_watched) {
+        notify_watched = watch_static_notify(notify_fd);
+    }
+}
+
+/* the loop is going away */
+void
+static_file_unwatch(void)
+{
+    if (notify_watched && unwatch_static_notify(notify_fd)) {
+        notify_watched = 0;
+    }
+}
+
+/* kept while the loop of another thread reads it */
+static void
+close_notify(void)
+{
+#ifdef linux
+    if (notify_fd >= 0 && !notify_watched) {
+        close(notify_fd);
+        notify_fd = -1;
+    }
+#endif
+}
+
+void
+static_file_process_events(void)
+{
+#ifdef linux
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *ev;
+    ssize_t len;
+    char *p;
+
+    for (;;) {
+        len = read(notify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            return;
+        }
+        CACHE_LOCK();
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                clear_entries();
+            } else if (!(ev->mask & IN_IGNORED)) {
+                invalidate_wd(ev->wd);
+            }
+        }
+        CACHE_UNLOCK();
+    }
+#endif
+}
+
+static int
+build_headers(static_entry *e)
+{
+    PyObject *headers;
+    struct tm tm;
+    const char *mime;
+
+    snprintf(e->etag, sizeof(e->etag), "\"%lx-%" PRIx64 "\"", (unsigned long)e->mtime, e->size);
+    gmtime_r(&e->mtime, &tm);
+    strftime(e->last_modified, sizeof(e->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    mime = get_mime_type(e->path, e->pathlen);
+
+    headers = Py_BuildValue("[(ss)(ss)(ss)]",
+                            "Content-Type", mime,
+                            "Last-Modified", e->last_modified,
+                            "ETag", e->etag);
+    if (headers == NULL) {
+        return -1;
+    }
+    e->headers = new_header_block(headers);
+    Py_DECREF(headers);
+    if (e->headers == NULL) {
+        return -1;
+    }
+    return 1;
+}
+
+static int
+is_fresh(static_entry *e)
+{
+    struct stat st;
+
+    if (notify_watched && e->wd >= 0) {
+        return 1;
+    }
+    if (current_msec - e->checked_msec < STATIC_CHECK_MSEC) {
+        return 1;
+    }
+    if (stat(e->path, &st) == -1 || st.st_ino != e->ino ||
+        (uint64_t)st.st_size != e->size || st.st_mtime != e->mtime) {
+        return 0;
+    }
+    e->checked_msec = current_msec;
+    return 1;
+}
+
+static static_entry *
+lookup_entry(const char *path, size_t len, int *code)
+{
+    static_entry *e;
+    struct stat st;
+    uint32_t hash;
+    int fd;
+
+    hash = hash_path(path, len);
+    for (e = buckets[hash % STATIC_HASH_SIZE]; e; e = e->hnext) {
+        if (e->hash == hash && e->pathlen == len && !memcmp(e->path, path, len)) {
+            break;
+        }
+    }
+    if (e) {
+        if (is_fresh(e)) {
+            lru_unlink(e);
+            lru_push(e);
+            return e;
+        }
+        remove_entry(e);
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        *code = errno == EACCES ? 403 : 404;
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        *code = 404;
+        return NULL;
+    }
+
+    e = PyMem_Malloc(sizeof(static_entry));
+    if (e == NULL) {
+        close(fd);
+        *code = 500;
+        return NULL;
+    }
+    memset(e, 0, sizeof(static_entry));
+    e->path = PyMem_Malloc(len + 1);
+    if (e->path == NULL) {
+        close(fd);
+        PyMem_Free(e);
+        *code = 500;
+        return NULL;
+    }
+    memcpy(e->path, path, len);
+    e->path[len] = '\0';
+    e->pathlen = len;
+    e->hash = hash;
+    e->fd = fd;
+    e->wd = -1;
+    e->size = st.st_size;
+    e->mtime = st.st_mtime;
+    e->ino = st.st_ino;
+    e->checked_msec = current_msec;
+    if (build_headers(e) == -1) {
+        PyErr_Clear();
+        free_entry(e);
+        *code = 500;
+        return NULL;
+    }
+#ifdef linux
+    if (notify_fd >= 0) {
+        e->wd = inotify_add_watch(notify_fd, e->path,
+                                  IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    }
+#endif
+
+    if (entry_cnt >= STATIC_CACHE_SIZE) {
+        remove_entry(lru_tail);
+    }
+    e->hnext = buckets[hash % STATIC_HASH_SIZE];
+    buckets[hash % STATIC_HASH_SIZE] = e;
+    lru_push(e);
+    e->cached = 1;
+    entry_cnt++;
+    GDEBUG("cache static entry %p %s", e, e->path);
+    return e;
+}
+
+static static_mount *
+find_mount(const char *path, size_t len)
+{
+    static_mount *m, *found = NULL;
+    int i;
+
+    for (i = 0; i < mount_cnt; i++) {
+        m = mounts + i;
+        if (len >= m->prefixlen && !memcmp(path, m->prefix, m->prefixlen) &&
+            (len == m->prefixlen || path[m->prefixlen] == '/')) {
+            if (found == NULL || m->prefixlen > found->prefixlen) {
+                found = m;
+            }
+        }
+    }
+    return found;
+}
+
+static int
+is_safe_path(const char *path, size_t len)
+{
+    const char *p = path, *end = path + len, *seg;
+
+    if (memchr(path, '\0', len)) {
+        return 0;
+    }
+    while (p < end) {
+        if (*p != '/') {
+            return 0;
+        }
+        seg = ++p;
+        while (p < end && *p != '/') {
+            p++;
+        }
+        if ((p - seg == 1 && seg[0] == '.') ||
+            (p - seg == 2 && seg[0] == '.' && seg[1] == '.')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int
+not_modified(PyObject *environ, static_entry *e)
+{
+    char *value;
+    struct tm tm;
+
+    value = get_environ_value(environ, "HTTP_IF_NONE_MATCH", NULL);
+    if (value) {
+        return strstr(value, e->etag) != NULL || !strcmp(value, "*");
+    }
+    value = get_environ_value(environ, "HTTP_IF_MODIFIED_SINCE", NULL);
+    if (value) {
+        if (!strcmp(value, e->last_modified)) {
+            return 1;
+        }
+        memset(&tm, 0, sizeof(tm));
+        if (strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm)) {
+            return e->mtime <= timegm(&tm);
+        }
+    }
+    return 0;
+}
+
+/*
+ * serve request from mounted directory.
+ * return 0 if the path is not mounted (call application)
+ */
+int
+static_file_start(client_t *client, response_status *status)
+{
+    PyObject *environ = client->current_req->environ;
+    static_mount *m;
+    static_entry *e;
+    char *path, *rest, full[PATH_MAX];
+    Py_ssize_t pathlen;
+    size_t restlen, len;
+    int code = 404;
+
+    if (likely(mount_cnt == 0)) {
+        return 0;
+    }
+    path = get_environ_value(environ, "PATH_INFO", &pathlen);
+    if (path == NULL) {
+        return 0;
+    }
+    m = find_mount(path, pathlen);
+    if (m == NULL) {
+        return 0;
+    }
+    if (client->http_parser->method != HTTP_GET && client->http_parser->method != HTTP_HEAD) {
+        code = 405;
+        goto error;
+    }
+    rest = path + m->prefixlen;
+    restlen = pathlen - m->prefixlen;
+    if (!is_safe_path(rest, restlen)) {
+        goto error;
+    }
+    if (m->rootlen + restlen + 12 > sizeof(full)) {
+        goto error;
+    }
+    memcpy(full, m->root, m->rootlen);
+    memcpy(full + m->rootlen, rest, restlen);
+    len = m->rootlen + restlen;
+    if (restlen == 0 || rest[restlen - 1] == '/') {
+        if (restlen == 0) {
+            full[len++] = '/';
+        }
+        memcpy(full + len, "index.html", 10);
+        len += 10;
+    }
+    full[len] = '\0';
+
+    CACHE_LOCK();
+    e = lookup_entry(full, len, &code);
+    if (e) {
+        e->refcnt++;
+    }
+    CACHE_UNLOCK();
+    if (e == NULL) {
+        goto error;
+    }
+    DEBUG("static file %s fd:%d", e->path, e->fd);
+    client->headers = PyList_New(1);
+    if (client->headers == NULL) {
+        static_file_release(e);
+        code = 500;
+        goto error;
+    }
+    Py_INCREF(e->headers);
+    PyList_SET_ITEM(client->headers, 0, e->headers);
+
+    if (not_modified(environ, e)) {
+        *status = start_static_response(client, 304, "304 Not Modified", e->fd, e->size, e);
+    } else {
+        *status = start_static_response(client, 200, "200 OK", e->fd, e->size, e);
+    }
+    return 1;
+
+error:
+    PyErr_Clear();
+    client->status_code = code;
+    *status = send_error_page(client);
+    return 1;
+}
+
+PyObject *
+mount_static(PyObject *self, PyObject *args)
+{
+    char *prefix;
+    PyObject *directory, *bytes = NULL;
+    char resolved[PATH_MAX];
+    struct stat st;
+    size_t prefixlen;
+    static_mount *m = NULL;
+    int i;
+
+    if (!PyArg_ParseTuple(args, "sO:mount_static", &prefix, &directory)) {
+        return NULL;
+    }
+    if (prefix[0] != '/') {
+        PyErr_SetString(PyExc_ValueError, "prefix must start with '/'");
+        return NULL;
+    }
+    prefixlen = strlen(prefix);
+    while (prefixlen > 0 && prefix[prefixlen - 1] == '/') {
+        prefixlen--;
+    }
+    for (i = 0; i < mount_cnt; i++) {
+        if (mounts[i].prefixlen == prefixlen && !memcmp(mounts[i].prefix, prefix, prefixlen)) {
+            m = mounts + i;
+            break;
+        }
+    }
+
+    if (directory == Py_None) {
+        // unmount
+        if (m) {
+            PyMem_Free(m->prefix);
+            PyMem_Free(m->root);
+            *m = mounts[--mount_cnt];
+            static_file_clear();
+            if (mount_cnt == 0) {
+                static_file_unwatch();
+                close_notify();
+            }
+        }
+        Py_RETURN_NONE;
+    }
+
+    if (!PyUnicode_FSConverter(directory, &bytes)) {
+        return NULL;
+    }
+    if (realpath(PyBytes_AS_STRING(bytes), resolved) == NULL || stat(resolved, &st) == -1) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_IOError, directory);
+        Py_DECREF(bytes);
+        return NULL;
+    }
+    Py_DECREF(bytes);
+    if (!S_ISDIR(st.st_mode)) {
+        PyErr_SetString(PyExc_ValueError, "not a directory");
+        return NULL;
+    }
+
+    if (m == NULL) {
+        if (mount_cnt == MAX_STATIC_MOUNTS) {
+            PyErr_Format(PyExc_ValueError, "too many static mounts (max %d)", MAX_STATIC_MOUNTS);
+            return NULL;
+        }
+        m = mounts + mount_cnt;
+        m->prefix = PyMem_Malloc(prefixlen + 1);
+        if (m->prefix == NULL) {
+            return PyErr_NoMemory();
+        }
+        memcpy(m->prefix, prefix, prefixlen);
+        m->prefix[prefixlen] = '\0';
+        m->prefixlen = prefixlen;
+        mount_cnt++;
+    } else {
+        PyMem_Free(m->root);
+        static_file_clear();
+    }
+    m->rootlen = strlen(resolved);
+    m->root = PyMem_Malloc(m->rootlen + 1);
+    if (m->root == NULL) {
+        PyMem_Free(m->prefix);
+        *m = mounts[--mount_cnt];
+        return PyErr_NoMemory();
+    }
+    memcpy(m->root, resolved, m->rootlen + 1);
+
+#ifdef linux
+    if (notify_fd == -1) {
+        notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        // no inotify, revalidate with stat
+    }
+#endif
+    static_file_watch();
+    Py_RETURN_NONE;
+}
@@ -0,0 +1,47 @@
+#ifndef STATIC_FILE_H
+#define STATIC_FILE_H
+
+#include "minefield.h"
+#include "client.h"
+#include "response.h"
+
+#define MAX_STATIC_MOUNTS 16
+#define STATIC_CACHE_SIZE 256
+#define STATIC_HASH_SIZE 512
+#define STATIC_CHECK_MSEC 1000
+
+typedef struct _static_entry {
+    char *path;
+    size_t pathlen;
+    uint32_t hash;
+    int fd;
+    int wd;                     // inotify watch descriptor
+    uint64_t size;
+    time_t mtime;
+    ino_t ino;
+    PyObject *headers;          // HeaderBlock (Content-Type, Last-Modified, ETag)
+    char etag[48];
+    char last_modified[32];
+    uintptr_t checked_msec;
+    int refcnt;                 // in-flight responses
+    uint8_t cached;
+    struct _static_entry *hnext;
+    struct _static_entry *prev;
+    struct _static_entry *next;
+} static_entry;
+
+int static_file_start(client_t *client, response_status *status);
+
+void static_file_release(void *entry);
+
+void static_file_watch(void);
+
+void static_file_unwatch(void);
+
+void static_file_process_events(void);
+
+void static_file_clear(void);
+
+PyObject* mount_static(PyObject *self, PyObject *args);
+
+#endif
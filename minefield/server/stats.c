@@ -0,0 +1,338 @@
+#include "stats.h"
+#include "util.h"
+#include <sys/mman.h>
+
+/*
+ * counters and latency histograms of the worker.
+ * the event loop updates them in place without locks (atomic adds on
+ * free-threaded builds), server.stats() reads them and set_stats_file()
+ * moves them to a mmap'd file so that a parent process can sum workers
+ * with minefield/metrics.py.
+ */
+
+static stats_t local_stats;
+stats_t *stats = &local_stats;
+
+static size_t map_size = 0;
+
+static const char *counter_names[STAT_COUNTERS] = {
+    "accepts",
+    "accept_errors",
+    "connections",
+    "keepalive",
+    "requests",
+    "status_1xx",
+    "status_2xx",
+    "status_3xx",
+    "status_4xx",
+    "status_5xx",
+    "bytes_sent",
+    "parse_errors",
+    "timeouts",
+    "app_errors",
+};
+
+static const char *hist_names[HIST_COUNT] = {
+    "wait_time",
+    "read_time",
+    "queue_time",
+    "app_time",
+    "send_time",
+    "total_time",
+};
+
+static void
+init_header(stats_t *s)
+{
+    s->version = STATS_VERSION;
+    s->counters = STAT_COUNTERS;
+    s->histograms = HIST_COUNT;
+    s->buckets = HIST_BUCKETS;
+    s->sub_bits = HIST_SUB_BITS;
+    s->pid = getpid();
+    s->start_msec = get_current_msec();
+}
+
+void
+stats_init(void)
+{
+    init_header(&local_stats);
+    memcpy(local_stats.magic, STATS_MAGIC, sizeof(local_stats.magic));
+}
+
+static inline int
+bucket_index(uint64_t v)
+{
+    int e;
+
+    if (v < HIST_SUB) {
+        return (int)v;
+    }
+    if (v >> (HIST_MAX_EXP + 1)) {
+        return HIST_BUCKETS - 1;
+    }
+    e = 63 - __builtin_clzll(v);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + (int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* lowest value and width of a bucket */
+static inline void
+bucket_range(int i, uint64_t *low, uint64_t *width)
+{
+    int e;
+
+    if (i < HIST_SUB) {
+        *low = i;
+        *width = 1;
+        return;
+    }
+    e = i / HIST_SUB + HIST_SUB_BITS - 1;
+    *width = 1ULL << (e - HIST_SUB_BITS);
+    *low = (uint64_t)(HIST_SUB + i % HIST_SUB) << (e - HIST_SUB_BITS);
+}
+
+void
+stat_record(stat_hist hist, uint64_t usec)
+{
+    stat_histogram *h = &stats->hist[hist];
+
+    COUNTER_ADD(h->buckets[bucket_index(usec)], 1);
+    COUNTER_ADD(h->count, 1);
+    COUNTER_ADD(h->sum, usec);
+#ifdef Py_GIL_DISABLED
+    {
+        uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+        while (usec > max &&
+               !__atomic_compare_exchange_n(&h->max, &max, usec, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+#else
+    if (usec > h->max) {
+        h->max = usec;
+    }
+#endif
+}
+
+void
+stat_response(uint16_t status_code, uint64_t bytes)
+{
+    STAT_ADD(STAT_BYTES_SENT, bytes);
+    if (status_code >= 100 && status_code < 600) {
+        // connections closed without a response have no status
+        STAT_INC(STAT_REQUESTS);
+        STAT_INC(STAT_STATUS_1XX + status_code / 100 - 1);
+    }
+}
+
+/* microseconds of a phase, -1 when the request did not go through it */
+int64_t
+request_span(request *req, stat_hist span)
+{
+    uint64_t *t = req->timing, start, end;
+
+    switch (span) {
+        case HIST_WAIT:
+            start = t[TIMING_ACCEPT];
+            end = t[TIMING_FIRST_BYTE];
+            break;
+        case HIST_READ:
+            start = t[TIMING_FIRST_BYTE];
+            end = t[TIMING_BODY];
+            break;
+        case HIST_QUEUE:
+            start = t[TIMING_BODY];
+            end = t[TIMING_APP_START];
+            break;
+        case HIST_APP:
+            start = t[TIMING_APP_START];
+            end = t[TIMING_APP_END];
+            break;
+        case HIST_SEND:
+            // static files and cached responses are sent without the application
+            start = t[TIMING_APP_END] ? t[TIMING_APP_END] : t[TIMING_BODY];
+            end = t[TIMING_LAST_WRITE];
+            break;
+        default:
+            start = t[TIMING_FIRST_BYTE];
+            end = t[TIMING_LAST_WRITE];
+            break;
+    }
+    if (start == 0 || end < start) {
+        return -1;
+    }
+    return (int64_t)(end - start);
+}
+
+void
+stat_request(request *req)
+{
+    int64_t usec;
+    int i;
+
+    for (i = 0; i < HIST_COUNT; i++) {
+        usec = request_span(req, i);
+        if (usec >= 0) {
+            stat_record(i, usec);
+        }
+    }
+}
+
+/* value at quantile q in seconds, the middle of its bucket */
+static double
+hist_quantile(stat_histogram *h, uint64_t count, double q)
+{
+    uint64_t rank, seen = 0, low, width, v;
+    int i;
+
+    if (count == 0) {
+        return 0.0;
+    }
+    rank = (uint64_t)(q * count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            bucket_range(i, &low, &width);
+            v = low + width / 2;
+            if (v > h->max) {
+                v = h->max;
+            }
+            return v / 1000000.0;
+        }
+    }
+    return h->max / 1000000.0;
+}
+
+static PyObject *
+hist_dict(stat_histogram *h)
+{
+    PyObject *dict;
+    uint64_t count = h->count;
+
+    dict = Py_BuildValue("{s:K,s:d,s:d,s:d,s:d,s:d,s:d,s:d}",
+            "count", (unsigned PY_LONG_LONG)count,
+            "sum", h->sum / 1000000.0,
+            "mean", count ? h->sum / 1000000.0 / count : 0.0,
+            "max", h->max / 1000000.0,
+            "p50", hist_quantile(h, count, 0.5),
+            "p90", hist_quantile(h, count, 0.9),
+            "p99", hist_quantile(h, count, 0.99),
+            "p999", hist_quantile(h, count, 0.999));
+    return dict;
+}
+
+PyObject *
+get_stats(PyObject *self, PyObject *args)
+{
+    PyObject *dict, *o;
+    int i;
+
+    dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < STAT_COUNTERS; i++) {
+        o = PyLong_FromUnsignedLongLong(stats->counter[i]);
+        if (o == NULL || PyDict_SetItemString(dict, counter_names[i], o) == -1) {
+            Py_XDECREF(o);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(o);
+    }
+    for (i = 0; i < HIST_COUNT; i++) {
+        o = hist_dict(&stats->hist[i]);
+        if (o == NULL || PyDict_SetItemString(dict, hist_names[i], o) == -1) {
+            Py_XDECREF(o);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(o);
+    }
+    return dict;
+}
+
+PyObject *
+reset_stats(PyObject *self, PyObject *args)
+{
+    uint64_t connections = stats->counter[STAT_CONNECTIONS];
+
+    // the gauge survives
+    memset(stats->counter, 0, sizeof(stats->counter));
+    memset(stats->hist, 0, sizeof(stats->hist));
+    stats->counter[STAT_CONNECTIONS] = connections;
+    stats->start_msec = get_current_msec();
+    Py_RETURN_NONE;
+}
+
+static void
+unmap_stats(void)
+{
+    if (stats != &local_stats) {
+        memcpy(local_stats.counter, stats->counter, sizeof(local_stats.counter));
+        memcpy(local_stats.hist, stats->hist, sizeof(local_stats.hist));
+        local_stats.start_msec = stats->start_msec;
+        munmap(stats, map_size);
+        stats = &local_stats;
+        map_size = 0;
+    }
+}
+
+PyObject *
+set_stats_file(PyObject *self, PyObject *args)
+{
+    PyObject *path, *bytes;
+    stats_t *s;
+    void *map;
+    int fd;
+
+    if (!PyArg_ParseTuple(args, "O:set_stats_file", &path)) {
+        return NULL;
+    }
+    if (path == Py_None) {
+        unmap_stats();
+        Py_RETURN_NONE;
+    }
+    bytes = pid_path(path);
+    if (bytes == NULL) {
+        return NULL;
+    }
+
+    fd = open(PyBytes_AS_STRING(bytes), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, PyBytes_AS_STRING(bytes));
+        Py_DECREF(bytes);
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(stats_t)) == -1) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, PyBytes_AS_STRING(bytes));
+        close(fd);
+        Py_DECREF(bytes);
+        return NULL;
+    }
+    Py_DECREF(bytes);
+    map = mmap(NULL, sizeof(stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return PyErr_SetFromErrno(PyExc_IOError);
+    }
+
+    s = (stats_t *)map;
+    init_header(s);
+    // values so far move to the file
+    memcpy(s->counter, stats->counter, sizeof(s->counter));
+    memcpy(s->hist, stats->hist, sizeof(s->hist));
+    s->start_msec = stats->start_msec;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    // readers wait for the magic
+    memcpy(s->magic, STATS_MAGIC, sizeof(s->magic));
+
+    if (stats != &local_stats) {
+        munmap(stats, map_size);
+    }
+    map_size = sizeof(stats_t);
+    stats = s;
+    Py_RETURN_NONE;
+}
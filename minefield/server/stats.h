@@ -0,0 +1,89 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "minefield.h"
+#include "request.h"
+
+#define STATS_MAGIC "MFSTATS1"
+#define STATS_VERSION 1
+
+/* log-linear histogram of microseconds, 16 linear buckets per power of two */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 36             // ~19 hours
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 2) * HIST_SUB)
+
+typedef enum {
+    STAT_ACCEPTS,
+    STAT_ACCEPT_ERRORS,
+    STAT_CONNECTIONS,               // gauge, open client connections
+    STAT_KEEPALIVE,                 // connections kept for the next request
+    STAT_REQUESTS,
+    STAT_STATUS_1XX,
+    STAT_STATUS_2XX,
+    STAT_STATUS_3XX,
+    STAT_STATUS_4XX,
+    STAT_STATUS_5XX,
+    STAT_BYTES_SENT,                // body bytes
+    STAT_PARSE_ERRORS,
+    STAT_TIMEOUTS,                  // read timeouts in a request and write timeouts
+    STAT_APP_ERRORS,
+    STAT_COUNTERS
+} stat_counter;
+
+/* phases of a request, see request_span() */
+typedef enum {
+    HIST_WAIT,                      // accept to the first byte, first request only
+    HIST_READ,                      // first byte to the end of the body
+    HIST_QUEUE,                     // end of the body to the application call
+    HIST_APP,                       // application call
+    HIST_SEND,                      // application return to the last byte written
+    HIST_TOTAL,                     // first byte to the last byte written
+    HIST_COUNT
+} stat_hist;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} stat_histogram;
+
+/* layout of the stats file, read by minefield/metrics.py */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t counters;
+    uint32_t histograms;
+    uint32_t buckets;
+    uint32_t sub_bits;
+    uint32_t pid;
+    uint64_t start_msec;
+    uint8_t reserved[24];
+    uint64_t counter[STAT_COUNTERS];
+    stat_histogram hist[HIST_COUNT];
+} stats_t;
+
+extern stats_t *stats;
+
+#define STAT_ADD(name, n) COUNTER_ADD(stats->counter[name], (n))
+#define STAT_INC(name) COUNTER_ADD(stats->counter[name], 1)
+#define STAT_DEC(name) COUNTER_SUB(stats->counter[name], 1)
+
+void stats_init(void);
+
+void stat_record(stat_hist hist, uint64_t usec);
+
+void stat_response(uint16_t status_code, uint64_t bytes);
+
+int64_t request_span(request *req, stat_hist span);
+
+void stat_request(request *req);
+
+PyObject* get_stats(PyObject *self, PyObject *args);
+
+PyObject* reset_stats(PyObject *self, PyObject *args);
+
+PyObject* set_stats_file(PyObject *self, PyObject *args);
+
+#endif
@@ -0,0 +1,375 @@
+#include "stream.h"
+#include "server.h"
+
+/*
+ * stream responses stay open after the application returns.
+ * data is pushed with stream.write() or server.broadcast(), which queue
+ * the same bytes object on every connection; each bucket only keeps
+ * references and its own send progress. pushed data is dropped for a
+ * connection whose output is full, see output_full().
+ */
+
+static int
+stream_write(StreamObject *stream, PyObject *data, PyObject **chunk, int push)
+{
+    client_t *client = stream->client;
+
+    if (client == NULL || stream->closed) {
+        return 0;
+    }
+    if (push && output_full(client)) {
+        DEBUG("drop stream data fd:%d buffered:%llu", client->fd, (unsigned long long)client->buffered);
+        return 0;
+    }
+    if (!client->header_done) {
+        // sent after the headers
+        if (PyList_Append(stream->backlog, data) == -1) {
+            return -1;
+        }
+        return 1;
+    }
+    if (client->chunked_response && *chunk == NULL) {
+        *chunk = get_chunk_data(PyBytes_GET_SIZE(data));
+        if (*chunk == NULL) {
+            return -1;
+        }
+    }
+    switch (write_stream_data(client, data, *chunk)) {
+        case STATUS_OK:
+            return 1;
+        case STATUS_SUSPEND:
+            wake_stream(client);
+            return 1;
+        default:
+            // broken connection, closed from the loop
+            PyErr_Clear();
+            stream->closed = 1;
+            stream->finished = 1;
+            client->keep_alive = 0;
+            wake_stream(client);
+            return 0;
+    }
+}
+
+PyObject *
+new_stream(client_t *client)
+{
+    StreamObject *stream;
+
+    if (client->stream) {
+        Py_INCREF((PyObject *)client->stream);
+        return (PyObject *)client->stream;
+    }
+    stream = PyObject_NEW(StreamObject, &StreamObjectType);
+    if (stream == NULL) {
+        return NULL;
+    }
+    stream->backlog = PyList_New(0);
+    if (stream->backlog == NULL) {
+        stream->client = NULL;
+        Py_DECREF(stream);
+        return NULL;
+    }
+    stream->client = client;
+    stream->closed = 0;
+    stream->finished = 0;
+    client->stream = stream;
+    GDEBUG("alloc StreamObject %p", stream);
+    return (PyObject *)stream;
+}
+
+PyObject *
+open_stream(PyObject *self, PyObject *args)
+{
+    PyObject *environ, *pyclient;
+
+    if (!PyArg_ParseTuple(args, "O!:stream", &PyDict_Type, &environ)) {
+        return NULL;
+    }
+    pyclient = PyDict_GetItemString(environ, "minefield.client");
+    if (pyclient == NULL || !CheckClientObject(pyclient)) {
+        PyErr_SetString(PyExc_ValueError, "environ is not a minefield request");
+        return NULL;
+    }
+    return new_stream(((ClientObject *)pyclient)->client);
+}
+
+/*
+ * write to the stream of the client, used by the async body driver.
+ * it waits for output_full() itself, so nothing is dropped.
+ */
+int
+write_stream(client_t *client, PyObject *data)
+{
+    PyObject *chunk = NULL;
+    int ret;
+
+    if (client->stream == NULL || PyBytes_GET_SIZE(data) == 0) {
+        return 0;
+    }
+    ret = stream_write((StreamObject *)client->stream, data, &chunk, 0);
+    Py_XDECREF(chunk);
+    return ret;
+}
+
+/*
+ * end the stream of the client, abort leaves out the end of the body
+ * and closes the connection.
+ */
+void
+end_stream(client_t *client, int abort)
+{
+    StreamObject *stream = client->stream;
+
+    if (stream == NULL || stream->closed) {
+        return;
+    }
+    stream->closed = 1;
+    if (abort) {
+        stream->finished = 1;
+        client->keep_alive = 0;
+    }
+    wake_stream(client);
+}
+
+PyObject *
+broadcast(PyObject *self, PyObject *args)
+{
+    PyObject *streams, *data, *iterator, *item, *chunk = NULL;
+    long cnt = 0;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "OO:broadcast", &streams, &data)) {
+        return NULL;
+    }
+    if (!PyBytes_Check(data)) {
+        PyErr_SetString(PyExc_TypeError, "data must be a byte string");
+        return NULL;
+    }
+    if (PyBytes_GET_SIZE(data) == 0) {
+        // empty chunk would end the body
+        return Py_BuildValue("l", cnt);
+    }
+    iterator = PyObject_GetIter(streams);
+    if (iterator == NULL) {
+        return NULL;
+    }
+    while ((item = PyIter_Next(iterator))) {
+        if (Py_TYPE(item) != &StreamObjectType) {
+            PyErr_SetString(PyExc_TypeError, "broadcast to non stream object");
+            Py_DECREF(item);
+            goto error;
+        }
+        ret = stream_write((StreamObject *)item, data, &chunk, 1);
+        Py_DECREF(item);
+        if (ret == -1) {
+            goto error;
+        }
+        cnt += ret;
+    }
+    if (PyErr_Occurred()) {
+        goto error;
+    }
+    Py_DECREF(iterator);
+    Py_XDECREF(chunk);
+    return Py_BuildValue("l", cnt);
+error:
+    Py_DECREF(iterator);
+    Py_XDECREF(chunk);
+    return NULL;
+}
+
+response_status
+start_stream(client_t *client)
+{
+    StreamObject *stream = client->stream;
+    PyObject *data, *chunk;
+    Py_ssize_t i;
+    response_status ret;
+
+    if (client->http_parser->http_minor == 0) {
+        // the body ends with the connection
+        client->keep_alive = 0;
+    }
+    ret = write_headers(client, NULL, 0, 0);
+    if (ret == STATUS_ERROR) {
+        return ret;
+    }
+    if (client->http_parser->method == HTTP_HEAD) {
+        // no body, later writes are ignored
+        stream->closed = 1;
+        stream->finished = 1;
+        return ret;
+    }
+    for (i = 0; i < PyList_GET_SIZE(stream->backlog); i++) {
+        data = PyList_GET_ITEM(stream->backlog, i);
+        chunk = NULL;
+        if (client->chunked_response) {
+            chunk = get_chunk_data(PyBytes_GET_SIZE(data));
+            if (chunk == NULL) {
+                return STATUS_ERROR;
+            }
+        }
+        ret = write_stream_data(client, data, chunk);
+        Py_XDECREF(chunk);
+        if (ret == STATUS_ERROR) {
+            return ret;
+        }
+    }
+    Py_CLEAR(stream->backlog);
+    stream->backlog = PyList_New(0);
+    // the connection stays open for stream data
+    return STATUS_SUSPEND;
+}
+
+response_status
+process_stream(client_t *client)
+{
+    StreamObject *stream = client->stream;
+    response_status ret;
+
+#ifdef PY3
+    if (client->task) {
+        // async body waits for the output queue
+        resume_task(client);
+    }
+#endif
+    if (client->bucket || !stream->closed) {
+        return STATUS_SUSPEND;
+    }
+    if (!stream->finished) {
+        stream->finished = 1;
+        ret = finish_stream_body(client);
+        if (ret != STATUS_OK) {
+            return ret;
+        }
+    }
+    return close_response(client);
+}
+
+void
+detach_stream(client_t *client)
+{
+    if (client->stream) {
+        ((StreamObject *)client->stream)->client = NULL;
+        client->stream = NULL;
+    }
+    client->stream_idle = 0;
+}
+
+static PyObject *
+StreamObject_write(StreamObject *self, PyObject *args)
+{
+    PyObject *data, *chunk = NULL;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "O:write", &data)) {
+        return NULL;
+    }
+    if (!PyBytes_Check(data)) {
+        PyErr_SetString(PyExc_TypeError, "data must be a byte string");
+        return NULL;
+    }
+    if (PyBytes_GET_SIZE(data) == 0) {
+        Py_RETURN_TRUE;
+    }
+    ret = stream_write(self, data, &chunk, 1);
+    Py_XDECREF(chunk);
+    if (ret == -1) {
+        return NULL;
+    }
+    return PyBool_FromLong(ret);
+}
+
+static PyObject *
+StreamObject_close(StreamObject *self, PyObject *args)
+{
+    if (!self->closed) {
+        self->closed = 1;
+        if (self->client) {
+            wake_stream(self->client);
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+StreamObject_get_closed(StreamObject *self, void *closure)
+{
+    return PyBool_FromLong(self->closed || self->client == NULL);
+}
+
+static PyObject *
+StreamObject_get_buffered(StreamObject *self, void *closure)
+{
+    return Py_BuildValue("K", self->client ? (unsigned long long)self->client->buffered : 0ULL);
+}
+
+static void
+StreamObject_dealloc(StreamObject *self)
+{
+    GDEBUG("dealloc StreamObject %p", self);
+    if (self->client) {
+        self->client->stream = NULL;
+    }
+    Py_XDECREF(self->backlog);
+    PyObject_DEL(self);
+}
+
+static PyMethodDef StreamObject_method[] = {
+    {"write", (PyCFunction)StreamObject_write, METH_VARARGS, "queue data on the stream, false when closed or dropped"},
+    {"close", (PyCFunction)StreamObject_close, METH_VARARGS, "end the stream"},
+    { NULL, NULL}
+};
+
+static PyGetSetDef StreamObject_getset[] = {
+    {"closed", (getter)StreamObject_get_closed, NULL, "stream is closed or the client is gone", NULL},
+    {"buffered", (getter)StreamObject_get_buffered, NULL, "queued but unsent bytes", NULL},
+    { NULL }
+};
+
+PyTypeObject StreamObjectType = {
+#ifdef PY3
+    PyVarObject_HEAD_INIT(NULL, 0)
+#else
+    PyObject_HEAD_INIT(NULL)
+    0,                    /* ob_size */
+#endif
+    "minefield.stream",             /*tp_name*/
+    sizeof(StreamObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)StreamObject_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "stream response",         /* tp_doc */
+    0,                       /* tp_traverse */
+    0,                       /* tp_clear */
+    0,                       /* tp_richcompare */
+    0,                       /* tp_weaklistoffset */
+    0,                       /* tp_iter */
+    0,                       /* tp_iternext */
+    StreamObject_method,        /* tp_methods */
+    0,                         /* tp_members */
+    StreamObject_getset,       /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                      /* tp_init */
+    0,                         /* tp_alloc */
+    0,                           /* tp_new */
+};
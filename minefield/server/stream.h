@@ -0,0 +1,36 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "minefield.h"
+#include "client.h"
+#include "response.h"
+
+typedef struct {
+    PyObject_HEAD
+    client_t *client;           // NULL once the connection is gone
+    PyObject *backlog;          // data written before the headers
+    uint8_t closed;             // no more data
+    uint8_t finished;           // end of body is queued
+} StreamObject;
+
+extern PyTypeObject StreamObjectType;
+
+#define is_stream_response(c) ((c)->stream != NULL && (c)->response == (PyObject *)(c)->stream)
+
+PyObject* new_stream(client_t *client);
+
+PyObject* open_stream(PyObject *self, PyObject *args);
+
+int write_stream(client_t *client, PyObject *data);
+
+void end_stream(client_t *client, int abort);
+
+PyObject* broadcast(PyObject *self, PyObject *args);
+
+response_status start_stream(client_t *client);
+
+response_status process_stream(client_t *client);
+
+void detach_stream(client_t *client);
+
+#endif
@@ -8,21 +8,21 @@
 
 #define TIME_SLOTS   64
 
-static uintptr_t        slot;
+static THREAD_LOCAL uintptr_t slot;
 //static uint32_t         time_lock = 1;
 
-volatile uintptr_t      current_msec;
-volatile cache_time_t     *_cached_time;
-volatile char       *err_log_time;
-volatile char       *http_time;
-volatile char       *http_log_time;
+THREAD_LOCAL volatile uintptr_t current_msec;
+THREAD_LOCAL volatile cache_time_t *_cached_time;
+THREAD_LOCAL volatile char *err_log_time;
+THREAD_LOCAL volatile char *http_time;
+THREAD_LOCAL volatile char *http_log_time;
 
-static cache_time_t        cached_time[TIME_SLOTS];
-static char            cached_err_log_time[TIME_SLOTS]
+static THREAD_LOCAL cache_time_t cached_time[TIME_SLOTS];
+static THREAD_LOCAL char cached_err_log_time[TIME_SLOTS]
                                     [sizeof("1970/09/28 12:00:00")];
-static char            cached_http_time[TIME_SLOTS]
+static THREAD_LOCAL char cached_http_time[TIME_SLOTS]
                                     [sizeof("Mon, 28 Sep 1970 06:00:00 GMT")];
-static char            cached_http_log_time[TIME_SLOTS]
+static THREAD_LOCAL char cached_http_log_time[TIME_SLOTS]
                                     [sizeof("28/Sep/1970:12:00:00 +0600")];
 
 
@@ -13,9 +13,9 @@ void cache_time_init(void);
 
 void cache_time_update(void);
 
-extern volatile uintptr_t current_msec;
-extern volatile char *err_log_time;
-extern volatile char *http_time;
-extern volatile char *http_log_time;
+extern THREAD_LOCAL volatile uintptr_t current_msec;
+extern THREAD_LOCAL volatile char *err_log_time;
+extern THREAD_LOCAL volatile char *http_time;
+extern THREAD_LOCAL volatile char *http_log_time;
 
 #endif
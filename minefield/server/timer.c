@@ -1,5 +1,6 @@
 #include "timer.h"
 #include "time_cache.h"
+#include "server.h"
 
 int
 is_active_timer(TimerObject *timer)
@@ -8,7 +9,7 @@ is_active_timer(TimerObject *timer)
 }
 
 TimerObject*
-TimerObject_new(long seconds, PyObject *callback, PyObject *args, PyObject *kwargs)
+TimerObject_new(long msec, PyObject *callback, PyObject *args, PyObject *kwargs)
 {
     TimerObject *self;
     PyObject *temp = NULL;
@@ -19,12 +20,12 @@ TimerObject_new(long seconds, PyObject *callback, PyObject *args, PyObject *kwar
         return NULL;
     }
 
-    //DEBUG("args seconds:%ld callback:%p args:%p kwargs:%p", seconds, callback, args, kwargs);
+    //DEBUG("args msec:%ld callback:%p args:%p kwargs:%p", msec, callback, args, kwargs);
 
-    if(seconds > 0){
-        self->seconds = current_msec/1000 + seconds;
+    if(msec > 0){
+        self->msec = current_msec + msec;
     }else{
-        self->seconds = 0;
+        self->msec = 0;
     }
 
     Py_XINCREF(callback);
@@ -40,6 +41,8 @@ TimerObject_new(long seconds, PyObject *callback, PyObject *args, PyObject *kwar
     }
     self->kwargs = kwargs;
     self->called = 0;
+    self->cancelled = 0;
+    self->active = NULL;
     PyObject_GC_Track(self);
     GDEBUG("self:%p", self);
     return self;
@@ -90,11 +93,21 @@ TimerObject_dealloc(TimerObject *self)
     Py_TRASHCAN_SAFE_END(self);
 }
 
+void
+cancel_timer(TimerObject *timer)
+{
+    if (!timer->called) {
+        timer->called = 1;
+        timer->cancelled = 1;
+        timer_cancelled(timer);
+    }
+}
+
 static PyObject *
 TimerObject_cancel(TimerObject *self, PyObject *args)
 {
     DEBUG("self %p", self);
-    self->called = 1;
+    cancel_timer(self);
 
     Py_RETURN_NONE;
 }
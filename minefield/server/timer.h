@@ -8,16 +8,20 @@ typedef struct {
     PyObject *args;
     PyObject *kwargs;
     PyObject *callback;
-    time_t seconds;
+    uintptr_t msec;             // fire time (current_msec), 0 is next loop turn
     char called;
+    char cancelled;             // cancel() before it fired
+    int *active;                // activecnt of the loop it keeps alive
 } TimerObject;
 
 extern PyTypeObject TimerObjectType;
 
-TimerObject* TimerObject_new(long seconds, PyObject *callback, PyObject *args, PyObject *kwargs);
+TimerObject* TimerObject_new(long msec, PyObject *callback, PyObject *args, PyObject *kwargs);
 
 void fire_timer(TimerObject *timer);
 
+void cancel_timer(TimerObject *timer);
+
 int is_active_timer(TimerObject *timer);
 
 #endif
@@ -0,0 +1,343 @@
+#include "trace.h"
+#include "log.h"
+#include <signal.h>
+
+/*
+ * request span sampler of server.set_trace().
+ * 1 in trace_sample requests records its phases, each response write and
+ * each sendfile call in a ring of fixed-size events, server.dump_trace()
+ * and SIGUSR2 write the ring as Chrome trace-event JSON (chrome://tracing,
+ * ui.perfetto.dev). writers reserve a position with an atomic add, an
+ * event is valid when its seq is the position + 1.
+ */
+
+uint64_t trace_sample = 0;
+volatile sig_atomic_t trace_signaled = 0;
+
+static trace_event *events = NULL;
+static uint64_t capacity = 0;
+static uint64_t head = 0;
+static uint64_t sampled = 0;
+static PyObject *trace_path = NULL;     // SIGUSR2 and dump_trace() default
+
+static uint32_t loop_ids = 0;
+static THREAD_LOCAL uint32_t loop_id = 0;
+
+static const char *kind_names[] = {"request", "read", "queue", "app", "write", "sendfile"};
+
+void
+trace_sample_request(request *req)
+{
+    uint64_t n = __atomic_add_fetch(&sampled, 1, __ATOMIC_RELAXED);
+
+    if (n % trace_sample == 0) {
+        req->trace_id = n;
+    }
+}
+
+static trace_event *
+reserve_event(uint64_t *pos)
+{
+    trace_event *ev;
+
+    if (events == NULL) {
+        return NULL;
+    }
+    if (loop_id == 0) {
+        loop_id = __atomic_add_fetch(&loop_ids, 1, __ATOMIC_RELAXED);
+    }
+    *pos = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    ev = events + *pos % capacity;
+    __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ev->tid = loop_id;
+    ev->path_len = 0;
+    return ev;
+}
+
+static void
+add_span(request *req, trace_kind kind, uint64_t start, uint64_t end, int64_t value)
+{
+    trace_event *ev;
+    uint64_t pos;
+
+    if ((ev = reserve_event(&pos)) == NULL) {
+        return;
+    }
+    ev->ts = start;
+    ev->dur = end > start ? end - start : 0;
+    ev->id = req->trace_id;
+    ev->value = value;
+    ev->kind = kind;
+    ev->method = req->method;
+    __atomic_store_n(&ev->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * a write or sendfile of a sampled request started at start returned.
+ */
+void
+trace_span(request *req, trace_kind kind, uint64_t start, int64_t value)
+{
+    add_span(req, kind, start, monotonic_usec(), value);
+}
+
+/*
+ * phases of a sampled request, called when it is done.
+ */
+void
+trace_request(request *req, int status, uint64_t bytes)
+{
+    uint64_t *t = req->timing;
+    uint64_t start = t[TIMING_FIRST_BYTE];
+    trace_event *ev;
+    uint64_t pos;
+    char *path;
+    Py_ssize_t len = 0;
+
+    if (req->trace_id == 0 || events == NULL || start == 0) {
+        return;
+    }
+    if (t[TIMING_BODY]) {
+        add_span(req, TRACE_READ, start, t[TIMING_BODY], 0);
+    }
+    if (t[TIMING_BODY] && t[TIMING_APP_START]) {
+        add_span(req, TRACE_QUEUE, t[TIMING_BODY], t[TIMING_APP_START], 0);
+    }
+    if (t[TIMING_APP_START] && t[TIMING_APP_END]) {
+        add_span(req, TRACE_APP, t[TIMING_APP_START], t[TIMING_APP_END], 0);
+    }
+
+    if ((ev = reserve_event(&pos)) == NULL) {
+        return;
+    }
+    ev->ts = start;
+    ev->dur = t[TIMING_LAST_WRITE] > start ? t[TIMING_LAST_WRITE] - start : 0;
+    ev->id = req->trace_id;
+    ev->value = bytes;
+    ev->status = status;
+    ev->kind = TRACE_REQUEST;
+    ev->method = t[TIMING_HEADERS] ? req->method : 255;
+    path = get_environ_value(req->environ, "PATH_INFO", &len);
+    if (path) {
+        if (len > TRACE_PATH_SIZE) {
+            len = TRACE_PATH_SIZE;
+            // do not cut a UTF-8 sequence
+            while (len > 0 && (path[len] & 0xc0) == 0x80) {
+                len--;
+            }
+        }
+        memcpy(ev->path, path, len);
+        ev->path_len = len;
+    }
+    __atomic_store_n(&ev->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static void
+write_json_string(FILE *fp, const char *s, size_t len)
+{
+    unsigned char c;
+
+    fputc('"', fp);
+    while (len--) {
+        c = (unsigned char)*s++;
+        if (c == '"' || c == '\\') {
+            fputc('\\', fp);
+            fputc(c, fp);
+        } else if (c < 0x20 || c == 0x7f) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void
+write_event(FILE *fp, trace_event *ev, int pid)
+{
+    fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"minefield\",\"ph\":\"X\",\"ts\":%" PRIu64
+            ",\"dur\":%" PRIu64 ",\"pid\":%d,\"tid\":%u,\"args\":{\"id\":%" PRIu64,
+            kind_names[ev->kind], ev->ts, ev->dur, pid, ev->tid, ev->id);
+    switch (ev->kind) {
+    case TRACE_REQUEST:
+        fprintf(fp, ",\"method\":\"%s\",\"path\":",
+                ev->method == 255 ? "-" : http_method_str(ev->method));
+        write_json_string(fp, ev->path, ev->path_len);
+        fprintf(fp, ",\"status\":%d,\"bytes\":%" PRId64 "}}", ev->status, ev->value);
+        break;
+    case TRACE_WRITE:
+    case TRACE_SENDFILE:
+        fprintf(fp, ",\"bytes\":%" PRId64 "}}", ev->value);
+        break;
+    default:
+        fputs("}}", fp);
+    }
+}
+
+/*
+ * write the events in the ring as a JSON object, return the count or -1.
+ */
+static long
+write_trace(const char *path)
+{
+    FILE *fp;
+    trace_event ev;
+    uint64_t pos, end, seq;
+    uint32_t tid, tids = 0;
+    long count = 0;
+    int pid = (int)getpid();
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"minefield %d\"}}",
+            pid, pid);
+    if (events != NULL) {
+        tids = __atomic_load_n(&loop_ids, __ATOMIC_RELAXED);
+        for (tid = 1; tid <= tids; tid++) {
+            fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+                    "\"args\":{\"name\":\"loop %u\"}}", pid, tid, tid);
+        }
+        end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+        pos = end > capacity ? end - capacity : 0;
+        for (; pos < end; pos++) {
+            seq = __atomic_load_n(&events[pos % capacity].seq, __ATOMIC_ACQUIRE);
+            if (seq != pos + 1) {
+                continue;
+            }
+            ev = events[pos % capacity];
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            // overwritten while copied
+            if (__atomic_load_n(&events[pos % capacity].seq, __ATOMIC_RELAXED) != seq) {
+                continue;
+            }
+            write_event(fp, &ev, pid);
+            count++;
+        }
+    }
+    fputs("\n]}\n", fp);
+    if (fclose(fp) != 0) {
+        return -1;
+    }
+    return count;
+}
+
+static PyObject *
+dump_path(PyObject *path)
+{
+    PyObject *bytes;
+    long count;
+
+    bytes = pid_path(path);
+    if (bytes == NULL) {
+        return NULL;
+    }
+    count = write_trace(PyBytes_AS_STRING(bytes));
+    if (count == -1) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, PyBytes_AS_STRING(bytes));
+        Py_DECREF(bytes);
+        return NULL;
+    }
+    Py_DECREF(bytes);
+    return PyLong_FromLong(count);
+}
+
+static void
+trace_signal_cb(int signum)
+{
+    trace_signaled = 1;
+}
+
+/*
+ * dump on SIGUSR2 when a trace path is set, called by server.run().
+ */
+void
+trace_install_signal(void)
+{
+    if (trace_path != NULL) {
+        PyOS_setsig(SIGUSR2, trace_signal_cb);
+    }
+}
+
+/* SIGUSR2 was caught, called by the main loop */
+void
+trace_dump_signaled(void)
+{
+    PyObject *res;
+
+    trace_signaled = 0;
+    if (trace_path == NULL) {
+        return;
+    }
+    res = dump_path(trace_path);
+    if (res == NULL) {
+        call_error_logger();
+    }
+    Py_XDECREF(res);
+}
+
+PyObject *
+set_trace(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    long sample;
+    Py_ssize_t size = TRACE_EVENTS;
+    PyObject *path = Py_None;
+    trace_event *buf = NULL;
+    static char *kwlist[] = {"sample", "events", "path", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "l|nO:set_trace", kwlist, &sample, &size, &path)) {
+        return NULL;
+    }
+    if (sample < 0) {
+        PyErr_SetString(PyExc_ValueError, "sample value out of range ");
+        return NULL;
+    }
+    if (size < 1 || size > TRACE_MAX_EVENTS) {
+        PyErr_SetString(PyExc_ValueError, "events value out of range ");
+        return NULL;
+    }
+    if (sample) {
+        buf = PyMem_Malloc(sizeof(trace_event) * size);
+        if (buf == NULL) {
+            return PyErr_NoMemory();
+        }
+        memset(buf, 0, sizeof(trace_event) * size);
+    }
+
+    // stop sampling before the ring goes
+    trace_sample = 0;
+    PyMem_Free(events);
+    events = buf;
+    capacity = sample ? size : 0;
+    head = 0;
+    Py_XDECREF(trace_path);
+    if (path == Py_None) {
+        trace_path = NULL;
+    } else {
+        Py_INCREF(path);
+        trace_path = path;
+    }
+    trace_sample = sample;
+    Py_RETURN_NONE;
+}
+
+PyObject *
+dump_trace(PyObject *self, PyObject *args)
+{
+    PyObject *path = Py_None;
+
+    if (!PyArg_ParseTuple(args, "|O:dump_trace", &path)) {
+        return NULL;
+    }
+    if (path == Py_None) {
+        if (trace_path == NULL) {
+            PyErr_SetString(PyExc_ValueError, "no trace path");
+            return NULL;
+        }
+        path = trace_path;
+    }
+    return dump_path(path);
+}
@@ -0,0 +1,79 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "minefield.h"
+#include "request.h"
+#include "util.h"
+#include <signal.h>
+
+#define TRACE_EVENTS 16384
+#define TRACE_MAX_EVENTS 1024 * 1024 * 16
+#define TRACE_PATH_SIZE 78
+
+typedef enum {
+    TRACE_REQUEST,              // first byte to last write
+    TRACE_READ,                 // first byte to body
+    TRACE_QUEUE,                // body to app call
+    TRACE_APP,
+    TRACE_WRITE,                // one writev of the response
+    TRACE_SENDFILE,             // one sendfile or pread/write of a file
+} trace_kind;
+
+typedef struct {
+    uint64_t seq;               // position + 1 when complete, 0 while written
+    uint64_t ts;                // monotonic usec
+    uint64_t dur;
+    uint64_t id;                // request
+    int64_t value;              // bytes
+    uint32_t tid;               // loop
+    uint8_t kind;
+    uint8_t method;             // enum http_method, 255 without headers
+    uint16_t status;
+    uint16_t path_len;
+    char path[TRACE_PATH_SIZE];
+} trace_event;                  // 128 bytes
+
+extern uint64_t trace_sample;
+
+extern volatile sig_atomic_t trace_signaled;
+
+void trace_sample_request(request *req);
+
+/* 1 in trace_sample requests get a trace_id */
+#define TRACE_REQUEST_BEGIN(req) \
+    do { \
+        if (unlikely(trace_sample != 0)) { \
+            trace_sample_request(req); \
+        } \
+    } while (0)
+
+/* start time of a span of req, 0 when it is not sampled */
+static inline uint64_t
+trace_begin(request *req)
+{
+    if (likely(req == NULL || req->trace_id == 0)) {
+        return 0;
+    }
+    return monotonic_usec();
+}
+
+void trace_span(request *req, trace_kind kind, uint64_t start, int64_t value);
+
+#define TRACE_END(req, kind, start, value) \
+    do { \
+        if (unlikely(start != 0)) { \
+            trace_span((req), (kind), (start), (value)); \
+        } \
+    } while (0)
+
+void trace_request(request *req, int status, uint64_t bytes);
+
+void trace_install_signal(void);
+
+void trace_dump_signaled(void);
+
+PyObject* set_trace(PyObject *self, PyObject *args, PyObject *kwds);
+
+PyObject* dump_trace(PyObject *self, PyObject *args);
+
+#endif
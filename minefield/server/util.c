@@ -1,5 +1,9 @@
 #include "util.h"
 
+#ifdef linux
+#include <sys/eventfd.h>
+#endif
+
 
 int
 setup_listen_sock(int fd)
@@ -106,3 +110,137 @@ get_current_msec()
     return (uintptr_t) sec * 1000 + msec;
 }
 
+uint64_t
+monotonic_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* file system path of path with {pid} replaced by the process id */
+PyObject *
+pid_path(PyObject *path)
+{
+    PyObject *res;
+#ifdef PY3
+    PyObject *pid, *bytes = NULL;
+
+    pid = PyUnicode_FromFormat("%d", (int)getpid());
+    if (pid == NULL) {
+        return NULL;
+    }
+    if (PyUnicode_Check(path)) {
+        res = PyObject_CallMethod(path, "replace", "sO", "{pid}", pid);
+    } else {
+        Py_INCREF(path);
+        res = path;
+    }
+    Py_DECREF(pid);
+    if (res != NULL) {
+        if (!PyUnicode_FSConverter(res, &bytes)) {
+            bytes = NULL;
+        }
+        Py_DECREF(res);
+    }
+    return bytes;
+#else
+    if (!PyString_Check(path)) {
+        PyErr_SetString(PyExc_TypeError, "path must be a string");
+        return NULL;
+    }
+    res = PyObject_CallMethod(path, "replace", "sN", "{pid}", PyString_FromFormat("%d", (int)getpid()));
+    return res;
+#endif
+}
+
+
+char *
+get_environ_value(PyObject *environ, const char *key, Py_ssize_t *len)
+{
+    PyObject *o;
+    char *s = NULL;
+
+    if (environ == NULL) {
+        return NULL;
+    }
+    o = PyDict_GetItemString(environ, key);
+    if (o == NULL) {
+        return NULL;
+    }
+#ifdef PY3
+    if (PyUnicode_Check(o)) {
+        s = (char *)PyUnicode_AsUTF8AndSize(o, len);
+        if (s == NULL) {
+            PyErr_Clear();
+        }
+        return s;
+    }
+#endif
+    if (PyBytes_Check(o)) {
+        if (len) {
+            *len = PyBytes_GET_SIZE(o);
+        }
+        s = PyBytes_AS_STRING(o);
+    }
+    return s;
+}
+
+/*
+ * wakeup fd of a loop, written by other threads.
+ * an eventfd on linux, a pipe elsewhere (rfd != wfd).
+ */
+int
+open_notify_fd(int *rfd, int *wfd)
+{
+#ifdef linux
+    *rfd = *wfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return *rfd == -1 ? -1 : 0;
+#else
+    int fds[2];
+
+    if (pipe(fds) == -1) {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    *rfd = fds[0];
+    *wfd = fds[1];
+    return 0;
+#endif
+}
+
+void
+close_notify_fd(int rfd, int wfd)
+{
+    if (wfd != -1 && wfd != rfd) {
+        close(wfd);
+    }
+    if (rfd != -1) {
+        close(rfd);
+    }
+}
+
+void
+write_notify_fd(int wfd)
+{
+#ifdef linux
+    uint64_t one = 1;
+    ssize_t r = write(wfd, &one, sizeof(one));
+#else
+    ssize_t r = write(wfd, "", 1);
+#endif
+    (void)r;
+}
+
+void
+drain_notify_fd(int rfd)
+{
+    char buf[64];
+
+    while (read(rfd, buf, sizeof(buf)) > 0) {
+    }
+}
@@ -16,4 +16,18 @@ int set_so_keepalive(int fd, int flag);
 
 uintptr_t get_current_msec(void);
 
+uint64_t monotonic_usec(void);
+
+PyObject* pid_path(PyObject *path);
+
+char* get_environ_value(PyObject *environ, const char *key, Py_ssize_t *len);
+
+int open_notify_fd(int *rfd, int *wfd);
+
+void close_notify_fd(int rfd, int wfd);
+
+void write_notify_fd(int wfd);
+
+void drain_notify_fd(int rfd);
+
 #endif
@@ -54,6 +54,21 @@ install_requires=[]
 if develop:
     define_macros.append(("DEVELOP", None))
 
+libraries = ["z"]
+
+def has_header(name):
+    include_dirs = ["/usr/include", "/usr/local/include", "/opt/homebrew/include"]
+    return any(os.path.exists(os.path.join(d, name)) for d in include_dirs)
+
+# optional brotli response compression
+if os.environ.get("MINEFIELD_NO_BROTLI") != "1" and has_header("brotli/encode.h"):
+    define_macros.append(("HAVE_BROTLI", None))
+    libraries.append("brotlienc")
+
+# USDT probes, see probes.h
+if os.environ.get("MINEFIELD_NO_SDT") != "1" and has_header("sys/sdt.h"):
+    define_macros.append(("HAVE_SYS_SDT", None))
+
 sources = get_sources("minefield", ["*picoev_*"])
 sources.append(get_picoev_file())
 
@@ -78,6 +93,7 @@ setup(name='minefield',
             sources=sources,
             include_dirs=[],
             library_dirs=[],
+            libraries=libraries,
             define_macros=define_macros
         )],
 
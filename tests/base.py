@@ -6,9 +6,10 @@ import threading
 
 class ClientRunner(object):
 
-    def __init__(self, app, middleware=None):
+    def __init__(self, app, middleware=None, run=server.run):
         self.app = app
         self.middleware = middleware
+        self.run_server = run
 
     def run(self, client):
         self.stop = False
@@ -36,17 +37,17 @@ class ClientRunner(object):
                 server.shutdown()
         server.set_watchdog(check)
         if self.middleware:
-            server.run(self.middleware(self.app))
+            self.run_server(self.middleware(self.app))
         else:
-            server.run(self.app)
+            self.run_server(self.app)
 
         thread.join()
         return self.env, self.result
 
 
-def run_client(client=None, app=None, middleware=None):
+def run_client(client=None, app=None, middleware=None, run=server.run):
     application = app()
-    s = ClientRunner(application, middleware)
+    s = ClientRunner(application, middleware, run)
     return s.run(client)
 
 
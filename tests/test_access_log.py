@@ -0,0 +1,127 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import os
+import tempfile
+import threading
+import time
+import requests
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [b"Hello world!"]
+
+def run_logged(client, **kwargs):
+    fd, path = tempfile.mkstemp()
+    os.close(fd)
+    server.set_access_logger(None)
+    server.set_access_log(path, **kwargs)
+    try:
+        env, res = run_client(client, App)
+    finally:
+        server.set_access_log(None)
+    with open(path) as f:
+        lines = f.read().splitlines()
+    os.unlink(path)
+    return res, lines
+
+def test_combined():
+
+    def client():
+        return requests.get("http://localhost:8000/foo?a=1", headers={"Referer": "http://example.com/"})
+
+    res, lines = run_logged(client)
+    assert(res.status_code == 200)
+    assert(len(lines) == 1)
+    assert(lines[0].startswith('127.0.0.1 - - ['))
+    assert(lines[0].endswith('] "GET /foo?a=1 HTTP/1.1" 200 12 "http://example.com/" "python-requests/%s"' % requests.__version__))
+
+def test_nginx_format():
+
+    def client():
+        return requests.get("http://localhost:8000/bar", headers={"X-Request-Id": 'id"1'})
+
+    res, lines = run_logged(client, format='$remote_addr $request_method $uri $status $body_bytes_sent $http_x_request_id ${pid}')
+    assert(lines == ['127.0.0.1 GET /bar 200 12 id\\x221 %d' % os.getpid()])
+
+def test_buffered():
+
+    def client():
+        s = requests.Session()
+        return [s.get("http://localhost:8000/%d" % i).status_code for i in range(100)]
+
+    res, lines = run_logged(client, format='%U %s', flush_interval=60)
+    assert(res == [200] * 100)
+    # written on shutdown
+    assert(lines == ['/%d 200' % i for i in range(100)])
+
+def test_slow_disk():
+    path = tempfile.mktemp()
+    os.mkfifo(path)
+    fd = os.open(path, os.O_RDONLY | os.O_NONBLOCK)
+    os.set_blocking(fd, True)
+    data = []
+
+    def read_log():
+        while True:
+            chunk = os.read(fd, 65536)
+            if not chunk:
+                break
+            data.append(chunk)
+
+    def client():
+        done = []
+        s = requests.Session()
+        url = "http://localhost:8000/" + "x" * 4000
+        t = threading.Thread(target=lambda: done.append([s.get(url).status_code for i in range(40)]))
+        t.start()
+        # the pipe and the ring are full, the loop waits without the GIL
+        time.sleep(1)
+        stalled = not done
+        reader.start()
+        t.join()
+        return stalled, done[0]
+
+    reader = threading.Thread(target=read_log)
+    server.set_access_logger(None)
+    server.set_access_log(path, format='%U', buffer_size=16384)
+    try:
+        env, (stalled, res) = run_client(client, App)
+    finally:
+        server.set_access_log(None)
+        reader.join()
+        os.close(fd)
+        os.unlink(path)
+    assert(stalled)
+    assert(res == [200] * 40)
+    assert(len(b"".join(data).splitlines()) == 40)
+
+def test_invalid_format():
+    for fmt in ('%Z', '%{foo', '$nosuchvar', '${status'):
+        try:
+            server.set_access_log(os.devnull, format=fmt)
+            assert(False)
+        except ValueError:
+            pass
+    try:
+        server.set_access_log(os.devnull, buffer_size=10)
+        assert(False)
+    except ValueError:
+        pass
+
+def test_reopen():
+    fd, path = tempfile.mkstemp()
+    os.close(fd)
+    server.set_access_log(path, format='%U')
+    try:
+        os.rename(path, path + '.1')
+        server.reopen_access_log()
+        server.flush_access_log()
+        assert(os.path.exists(path))
+    finally:
+        server.set_access_log(None)
+        os.unlink(path)
+        os.unlink(path + '.1')
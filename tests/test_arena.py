@@ -0,0 +1,58 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import requests
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        # chunked, one bucket each
+        return self.chunks()
+
+    def chunks(self):
+        for i in range(2000):
+            yield b"x" * (i + 1)
+        self.environ['arena'] = server.slab_stats()['arena']['in_use']
+
+def body():
+    return b"".join(b"x" * (i + 1) for i in range(2000))
+
+def test_chunks():
+
+    def client():
+        return requests.get("http://localhost:8000/")
+
+    env, res = run_client(client, App)
+    assert(res.status_code == 200)
+    assert(res.headers['Transfer-Encoding'] == 'chunked')
+    assert(res.content == body())
+    assert(server.slab_stats()['arena']['in_use'] == 0)
+    # sent and queued buckets give the arena space back
+    assert(env['arena'] <= 2)
+
+def test_long_path():
+    path = "/" + "a" * 5000
+
+    def client():
+        return requests.get("http://localhost:8000" + path)
+
+    env, res = run_client(client, App)
+    assert(res.status_code == 200)
+    assert(env['PATH_INFO'] == path)
+    assert(server.slab_stats()['arena']['in_use'] == 0)
+
+def test_pipeline():
+
+    def client():
+        s = requests.Session()
+        return [s.get("http://localhost:8000/%d" % i).content == body() for i in range(3)]
+
+    server.set_keepalive(10)
+    try:
+        env, res = run_client(client, App)
+    finally:
+        server.set_keepalive(0)
+    assert(res == [True, True, True])
+    assert(server.slab_stats()['arena']['in_use'] == 0)
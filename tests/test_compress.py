@@ -0,0 +1,137 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import gzip
+import os
+import shutil
+import tempfile
+import zlib
+import requests
+
+BODY = b"minefield " * 100
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [BODY[:500], BODY[500:]]
+
+class IterApp(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        start_response('200 OK', [('Content-type', 'application/json')])
+        def body():
+            for i in range(10):
+                yield BODY
+        return body()
+
+class SmallApp(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [b"small"]
+
+class ImageApp(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        start_response('200 OK', [('Content-type', 'image/png')])
+        return [BODY]
+
+def run_compress(client, app):
+    server.set_compression(6)
+    try:
+        return run_client(client, app)
+    finally:
+        server.set_compression(0)
+
+def get(headers=None):
+    return requests.get("http://localhost:8000/", headers=headers, stream=True)
+
+def test_gzip():
+
+    def client():
+        res = get({"Accept-Encoding": "gzip"})
+        return res, res.raw.read()
+
+    env, (res, raw) = run_compress(client, App)
+    assert(res.headers["Content-Encoding"] == "gzip")
+    assert(res.headers["Vary"] == "Accept-Encoding")
+    assert(int(res.headers["Content-Length"]) == len(raw))
+    assert(gzip.decompress(raw) == BODY)
+
+def test_deflate():
+
+    def client():
+        res = get({"Accept-Encoding": "deflate"})
+        return res, res.raw.read()
+
+    env, (res, raw) = run_compress(client, App)
+    assert(res.headers["Content-Encoding"] == "deflate")
+    assert(zlib.decompress(raw) == BODY)
+
+def test_gzip_stream():
+
+    def client():
+        res = get({"Accept-Encoding": "gzip"})
+        return res, res.raw.read()
+
+    env, (res, raw) = run_compress(client, IterApp)
+    assert(res.headers["Content-Encoding"] == "gzip")
+    assert(res.headers["Transfer-Encoding"] == "chunked")
+    assert(gzip.decompress(raw) == BODY * 10)
+
+def test_not_compressed():
+
+    def client():
+        identity = get({"Accept-Encoding": "identity"})
+        return identity, identity.raw.read()
+
+    env, (res, raw) = run_compress(client, App)
+    assert("Content-Encoding" not in res.headers)
+    assert(res.headers["Vary"] == "Accept-Encoding")
+    assert(raw == BODY)
+
+    env, (res, raw) = run_compress(lambda: client(), SmallApp)
+    assert("Content-Encoding" not in res.headers)
+    assert(raw == b"small")
+
+    env, (res, raw) = run_compress(lambda: client(), ImageApp)
+    assert("Content-Encoding" not in res.headers)
+    assert("Vary" not in res.headers)
+
+class FileApp(BaseApp):
+
+    path = None
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return environ['wsgi.file_wrapper'](open(FileApp.path, 'rb'))
+
+def test_gzip_sidecar():
+    root = tempfile.mkdtemp()
+    try:
+        FileApp.path = os.path.join(root, "data.txt")
+        with open(FileApp.path, "wb") as f:
+            f.write(BODY)
+        with open(FileApp.path + ".gz", "wb") as f:
+            f.write(gzip.compress(BODY))
+
+        def client():
+            gz = get({"Accept-Encoding": "gzip"})
+            plain = get({"Accept-Encoding": "identity"})
+            return gz, gz.raw.read(), plain, plain.raw.read()
+
+        env, (gz, gzraw, plain, raw) = run_compress(client, FileApp)
+        assert(gz.headers["Content-Encoding"] == "gzip")
+        assert(gz.headers["Content-Length"] == str(len(gzraw)))
+        assert(gzip.decompress(gzraw) == BODY)
+        assert("Content-Encoding" not in plain.headers)
+        assert(plain.headers["Vary"] == "Accept-Encoding")
+        assert(raw == BODY)
+    finally:
+        shutil.rmtree(root)
@@ -0,0 +1,81 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import socket
+import time
+import requests
+
+class App(BaseApp):
+
+    waiters = []
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        if environ['PATH_INFO'] == '/notify':
+            # created by the requests asking for it only
+            App.notify_continuation = 'minefield.continuation' in environ
+            waiters = App.waiters
+            App.waiters = []
+            n = sum(c.resume() for c in waiters)
+            start_response('200 OK', [('Content-type', 'text/plain')])
+            return [str(n).encode()]
+        c = server.get_continuation(environ)
+        assert(server.get_continuation(environ) is c)
+        if not c.resumed and not c.expired:
+            App.waiters.append(c)
+            c.suspend(int(environ.get('QUERY_STRING') or 0))
+            return []
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [b"resumed" if c.resumed else b"expired"]
+
+def wait(query=""):
+    sock = socket.create_connection(("localhost", 8000))
+    sock.sendall(("GET /wait?%s HTTP/1.0\r\nHost: localhost\r\n\r\n" % query).encode())
+    return sock
+
+def read_all(sock):
+    data = b""
+    while True:
+        r = sock.recv(1024)
+        if not r:
+            return data
+        data += r
+
+def test_resume():
+
+    def client():
+        socks = [wait() for i in range(20)]
+        time.sleep(0.5)
+        n = requests.get("http://localhost:8000/notify").content
+        return n, [read_all(sock) for sock in socks]
+
+    App.waiters = []
+    env, (n, bodies) = run_client(client, App)
+    assert(n == b"20")
+    assert(App.notify_continuation is False)
+    for body in bodies:
+        assert(body.startswith(b"HTTP/1.0 200 OK"))
+        assert(body.endswith(b"\r\n\r\nresumed"))
+
+def test_expire():
+
+    def client():
+        sock = wait("1")
+        return read_all(sock)
+
+    App.waiters = []
+    env, body = run_client(client, App)
+    assert(body.endswith(b"\r\n\r\nexpired"))
+
+def test_disconnected():
+
+    def client():
+        sock = wait()
+        time.sleep(0.3)
+        sock.close()
+        time.sleep(0.3)
+        return requests.get("http://localhost:8000/notify").content
+
+    App.waiters = []
+    env, n = run_client(client, App)
+    assert(n == b"0")
@@ -0,0 +1,131 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import socket
+import time
+import requests
+
+class App(BaseApp):
+
+    cancelled = False
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        return self.handle(environ, start_response)
+
+    async def handle(self, environ, start_response):
+        path = environ['PATH_INFO']
+        if path == '/sleep':
+            start = time.time()
+            await server.sleep(0.2)
+            await server.sleep(0.2)
+            elapsed = time.time() - start
+            start_response('200 OK', [('Content-type', 'text/plain')])
+            return [("%.1f" % elapsed).encode()]
+        if path == '/upstream':
+            a, b = socket.socketpair()
+            a.setblocking(False)
+            server.schedule_call(1, b.send, b"upstream")
+            await server.wait_readable(a)
+            data = a.recv(1024)
+            try:
+                await server.wait_readable(a, 1)
+            except server.timeout:
+                data += b" timeout"
+            a.close()
+            b.close()
+            start_response('200 OK', [('Content-type', 'text/plain')])
+            return [data]
+        if path == '/forever':
+            try:
+                await server.sleep(60)
+            finally:
+                App.cancelled = True
+        if path == '/cancelled':
+            start_response('200 OK', [('Content-type', 'text/plain')])
+            return [str(App.cancelled).encode()]
+        if path == '/error':
+            await server.sleep(0)
+            raise Exception("async error")
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        async def body():
+            for i in range(3):
+                await server.sleep(0.1)
+                yield b"item%d\n" % i
+        return body()
+
+def test_sleep():
+
+    def client():
+        return requests.get("http://localhost:8000/sleep")
+
+    env, res = run_client(client, App)
+    assert(res.status_code == 200)
+    assert(res.content == b"0.4")
+
+def test_wait_readable():
+
+    def client():
+        return requests.get("http://localhost:8000/upstream")
+
+    env, res = run_client(client, App)
+    assert(res.status_code == 200)
+    assert(res.content == b"upstream timeout")
+
+def test_concurrent():
+
+    def client():
+        socks = []
+        start = time.time()
+        for i in range(20):
+            sock = socket.create_connection(("localhost", 8000))
+            sock.sendall(b"GET /sleep HTTP/1.0\r\nHost: localhost\r\n\r\n")
+            socks.append(sock)
+        bodies = []
+        for sock in socks:
+            data = b""
+            while True:
+                r = sock.recv(1024)
+                if not r:
+                    break
+                data += r
+            bodies.append(data)
+        return time.time() - start, bodies
+
+    env, (elapsed, bodies) = run_client(client, App)
+    assert(elapsed < 2)
+    for body in bodies:
+        assert(body.startswith(b"HTTP/1.0 200 OK"))
+        assert(body.endswith(b"\r\n\r\n0.4"))
+
+def test_async_body():
+
+    def client():
+        return requests.get("http://localhost:8000/body")
+
+    env, res = run_client(client, App)
+    assert(res.status_code == 200)
+    assert(res.headers["Transfer-Encoding"] == "chunked")
+    assert(res.content == b"item0\nitem1\nitem2\n")
+
+def test_error():
+
+    def client():
+        return requests.get("http://localhost:8000/error")
+
+    env, res = run_client(client, App)
+    assert(res.status_code == 500)
+
+def test_disconnected():
+
+    def client():
+        sock = socket.create_connection(("localhost", 8000))
+        sock.sendall(b"GET /forever HTTP/1.0\r\nHost: localhost\r\n\r\n")
+        time.sleep(0.3)
+        sock.close()
+        time.sleep(0.3)
+        return requests.get("http://localhost:8000/cancelled").content
+
+    App.cancelled = False
+    env, res = run_client(client, App)
+    assert(res == b"True")
@@ -0,0 +1,110 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import os
+import tempfile
+import requests
+from minefield import logring
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        if environ['PATH_INFO'] == '/missing':
+            start_response('404 Not Found', [('Content-type', 'text/plain')])
+            return [b"not found"]
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [b"Hello world!"]
+
+def run_ring(client, records=1024):
+    path = os.path.join(tempfile.gettempdir(), "minefield-test.{pid}.ring")
+    server.set_log_ring(path, records=records)
+    path = path.replace("{pid}", str(os.getpid()))
+    try:
+        env, res = run_client(client, App)
+    finally:
+        server.set_log_ring(None)
+    return res, path
+
+def test_records():
+
+    def client():
+        s = requests.Session()
+        return [s.get("http://localhost:8000/foo").status_code,
+                s.post("http://localhost:8000/missing", data=b"x").status_code]
+
+    res, path = run_ring(client)
+    assert(res == [200, 404])
+    try:
+        with logring.LogRing(path) as ring:
+            assert(ring.pid == os.getpid())
+            records = ring.read()
+            assert(ring.read() == [])
+    finally:
+        os.unlink(path)
+    assert(len(records) == 2)
+    first, second = records
+    assert(first.method == "GET")
+    assert(first.status == 200)
+    assert(first.bytes == 12)
+    assert(first.path_hash == logring.path_hash("/foo"))
+    assert(first.remote_addr == "127.0.0.1")
+    assert(0 <= first.duration < 5)
+    assert(second.method == "POST")
+    assert(second.status == 404)
+    assert(second.path_hash == logring.path_hash("/missing"))
+    summary = logring.summarize(records)
+    assert(summary["count"] == 2)
+    assert(summary["status"] == {200: 1, 404: 1})
+
+def test_wrap():
+
+    def client():
+        s = requests.Session()
+        return [s.get("http://localhost:8000/%d" % i).status_code for i in range(20)]
+
+    res, path = run_ring(client, records=8)
+    try:
+        with logring.LogRing(path) as ring:
+            records = ring.read()
+    finally:
+        os.unlink(path)
+    # the oldest records are overwritten
+    assert([r.path_hash for r in records] == [logring.path_hash("/%d" % i) for i in range(12, 20)])
+
+def test_invalid():
+    try:
+        server.set_log_ring(os.devnull + "x/ring", records=0)
+        assert(False)
+    except ValueError:
+        pass
+
+class SwapApp(App):
+
+    def __call__(self, environ, start_response):
+        try:
+            server.set_log_ring(None)
+            self.error = None
+        except RuntimeError as e:
+            self.error = str(e)
+        return App.__call__(self, environ, start_response)
+
+def test_running():
+    app = SwapApp()
+
+    def client():
+        return requests.get("http://localhost:8000/").status_code
+
+    path = os.path.join(tempfile.gettempdir(), "minefield-test.ring")
+    server.set_log_ring(path)
+    try:
+        env, res = run_client(client, lambda: app)
+        with logring.LogRing(path) as ring:
+            records = ring.read()
+    finally:
+        server.set_log_ring(None)
+        os.unlink(path)
+    assert(res == 200)
+    assert(app.error == "log ring is used by the running server")
+    # still mapped, the request is recorded
+    assert(len(records) == 1)
@@ -0,0 +1,88 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+from minefield import loop
+import asyncio
+import socket
+import time
+import requests
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        return self.handle(environ, start_response)
+
+    async def handle(self, environ, start_response):
+        # upstream served by asyncio on the same loop
+        reader, writer = await asyncio.open_connection("127.0.0.1", 8001)
+        writer.write(environ['PATH_INFO'].encode() + b"\n")
+        data = await asyncio.wait_for(reader.readline(), 5)
+        writer.close()
+        await asyncio.sleep(0.1)
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [data]
+
+async def upper(reader, writer):
+    data = await reader.readline()
+    writer.write(data.upper())
+    await writer.drain()
+    writer.close()
+
+def new_loop():
+    ev = loop.EventLoop()
+    asyncio.set_event_loop(ev)
+    return ev
+
+def test_callbacks():
+    ev = new_loop()
+    try:
+        order = []
+        async def main():
+            for i in range(5):
+                ev.call_soon(order.append, i)
+            ev.call_later(0.2, order.append, "later")
+            h = ev.call_later(0.1, order.append, "cancelled")
+            h.cancel()
+            start = ev.time()
+            await asyncio.sleep(0.3)
+            return ev.time() - start
+        elapsed = ev.run_until_complete(main())
+        assert(0.25 < elapsed < 1)
+        assert(order == [0, 1, 2, 3, 4, "later"])
+    finally:
+        ev.close()
+
+def test_sock():
+    ev = new_loop()
+    try:
+        a, b = socket.socketpair()
+        a.setblocking(False)
+        b.setblocking(False)
+        async def main():
+            ev.call_later(0.1, b.send, b"ping")
+            data = await ev.sock_recv(a, 16)
+            await ev.sock_sendall(a, data.upper())
+            await asyncio.sleep(0.1)
+            return b.recv(16)
+        assert(ev.run_until_complete(main()) == b"PING")
+        a.close()
+        b.close()
+    finally:
+        ev.close()
+
+def test_serve():
+    ev = new_loop()
+    try:
+        upstream = ev.run_until_complete(asyncio.start_server(upper, "127.0.0.1", 8001))
+
+        def client():
+            return [requests.get("http://localhost:8000/hello%d" % i).content for i in range(3)]
+
+        env, res = run_client(client, App, run=ev.serve)
+        assert(res == [b"/HELLO0\n", b"/HELLO1\n", b"/HELLO2\n"])
+        upstream.close()
+        ev.run_until_complete(upstream.wait_closed())
+    finally:
+        ev.close()
+        asyncio.set_event_loop(None)
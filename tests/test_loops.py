@@ -0,0 +1,97 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import socket
+import threading
+import time
+import requests
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        if environ['PATH_INFO'] == '/block':
+            # the loop of the request blocks, the others do not
+            time.sleep(0.3)
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [threading.current_thread().name.encode()]
+
+def run_loops(client, loops=4):
+    server.set_loops(loops)
+    try:
+        return run_client(client, App)
+    finally:
+        server.set_loops(1)
+
+def read_all(sock):
+    data = b""
+    while True:
+        r = sock.recv(1024)
+        if not r:
+            return data
+        data += r
+
+def test_set_loops():
+    assert(server.get_loops() == 1)
+    server.set_loops(8)
+    assert(server.get_loops() == 8)
+    server.set_loops(1)
+    for value in (0, 100000):
+        try:
+            server.set_loops(value)
+            assert(False)
+        except ValueError:
+            pass
+
+def test_simple():
+
+    def client():
+        return requests.get("http://localhost:8000/")
+
+    env, res = run_loops(client)
+    assert(res.status_code == 200)
+
+def test_concurrent():
+
+    def client():
+        start = time.time()
+        socks = []
+        for i in range(16):
+            sock = socket.create_connection(("localhost", 8000))
+            sock.sendall(b"GET /block HTTP/1.0\r\nHost: localhost\r\n\r\n")
+            socks.append(sock)
+        bodies = [read_all(sock) for sock in socks]
+        return time.time() - start, bodies
+
+    env, (elapsed, bodies) = run_loops(client)
+    names = set()
+    for body in bodies:
+        assert(body.startswith(b"HTTP/1.0 200 OK"))
+        names.add(body.split(b"\r\n\r\n", 1)[1])
+    assert(len(names) > 1)
+    assert(elapsed < 16 * 0.3)
+
+def test_threads_and_loops():
+    server.set_loops(2)
+    server.set_threads(2)
+    try:
+        server.run(App())
+        assert(False)
+    except ValueError:
+        pass
+    finally:
+        server.set_threads(0)
+        server.set_loops(1)
+
+def test_keepalive():
+
+    def client():
+        s = requests.Session()
+        return [s.get("http://localhost:8000/").status_code for i in range(5)]
+
+    server.set_keepalive(10)
+    try:
+        env, res = run_loops(client, 2)
+    finally:
+        server.set_keepalive(0)
+    assert(res == [200] * 5)
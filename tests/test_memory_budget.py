@@ -0,0 +1,157 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import socket
+import threading
+import time
+import requests
+import pytest
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        self.usage = server.memory_usage()
+        body = environ['wsgi.input'].read()
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [str(len(body)).encode()]
+
+def test_usage():
+    assert(server.get_memory_budget() == 0)
+    usage = server.memory_usage()
+    assert(sorted(usage) == ['bodies', 'budget', 'output', 'paused', 'pauses', 'spilled', 'total'])
+    assert(usage['total'] == usage['bodies'] + usage['output'])
+    with pytest.raises(ValueError):
+        server.set_memory_budget(-1)
+
+def test_body_charged():
+    app = App()
+
+    def client():
+        return requests.post("http://localhost:8000/", data=b"a" * 200000)
+
+    env, res = run_client(client, lambda: app)
+    assert(res.status_code == 200)
+    assert(res.content == b"200000")
+    assert(app.usage['bodies'] == 200000)
+    # wsgi.input owns the body
+    del env
+    app.environ = None
+    assert(server.memory_usage()['bodies'] == 0)
+
+def test_spill():
+    app = App()
+    before = server.memory_usage()['spilled']
+
+    def client():
+        return requests.post("http://localhost:8000/", data=b"a" * 200000)
+
+    server.set_memory_budget(100000)
+    try:
+        env, res = run_client(client, lambda: app)
+    finally:
+        server.set_memory_budget(0)
+    assert(res.status_code == 200)
+    assert(res.content == b"200000")
+    assert(app.usage['bodies'] == 0)
+    assert(server.memory_usage()['spilled'] - before == 1)
+
+class BigApp(App):
+
+    def __call__(self, environ, start_response):
+        if environ['PATH_INFO'] == '/big':
+            start_response('200 OK', [('Content-type', 'text/plain')])
+            return [b"x" * (16 * 1024 * 1024)]
+        return App.__call__(self, environ, start_response)
+
+def connect(request):
+    s = socket.create_connection(("localhost", 8000))
+    s.sendall(request)
+    return s
+
+def upload(length):
+    return connect(b"POST / HTTP/1.0\r\nContent-Length: %d\r\n\r\n" % length + b"a" * 1000)
+
+def read_all(s):
+    data = b""
+    while True:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+    s.close()
+    return data
+
+def stall_output():
+    # a reader that does not read, its queued output is over the budget
+    s = connect(b"GET /big HTTP/1.0\r\n\r\n")
+    time.sleep(0.3)
+    assert(server.memory_usage()['output'] > server.get_memory_budget())
+    return s
+
+def send_later(s, data):
+    t = threading.Thread(target=s.sendall, args=(data,))
+    t.start()
+    return t
+
+def run_budget(client):
+    server.set_memory_budget(1024 * 1024)
+    try:
+        env, res = run_client(client, BigApp)
+    finally:
+        server.set_memory_budget(0)
+    assert(server.memory_usage()['paused'] == 0)
+    return res
+
+def test_pause_handover():
+
+    def client():
+        near = upload(150000)
+        far = upload(300000)
+        time.sleep(0.2)
+        big = stall_output()
+        # near is read over the budget, 70000 bytes left
+        near.sendall(b"a" * 79000)
+        time.sleep(0.2)
+        sender = send_later(far, b"a" * 299000)
+        time.sleep(0.3)
+        paused = server.memory_usage()['paused']
+        near.sendall(b"a" * 70000)
+        # far takes over when near is done, the output is still stalled
+        bodies = [read_all(near), read_all(far)]
+        sender.join()
+        big.settimeout(10)
+        read_all(big)
+        return paused, bodies
+
+    before = server.memory_usage()['pauses']
+    paused, (near, far) = run_budget(client)
+    assert(paused == 1)
+    assert(near.endswith(b"\r\n\r\n150000"))
+    assert(far.endswith(b"\r\n\r\n300000"))
+    assert(server.memory_usage()['pauses'] - before == 1)
+
+def test_pause_resume():
+
+    def client():
+        near = upload(150000)
+        far = upload(300000)
+        time.sleep(0.2)
+        big = stall_output()
+        near.sendall(b"a" * 79000)
+        time.sleep(0.2)
+        sender = send_later(far, b"a" * 299000)
+        time.sleep(0.3)
+        paused = server.memory_usage()['paused']
+        # the output drains, far is resumed while near still waits
+        big.settimeout(10)
+        read_all(big)
+        far_body = read_all(far)
+        sender.join()
+        near.sendall(b"a" * 70000)
+        return paused, far_body, read_all(near)
+
+    paused, far, near = run_budget(client)
+    assert(paused == 1)
+    assert(far.endswith(b"\r\n\r\n300000"))
+    assert(near.endswith(b"\r\n\r\n150000"))
@@ -0,0 +1,71 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import socket
+import time
+
+CHUNK = b"x" * (1024 * 64)
+COUNT = 1000
+
+class StreamApp(BaseApp):
+
+    pulled = 0
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        start_response('200 OK', [('Content-type', 'text/plain'),
+                                  ('Content-Length', str(len(CHUNK) * COUNT))])
+        StreamApp.pulled = 0
+        def body():
+            for i in range(COUNT):
+                StreamApp.pulled += 1
+                yield CHUNK
+        return body()
+
+def run_watermarks(client, high, low):
+    server.set_output_watermarks(high, low)
+    try:
+        return run_client(client, StreamApp)
+    finally:
+        server.set_output_watermarks(1024 * 64, 1024 * 16)
+
+def read_all(sock):
+    size = 0
+    while True:
+        r = sock.recv(1024 * 256)
+        if not r:
+            return size
+        size += len(r)
+
+def test_pause_above_high_watermark():
+
+    def client():
+        sock = socket.create_connection(("localhost", 8000))
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1024 * 64)
+        sock.sendall(b"GET / HTTP/1.0\r\nHost: localhost\r\n\r\n")
+        # don't read, let the server fill its buffers
+        time.sleep(1)
+        pulled, buffered = StreamApp.pulled, server.get_buffered_output()
+        return pulled, buffered, read_all(sock), server.get_buffered_output()
+
+    env, (pulled, buffered, size, after) = run_watermarks(client, 1024 * 1024, 1024 * 256)
+    assert(0 < pulled < COUNT)
+    assert(0 < buffered <= 1024 * 1024 + len(CHUNK))
+    assert(size > len(CHUNK) * COUNT)
+    assert(StreamApp.pulled == COUNT)
+    assert(after == 0)
+
+def test_no_pull_ahead():
+
+    def client():
+        sock = socket.create_connection(("localhost", 8000))
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1024 * 64)
+        sock.sendall(b"GET / HTTP/1.0\r\nHost: localhost\r\n\r\n")
+        time.sleep(1)
+        buffered = server.get_buffered_output()
+        return buffered, read_all(sock)
+
+    env, (buffered, size) = run_watermarks(client, 0, 0)
+    assert(buffered <= len(CHUNK))
+    assert(size > len(CHUNK) * COUNT)
+    assert(StreamApp.pulled == COUNT)
@@ -0,0 +1,138 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import time
+import requests
+
+class App(BaseApp):
+
+    calls = 0
+
+    def __call__(self, environ, start_response):
+        App.calls += 1
+        self.environ = environ.copy()
+        body = ("call %d" % App.calls).encode()
+        start_response('200 OK', [('Content-type', 'text/plain'),
+                                  ('X-Minefield-Cache', '1')])
+        return [body]
+
+def run_cache(client, vary=()):
+    App.calls = 0
+    server.set_response_cache(1024 * 1024, vary)
+    try:
+        return run_client(client, App)
+    finally:
+        server.set_response_cache(0)
+
+def test_cache_hit():
+
+    def client():
+        r1 = requests.get("http://localhost:8000/page?a=1")
+        r2 = requests.get("http://localhost:8000/page?a=1")
+        r3 = requests.get("http://localhost:8000/page?a=2")
+        return r1, r2, r3
+
+    env, (r1, r2, r3) = run_cache(client)
+    assert(r1.content == b"call 1")
+    assert(r2.content == b"call 1")
+    assert(r2.headers["Content-Type"] == "text/plain")
+    assert(r2.headers["Content-Length"] == "6")
+    assert("X-Minefield-Cache" not in r1.headers)
+    assert("X-Minefield-Cache" not in r2.headers)
+    assert(r3.content == b"call 2")
+    assert(App.calls == 2)
+
+def test_cache_expire():
+
+    def client():
+        r1 = requests.get("http://localhost:8000/")
+        time.sleep(1.5)
+        r2 = requests.get("http://localhost:8000/")
+        return r1, r2
+
+    env, (r1, r2) = run_cache(client)
+    assert(r1.content == b"call 1")
+    assert(r2.content == b"call 2")
+
+def test_cache_vary():
+
+    def client():
+        r1 = requests.get("http://localhost:8000/", headers={"Accept-Language": "en"})
+        r2 = requests.get("http://localhost:8000/", headers={"Accept-Language": "ja"})
+        r3 = requests.get("http://localhost:8000/", headers={"Accept-Language": "en"})
+        return r1, r2, r3
+
+    env, (r1, r2, r3) = run_cache(client, ["Accept-Language"])
+    assert(r1.content == b"call 1")
+    assert(r2.content == b"call 2")
+    assert(r3.content == b"call 1")
+
+def test_cache_vary_missing():
+
+    def client():
+        r1 = requests.get("http://localhost:8000/")
+        r2 = requests.get("http://localhost:8000/", headers={"X-Lang": ""})
+        r3 = requests.get("http://localhost:8000/")
+        return r1, r2, r3
+
+    env, (r1, r2, r3) = run_cache(client, ["X-Lang"])
+    assert(r1.content == b"call 1")
+    assert(r2.content == b"call 2")
+    assert(r3.content == b"call 1")
+
+class ExplicitApp(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        headers = [('Content-type', 'text/plain')]
+        body = b"explicit"
+        server.cache_response(environ, '200 OK', headers, body, 60)
+        start_response('200 OK', headers)
+        return [b"first"]
+
+def test_cache_response():
+
+    def client():
+        r1 = requests.get("http://localhost:8000/")
+        r2 = requests.get("http://localhost:8000/")
+        return r1, r2
+
+    server.set_response_cache(1024 * 1024)
+    try:
+        env, (r1, r2) = run_client(client, ExplicitApp)
+    finally:
+        server.set_response_cache(0)
+    assert(r1.content == b"first")
+    assert(r2.content == b"explicit")
+
+class CountingApp(BaseApp):
+
+    calls = 0
+
+    def __call__(self, environ, start_response):
+        CountingApp.calls += 1
+        self.environ = environ.copy()
+        headers = [('Content-type', 'text/plain')]
+        body = ("call %d" % CountingApp.calls).encode()
+        server.cache_response(environ, '200 OK', headers, body, 60)
+        start_response('200 OK', headers)
+        return [body]
+
+def test_cache_response_threads():
+
+    def client():
+        r1 = requests.get("http://localhost:8000/")
+        r2 = requests.get("http://localhost:8000/")
+        return r1, r2
+
+    CountingApp.calls = 0
+    server.set_response_cache(1024 * 1024)
+    server.set_threads(2)
+    try:
+        env, (r1, r2) = run_client(client, CountingApp)
+    finally:
+        server.set_threads(0)
+        server.set_response_cache(0)
+    assert(r1.content == b"call 1")
+    assert(r2.content == b"call 1")
+    assert(CountingApp.calls == 1)
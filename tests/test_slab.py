@@ -0,0 +1,63 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import time
+import requests
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [b"Hello world!"]
+
+def test_stats():
+    st = server.slab_stats()
+    assert(sorted(st) == ['arena', 'buffer', 'client', 'parser', 'request'])
+    before = st['request']['allocs']
+
+    def client():
+        return [requests.get("http://localhost:8000/").status_code for i in range(3)]
+
+    env, res = run_client(client, App)
+    assert(res == [200, 200, 200])
+    st = server.slab_stats()
+    assert(st['request']['allocs'] - before == 3)
+    assert(st['request']['in_use'] == 0)
+    assert(st['client']['peak'] >= 1)
+    for s in st.values():
+        assert(s['size'] % 16 == 0)
+
+def test_prewarm():
+    server.set_slab(prewarm=2000)
+    try:
+        st = server.slab_stats()
+        assert(st['client']['free'] >= 2000)
+        assert(st['buffer']['free'] >= 4000)
+    finally:
+        server.set_slab()
+    st = server.slab_stats()
+    assert(st['client']['free'] < 2000)
+
+def test_idle_trim():
+
+    def client():
+        requests.get("http://localhost:8000/")
+        time.sleep(1)
+        return server.slab_stats()
+
+    server.set_slab(idle_trim=0.2)
+    try:
+        env, st = run_client(client, App)
+    finally:
+        server.set_slab()
+    assert(st['request']['in_use'] == 0)
+    assert(st['request']['chunks'] == 0)
+
+def test_limits():
+    for kwargs in ({"prewarm": -1}, {"max_free": -1}, {"idle_trim": -1}):
+        try:
+            server.set_slab(**kwargs)
+            assert(False)
+        except ValueError:
+            pass
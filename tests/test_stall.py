@@ -0,0 +1,81 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import time
+import requests
+
+def blocking_sleep(sec):
+    time.sleep(sec)
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        if environ['PATH_INFO'] == '/slow':
+            blocking_sleep(0.3)
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [b"Hello world!"]
+
+def run_detected(client, **kwargs):
+    reports = []
+    server.set_stall_detector(0.1, logger=reports.append, **kwargs)
+    try:
+        env, res = run_client(client, App)
+    finally:
+        server.set_stall_detector(0)
+    return res, reports
+
+def test_request():
+
+    def client():
+        return [requests.get("http://localhost:8000/fast").status_code,
+                requests.get("http://localhost:8000/slow").status_code]
+
+    res, reports = run_detected(client)
+    assert(res == [200, 200])
+    assert(len(reports) == 1)
+    report = reports[0]
+    assert(report['kind'] == 'io')
+    assert(report['method'] == 'GET')
+    assert(report['path'] == '/slow')
+    assert(0.3 <= report['duration'] < 2)
+    assert(report['stack'] is None)
+
+def test_stack():
+
+    def client():
+        return requests.get("http://localhost:8000/slow").status_code
+
+    res, reports = run_detected(client, stack=True)
+    assert(res == 200)
+    assert(len(reports) == 1)
+    stack = reports[0]['stack']
+    assert('blocking_sleep' in stack)
+    assert('test_stall.py' in stack)
+
+def test_timer():
+
+    def client():
+        server.call_later(0, blocking_sleep, 0.2)
+        time.sleep(0.5)
+        return requests.get("http://localhost:8000/fast").status_code
+
+    res, reports = run_detected(client)
+    assert(res == 200)
+    assert(len(reports) == 1)
+    assert(reports[0]['kind'] in ('timer', 'pending'))
+    assert(reports[0]['callback'] is blocking_sleep)
+    assert(reports[0]['path'] is None)
+
+def test_threshold():
+    server.set_stall_detector(0.25)
+    try:
+        assert(server.get_stall_threshold() == 0.25)
+    finally:
+        server.set_stall_detector(0)
+    assert(server.get_stall_threshold() == 0)
+    try:
+        server.set_stall_detector(-1)
+        assert(False)
+    except ValueError:
+        pass
@@ -0,0 +1,158 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import os
+import shutil
+import tempfile
+import time
+import requests
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        self.environ = environ.copy()
+        return [b"app"]
+
+def make_root():
+    root = tempfile.mkdtemp()
+    with open(os.path.join(root, "index.html"), "wb") as f:
+        f.write(b"<html>index</html>")
+    with open(os.path.join(root, "style.css"), "wb") as f:
+        f.write(b"body { color: red; }")
+    return root
+
+def run_static(client):
+    root = make_root()
+    server.mount_static("/static", root)
+    try:
+        return root, run_client(client, App)
+    finally:
+        server.mount_static("/static", None)
+        shutil.rmtree(root)
+
+def test_static_file():
+
+    def client():
+        return requests.get("http://localhost:8000/static/style.css")
+
+    root, (env, res) = run_static(client)
+    assert(res.status_code == 200)
+    assert(res.content == b"body { color: red; }")
+    assert(res.headers["Content-Type"] == "text/css")
+    assert(res.headers["Content-Length"] == "20")
+    assert("ETag" in res.headers)
+    assert("Last-Modified" in res.headers)
+    # never reached the application
+    assert(env is None)
+
+def test_static_index():
+
+    def client():
+        return requests.get("http://localhost:8000/static/")
+
+    root, (env, res) = run_static(client)
+    assert(res.status_code == 200)
+    assert(res.content == b"<html>index</html>")
+    assert(res.headers["Content-Type"] == "text/html")
+
+def test_static_not_found():
+
+    def client():
+        return [requests.get("http://localhost:8000/static/nothing.txt"),
+                requests.get("http://localhost:8000/static/%2e%2e/etc/passwd"),
+                requests.get("http://localhost:8000/other")]
+
+    root, (env, res) = run_static(client)
+    assert(res[0].status_code == 404)
+    assert(res[1].status_code == 404)
+    # outside of mount point
+    assert(res[2].status_code == 200)
+    assert(res[2].content == b"app")
+
+def test_static_not_modified():
+
+    def client():
+        res = requests.get("http://localhost:8000/static/style.css")
+        etag = requests.get("http://localhost:8000/static/style.css",
+                            headers={"If-None-Match": res.headers["ETag"]})
+        since = requests.get("http://localhost:8000/static/style.css",
+                             headers={"If-Modified-Since": res.headers["Last-Modified"]})
+        return etag, since
+
+    root, (env, res) = run_static(client)
+    assert(res[0].status_code == 304)
+    assert(res[0].content == b"")
+    assert(res[1].status_code == 304)
+
+def test_static_modified():
+
+    def client():
+        path = os.path.join(server_root[0], "style.css")
+        first = requests.get("http://localhost:8000/static/style.css")
+        with open(path, "wb") as f:
+            f.write(b"body { color: blue; background: white; }")
+        time.sleep(1.1)
+        second = requests.get("http://localhost:8000/static/style.css")
+        return first, second
+
+    server_root = []
+    root = make_root()
+    server_root.append(root)
+    server.mount_static("/static", root)
+    try:
+        env, res = run_client(client, App)
+    finally:
+        server.mount_static("/static", None)
+        shutil.rmtree(root)
+    assert(res[0].content == b"body { color: red; }")
+    assert(res[1].content == b"body { color: blue; background: white; }")
+
+class MountApp(BaseApp):
+
+    root = None
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        # mounted while the loop runs
+        server.mount_static("/static", MountApp.root)
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [b"mounted"]
+
+def edit_after_mount(mount, wait):
+
+    def client():
+        path = os.path.join(MountApp.root, "style.css")
+        mount()
+        first = requests.get("http://localhost:8000/static/style.css")
+        with open(path, "wb") as f:
+            f.write(b"body { color: blue; background: white; }")
+        time.sleep(wait)
+        second = requests.get("http://localhost:8000/static/style.css")
+        return first, second
+
+    MountApp.root = make_root()
+    try:
+        env, res = run_client(client, MountApp)
+    finally:
+        server.mount_static("/static", None)
+        shutil.rmtree(MountApp.root)
+    assert(res[0].content == b"body { color: red; }")
+    assert(res[1].content == b"body { color: blue; background: white; }")
+
+def test_static_mount_running():
+    # invalidated by inotify before the stat interval
+    edit_after_mount(lambda: requests.get("http://localhost:8000/mount"), 0.3)
+
+def test_static_mount_other_thread():
+    # not read by a loop, revalidated with stat
+    edit_after_mount(lambda: server.mount_static("/static", MountApp.root), 1.1)
+
+def test_static_range():
+
+    def client():
+        return requests.get("http://localhost:8000/static/style.css", headers={"Range": "bytes=5-9"})
+
+    root, (env, res) = run_static(client)
+    assert(res.status_code == 206)
+    assert(res.content == b"{ col")
@@ -0,0 +1,107 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import os
+import socket
+import tempfile
+import time
+import requests
+from minefield import metrics
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        if environ['PATH_INFO'] == '/error':
+            raise Exception("error")
+        if environ['PATH_INFO'] == '/missing':
+            start_response('404 Not Found', [('Content-type', 'text/plain')])
+            return [b"not found"]
+        if environ['PATH_INFO'] == '/slow':
+            time.sleep(0.2)
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [b"Hello world!"]
+
+def test_counters():
+
+    def client():
+        s = requests.Session()
+        res = [s.get("http://localhost:8000/%d" % i).status_code for i in range(3)]
+        res.append(s.get("http://localhost:8000/missing").status_code)
+        res.append(requests.get("http://localhost:8000/error").status_code)
+        sock = socket.create_connection(("localhost", 8000))
+        sock.sendall(b"BAD\r\n\r\n")
+        sock.recv(1024)
+        sock.close()
+        return res
+
+    server.reset_stats()
+    server.set_keepalive(10)
+    try:
+        env, res = run_client(client, App)
+    finally:
+        server.set_keepalive(0)
+    assert(res == [200, 200, 200, 404, 500])
+    st = server.stats()
+    assert(st['accepts'] == 3)
+    assert(st['connections'] == 0)
+    assert(st['keepalive'] >= 3)
+    assert(st['requests'] == 6)
+    assert(st['status_2xx'] == 3)
+    assert(st['status_4xx'] == 2)
+    assert(st['status_5xx'] == 1)
+    assert(st['bytes_sent'] >= 12 * 3 + 9)
+    assert(st['parse_errors'] == 1)
+    assert(st['app_errors'] == 1)
+    assert(st['total_time']['count'] == 5)
+    assert(st['app_time']['count'] == 5)
+
+def test_histograms():
+
+    def client():
+        s = requests.Session()
+        res = [s.get("http://localhost:8000/fast").status_code for i in range(9)]
+        res.append(s.get("http://localhost:8000/slow").status_code)
+        return res
+
+    server.reset_stats()
+    env, res = run_client(client, App)
+    assert(res == [200] * 10)
+    app = server.stats()['app_time']
+    assert(app['count'] == 10)
+    assert(0.2 <= app['max'] < 1)
+    assert(app['p50'] < 0.05)
+    # 0.2s within the bucket width (1/16)
+    assert(0.18 <= app['p99'] <= 0.22)
+    assert(app['p50'] <= app['p90'] <= app['p99'] <= app['p999'] <= app['max'])
+    assert(0.02 <= app['mean'] <= 0.1)
+    total = server.stats()['total_time']
+    assert(total['max'] >= app['max'])
+
+def test_stats_file():
+
+    def client():
+        s = requests.Session()
+        return [s.get("http://localhost:8000/").status_code for i in range(5)]
+
+    server.reset_stats()
+    path = os.path.join(tempfile.gettempdir(), "minefield-test.{pid}.stats")
+    server.set_stats_file(path)
+    path = path.replace("{pid}", str(os.getpid()))
+    try:
+        env, res = run_client(client, App)
+        st = metrics.read_stats(path)
+        assert(st['pid'] == os.getpid())
+        assert(st['requests'] == 5)
+        assert(st['status_2xx'] == 5)
+        total = metrics.aggregate([path, path])
+        assert(total['workers'] == 2)
+        assert(total['requests'] == 10)
+        assert(total['total_time']['count'] == 10)
+        assert(total['app_time'] == dict(server.stats()['app_time'], count=10,
+                                         sum=total['app_time']['sum']))
+    finally:
+        server.set_stats_file(None)
+        os.unlink(path)
+    # values are kept after the file is closed
+    assert(server.stats()['requests'] == 5)
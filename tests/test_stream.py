@@ -0,0 +1,135 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import socket
+import time
+import requests
+
+class App(BaseApp):
+
+    subscribers = []
+
+    def __call__(self, environ, start_response):
+        if environ["PATH_INFO"] == "/sub":
+            stream = server.stream(environ)
+            App.subscribers.append(stream)
+            start_response('200 OK', [('Content-type', 'text/event-stream')])
+            stream.write(b"hello\n")
+            return stream
+        self.environ = environ.copy()
+        subscribers = App.subscribers
+        App.subscribers = []
+        closed = [s.closed for s in subscribers]
+        n = server.broadcast(subscribers, b"msg\n")
+        for s in subscribers:
+            s.close()
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [("%d %s" % (n, closed)).encode()]
+
+def subscribe(version="HTTP/1.1"):
+    sock = socket.create_connection(("localhost", 8000))
+    sock.sendall(("GET /sub %s\r\nHost: localhost\r\n\r\n" % version).encode())
+    data = b""
+    while b"hello" not in data:
+        data += sock.recv(1024)
+    return sock, data
+
+def read_all(sock, data):
+    while True:
+        r = sock.recv(1024)
+        if not r:
+            return data
+        data += r
+
+def test_broadcast():
+
+    def client():
+        subs = [subscribe() for i in range(3)]
+        res = requests.get("http://localhost:8000/pub")
+        return res.content, [read_all(sock, data) for sock, data in subs]
+
+    App.subscribers = []
+    env, (res, bodies) = run_client(client, App)
+    assert(res == b"3 [False, False, False]")
+    for body in bodies:
+        assert(b"Transfer-Encoding: chunked" in body)
+        assert(body.endswith(b"\r\n\r\n6\r\nhello\n\r\n4\r\nmsg\n\r\n0\r\n\r\n"))
+
+def test_broadcast_http10():
+
+    def client():
+        sock, data = subscribe("HTTP/1.0")
+        res = requests.get("http://localhost:8000/pub")
+        return res.content, read_all(sock, data)
+
+    App.subscribers = []
+    env, (res, body) = run_client(client, App)
+    assert(res == b"1 [False]")
+    assert(b"Transfer-Encoding" not in body)
+    assert(body.endswith(b"\r\n\r\nhello\nmsg\n"))
+
+def test_disconnected():
+
+    def client():
+        sock, data = subscribe()
+        sock.close()
+        time.sleep(0.5)
+        return requests.get("http://localhost:8000/pub").content
+
+    App.subscribers = []
+    env, res = run_client(client, App)
+    assert(res == b"0 [True]")
+
+class BigApp(App):
+
+    def __call__(self, environ, start_response):
+        if environ["PATH_INFO"] != "/big":
+            return App.__call__(self, environ, start_response)
+        subscribers = App.subscribers
+        App.subscribers = []
+        data = b"x" * (16 * 1024 * 1024)
+        # the subscriber does not read, the second message is dropped
+        sent = [server.broadcast(subscribers, data), subscribers[0].write(data)]
+        buffered = subscribers[0].buffered
+        for s in subscribers:
+            s.close()
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [("%s %d" % (sent, buffered > 0)).encode()]
+
+def test_slow_subscriber():
+
+    def client():
+        sock, data = subscribe()
+        res = requests.get("http://localhost:8000/big")
+        chunks = [data]
+        while chunks[-1]:
+            chunks.append(sock.recv(65536))
+        return res.content, b"".join(chunks)
+
+    App.subscribers = []
+    env, (res, body) = run_client(client, BigApp)
+    assert(res == b"[1, False] 1")
+    assert(body.split(b"\r\n\r\n", 1)[1].count(b"x") == 16 * 1024 * 1024)
+    assert(body.endswith(b"\r\n0\r\n\r\n"))
+
+def test_head():
+
+    def client():
+        sock = socket.create_connection(("localhost", 8000))
+        sock.sendall(b"HEAD /sub HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        data = b""
+        while b"\r\n\r\n" not in data:
+            data += sock.recv(1024)
+        res = requests.get("http://localhost:8000/pub")
+        sock.settimeout(1)
+        try:
+            data += sock.recv(1024)
+        except socket.timeout:
+            pass
+        sock.close()
+        return res.content, data
+
+    App.subscribers = []
+    env, (res, data) = run_client(client, App)
+    assert(res == b"0 [True]")
+    assert(data.endswith(b"\r\n\r\n"))
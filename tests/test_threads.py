@@ -0,0 +1,93 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import socket
+import threading
+import time
+import requests
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        path = environ['PATH_INFO']
+        if path == '/error':
+            raise Exception("thread error")
+        if path == '/block':
+            # blocking call, like a database query
+            time.sleep(0.5)
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [threading.current_thread().name.encode()]
+
+def run_threads(client, threads=4):
+    server.set_threads(threads)
+    try:
+        return run_client(client, App)
+    finally:
+        server.set_threads(0)
+
+def read_all(sock):
+    data = b""
+    while True:
+        r = sock.recv(1024)
+        if not r:
+            return data
+        data += r
+
+def test_set_threads():
+    assert(server.get_threads() == 0)
+    server.set_threads(8)
+    assert(server.get_threads() == 8)
+    server.set_threads(0)
+    try:
+        server.set_threads(-1)
+        assert(False)
+    except ValueError:
+        pass
+
+def test_worker_thread():
+
+    def client():
+        return requests.get("http://localhost:8000/")
+
+    env, res = run_threads(client)
+    assert(res.status_code == 200)
+    assert(res.content != threading.main_thread().name.encode())
+
+def test_concurrent():
+
+    def client():
+        start = time.time()
+        socks = []
+        for i in range(4):
+            sock = socket.create_connection(("localhost", 8000))
+            sock.sendall(b"GET /block HTTP/1.0\r\nHost: localhost\r\n\r\n")
+            socks.append(sock)
+        bodies = [read_all(sock) for sock in socks]
+        return time.time() - start, bodies
+
+    env, (elapsed, bodies) = run_threads(client)
+    assert(elapsed < 1.5)
+    for body in bodies:
+        assert(body.startswith(b"HTTP/1.0 200 OK"))
+
+def test_error():
+
+    def client():
+        return requests.get("http://localhost:8000/error")
+
+    env, res = run_threads(client)
+    assert(res.status_code == 500)
+
+def test_keepalive():
+
+    def client():
+        s = requests.Session()
+        return [s.get("http://localhost:8000/").status_code for i in range(5)]
+
+    server.set_keepalive(10)
+    try:
+        env, res = run_threads(client, 2)
+    finally:
+        server.set_keepalive(0)
+    assert(res == [200] * 5)
@@ -0,0 +1,151 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import os
+import tempfile
+import threading
+import time
+import requests
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        self.timing = environ['minefield.timing'].copy()
+        self.now = time.monotonic()
+        time.sleep(0.1)
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [b"Hello world!"]
+
+class Logger(object):
+
+    def __init__(self):
+        self.timings = []
+
+    def access(self, environ):
+        self.timings.append(environ['minefield.timing'].copy())
+
+    def error(self, exc_info):
+        pass
+
+def run_app(client, app):
+    s = ClientRunner(app)
+    return s.run(client)
+
+def test_environ():
+
+    def client():
+        return requests.post("http://localhost:8000/", data=b"x" * 1000).status_code
+
+    app = App()
+    env, res = run_app(client, app)
+    assert(res == 200)
+    t = app.timing
+    assert(sorted(t) == ['accept', 'app_end', 'app_start', 'body', 'first_byte',
+                         'first_write', 'headers', 'last_write'])
+    # time.monotonic() clock
+    assert(t['accept'] <= t['first_byte'] <= t['headers'] <= t['body'] <= t['app_start'] <= app.now)
+    assert(app.now - t['accept'] < 5)
+    assert(t['app_end'] is None and t['first_write'] is None)
+    # read from the request until it is done, then kept
+    t = env['minefield.timing']
+    assert(sorted(t) == sorted(app.timing) == sorted(t.keys()))
+    assert(len(t) == 8 and 'app_end' in t and 'foo' not in t)
+    assert(t['accept'] == app.timing['accept'])
+    assert(t['app_start'] + 0.1 <= t['app_end'] <= t['first_write'] <= t['last_write'])
+    assert(t.get('foo', 1) == 1)
+    assert(dict(t.items()) == t.copy())
+
+class QueuedApp(App):
+
+    def __call__(self, environ, start_response):
+        if environ['PATH_INFO'] == '/block':
+            time.sleep(0.3)
+        return App.__call__(self, environ, start_response)
+
+def test_environ_threads():
+
+    def client():
+        # the second call waits for the only worker
+        t = threading.Thread(target=requests.get, args=("http://localhost:8000/block",))
+        t.start()
+        time.sleep(0.1)
+        res = requests.get("http://localhost:8000/").status_code
+        t.join()
+        return res
+
+    app = QueuedApp()
+    server.set_threads(1)
+    try:
+        env, res = run_app(client, app)
+    finally:
+        server.set_threads(0)
+    assert(res == 200)
+    t = app.timing
+    # the call on the worker, after the first one returned
+    assert(t['app_start'] - t['headers'] >= 0.1)
+    assert(t['app_start'] <= app.now)
+
+def test_logger():
+
+    def client():
+        s = requests.Session()
+        return [s.get("http://localhost:8000/").status_code for i in range(2)]
+
+    logger = Logger()
+    server.set_access_logger(logger)
+    server.set_keepalive(10)
+    try:
+        env, res = run_app(client, App())
+    finally:
+        server.set_keepalive(0)
+        server.set_access_logger(None)
+    assert(res == [200, 200])
+    first, second = logger.timings
+    assert(first['accept'] is not None)
+    # keep-alive requests have no accept
+    assert(second['accept'] is None)
+    for t in (first, second):
+        assert(t['app_start'] + 0.1 <= t['app_end'] <= t['first_write'] <= t['last_write'])
+
+def test_native_log():
+
+    def client():
+        return requests.get("http://localhost:8000/").status_code
+
+    fd, path = tempfile.mkstemp()
+    os.close(fd)
+    server.set_access_logger(None)
+    server.set_access_log(path, format='$wait_time $read_time $queue_time $app_time $send_time %D')
+    try:
+        env, res = run_app(client, App())
+    finally:
+        server.set_access_log(None)
+    with open(path) as f:
+        line = f.read().strip()
+    os.unlink(path)
+    values = line.split()
+    assert(len(values) == 6)
+    wait, read, queue, app, send = [float(v) for v in values[:5]]
+    assert(0.1 <= app < 1)
+    assert(wait < 1 and read < 1 and queue < 1 and send < 1)
+    assert(int(values[5]) >= app * 1000000)
+
+def test_histograms():
+
+    def client():
+        s = requests.Session()
+        return [s.get("http://localhost:8000/").status_code for i in range(3)]
+
+    server.reset_stats()
+    server.set_keepalive(10)
+    try:
+        env, res = run_app(client, App())
+    finally:
+        server.set_keepalive(0)
+    st = server.stats()
+    assert(st['wait_time']['count'] == 1)
+    for name in ('read_time', 'queue_time', 'app_time', 'send_time', 'total_time'):
+        assert(st[name]['count'] == 3)
+    assert(st['app_time']['p50'] >= 0.09)
+    assert(st['total_time']['max'] >= st['app_time']['max'])
@@ -0,0 +1,121 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+import json
+import os
+import signal
+import tempfile
+import time
+import requests
+
+WALLPAPER = os.path.join(os.path.dirname(__file__), "wallpaper.jpg")
+
+class App(BaseApp):
+
+    def __call__(self, environ, start_response):
+        self.environ = environ.copy()
+        if environ['PATH_INFO'] == '/file':
+            start_response('200 OK', [('Content-type', 'image/jpeg')])
+            return environ['wsgi.file_wrapper'](open(WALLPAPER, 'rb'))
+        start_response('200 OK', [('Content-type', 'text/plain')])
+        return [b"Hello ", b"world!"]
+
+def trace_path():
+    fd, path = tempfile.mkstemp(suffix=".json")
+    os.close(fd)
+    return path
+
+def load(path):
+    with open(path) as f:
+        trace = json.load(f)
+    os.unlink(path)
+    return [ev for ev in trace['traceEvents'] if ev['ph'] == 'X']
+
+def test_spans():
+
+    def client():
+        return [requests.get("http://localhost:8000/hello").status_code,
+                requests.get("http://localhost:8000/file").status_code]
+
+    server.set_trace(1)
+    try:
+        env, res = run_client(client, App)
+        path = trace_path()
+        count = server.dump_trace(path)
+    finally:
+        server.set_trace(0)
+    assert(res == [200, 200])
+    events = load(path)
+    assert(count == len(events))
+    requests_ = [ev for ev in events if ev['name'] == 'request']
+    assert([ev['args']['path'] for ev in requests_] == ['/hello', '/file'])
+    hello, file_ = requests_
+    assert(hello['args']['method'] == 'GET')
+    assert(hello['args']['status'] == 200)
+    assert(file_['args']['bytes'] == os.path.getsize(WALLPAPER))
+
+    spans = [ev for ev in events if ev['args']['id'] == hello['args']['id']]
+    names = set(ev['name'] for ev in spans)
+    assert(set(['request', 'read', 'queue', 'app', 'write']) <= names)
+    for ev in spans:
+        assert(hello['ts'] <= ev['ts'])
+        assert(ev['ts'] + ev['dur'] <= hello['ts'] + hello['dur'])
+
+    sent = [ev['args']['bytes'] for ev in events
+            if ev['name'] == 'sendfile' and ev['args']['id'] == file_['args']['id']]
+    assert(sum(sent) == os.path.getsize(WALLPAPER))
+
+def test_sample():
+
+    def client():
+        return [requests.get("http://localhost:8000/").status_code for i in range(6)]
+
+    server.set_trace(3)
+    try:
+        env, res = run_client(client, App)
+        path = trace_path()
+        server.dump_trace(path)
+    finally:
+        server.set_trace(0)
+    events = load(path)
+    assert(len([ev for ev in events if ev['name'] == 'request']) == 2)
+
+def test_ring():
+
+    def client():
+        return [requests.get("http://localhost:8000/").status_code for i in range(5)]
+
+    server.set_trace(1, events=4)
+    try:
+        env, res = run_client(client, App)
+        path = trace_path()
+        count = server.dump_trace(path)
+    finally:
+        server.set_trace(0)
+    assert(count == 4)
+    events = load(path)
+    assert(events[-1]['name'] == 'request')
+
+def test_signal():
+    path = trace_path()
+    os.unlink(path)
+
+    def client():
+        requests.get("http://localhost:8000/")
+        os.kill(os.getpid(), signal.SIGUSR2)
+        time.sleep(0.5)
+        return os.path.exists(path)
+
+    server.set_trace(1, path=path)
+    try:
+        env, res = run_client(client, App)
+    finally:
+        server.set_trace(0)
+    assert(res)
+    events = load(path)
+    assert(events[-1]['name'] == 'request')
+    try:
+        server.dump_trace()
+        assert(False)
+    except ValueError:
+        pass
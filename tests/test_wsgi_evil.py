@@ -108,3 +108,69 @@ def test_bad_path():
     env, res = run_client(client, App)
     assert(res.split(b"\r\n")[0] == ERR_400)
 
+
+def test_expect_continue():
+
+    def client():
+        sock = socket.create_connection(DEFAULT_ADDR)
+        sock.send(b"POST / HTTP/1.1\r\nHost: localhost\r\n"
+                  b"Content-Length: 4\r\nExpect: 100-continue\r\n\r\n")
+        interim = sock.recv(1024)
+        sock.send(b"data")
+        return interim, sock.recv(1024 * 2)
+
+    env, (interim, res) = run_client(client, App)
+    assert(interim == b"HTTP/1.1 100 Continue\r\n\r\n")
+    assert(res.split(b"\r\n")[0] == b"HTTP/1.1 200 OK")
+    assert(b"Hello " in res and b"world!" in res)
+
+def test_bad_expect():
+
+    def client():
+        return send_data(method="POST", version="HTTP/1.1",
+                         headers=[("Content-Length", "4"), ("Expect", "unknown")])
+
+    env, res = run_client(client, App)
+    assert(res.split(b"\r\n")[0] == b"HTTP/1.1 417 Expectation Failed")
+
+class CountApp(BaseApp):
+
+    calls = 0
+
+    def __call__(self, environ, start_response):
+        CountApp.calls += 1
+        self.environ = environ.copy()
+        body = ("%s %d" % (environ["PATH_INFO"], CountApp.calls)).encode()
+        start_response('200 OK', [('Content-type', 'text/plain'),
+                                  ('Content-Length', str(len(body)))])
+        return [body]
+
+def test_pipeline():
+    depth = 20
+
+    def client():
+        sock = socket.create_connection(DEFAULT_ADDR)
+        reqs = b"".join(b"GET /%d HTTP/1.1\r\nHost: localhost\r\n\r\n" % i
+                        for i in range(depth - 1))
+        reqs += b"GET /last HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+        sock.sendall(reqs)
+        data = b""
+        while True:
+            r = sock.recv(1024 * 16)
+            if not r:
+                break
+            data += r
+        return data
+
+    CountApp.calls = 0
+    server.set_keepalive(10)
+    server.set_pipeline_batch(4)
+    try:
+        env, res = run_client(client, CountApp)
+    finally:
+        server.set_pipeline_batch(16)
+        server.set_keepalive(0)
+    assert(res.count(b"HTTP/1.1 200 OK") == depth)
+    for i in range(depth - 1):
+        assert(b"/%d %d" % (i, i + 1) in res)
+    assert(res.endswith(b"/last %d" % depth))
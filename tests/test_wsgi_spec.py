@@ -174,3 +174,148 @@ def test_error():
     assert(res.status_code == 500)
     assert(res.content == ASSERT_RESPONSE)
     assert(env.get("REQUEST_METHOD") == "GET")
+
+HEADER_BLOCK = server.compile_headers([('X-Frame-Options', 'DENY'), ('Cache-Control', 'no-cache')])
+
+class HeaderBlockApp(BaseApp):
+
+    def __call__(self, environ, start_response):
+        status = '200 OK'
+        response_headers = [HEADER_BLOCK, ('Content-type','text/plain')]
+        start_response(status, response_headers)
+        self.environ = environ.copy()
+        return RESPONSE
+
+def test_header_block():
+
+    def client():
+        return requests.get("http://localhost:8000/")
+
+    env, res = run_client(client, HeaderBlockApp)
+    assert(res.status_code == 200)
+    assert(res.content == ASSERT_RESPONSE)
+    assert(res.headers["X-Frame-Options"] == "DENY")
+    assert(res.headers["Cache-Control"] == "no-cache")
+    assert(res.headers["Content-Type"] == "text/plain")
+
+def test_default_headers():
+
+    def client():
+        return requests.get("http://localhost:8000/")
+
+    server.set_default_headers([('Content-type', 'application/json'), ('X-Content-Type-Options', 'nosniff')])
+    try:
+        env, res = run_client(client, App)
+    finally:
+        server.set_default_headers(None)
+    assert(res.status_code == 200)
+    assert(res.content == ASSERT_RESPONSE)
+    assert(res.headers["X-Content-Type-Options"] == "nosniff")
+    # app headers override defaults of the same name
+    assert(res.headers["Content-Type"] == "text/plain")
+
+def test_compile_reserved_header():
+    try:
+        server.compile_headers([('Content-Length', '10')])
+    except ValueError:
+        pass
+    else:
+        assert False
+
+WALLPAPER = os.path.join(os.path.dirname(__file__), "wallpaper.jpg")
+
+class FileApp(BaseApp):
+
+    kwargs = {}
+
+    def __call__(self, environ, start_response):
+        status = '200 OK'
+        response_headers = [('Content-type','image/jpeg')]
+        start_response(status, response_headers)
+        self.environ = environ.copy()
+        f = open(WALLPAPER, 'rb')
+        return environ['wsgi.file_wrapper'](f, **self.kwargs)
+
+class OffsetFileApp(FileApp):
+
+    kwargs = {"offset": 100, "length": 1000}
+
+def read_wallpaper():
+    with open(WALLPAPER, 'rb') as f:
+        return f.read()
+
+def test_file_wrapper():
+
+    def client():
+        return requests.get("http://localhost:8000/")
+
+    env, res = run_client(client, FileApp)
+    data = read_wallpaper()
+    assert(res.status_code == 200)
+    assert(res.headers["Accept-Ranges"] == "bytes")
+    assert(res.headers["Content-Length"] == str(len(data)))
+    assert(res.content == data)
+
+def test_file_wrapper_range():
+
+    def client():
+        return requests.get("http://localhost:8000/", headers={"Range": "bytes=10-109"})
+
+    env, res = run_client(client, FileApp)
+    data = read_wallpaper()
+    assert(res.status_code == 206)
+    assert(res.headers["Content-Range"] == "bytes 10-109/%d" % len(data))
+    assert(res.content == data[10:110])
+
+def test_file_wrapper_suffix_range():
+
+    def client():
+        return requests.get("http://localhost:8000/", headers={"Range": "bytes=-50"})
+
+    env, res = run_client(client, FileApp)
+    data = read_wallpaper()
+    assert(res.status_code == 206)
+    assert(res.content == data[-50:])
+
+def test_file_wrapper_multi_range():
+
+    def client():
+        return requests.get("http://localhost:8000/", headers={"Range": "bytes=0-9,100-199"})
+
+    env, res = run_client(client, FileApp)
+    data = read_wallpaper()
+    assert(res.status_code == 206)
+    ctype = res.headers["Content-Type"]
+    assert(ctype.startswith("multipart/byteranges; boundary="))
+    boundary = ctype.split("=", 1)[1].encode()
+    assert(int(res.headers["Content-Length"]) == len(res.content))
+    parts = res.content.split(b"--" + boundary)
+    assert(parts[-1] == b"--\r\n")
+    head, body = parts[1].split(b"\r\n\r\n", 1)
+    assert(b"Content-Type: image/jpeg" in head)
+    assert(b"Content-Range: bytes 0-9/%d" % len(data) in head)
+    assert(body == data[0:10] + b"\r\n")
+    head, body = parts[2].split(b"\r\n\r\n", 1)
+    assert(body == data[100:200] + b"\r\n")
+
+def test_file_wrapper_unsatisfiable_range():
+
+    def client():
+        return requests.get("http://localhost:8000/", headers={"Range": "bytes=10000000-"})
+
+    env, res = run_client(client, FileApp)
+    data = read_wallpaper()
+    assert(res.status_code == 416)
+    assert(res.headers["Content-Range"] == "bytes */%d" % len(data))
+    assert(res.content == b"")
+
+def test_file_wrapper_offset():
+
+    def client():
+        return requests.get("http://localhost:8000/", headers={"Range": "bytes=0-9"})
+
+    env, res = run_client(client, OffsetFileApp)
+    data = read_wallpaper()
+    assert(res.status_code == 206)
+    assert(res.headers["Content-Range"] == "bytes 0-9/1000")
+    assert(res.content == data[100:110])